@@ -0,0 +1,300 @@
+#!/usr/bin/env python
+
+"""
+A fake SpiNNaker machine which answers SCP version, read and write requests
+over UDP so that the host-side I/O can be profiled (and checked) without a
+board.
+
+Each chip's memory is a sparse set of zero-initialised pages. Responses are
+delayed by a configurable network round trip and each chip (like SC&MP)
+services one request at a time. A fraction of requests may be dropped or
+refused as busy, and of responses held back to arrive out of order, to
+exercise retries (see tests/test_scp_transport.py).
+
+Run as a script to compare loading and reading back a machine one request at
+a time against using the concurrent transport:
+
+    python -m spinn_test_driver.fake_scp --chips 24 --bytes 16384
+"""
+
+import time
+import heapq
+import random
+import socket
+import select
+import threading
+
+from spinn_test_driver import scp_transport
+
+
+################################################################################
+# Fake machine
+################################################################################
+
+class FakeSCPServer(object):
+	"""
+	A fake machine listening on a local UDP port (self.address) in a background
+	thread.
+	"""
+	
+	PAGE_SIZE = 4096
+	
+	def __init__( self, latency = 0.001, service_time = 0.00005
+	            , loss = 0.0, busy = 0.0, reorder = 0.0, reorder_delay = None
+	            , seed = None
+	            ):
+		"""
+		latency is the round trip time (seconds) of the network, service_time the
+		time a chip takes to process a request. loss is the probability a request
+		is silently dropped and busy the probability a chip responds with
+		RC_P2P_BUSY. reorder is the probability a response is held back a further
+		reorder_delay seconds (default: four round trips) so that later responses
+		overtake it.
+		"""
+		self.latency       = latency
+		self.service_time  = service_time
+		self.loss          = loss
+		self.busy          = busy
+		self.reorder       = reorder
+		self.reorder_delay = 4.0 * latency if reorder_delay is None else reorder_delay
+		
+		self._random = random.Random(seed)
+		
+		# {(x,y,page_addr): bytearray, ...}
+		self._pages = {}
+		
+		# The time at which each chip finishes processing its last request
+		# {(x,y): time, ...}
+		self._chip_free = {}
+		
+		# Number of requests received
+		self.num_requests = 0
+		
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.sock.bind(("127.0.0.1", 0))
+		self.address = self.sock.getsockname()
+		
+		self._stop = False
+		self._thread = threading.Thread(target = self._serve)
+		self._thread.daemon = True
+	
+	
+	def start(self):
+		self._thread.start()
+		return self
+	
+	
+	def stop(self):
+		self._stop = True
+		self._thread.join()
+		self.sock.close()
+	
+	
+	def read(self, x, y, addr, length):
+		"""
+		Read directly from a chip's memory.
+		"""
+		data = bytearray()
+		while length:
+			page_addr = addr - (addr % self.PAGE_SIZE)
+			offset = addr - page_addr
+			chunk_length = min(length, self.PAGE_SIZE - offset)
+			page = self._pages.get((x, y, page_addr))
+			if page is None:
+				data += bytearray(chunk_length)
+			else:
+				data += page[offset:offset + chunk_length]
+			addr   += chunk_length
+			length -= chunk_length
+		return str(data)
+	
+	
+	def write(self, x, y, addr, data):
+		"""
+		Write directly into a chip's memory.
+		"""
+		while data:
+			page_addr = addr - (addr % self.PAGE_SIZE)
+			offset = addr - page_addr
+			chunk = data[:self.PAGE_SIZE - offset]
+			page = self._pages.setdefault((x, y, page_addr), bytearray(self.PAGE_SIZE))
+			page[offset:offset + len(chunk)] = chunk
+			addr += len(chunk)
+			data  = data[len(chunk):]
+	
+	
+	def _respond(self, packet):
+		"""
+		Process a request, returning (x, y, response) or None if no response is
+		to be sent.
+		"""
+		header_size = scp_transport.sdp_header_t.size
+		request_size = scp_transport.scp_request_t.size
+		if len(packet) < header_size + request_size:
+			return None
+		
+		(flags, tag, dest_port_cpu, srce_port_cpu, dest_y, dest_x, srce_y, srce_x) = \
+			scp_transport.sdp_header_t.unpack_from(packet)
+		cmd, seq, arg1, arg2, arg3 = \
+			scp_transport.scp_request_t.unpack_from(packet, header_size)
+		data = packet[header_size + request_size:]
+		
+		if self._random.random() < self.loss:
+			return None
+		
+		payload = ""
+		if self._random.random() < self.busy:
+			rc = scp_transport.RC_P2P_BUSY
+		elif cmd == scp_transport.CMD_VER:
+			rc = scp_transport.RC_OK
+			payload = (scp_transport.scp_request_t.pack(0, 0, dest_port_cpu & 0x1F, 0, 0)[4:]
+			           + "FakeSCP/SpiNNaker\0")
+		elif cmd == scp_transport.CMD_READ:
+			if arg2 > scp_transport.SCP_DATA_LENGTH:
+				rc = scp_transport.RC_LEN
+			else:
+				rc = scp_transport.RC_OK
+				payload = self.read(dest_x, dest_y, arg1, arg2)
+		elif cmd == scp_transport.CMD_WRITE:
+			if arg2 != len(data) or arg2 > scp_transport.SCP_DATA_LENGTH:
+				rc = scp_transport.RC_LEN
+			else:
+				rc = scp_transport.RC_OK
+				self.write(dest_x, dest_y, arg1, data)
+		else:
+			rc = scp_transport.RC_CMD
+		
+		response = ( scp_transport.sdp_header_t.pack( flags & 0x07, tag
+		                                            , srce_port_cpu, dest_port_cpu
+		                                            , srce_y, srce_x, dest_y, dest_x
+		                                            )
+		           + scp_transport.scp_response_t.pack(rc, seq)
+		           + payload
+		           )
+		return (dest_x, dest_y, response)
+	
+	
+	def _serve(self):
+		# Responses waiting to be sent: [(due, n, address, response), ...]
+		waiting = []
+		n = 0
+		
+		while not self._stop:
+			now = time.time()
+			
+			# Send any responses which are due
+			while waiting and waiting[0][0] <= now:
+				_, _, address, response = heapq.heappop(waiting)
+				self.sock.sendto(response, address)
+			
+			timeout = min(0.01, max(0.0, waiting[0][0] - now)) if waiting else 0.01
+			readable, _, _ = select.select([self.sock], [], [], timeout)
+			if not readable:
+				continue
+			
+			packet, address = self.sock.recvfrom(65536)
+			self.num_requests += 1
+			result = self._respond(packet)
+			if result is None:
+				continue
+			x, y, response = result
+			
+			# Requests arrive after half the round trip and are serviced in turn by
+			# each chip
+			now = time.time()
+			start = max(now + self.latency / 2.0, self._chip_free.get((x, y), 0.0))
+			self._chip_free[(x, y)] = start + self.service_time
+			due = start + self.service_time + self.latency / 2.0
+			if self._random.random() < self.reorder:
+				due += self.reorder_delay
+			
+			heapq.heappush(waiting, (due, n, address, response))
+			n += 1
+
+
+################################################################################
+# Benchmark
+################################################################################
+
+def _load_and_read_back(transport, chips, data, concurrent):
+	"""
+	Write data to and read it back from every chip, returning the time taken.
+	"""
+	addr = 0x70000000
+	
+	def load(coord):
+		x, y = coord
+		transport.write_mem((x, y, 0), addr, data)
+	
+	def read_back(coord):
+		x, y = coord
+		if transport.read_mem((x, y, 0), addr, len(data)) != data:
+			raise Exception("Chip %d,%d read back the wrong data."%(x, y))
+	
+	before = time.time()
+	for f in (load, read_back):
+		if concurrent:
+			transport.map(f, chips)
+		else:
+			map(f, chips)
+	return time.time() - before
+
+
+if __name__ == "__main__":
+	import argparse
+	
+	parser = argparse.ArgumentParser(description = __doc__.strip().split("\n")[0])
+	parser.add_argument("--chips", type = int, default = 8,
+	                    help = "width and height of the fake machine (chips)")
+	parser.add_argument("--bytes", type = int, default = 16384,
+	                    help = "bytes written to and read back from each chip")
+	parser.add_argument("--latency", type = float, default = 0.001,
+	                    help = "network round trip time (seconds)")
+	parser.add_argument("--service-time", type = float, default = 0.00005,
+	                    help = "time for a chip to process a request (seconds)")
+	parser.add_argument("--loss", type = float, default = 0.01,
+	                    help = "probability a request is dropped")
+	parser.add_argument("--busy", type = float, default = 0.01,
+	                    help = "probability a request is refused as busy")
+	parser.add_argument("--workers", type = int, default = 8,
+	                    help = "worker threads in the concurrent transport")
+	parser.add_argument("--window", type = int, default = 4,
+	                    help = "requests in flight per worker")
+	args = parser.parse_args()
+	
+	server = FakeSCPServer( latency      = args.latency
+	                      , service_time = args.service_time
+	                      , loss         = args.loss
+	                      , busy         = args.busy
+	                      , seed         = 0
+	                      ).start()
+	host, port = server.address
+	
+	chips = [(x, y) for x in range(args.chips) for y in range(args.chips)]
+	data  = "".join(chr(random.randint(0, 255)) for _ in xrange(args.bytes))
+	
+	# One request at a time, one chip at a time
+	serial = scp_transport.SCPTransport( host, port, num_workers = 1, window = 1
+	                                   , timeout = max(0.05, 10 * args.latency)
+	                                   )
+	serial_time = _load_and_read_back(serial, chips, data, False)
+	serial.close()
+	
+	concurrent = scp_transport.SCPTransport( host, port
+	                                       , num_workers = args.workers
+	                                       , window      = args.window
+	                                       , timeout     = max(0.05, 10 * args.latency)
+	                                       )
+	concurrent_time = _load_and_read_back(concurrent, chips, data, True)
+	concurrent.close()
+	
+	server.stop()
+	
+	print "%dx%d chips, %d bytes/chip, %d requests"%(
+		args.chips, args.chips, args.bytes, server.num_requests
+	)
+	print "serial:     %8.3f s"%serial_time
+	print "concurrent: %8.3f s (%d workers, window %d)"%(
+		concurrent_time, args.workers, args.window
+	)
+	print "speedup:    %8.2fx"%(serial_time / concurrent_time)
@@ -0,0 +1,156 @@
+#!/usr/bin/env python
+
+"""
+A content-addressed cache of the parts of the SDRAM images loaded onto each chip
+which do not change between the runs (or sweep points) of an experiment.
+
+Generating routing tables and packing the configuration of every core from
+scratch dominates the host-side cost of setting up a run, yet consecutive runs
+of an experiment usually only differ in a handful of fields (e.g. the generators'
+parameters, the router timeout or the seed). The cache holds:
+
+* The routing tables of every chip under a digest of the topology and streams
+  of the experiment. These may also be kept on disk (as pickles named by their
+  digest) so that they survive between processes.
+* A template of each chip's last image along with the location of every field
+  which may change between runs. The template is keyed by the layout of the
+  image: while the layout is unchanged a new image is produced by copying the
+  template and overwriting just those fields.
+"""
+
+import os
+import hashlib
+import tempfile
+
+import cPickle as pickle
+
+from collections import namedtuple
+
+
+# The template of a chip's SDRAM image. layout is the key the template was built
+# for, image the image itself (a bytearray) and cores a list of CorePatch, one per
+# core, giving the parts of the image which change between runs.
+ChipTemplate = namedtuple("ChipTemplate", ["layout", "image", "locations", "cores"])
+
+# The parts of a core's configuration which change between runs: config_offset is
+# the offset in the image of its config_root (which the sources immediately
+# follow), data_offset that of its bulk data and config_root the config_root_tuple
+# it was built with (whose offsets are kept when patching).
+CorePatch = namedtuple("CorePatch", ["core_id", "config_offset", "data_offset", "config_root"])
+
+
+def digest(value):
+	"""
+	Return a hex digest of a value made up of (nested) tuples, lists, strings and
+	numbers.
+	"""
+	return hashlib.sha1(repr(value)).hexdigest()
+
+
+class ImageCache(object):
+	"""
+	Cached routing tables and chip image templates.
+	"""
+	
+	def __init__(self, directory = None):
+		"""
+		If directory is given, routing tables are also kept in (and loaded from)
+		files in that directory.
+		"""
+		self.directory = directory
+		
+		# {digest: {(x,y): (num_router_entries, router_entries, ...), ...}, ...}
+		self._router_tables = {}
+		
+		# The most recently built template of each chip's image {(x,y):
+		# ChipTemplate, ...}
+		self._templates = {}
+		
+		# Packed generators {(type(gen), gen): (temporal_dist, temporal_dist_data),
+		# ...}
+		self._generators = {}
+		
+		# Number of templates and routing tables built, e.g. to check the cache is
+		# effective.
+		self.num_templates_built     = 0
+		self.num_router_tables_built = 0
+	
+	
+	def _router_tables_path(self, key):
+		return os.path.join(self.directory, "%s.tables"%key)
+	
+	
+	def router_tables(self, key, generate):
+		"""
+		Get the routing tables of every chip {(x,y): (num_router_entries,
+		router_entries, ...), ...} cached under the given digest, calling
+		generate() to produce them if they are not cached.
+		"""
+		if key in self._router_tables:
+			return self._router_tables[key]
+		
+		if self.directory is not None and os.path.exists(self._router_tables_path(key)):
+			with open(self._router_tables_path(key), "rb") as f:
+				tables = pickle.load(f)
+		else:
+			tables = generate()
+			self.num_router_tables_built += 1
+			
+			if self.directory is not None:
+				# Written to a temporary file first so that concurrent writers never
+				# leave a partial file behind
+				if not os.path.isdir(self.directory):
+					os.makedirs(self.directory)
+				fd, path = tempfile.mkstemp(dir = self.directory)
+				with os.fdopen(fd, "wb") as f:
+					pickle.dump(tables, f, pickle.HIGHEST_PROTOCOL)
+				os.rename(path, self._router_tables_path(key))
+		
+		# Only the tables of the current topology are kept in memory
+		self._router_tables = {key: tables}
+		return tables
+	
+	
+	def generator(self, gen, encode):
+		"""
+		Get the (temporal_dist, temporal_dist_data) of a generator, calling
+		encode(gen) if it has not been encoded before. Unhashable generators (e.g.
+		traces given as lists) are always encoded.
+		
+		Generators are keyed by type as well as value since those of different
+		types (e.g. BernoulliGeneration(0.1) and PoissonGeneration(0.1)) may be
+		equal tuples.
+		"""
+		key = (type(gen), gen)
+		try:
+			return self._generators[key]
+		except KeyError:
+			encoded = self._generators[key] = encode(gen)
+			return encoded
+		except TypeError:
+			return encode(gen)
+	
+	
+	def template(self, coord, layout):
+		"""
+		Get the template of the chip's image built for the given layout or None.
+		"""
+		template = self._templates.get(coord)
+		if template is not None and template.layout == layout:
+			return template
+		else:
+			return None
+	
+	
+	def add_template(self, coord, template):
+		self._templates[coord] = template
+		self.num_templates_built += 1
+	
+	
+	def clear(self):
+		"""
+		Forget everything cached in memory.
+		"""
+		self._router_tables = {}
+		self._templates     = {}
+		self._generators    = {}
@@ -5,10 +5,14 @@ A wrapper which deals with many of the details of producing and running network
 experiments.
 """
 
+import os
 import sys
 import math
 import time
 import random
+import struct
+import array
+import multiprocessing
 
 from collections import defaultdict, namedtuple
 
@@ -18,6 +22,10 @@ import spinn_route.model
 import spinn_route.table_gen
 
 from spinn_test_driver import spinnaker_app
+from spinn_test_driver import scp_transport
+from spinn_test_driver import simulator
+from spinn_test_driver import image_cache
+from spinn_test_driver import router_minimise
 
 ################################################################################
 # Traffic patterns
@@ -26,9 +34,115 @@ from spinn_test_driver import spinnaker_app
 # Bernoulli temporal distribution for packet generation
 BernoulliGeneration = namedtuple("BernoulliGeneration", ["probability"])
 
+# Poisson process generating a mean of rate packets per tick (possibly several
+# in a single tick)
+PoissonGeneration = namedtuple("PoissonGeneration", ["rate"])
+
+# Bursty (two-state Markov-modulated) generation: while on, a packet is
+# generated with the given probability each tick. On and off periods are
+# geometrically distributed with the given means (in ticks). Sources start off.
+OnOffGeneration = namedtuple("OnOffGeneration", ["probability", "mean_on_duration", "mean_off_duration"])
+
+# A packet every period ticks, the first phase ticks after the first tick
+PeriodicGeneration = namedtuple("PeriodicGeneration", ["period", "phase"])
+
+# Replay of a recorded trace: an iterable of the ticks (counting from 1, the
+# first tick of the warmup) in which to generate a packet, a tick appearing once
+# for each packet to be generated in it.
+TraceGeneration = namedtuple("TraceGeneration", ["ticks"])
+
 # Packet consumer which accepts packets instantly
 InstantConsumption = namedtuple("InstantConsumption", [])
 
+# One phase of a sweep (see NetworkExperiment.run_sweep). Each field overrides
+# the experiment's own setting for the phase unless None: warmup and duration
+# (seconds), router_timeout (router cycles) and generators, a function mapping
+# the generator given to add_stream for each stream to the one to use during
+# the phase, e.g. lambda gen: BernoulliGeneration(0.2).
+Phase = namedtuple("Phase", ["warmup", "duration", "router_timeout", "generators"])
+Phase.__new__.__defaults__ = (None,) * len(Phase._fields)
+
+# A search for the injection scale at which the network saturates (see
+# NetworkExperiment.run_saturation_search). The app runs the given number of
+# measurement windows back-to-back, each like a phase of a sweep with the given
+# settle (warmup) and window durations (seconds). Every source generates only
+# a fraction (the injection scale) of the packets its generator would. The
+# first window runs at initial_scale and calibrates the fraction of generated
+# packets which arrive at sinks. The scale of each later window is chosen by
+# bisection: a window is saturated if its fraction of generated packets which
+# arrive falls below min_acceptance times the calibrated fraction or if more
+# than max_drop_rate of the generated packets are dropped by routers. After
+# each window has drained, cores wait a further settle seconds for any packets
+# still queued to leave the network before reporting to the master and give up
+# (and fail) after waiting timeout seconds for the next scale.
+SaturationSearch = namedtuple("SaturationSearch", ["windows", "window", "settle", "initial_scale", "min_acceptance", "max_drop_rate", "timeout"])
+SaturationSearch.__new__.__defaults__ = (8, 0.01, 0.001, 1.0/16, 0.9, 0.01, 1.0)
+
+# Reinjection of the packets routers drop (see NetworkExperiment.reinjection).
+# The lead core of every chip captures each packet its router drops and
+# reinjects it after backoff seconds (or on the next tick if shorter), waiting
+# twice as long again each time the packet is dropped again, and gives up on it
+# once it has been reinjected max_retries times. Up to queue_size packets may
+# be held at once (each taking 16 bytes of the lead core's DTCM); those dropped
+# while the queue is full are abandoned.
+Reinjection = namedtuple("Reinjection", ["max_retries", "backoff", "queue_size"])
+Reinjection.__new__.__defaults__ = (4, 0.0, 256)
+
+# The CPU clock frequency (MHz) assumed when converting latency bin widths to
+# clock cycles. Results are converted back using the frequency each core reports.
+NOMINAL_CPU_CLK = 200
+
+# The time (seconds) allowed for the cores started with one build of the app to
+# start (and so copy it out of SDRAM) before the run is abandoned.
+APLX_START_TIMEOUT = 5.0
+
+
+################################################################################
+# Router counter profiles
+################################################################################
+
+# A counter profile gives the router diagnostic counters used by an experiment
+# (see NetworkExperiment.router_counters) as a dict {name: (counter, filter),
+# ...} where counter is the number of the counter (0-15) and filter the value its
+# filter register is programmed with (see spinnaker_app.counter_filter). The
+# counts of counters spinnaker_app.FWD_CNTR and DRP_CNTR are also reported as the
+# router's forwarded and dropped packets.
+
+# Packets forwarded and dropped by the router
+DEFAULT_ROUTER_COUNTERS = {
+	"forwarded": ( spinnaker_app.FWD_CNTR
+	             , spinnaker_app.counter_filter(er = spinnaker_app.COUNTER_ER_NORMAL)
+	             ),
+	"dropped":   ( spinnaker_app.DRP_CNTR
+	             , spinnaker_app.counter_filter( er   = spinnaker_app.COUNTER_ER_NORMAL
+	                                           , dest = spinnaker_app.COUNTER_DEST_DROPPED
+	                                           )
+	             ),
+}
+
+# Names of the router's links, in order
+LINK_NAMES = ["east", "north_east", "north", "west", "south_west", "south"]
+
+# As DEFAULT_ROUTER_COUNTERS plus the packets sent down each link, those
+# originating on the chip and arriving over a link, and those emergency or
+# default routed: enough to find hot links and what loads them. Uses counters
+# otherwise used by the monitor processor, which are restored afterwards.
+CONTENTION_ROUTER_COUNTERS = dict(DEFAULT_ROUTER_COUNTERS, **dict(
+	[ ( "link_%s"%name
+	  , (link, spinnaker_app.counter_filter(dest = spinnaker_app.counter_dest_link(link)))
+	  )
+	  for link, name in enumerate(LINK_NAMES)
+	] +
+	[ ("local",    (6, spinnaker_app.counter_filter(loc = spinnaker_app.COUNTER_LOCAL)))
+	, ("external", (7, spinnaker_app.counter_filter(loc = spinnaker_app.COUNTER_EXTERNAL)))
+	, ( "emergency_routed"
+	  , (8, spinnaker_app.counter_filter(er = spinnaker_app.COUNTER_ER_FIRST_STAGE
+	                                        | spinnaker_app.COUNTER_ER_SECOND_STAGE))
+	  )
+	, ("default_routed", (9, spinnaker_app.counter_filter(default = spinnaker_app.COUNTER_DEFAULT)))
+	]
+))
+
 
 ################################################################################
 # Result objects
@@ -38,12 +152,418 @@ InstantConsumption = namedtuple("InstantConsumption", [])
 ChipResults = namedtuple("ChipResults", ["router","cores"])
 
 # Contained by the router and cores items respectively in ChipResults
-RouterResults = namedtuple("RouterResults", ["dropped_packets","forwarded_packets","num_router_entries"])
-CoreResults   = namedtuple("CoreResults",   ["sources", "sinks"])
+RouterResults = namedtuple("RouterResults", ["dropped_packets","forwarded_packets","num_router_entries","counters","reinjection"])
+CoreResults   = namedtuple("CoreResults",   ["sources", "sinks", "load_time", "store_time", "samples", "samples_dropped", "tx_queue_max_depth", "timing"])
+
+# Contained by the reinjection item in RouterResults: the packets dumped by the
+# router when reinjecting dropped packets (those dumped again after being
+# reinjected included), those lost because the previous had not yet been
+# captured, the reinjections made, the reinjected packets dropped again and
+# those not dropped again by the same router (which says nothing of whether they
+# were delivered: they may be dropped on a later chip). Also those given up on,
+# those reinjected too late in the run to tell whether they were dropped again
+# and those matching no routing entry (default routed packets, which can't be
+# reinjected and so are lost). Every packet first dumped ends up in exactly one
+# of the last four, so dumped - redropped == not_redropped_locally + abandoned +
+# unconfirmed + unrouted. All zero unless reinjecting.
+ReinjectionResults = namedtuple("ReinjectionResults", ["dumped", "missed", "reinjected", "redropped", "not_redropped_locally", "abandoned", "unconfirmed", "unrouted"])
+
+# Contained by the sources and sinks items respectively in CoreResults. Packets
+# which couldn't be sent immediately are deferred to a software transmit queue
+# (and may later be sent); those generated while it is full are discarded.
+SourceResults = namedtuple("SourceResults", ["packets_generated", "packets_sent", "packets_deferred", "packets_deferred_sent", "packets_discarded"])
+SinkResults   = namedtuple("SinkResults",   ["packets_arrived", "latency_histogram", "latency_bin_width"])
+
+# Contained by the samples list in CoreResults: the counters of a core (and its
+# router) at a given tick after the warmup. packets_sent and packets_arrived are
+# dicts {routing_key: count, ...} for the core's sources and sinks respectively.
+Sample = namedtuple("Sample", ["tick", "forwarded_packets", "dropped_packets", "packets_sent", "packets_arrived"])
+
+# The results of a saturation search: a SearchPoint for each window and the
+# greatest injection scale found unsaturated.
+SearchResults = namedtuple("SearchResults", ["points", "saturation_scale"])
+
+# The throughput of the whole machine during one window of a saturation search
+# at the given injection scale (a fraction of the load configured): the packets
+# generated, sent and arrived at every core and forwarded and dropped by every
+# router, and whether the window was judged saturated.
+SearchPoint = namedtuple("SearchPoint", ["scale", "generated", "sent", "arrived", "forwarded", "dropped", "saturated"])
+
+# Contained by the timing item of CoreResults: how long the core's timer tick and
+# packet arrival callbacks took after the warmup (durations and latencies in
+# seconds). ticks is the number of ticks the experiment was configured to last
+# and ticks_elapsed the number which actually elapsed. A tick overruns when its
+# callback takes longer than a tick; its latency is how late its callback started.
+# Bin n of each histogram counts callbacks taking [2**n, 2**(n+1)) times
+# histogram_bin_width seconds (the first bin also counting shorter callbacks and
+# the last longer ones). kept_up is False if the core's ticks fell behind, i.e.
+# the load it offered may be lower than configured.
+CallbackTiming = namedtuple("CallbackTiming", ["ticks", "ticks_elapsed", "tick_overruns", "tick_max_duration", "tick_max_latency", "tick_histogram", "packet_max_duration", "packet_histogram", "histogram_bin_width", "kept_up"])
+
+def lagging_cores(results):
+	"""
+	List the cores whose ticks fell behind (see CallbackTiming.kept_up) in a
+	Results object (as produced by NetworkExperiment.run) as [((x,y), core_id,
+	CallbackTiming), ...].
+	"""
+	return [ ((x,y), core_id, core.timing)
+	         for (x,y), chip in sorted(results.iteritems())
+	         for core_id, core in sorted(chip.cores.iteritems())
+	         if not core.timing.kept_up
+	       ]
+
+
+################################################################################
+# Columnar results
+################################################################################
+
+# The results of every source and sink in the system as parallel columns (each
+# an array.array of unsigned ints) with one row per source or sink, ordered by
+# routing key. x, y and core_id give the core each belongs to. Sinks sharing a
+# routing key (i.e. the destinations of one stream) are ordered by core.
+ColumnarResults = namedtuple("ColumnarResults", ["sources", "sinks"])
+SourceColumns   = namedtuple("SourceColumns", ["routing_key", "x", "y", "core_id"] + list(SourceResults._fields))
+SinkColumns     = namedtuple("SinkColumns",   ["routing_key", "x", "y", "core_id", "packets_arrived"])
+
+def columnar_results(results):
+	"""
+	Convert a Results object (as produced by NetworkExperiment.run) into
+	ColumnarResults. Latency histograms and samples are not included.
+	"""
+	source_rows = []
+	sink_rows   = []
+	for (x,y), chip in results.iteritems():
+		for core_id, core in chip.cores.iteritems():
+			for routing_key, source in core.sources.iteritems():
+				source_rows.append((routing_key, x, y, core_id) + tuple(source))
+			for routing_key, sink in core.sinks.iteritems():
+				sink_rows.append((routing_key, x, y, core_id, sink.packets_arrived))
+	source_rows.sort()
+	sink_rows.sort()
+	
+	def columns(columns_tuple, rows):
+		return columns_tuple._make( array.array("I", column)
+		                            for column in (zip(*rows) or [()] * len(columns_tuple._fields))
+		                          )
+	
+	return ColumnarResults( sources = columns(SourceColumns, source_rows)
+	                      , sinks   = columns(SinkColumns,   sink_rows)
+	                      )
+
+
+################################################################################
+# Encoding
+################################################################################
+
+def _encode_router_timeout(value):
+	"""
+	Encode a router timeout (wait1) in router cycles as the exponent and mantissa
+	used by the router. Raises a ValueError if the value can't be represented
+	exactly.
+	"""
+	# Hard-coded solutions for e <= 4, a more general solution exists after that
+	if value == 0:
+		e = m = 0
+	elif value < 16:
+		e = 0
+		m = value
+	elif value < 48:
+		e = 1
+		m = (value/2)-8
+	elif value < 112:
+		e = 2
+		m = (value/4)-12
+	elif value < 240:
+		e = 3
+		m = (value/8)-14
+	elif value < 512:
+		e = 4
+		m = (value/16)-15
+	else:
+		e = max(0, int(math.log(value,2)) - 4)
+		m = (value / (1<<e)) - 16
+	
+	# Clamp the exponent and mantissa to allowed 4-bit ranges
+	e = max(0, min(15, e))
+	m = max(0, min(15, m))
+	
+	# Test that the value is represented exactly
+	if e <= 4:
+		calc_value = (m + 16 - 2**(4-e)) * 2**e
+	else:
+		calc_value = (m + 16           ) * 2**e
+	
+	if calc_value != value:
+		raise ValueError("A timeout of %d cannot be used. You could use %d instead..."%(value, calc_value))
+	
+	return (e, m)
+
+
+def _encode_generator(gen, traces):
+	"""
+	Encode a packet generator as the temporal_dist and temporal_dist_data of a
+	source. Traces are appended to the given string of traces (the offsets of
+	which are relative to its start).
+	
+	Returns a tuple (temporal_dist, temporal_dist_data, traces).
+	"""
+	if type(gen) is BernoulliGeneration:
+		temporal_dist = spinnaker_app.TEMPORAL_DIST_BERNOULLI
+		temporal_dist_data = spinnaker_app.bernoulli_packet_prob_t.pack(
+			*spinnaker_app.bernoulli_packet_prob_tuple(
+				bernoulli_threshold      = spinnaker_app.bernoulli_threshold(gen.probability),
+				bernoulli_interval_scale = spinnaker_app.bernoulli_interval_scale(gen.probability),
+			)
+		)
+	elif type(gen) is PoissonGeneration:
+		temporal_dist = spinnaker_app.TEMPORAL_DIST_POISSON
+		temporal_dist_data = spinnaker_app.poisson_packet_rate_t.pack(
+			*spinnaker_app.poisson_packet_rate_tuple(
+				interval_scale = spinnaker_app.poisson_interval_scale(gen.rate),
+			)
+		)
+	elif type(gen) is OnOffGeneration:
+		temporal_dist = spinnaker_app.TEMPORAL_DIST_ON_OFF
+		temporal_dist_data = spinnaker_app.on_off_packet_prob_t.pack(
+			*spinnaker_app.on_off_packet_prob_tuple(
+				threshold          = spinnaker_app.bernoulli_threshold(gen.probability),
+				on_interval_scale  = spinnaker_app.bernoulli_interval_scale(1.0 / max(1.0, gen.mean_on_duration)),
+				off_interval_scale = spinnaker_app.bernoulli_interval_scale(1.0 / max(1.0, gen.mean_off_duration)),
+			)
+		)
+	elif type(gen) is PeriodicGeneration:
+		temporal_dist = spinnaker_app.TEMPORAL_DIST_PERIODIC
+		temporal_dist_data = spinnaker_app.periodic_packet_t.pack(
+			*spinnaker_app.periodic_packet_tuple(
+				period = gen.period,
+				phase  = gen.phase,
+			)
+		)
+	elif type(gen) is TraceGeneration:
+		trace = spinnaker_app.trace_pack(gen.ticks)
+		temporal_dist = spinnaker_app.TEMPORAL_DIST_TRACE
+		temporal_dist_data = spinnaker_app.trace_packet_t.pack(
+			*spinnaker_app.trace_packet_tuple(
+				offset = len(traces),
+				length = len(trace),
+			)
+		)
+		traces += trace
+	else:
+		raise Exception("Unknown packet generator %s."%repr(gen))
+	
+	return (temporal_dist, temporal_dist_data, traces)
+
+
+################################################################################
+# Routing
+################################################################################
+
+def _route(source, dests, routing_algorithms, chips):
+	"""
+	Route from a source core to a list of destination cores with the supplied
+	list of routing algorithms from spinn_route (with latter routers picking up
+	unrouted paths from the ones before them). Returns a list of node sequences.
+	"""
+	unrouted_dests = dests
+	routing_algorithms = list(routing_algorithms)
+	node_sequences = []
+	while unrouted_dests:
+		if not routing_algorithms:
+			raise Exception("Some destinations could not be routed with the routers provided!")
+		node_sequences_, unrouted_dests = routing_algorithms.pop(0)(
+			source,
+			unrouted_dests,
+			chips
+		)
+		node_sequences.extend(node_sequences_)
+	return node_sequences
+
+
+def _unique(items):
+	"""
+	The distinct items of an iterable (by identity), in order.
+	"""
+	seen = set()
+	unique = []
+	for item in items:
+		if id(item) not in seen:
+			seen.add(id(item))
+			unique.append(item)
+	return unique
+
+
+def _reuse_node_sequences(node_sequences, group_source, source, dests):
+	"""
+	Derive the route of a stream from that computed for its group (from
+	group_source to every destination in the group): each node sequence must lead
+	from group_source to one destination. The stream takes the sequences to its
+	own destinations, starting from its own source. Returns None if the group's
+	route has any other form (or doesn't reach every destination of the stream),
+	in which case the stream must be routed itself.
+	"""
+	if node_sequences is None:
+		return None
+	
+	wanted = set(id(dest) for dest in dests)
+	reached = set()
+	reused = []
+	for node_sequence in node_sequences:
+		if len(node_sequence) < 2 or node_sequence[0] is not group_source:
+			return None
+		if id(node_sequence[-1]) in wanted:
+			reached.add(id(node_sequence[-1]))
+			reused.append([source] + list(node_sequence[1:]))
+	
+	return reused if reached == wanted else None
+
+
+# The arguments of _route_requests while its worker processes run (inherited
+# by the processes when they are forked): (requests, routing_algorithms, chips,
+# {id(node): node, ...}).
+_routing_state = None
+
+def _route_request(index):
+	"""
+	Route one request of _routing_state in a worker process, returning its node
+	sequences with each node given by its id (which is the same in the parent
+	process) or None if any node is not a chip, router or core of the model.
+	"""
+	requests, routing_algorithms, chips, nodes = _routing_state
+	source, dests = requests[index]
+	node_sequences = _route(source, dests, routing_algorithms, chips)
+	if any(id(node) not in nodes for node_sequence in node_sequences for node in node_sequence):
+		return None
+	return [[id(node) for node in node_sequence] for node_sequence in node_sequences]
+
+
+def _route_requests(requests, routing_algorithms, chips, workers = None):
+	"""
+	Route a list of requests [(source, [dest, ...]), ...] returning a list of the
+	node sequences of each. The requests are divided between workers processes
+	(default: one per CPU), provided the routes consist only of the chips,
+	routers and cores of the model (which the workers share with this process).
+	"""
+	if workers is None:
+		workers = multiprocessing.cpu_count()
+	
+	# The nodes of the model which routes may pass through
+	nodes = {}
+	for chip in chips.itervalues():
+		nodes[id(chip)] = chip
+		nodes[id(chip.router)] = chip.router
+		for core in chip.cores.itervalues():
+			nodes[id(core)] = core
+	
+	# The first request is routed here to check that its route can be passed back
+	# from a worker
+	first = _route(requests[0][0], requests[0][1], routing_algorithms, chips)
+	if ( workers <= 1 or len(requests) < 2 * workers or not hasattr(os, "fork")
+	     or any(id(node) not in nodes for node_sequence in first for node in node_sequence)
+	   ):
+		return [first] + [_route(source, dests, routing_algorithms, chips)
+		                  for source, dests in requests[1:]]
+	
+	global _routing_state
+	_routing_state = (requests, routing_algorithms, chips, nodes)
+	pool = multiprocessing.Pool(workers)
+	try:
+		routed = pool.map( _route_request, range(1, len(requests))
+		                 , chunksize = max(1, len(requests) // (4 * workers))
+		                 )
+	finally:
+		pool.terminate()
+		_routing_state = None
+	
+	return [first] + [ None if node_sequences is None else
+	                   [[nodes[node] for node in node_sequence] for node_sequence in node_sequences]
+	                   for node_sequences in routed
+	                 ]
+
+
+# The link from a chip to the neighbour at each offset
+LINK_OFFSETS = {(1,0): 0, (1,1): 1, (0,1): 2, (-1,0): 3, (-1,-1): 4, (0,-1): 5}
+
+def _search_control_routes(chips, master_coord, master_core_id, control_key):
+	"""
+	The routing table entries carrying saturation search control packets: reports
+	from every core converge on the master core along a tree (towards the
+	master's column, then along it) and the master's scale packets are broadcast
+	back down the same tree to every core. Returns {(x,y):
+	[config_router_entry_tuple, ...], ...}. Every chip on the tree must have
+	cores (to load its routing table).
+	"""
+	mx, my = master_coord
+	
+	def parent((x,y)):
+		if x != mx:
+			return (x + (1 if x < mx else -1), y)
+		elif y != my:
+			return (x, y + (1 if y < my else -1))
+		else:
+			return None
+	
+	def link((x,y), (nx,ny)):
+		return spinnaker_app.route_link(LINK_OFFSETS[(nx - x, ny - y)])
+	
+	children = defaultdict(list)
+	for coord in chips:
+		if parent(coord) is not None:
+			if not chips.get(parent(coord)) or not chips[parent(coord)].cores:
+				raise Exception("Saturation search control packets can't be routed via chip %d,%d."%(
+					parent(coord)
+				))
+			children[parent(coord)].append(coord)
+	
+	entries = {}
+	for coord, chip in chips.iteritems():
+		if parent(coord) is None:
+			report_route = spinnaker_app.route_core(master_core_id)
+		else:
+			report_route = link(coord, parent(coord))
+		
+		scale_route = sum(spinnaker_app.route_core(core_id) for core_id in chip.cores)
+		for child in children[coord]:
+			scale_route |= link(coord, child)
+		
+		entries[coord] = [ spinnaker_app.config_router_entry_tuple(
+		                     key   = control_key,
+		                     mask  = spinnaker_app.SEARCH_KEY_MASK | spinnaker_app.SEARCH_KEY_SCALE,
+		                     route = report_route,
+		                   )
+		                 , spinnaker_app.config_router_entry_tuple(
+		                     key   = control_key | spinnaker_app.SEARCH_KEY_SCALE,
+		                     mask  = 0xFFFFFFFF,
+		                     route = scale_route,
+		                   )
+		                 ]
+	return entries
 
-# Contained by the sources and sinks items respectively in CoreResults
-SourceResults = namedtuple("SourceResults", ["packets_generated", "packets_sent"])
-SinkResults   = namedtuple("SinkResults",   ["packets_arrived"])
+
+def _search_normalise(a, b):
+	"""
+	Reduce a pair of counts until both fit in 23 bits (as the app does).
+	"""
+	while (a | b) >> 23:
+		a >>= 1
+		b >>= 1
+	return a, b
+
+
+def _search_saturated(search, point, calibration):
+	"""
+	Decide whether a window (a SearchPoint) of a saturation search was saturated
+	as the app's search master does given the SearchPoint of the first window.
+	"""
+	min_acceptance = int(search.min_acceptance * spinnaker_app.SEARCH_SCALE_ONE)
+	max_drop_rate  = int(search.max_drop_rate  * spinnaker_app.SEARCH_SCALE_ONE)
+	
+	saturated = (point.dropped << 16) > max_drop_rate * point.generated
+	if point is not calibration and calibration.arrived and point.generated:
+		a,  g  = _search_normalise(point.arrived, point.generated)
+		ca, cg = _search_normalise(calibration.arrived, calibration.generated)
+		saturated = saturated or ((a * cg) << 16) < min_acceptance * g * ca
+	return saturated
 
 
 ################################################################################
@@ -89,8 +609,81 @@ class NetworkExperiment(object):
 		self._warmup   = 1.0
 		self._duration = 2.0
 		
+		# Should the latency of every packet be measured? If so, each sink records
+		# a histogram of latencies with bins of latency_bin_width seconds.
+		self.measure_latency = False
+		
+		# Width of the latency histogram bins as a power of two number of CPU clock
+		# cycles. The width can be set in seconds using the latency_bin_width
+		# property.
+		self._latency_bin_shift = 8
+		
+		# Number of ticks between samples of every core's (and router's) counters
+		# during the experiment or zero to disable sampling. At most max_samples
+		# (the most recent) are kept.
+		self.sample_interval = 0
+		self.max_samples     = 1024
+		
+		# Time (seconds) at the end of each phase of a sweep during which no
+		# packets are generated so that the network drains before the next phase.
+		self.drain = 0.01
+		
+		# Number of worker threads (each handling a chip at a time) and the number
+		# of SCP requests each keeps in flight when loading and reading back the
+		# machine.
+		self.scp_workers = 8
+		self.scp_window  = 4
+		
+		# Interval (seconds) between polls of every chip's status once the
+		# experiment should have finished. Starts at poll_interval_min and doubles
+		# (up to poll_interval_max) while any chip is still running.
+		self.poll_interval_min = 0.01
+		self.poll_interval_max = 0.5
+		
 		# The next routing key to use
 		self._next_routing_key = 0
+		
+		# The router diagnostic counters used during the experiment (see
+		# DEFAULT_ROUTER_COUNTERS). The count of each is given in the results.
+		self.router_counters = dict(DEFAULT_ROUTER_COUNTERS)
+		
+		# Should a run in which any core's ticks fell behind (see lagging_cores)
+		# raise ExperimentFailed? Otherwise a warning is printed.
+		self.reject_lagging_runs = False
+		
+		# The reinjection of packets dropped by routers (a Reinjection) or None to
+		# leave dropped packets lost. The router results give the reinjection
+		# statistics of each chip.
+		self.reinjection = None
+		
+		# Should routing tables be minimised (see router_minimise) before being
+		# loaded? After each build, router_table_sizes gives the number of entries
+		# generated and actually loaded into each chip's router: {(x,y):
+		# (num_generated_entries, num_router_entries), ...}.
+		self.minimise_router_tables = True
+		self.router_table_sizes     = {}
+		
+		# The streams added by add_stream (from which routing tables are generated)
+		# [(routing_key, source_core, [dest_core, ...], [routing_algorithm, ...]),
+		# ...] where each routing algorithm is identified by name.
+		self._streams = []
+		
+		# The routing tables and image templates of earlier builds (see
+		# build_images). Give the cache a directory to keep routing tables between
+		# sessions.
+		self.image_cache = image_cache.ImageCache()
+		
+		# The location in SDRAM of each core's configuration (and results) once
+		# loaded: {(x,y): {core_id: spinnaker_app.CoreConfigLocation, ...}, ...}
+		self._core_config_addrs = {}
+		
+		# The build of the app chosen for each core by the last build_images (see
+		# _app_variants): {(x,y): {core_id: spinnaker_app.AppVariant, ...}, ...}
+		self._core_variants = {}
+		
+		# The status reported by each chip at the end of the last run: {(x,y):
+		# spinnaker_app.chip_status_tuple, ...}
+		self._chip_statuses = {}
 	
 	
 	@property
@@ -131,43 +724,7 @@ class NetworkExperiment(object):
 		"""
 		The router timeout (wait1) before dropping packets in router cycles.
 		"""
-		# Hard-coded solutions for e <= 4, a more general solution exists after that
-		if value == 0:
-			e = m = 0
-		elif value < 16:
-			e = 0
-			m = value
-		elif value < 48:
-			e = 1
-			m = (value/2)-8
-		elif value < 112:
-			e = 2
-			m = (value/4)-12
-		elif value < 240:
-			e = 3
-			m = (value/8)-14
-		elif value < 512:
-			e = 4
-			m = (value/16)-15
-		else:
-			e = max(0, int(math.log(value,2)) - 4)
-			m = (value / (1<<e)) - 16
-		
-		# Clamp the exponent and mantissa to allowed 4-bit ranges
-		e = max(0, min(15, e))
-		m = max(0, min(15, m))
-		
-		# Test that the value is represented exactly
-		if e <= 4:
-			calc_value = (m + 16 - 2**(4-e)) * 2**e
-		else:
-			calc_value = (m + 16           ) * 2**e
-		
-		if calc_value != value:
-			raise ValueError("A timeout of %d cannot be used. You could use %d instead..."%(value, calc_value))
-		
-		self._router_timeout_e = e
-		self._router_timeout_m = m
+		self._router_timeout_e, self._router_timeout_m = _encode_router_timeout(value)
 	
 	
 	@property
@@ -204,6 +761,27 @@ class NetworkExperiment(object):
 		self._duration = duration
 	
 	
+	@property
+	def latency_bin_width(self):
+		"""
+		The width of each latency histogram bin (seconds) given the nominal CPU
+		clock frequency.
+		"""
+		return (1 << self._latency_bin_shift) / (NOMINAL_CPU_CLK * 1000000.0)
+	
+	
+	@latency_bin_width.setter
+	def latency_bin_width(self, width):
+		"""
+		The width of each latency histogram bin (seconds). Rounded to the nearest
+		power of two number of CPU clock cycles.
+		"""
+		cycles = width * NOMINAL_CPU_CLK * 1000000.0
+		assert cycles >= 1.0, "Latency bin width must be at least one clock cycle."
+		
+		self._latency_bin_shift = int(round(math.log(cycles, 2)))
+	
+	
 	def add_stream(self, source_, destinations, routing_algorithms_):
 		"""
 		Add a stream of packets from a source core to a set of destinations routed
@@ -216,301 +794,1129 @@ class NetworkExperiment(object):
 		source, gen = source_
 		
 		# Route from the soruce to all destinations.
-		unrouted_dests = [d for (d,c) in destinations]
-		routing_algorithms = routing_algorithms_[:]
-		node_sequences = []
-		while unrouted_dests:
-			if not routing_algorithms:
-				raise Exception("Some destinations could not be routed with the routers provided!")
-			node_sequences_, unrouted_dests = routing_algorithms.pop(0)(
-				source,
-				unrouted_dests,
-				self.chips
-			)
-			node_sequences.extend(node_sequences_)
+		node_sequences = _route(source, [d for (d,c) in destinations], routing_algorithms_, self.chips)
 		
-		# Add the route to the model
-		route = spinn_route.model.Route(self._next_routing_key)
+		key = self._next_routing_key
 		self._next_routing_key += 1
+		self._add_routed_stream(key, source_, destinations, routing_algorithms_, node_sequences)
+		
+		return key
+	
+	
+	def add_streams(self, streams, routing_algorithms, workers = None):
+		"""
+		Add many streams at once, as if by add_stream, given a list [((source,
+		gen), [(dest, con), ...]), ...] (e.g. built by traffic_patterns) which are
+		all routed by the same list of routing algorithms.
+		
+		The streams are given a block of consecutive routing keys, in order,
+		starting at a multiple of the smallest power of two which fits them all (so
+		that the routing tables minimise well). Streams from the same chip to
+		destinations on the same set of chips share a single routing computation
+		(to every destination of the group). Routes are computed by workers
+		processes (default: one per CPU).
+		
+		Returns the list of routing keys used by the streams.
+		"""
+		if not streams:
+			return []
+		
+		# Allocate the block of keys
+		block = 1 << (len(streams) - 1).bit_length()
+		first_key = -(-self._next_routing_key // block) * block
+		self._next_routing_key = first_key + len(streams)
+		
+		# The chip of every core (identified by id)
+		chip_of = {}
+		for coord, chip in self.chips.iteritems():
+			for core in chip.cores.itervalues():
+				chip_of[id(core)] = coord
+		
+		# Group the streams: {(source_chip, dest_chips): [stream_index, ...], ...}
+		groups = defaultdict(list)
+		for index, ((source, gen), destinations) in enumerate(streams):
+			groups[( chip_of.get(id(source))
+			       , frozenset(chip_of.get(id(dest)) for dest, con in destinations)
+			       )].append(index)
+		requests = [ ( streams[indices[0]][0][0]
+		             , _unique(dest for index in indices for dest, con in streams[index][1])
+		             )
+		             for indices in groups.itervalues()
+		           ]
+		
+		# Route each group (None where a group must be routed stream by stream)
+		group_routes = _route_requests(requests, routing_algorithms, self.chips, workers)
+		
+		for indices, (group_source, _), group_node_sequences in zip(groups.itervalues(), requests, group_routes):
+			for index in indices:
+				source_, destinations = streams[index]
+				if len(indices) == 1:
+					node_sequences = group_node_sequences
+				else:
+					node_sequences = _reuse_node_sequences( group_node_sequences, group_source
+					                                      , source_[0], [d for (d,c) in destinations]
+					                                      )
+				if node_sequences is None:
+					node_sequences = _route( source_[0], [d for (d,c) in destinations]
+					                       , routing_algorithms, self.chips
+					                       )
+				self._add_routed_stream( first_key + index, source_, destinations
+				                       , routing_algorithms, node_sequences
+				                       )
+		
+		return range(first_key, first_key + len(streams))
+	
+	
+	def _add_routed_stream(self, key, source_, destinations, routing_algorithms_, node_sequences):
+		"""
+		Add a stream which has been routed (see _route) to the model under the given
+		routing key.
+		"""
+		source, gen = source_
+		
+		# Add the route to the model
+		route = spinn_route.model.Route(key)
 		for node_sequence in node_sequences:
 			spinn_route.model.add_route(route, node_sequence)
 		
+		self._streams.append(( route.key
+		                     , source
+		                     , [d for (d,c) in destinations]
+		                     , [ "%s.%s"%(f.__module__, f.__name__)
+		                         for f in routing_algorithms_
+		                       ]
+		                     ))
+		
 		# Note down where the traffic generators/consumers live
 		self.core_generators[source][route] = gen
 		for dest, con in destinations:
 			self.core_consumers[dest][route] = con
+	
+	
+	def _phase_parameters(self, phases):
+		"""
+		Resolve a list of Phases against the experiment's own settings. Returns a
+		list [(config_phase_tuple, generators), ...] where generators maps each
+		stream's generator to the one used in that phase.
+		"""
+		phase_parameters = []
+		for phase in phases:
+			warmup   = self._warmup   if phase.warmup   is None else phase.warmup
+			duration = self._duration if phase.duration is None else phase.duration
+			if phase.router_timeout is None:
+				rtr_drop_e, rtr_drop_m = self._router_timeout_e, self._router_timeout_m
+			else:
+				rtr_drop_e, rtr_drop_m = _encode_router_timeout(phase.router_timeout)
+			
+			phase_parameters.append((
+				spinnaker_app.config_phase_tuple(
+					warmup_duration = int(warmup/self.tick_period),
+					duration        = int(duration/self.tick_period),
+					rtr_drop_e      = rtr_drop_e,
+					rtr_drop_m      = rtr_drop_m,
+				),
+				phase.generators or (lambda gen: gen),
+			))
 		
-		return route.key
+		return phase_parameters
 	
 	
-	def _write_mem_with_retry(self, conn, *args, **kwargs):
-		num_retries = 10
-		for retry in xrange(num_retries):
-			try:
-				return conn.write_mem(*args, **kwargs)
-			except:
-				time.sleep(0.01)
-				if retry == num_retries - 1:
-					raise
+	def _topology_digest(self):
+		"""
+		A digest of everything the routing tables and the static parts of each
+		chip's image depend on: the topology, the streams and whether the routing
+		tables are minimised.
+		"""
+		locations = {}
+		topology  = []
+		for coord, chip in sorted(self.chips.iteritems()):
+			cores = []
+			for core in chip.cores.itervalues():
+				locations[id(core)] = coord + (core.core_id,)
+				cores.append(( core.core_id
+				             , sorted(route.key for route in self.core_generators[core])
+				             , sorted(route.key for route in self.core_consumers[core])
+				             ))
+			topology.append((coord, cores))
+		
+		streams = [ ( key
+		            , locations.get(id(source))
+		            , [locations.get(id(dest)) for dest in destinations]
+		            , algorithms
+		            )
+		            for key, source, destinations, algorithms in self._streams
+		          ]
+		
+		return image_cache.digest((topology, streams, self.minimise_router_tables))
 	
 	
-	def _load_coremaps(self, conn):
+	def _router_tables(self):
 		"""
-		Generate the coremap for the system and write it to every chip.
+		Generate (and, if minimise_router_tables is set, minimise) the routing
+		table of every chip {(x,y): (num_router_entries, router_entries,
+		num_generated_entries), ...}.
 		"""
-		# Calculate coremap
-		core_map = {}
-		for coord, chip in self.chips.iteritems():
-			core_map[coord] = sum(1<<c.core_id for c in chip.cores.itervalues())
-		data = spinnaker_app.core_map_struct_pack(core_map)
-		addr = spinnaker_app.core_map_sdram_addr()
+		# Every key sent during the experiment: the routing of any other key need
+		# not be preserved by minimisation
+		keys = set(route.key for generators in self.core_generators.itervalues()
+		                     for route in generators)
 		
-		# Load onto system
+		tables = {}
 		for (x,y), chip in self.chips.iteritems():
-			conn.selected_cpu_coords = (x,y,0)
-			self._write_mem_with_retry(conn, addr, scp.TYPE_BYTE, data)
+			num_router_entries, router_entries = \
+				spinn_route.table_gen.spin1_table_gen(chip.router)
+			num_generated_entries = num_router_entries
+			
+			if self.minimise_router_tables:
+				entries   = router_minimise.unpack_entries(num_router_entries, router_entries)
+				minimised = router_minimise.minimise(entries, keys)
+				router_minimise.verify(entries, minimised, keys)
+				num_router_entries, router_entries = \
+					len(minimised), router_minimise.pack_entries(minimised)
+			
+			tables[(x,y)] = (num_router_entries, router_entries, num_generated_entries)
+		
+		if self.minimise_router_tables:
+			generated = sum(num_generated for _, _, num_generated in tables.itervalues())
+			minimised = sum(num_minimised for num_minimised, _, _ in tables.itervalues())
+			sys.stderr.write("Minimised routing tables from %d to %d entries (%.1fx)...\n"%(
+				generated, minimised, float(generated) / max(1, minimised)
+			))
+		
+		return tables
+	
+	
+	def _counter_profile(self):
+		"""
+		Encode router_counters as the counter_mask, counter_filter_* (and zeroed
+		result_counter_*) fields of a config_root_tuple, returned as a dict.
+		"""
+		fields = {"counter_mask": 0}
+		for counter in range(spinnaker_app.NUM_ROUTER_COUNTERS):
+			fields["counter_filter_%d"%counter] = 0
+			fields["result_counter_%d"%counter] = 0
+		
+		for name, (counter, counter_filter) in sorted(self.router_counters.iteritems()):
+			if not 0 <= counter < spinnaker_app.NUM_ROUTER_COUNTERS:
+				raise Exception("Router counter %s must be numbered 0-%d, not %d."%(
+					name, spinnaker_app.NUM_ROUTER_COUNTERS - 1, counter
+				))
+			if fields["counter_mask"] & (1 << counter):
+				raise Exception("Router counter %d is used more than once."%counter)
+			
+			fields["counter_mask"] |= 1 << counter
+			fields["counter_filter_%d"%counter] = counter_filter
+		
+		return fields
+	
+	
+	def _reinjection_fields(self):
+		"""
+		Encode reinjection as the reinject_* (and zeroed result_reinject_*) fields
+		of a config_root_tuple, returned as a dict.
+		"""
+		fields = dict( (field, 0) for field in spinnaker_app.config_root_tuple._fields
+		               if field.startswith("result_reinject_")
+		             )
+		if self.reinjection is None:
+			fields["reinject_max_retries"] = 0
+			fields["reinject_backoff"]     = 0
+			fields["reinject_queue_size"]  = 0
+		else:
+			fields["reinject_max_retries"] = self.reinjection.max_retries
+			fields["reinject_backoff"]     = int(self.reinjection.backoff / self.tick_period)
+			fields["reinject_queue_size"]  = self.reinjection.queue_size
+		return fields
+	
+	
+	def _encode_generator(self, gen, traces):
+		"""
+		As _encode_generator but reusing the encoding of generators seen before.
+		"""
+		if type(gen) is TraceGeneration:
+			return _encode_generator(gen, traces)
+		
+		temporal_dist, temporal_dist_data = self.image_cache.generator(
+			gen, lambda gen: _encode_generator(gen, "")[:2]
+		)
+		return (temporal_dist, temporal_dist_data, traces)
+	
+	
+	def _static_core_config(self, core, num_router_entries, router_entries, loads_router_entries):
+		"""
+		Pack the parts of a core's configuration block which only change with the
+		topology and streams: its (empty) sinks, latency histograms and, for the
+		core which loads them, the routing table entries.
+		"""
+		# Define the packet sinks (which must be supplied in ascending order of
+		# routing key)
+		config_sinks = ""
+		for route in sorted(self.core_consumers[core]):
+			con = self.core_consumers[core][route]
+			
+			# Encode packet generator data
+			if type(con) is not InstantConsumption:
+				raise Exception("Unknown packet consumer %s."%repr(con))
+			
+			# Encode this sink
+			config_sinks += spinnaker_app.config_sink_t.pack(*spinnaker_app.config_sink_tuple(
+				routing_key            = route.key,
+				result_packets_arrived = 0,
+			))
+		
+		# Each sink has an (empty) latency histogram when measuring latency
+		config_latency_histograms = ""
+		if self.measure_latency:
+			config_latency_histograms = spinnaker_app.config_latency_histogram_t.pack(
+				*([0] * spinnaker_app.LATENCY_HISTOGRAM_BINS)
+			) * len(self.core_consumers[core])
+		
+		return ( config_sinks
+		       + config_latency_histograms
+		       + (router_entries if loads_router_entries else "")
+		       )
+	
+	
+	def _app_variants(self, chip, core_temporal_dists):
+		"""
+		Choose the build of the app to run on each core of a chip given the
+		temporal distributions used by each core's sources (in any phase) {core:
+		set([temporal_dist, ...]), ...}. Returns {core_id:
+		spinnaker_app.AppVariant, ...}.
+		
+		The chip's lead (lowest numbered) core loads the routing table and so
+		needs a build with a lead core's duties: the router-loader, source-only,
+		sink-only or generic build. The lead is marked in its configuration (see
+		CONFIG_FLAG_LEAD) so other cores may run these builds without taking the
+		lead.
+		"""
+		lead_core_id = min(chip.cores)
+		
+		variants = {}
+		for core_id, core in chip.cores.iteritems():
+			num_sources = len(self.core_generators[core])
+			num_sinks   = len(self.core_consumers[core])
+			variant = spinnaker_app.app_variant( num_sources
+			                                   , num_sinks
+			                                   , num_sinks if self.measure_latency else 0
+			                                   , core_id == lead_core_id
+			                                   , core_temporal_dists[core]
+			                                   )
+			if variant is None:
+				raise Exception("Too many sources/sinks on a single core for any build of the app: %d/%d%s"%(
+					num_sources, num_sinks, " (measuring latency)" if self.measure_latency else ""
+				))
+			variants[core_id] = variant
+		
+		return variants
+	
+	
+	def _search_fields(self, search):
+		"""
+		The fields of a config_root_tuple configuring a saturation search (or no
+		search if search is None) on each core {core: {field: value, ...}, ...}
+		and the control packets' routing table entries on each chip {(x,y):
+		[config_router_entry_tuple, ...], ...}.
+		"""
+		if search is None:
+			fields = dict( search_control_key    = 0
+			             , search_master         = 0
+			             , search_num_reports    = 0
+			             , search_initial_scale  = 0
+			             , search_min_acceptance = 0
+			             , search_max_drop_rate  = 0
+			             , search_report_delay   = 0
+			             , search_timeout        = 0
+			             )
+			return ( dict((core, fields) for chip in self.chips.itervalues()
+			                             for core in chip.cores.itervalues())
+			       , dict((coord, []) for coord in self.chips)
+			       )
+		
+		# The control packets use the first keys after those of every stream and the
+		# first core of the first chip is the master
+		control_key = -(-self._next_routing_key // 8) * 8
+		master_coord = min(coord for coord, chip in self.chips.iteritems() if chip.cores)
+		master_core_id = min(self.chips[master_coord].cores)
+		
+		# Every core reports its arrived and generated packets, every chip its
+		# dropped and forwarded packets
+		num_reports = sum(2 * len(chip.cores) + 2
+		                  for chip in self.chips.itervalues() if chip.cores)
+		
+		fields = {}
+		for coord, chip in self.chips.iteritems():
+			for core_id, core in chip.cores.iteritems():
+				is_master = (coord, core_id) == (master_coord, master_core_id)
+				fields[core] = dict(
+					search_control_key    = control_key,
+					search_master         = int(is_master),
+					search_num_reports    = num_reports if is_master else 0,
+					search_initial_scale  = int(search.initial_scale * spinnaker_app.SEARCH_SCALE_ONE),
+					search_min_acceptance = int(search.min_acceptance * spinnaker_app.SEARCH_SCALE_ONE),
+					search_max_drop_rate  = int(search.max_drop_rate * spinnaker_app.SEARCH_SCALE_ONE),
+					search_report_delay   = int(search.settle / self.tick_period),
+					search_timeout        = int((search.settle + search.timeout) / self.tick_period),
+				)
+		
+		return (fields, _search_control_routes(self.chips, master_coord, master_core_id, control_key))
 	
 	
-	def _load_configs(self, conn):
+	def _search_phases(self, search):
 		"""
-		Pack and load the configuration data for all chips/cores on the system.
+		The phases of a sweep running each window of a saturation search.
 		"""
+		return [Phase(warmup = search.settle, duration = search.window)] * search.windows
+	
+	
+	def build_images(self, phases = None, search = None):
+		"""
+		Build the complete SDRAM image (coremap, configuration and routing tables)
+		of every chip, to be written to spinnaker_app.core_map_sdram_addr(). If a
+		list of Phases is given the app runs each in turn. If a SaturationSearch is
+		given (in place of phases) the app runs the search.
+		
+		The routing tables and the parts of each image which only depend on the
+		topology and streams are cached in self.image_cache: while the layout of a
+		chip's image is unchanged since the last build, only the fields which may
+		have changed (e.g. the seeds, timings and generators) are repacked and
+		patched into a copy of the last image.
+		
+		Returns a dict {(x,y): image, ...}.
+		"""
+		if search is not None:
+			phases = self._search_phases(search)
+		phase_parameters = self._phase_parameters(phases or [])
+		if phase_parameters:
+			durations      = [config_phase.duration for config_phase, _ in phase_parameters]
+			drain_duration = int(self.drain/self.tick_period)
+		else:
+			durations      = [int(self._duration/self.tick_period)]
+			drain_duration = 0
+		
+		# Size the sample ring buffers to hold every sample (up to max_samples) of
+		# the longest phase. Each phase of a sweep has its own ring buffer.
+		if self.sample_interval:
+			num_samples = min(self.max_samples, max(durations) / self.sample_interval)
+		else:
+			num_samples = 0
+		
+		# The router counter profile and the (empty) callback timing histograms
+		root_fields = dict(self._counter_profile(), **self._reinjection_fields())
+		for i in range(spinnaker_app.CALLBACK_HISTOGRAM_BINS):
+			root_fields["result_tick_histogram_%d"%i]   = 0
+			root_fields["result_packet_histogram_%d"%i] = 0
+		topology_digest = self._topology_digest()
+		router_tables   = self.image_cache.router_tables(topology_digest, self._router_tables)
+		
+		search_fields, search_routes = self._search_fields(search)
+		
+		# Calculate coremap
+		core_map = {}
+		for coord, chip in self.chips.iteritems():
+			core_map[coord] = sum(1<<c.core_id for c in chip.cores.itervalues())
+		
+		# The data to load into each chip {(x,y): data, ...}
+		chip_data = {}
+		
 		for (x,y), chip in self.chips.iteritems():
-			# Select the chip to load the data into
-			conn.selected_cpu_coords = (x,y,0)
+			num_router_entries, router_entries, num_generated_entries = router_tables[(x,y)]
+			self.router_table_sizes[(x,y)] = (num_generated_entries, num_router_entries)
 			
-			# Generate the chip's routing table (only loaded by a single core)
-			num_router_entries, router_entries = \
-				spinn_route.table_gen.spin1_table_gen(chip.router)
+			# A chip without cores has no lead to load its routing table (so it
+			# default routes everything) and is given only the core map
+			if not chip.cores:
+				chip_data[(x,y)] = spinnaker_app.chip_config_pack(core_map, [])[0]
+				self._core_config_addrs[(x,y)] = {}
+				continue
+			
+			# Saturation search control packets are routed ahead of the streams
+			num_router_entries += len(search_routes[(x,y)])
+			router_entries = router_minimise.pack_entries(search_routes[(x,y)]) + router_entries
 			
-			# Ensure we don't have too many routing entries
-			if num_router_entries > spinnaker_app.MAX_ROUTES_PER_CORE:
-				raise Exception("Too many router entries on a single core: %d (max %d)"%(
-					num_router_entries, spinnaker_app.MAX_ROUTES_PER_CORE
+			# Ensure the routing table (control entries included) fits in the router
+			if num_router_entries > spinnaker_app.MAX_ROUTER_ENTRIES:
+				raise Exception("Too many router entries on chip (%d,%d): %d including %d search control entries (max %d)"%(
+					x, y, num_router_entries, len(search_routes[(x,y)]), spinnaker_app.MAX_ROUTER_ENTRIES
 				))
 			
-			for index, core in enumerate(chip.cores.itervalues()):
-				# Arbitarily choose one core to load the routing tables
-				loads_router_enties = index == 0
-				
-				# Ensure we don't have too many sources/sinks
-				if len(self.core_generators[core]) > spinnaker_app.MAX_SOURCES_PER_CORE:
-					raise Exception("Too many sources on a single core: %d (max %d)"%(
-						len(self.core_generators[core]), spinnaker_app.MAX_SOURCES_PER_CORE
-					))
-				if len(self.core_consumers[core]) > spinnaker_app.MAX_SINKS_PER_CORE:
-					raise Exception("Too many sinks on a single core: %d (max %d)"%(
-						len(self.core_consumers[core]), spinnaker_app.MAX_SINKS_PER_CORE
-					))
+			# The parts of each core's configuration which may change between
+			# builds, in the order the cores are placed in the image [(core,
+			# config_root, config_sources, data), ...]
+			core_configs = []
+			
+			# The temporal distributions used by each core's sources (which decide
+			# the build of the app each runs)
+			core_temporal_dists = {}
+			
+			# The lead (lowest numbered) core loads the routing tables and is marked
+			# as the lead (see CONFIG_FLAG_LEAD)
+			lead_core_id = min(chip.cores)
+			
+			for core in chip.cores.itervalues():
+				is_lead = core.core_id == lead_core_id
 				
-				# The root block of the configuration 
-				config_root = spinnaker_app.config_root_t.pack(*spinnaker_app.config_root_tuple(
-					completion_state         = spinnaker_app.COMPLETION_STATE_RUNNING,
-					seed                     = random.getrandbits(32),
-					tick_microseconds        = self._tick_period,
-					warmup_duration          = int(self._warmup/self.tick_period),
-					duration                 = int(self._duration/self.tick_period),
-					rtr_drop_e               = self._router_timeout_e,
-					rtr_drop_m               = self._router_timeout_m,
-					result_dropped_packets   = 0,
-					result_forwarded_packets = 0,
-					num_sources              = len(self.core_generators[core]),
-					num_sinks                = len(self.core_consumers[core]),
-					num_router_entries       = num_router_entries if loads_router_enties else 0,
-				))
+				num_sources = len(self.core_generators[core])
+				num_sinks   = len(self.core_consumers[core])
 				
-				# Define the packet sources
+				# Define the packet sources (and the traces they replay)
 				config_sources = ""
+				config_traces  = ""
+				temporal_dists = core_temporal_dists[core] = set()
 				for route, gen in self.core_generators[core].iteritems():
-					# Encode packet generator data
-					if type(gen) is BernoulliGeneration:
-						temporal_dist = spinnaker_app.TEMPORAL_DIST_BERNOULLI
-						temporal_dist_data = spinnaker_app.bernoulli_packet_prob_t.pack(
-							*spinnaker_app.bernoulli_packet_prob_tuple(
-								bernoulli_packet_prob = gen.probability
-							)
-						)
-					else:
-						raise Exception("Unknown packet generator %s."%repr(gen))
+					temporal_dist, temporal_dist_data, config_traces = \
+						self._encode_generator(gen, config_traces)
+					temporal_dists.add(temporal_dist)
 					
 					# Encode this source
 					config_sources += spinnaker_app.config_source_t.pack(*spinnaker_app.config_source_tuple(
-						routing_key              = route.key,
-						temporal_dist            = temporal_dist,
-						temporal_dist_data       = temporal_dist_data,
-						result_packets_generated = 0,
-						result_packets_sent      = 0,
+						routing_key                  = route.key,
+						temporal_dist                = temporal_dist,
+						temporal_dist_data           = temporal_dist_data,
+						result_packets_generated     = 0,
+						result_packets_sent          = 0,
+						result_packets_deferred      = 0,
+						result_packets_deferred_sent = 0,
+						result_packets_discarded     = 0,
 					))
 				
-				# Define the packet sinks (which must be supplied in ascending order of
-				# routing key)
-				config_sinks = ""
-				for route in sorted(self.core_consumers[core]):
-					con = self.core_consumers[core][route]
-					
-					# Encode packet generator data
-					if type(con) is not InstantConsumption:
-						raise Exception("Unknown packet consumer %s."%repr(con))
-					
-					# Encode this sink
-					config_sinks += spinnaker_app.config_sink_t.pack(*spinnaker_app.config_sink_tuple(
-						routing_key            = route.key,
-						result_packets_arrived = 0,
-					))
-				
-				# Put all the configuration blocks together
-				config = config_root + config_sources + config_sinks
+				# Define each phase of a sweep, its sources being given in the same order
+				# as above
+				config_phases = ""
+				for config_phase, generators in phase_parameters:
+					config_phases += spinnaker_app.config_phase_t.pack(*config_phase)
+					for route, gen in self.core_generators[core].iteritems():
+						temporal_dist, temporal_dist_data, config_traces = \
+							self._encode_generator(generators(gen), config_traces)
+						temporal_dists.add(temporal_dist)
+						
+						config_phases += spinnaker_app.config_phase_source_t.pack(
+							*spinnaker_app.config_phase_source_tuple(
+								temporal_dist      = temporal_dist,
+								temporal_dist_data = temporal_dist_data,
+							)
+						)
 				
-				if loads_router_enties:
-					config += router_entries
+				# The root block of the configuration 
+				config_root = spinnaker_app.config_root_tuple(
+					completion_state          = spinnaker_app.COMPLETION_STATE_RUNNING,
+					seed                      = random.getrandbits(32),
+					tick_microseconds         = self._tick_period,
+					warmup_duration           = int(self._warmup/self.tick_period),
+					duration                  = int(self._duration/self.tick_period),
+					rtr_drop_e                = self._router_timeout_e,
+					rtr_drop_m                = self._router_timeout_m,
+					flags                     = ( (spinnaker_app.CONFIG_FLAG_LATENCY if self.measure_latency else 0)
+					                            | (spinnaker_app.CONFIG_FLAG_SEARCH if search is not None else 0)
+					                            | (spinnaker_app.CONFIG_FLAG_REINJECT if self.reinjection is not None else 0)
+					                            | (spinnaker_app.CONFIG_FLAG_LEAD if is_lead else 0)
+					                            ),
+					latency_bin_shift         = self._latency_bin_shift,
+					data_offset               = 0, # Filled in by chip_config_pack
+					num_phases                = len(phase_parameters),
+					phases_offset             = len(config_traces),
+					drain_duration            = drain_duration,
+					phase_results_offset      = 0, # Filled in by chip_config_pack
+					sample_interval           = self.sample_interval,
+					num_samples               = num_samples,
+					samples_offset            = 0, # Filled in by chip_config_pack
+					result_num_samples        = 0,
+					result_samples_dropped    = 0,
+					result_dropped_packets    = 0,
+					result_forwarded_packets  = 0,
+					result_load_time          = 0,
+					result_store_time         = 0,
+					result_cpu_clk            = 0,
+					result_tx_queue_max_depth = 0,
+					result_tick_overruns      = 0,
+					result_tick_max_cycles    = 0,
+					result_tick_max_latency   = 0,
+					result_ticks_elapsed      = 0,
+					result_packet_max_cycles  = 0,
+					result_search_scale       = 0,
+					result_checksum           = 0,
+					num_sources               = num_sources,
+					num_sinks                 = num_sinks,
+					num_router_entries        = num_router_entries if is_lead else 0,
+					**dict(root_fields, **search_fields[core])
+				)
 				
-				# Load this core's configuration
-				addr = spinnaker_app.config_root_sdram_addr(core.core_id)
-				data = config
-				self._write_mem_with_retry(conn, addr, scp.TYPE_BYTE, data)
+				# The core which loads the router entries is placed last so that the
+				# results of every core on the chip can be read back without them.
+				core_config = (core, config_root, config_sources, config_traces + config_phases)
+				if is_lead:
+					core_configs.append(core_config)
+				else:
+					core_configs.insert(0, core_config)
+			
+			self._core_variants[(x,y)] = self._app_variants(chip, core_temporal_dists)
+			
+			# Everything which determines where each field lies in the image
+			layout = ( topology_digest
+			         , self.measure_latency
+			         , search is not None
+			         , len(phase_parameters)
+			         , num_samples
+			         , tuple(len(data) for _, _, _, data in core_configs)
+			         )
+			
+			template = self.image_cache.template((x,y), layout)
+			if template is None:
+				template = self._build_template(core_map, core_configs,
+				                                num_router_entries, router_entries,
+				                                num_phases = len(phase_parameters),
+				                                num_samples = num_samples)
+				self.image_cache.add_template((x,y), template._replace(layout = layout))
+			
+			# Patch the changing fields into a copy of the template
+			image = bytearray(template.image)
+			for (core, config_root, config_sources, data), patch in zip(core_configs, template.cores):
+				config_root = config_root._replace(
+					data_offset          = patch.config_root.data_offset,
+					phase_results_offset = patch.config_root.phase_results_offset,
+					samples_offset       = patch.config_root.samples_offset,
+				)
+				config = spinnaker_app.config_root_t.pack(*config_root) + config_sources
+				image[patch.config_offset:patch.config_offset + len(config)] = config
+				image[patch.data_offset:patch.data_offset + len(data)] = data
+			
+			chip_data[(x,y)] = str(image)
+			self._core_config_addrs[(x,y)] = template.locations
+		
+		return chip_data
 	
 	
-	def _run_app(self, conn):
+	def _build_template(self, core_map, core_configs, num_router_entries, router_entries,
+	                    num_phases, num_samples):
 		"""
-		Run the application on the machine and block until the experiment is
-		complete.
+		Pack a chip's image from scratch given the parts of each core's
+		configuration produced by build_images, returning a ChipTemplate (with no
+		layout).
 		"""
-		# Load the spinnaker app onto all cores
-		for (x,y), chip in self.chips.iteritems():
-			# Apps must be started via the monitor processor
-			conn.selected_cpu_coords = (x,y,0)
-			
-			# Load the APLX into memory
-			# XXX: Shouldn't this be defined in the SCP module...
-			self._write_mem_with_retry(conn
-			                          , 0x67800000
-			                          , scp.TYPE_WORD
-			                          , open(spinnaker_app.SPINNAKER_APP_APLX,"rb").read()
-			                          )
-		
-		# Start the app on all cores
-		for (x,y), chip in self.chips.iteritems():
-			# Apps must be started via the monitor processor
-			conn.selected_cpu_coords = (x,y,0)
-			# Cause the APLX to be loaded into ITCM and executed on all cores
-			core_mask = sum(1<<core_id for core_id in chip.cores.iterkeys())
-			conn.reset_aplx(core_mask, 16)
+		packed_core_configs = []
+		for index, (core, config_root, config_sources, data) in enumerate(core_configs):
+			# The last core loads the router entries
+			loads_router_entries = index == len(core_configs) - 1
+			
+			num_sources = len(self.core_generators[core])
+			num_sinks   = len(self.core_consumers[core])
+			samples_length = num_samples * spinnaker_app.sample_size(num_sources, num_sinks)
+			
+			# Put all the configuration blocks together. Each phase of a sweep has a
+			# slot for a copy of the results (of everything but the routing table).
+			config = ( spinnaker_app.config_root_t.pack(*config_root)
+			         + config_sources
+			         + self._static_core_config( core, num_router_entries, router_entries
+			                                   , loads_router_entries
+			                                   )
+			         )
+			config_length = len(config) - (len(router_entries) if loads_router_entries else 0)
+			packed_core_configs.append(spinnaker_app.CoreConfig(
+				core_id              = core.core_id,
+				config               = config,
+				data                 = data,
+				samples_length       = samples_length * max(1, num_phases),
+				phase_results_length = config_length * num_phases,
+			))
+		
+		image, locations = spinnaker_app.chip_config_pack(core_map, packed_core_configs)
+		
+		cores = []
+		for core, _, _, _ in core_configs:
+			location    = locations[core.core_id]
+			config_root = spinnaker_app.config_root_tuple(
+				*spinnaker_app.config_root_t.unpack_from(image, location.addr - spinnaker_app.core_map_sdram_addr())
+			)
+			cores.append(image_cache.CorePatch(
+				core_id       = core.core_id,
+				config_offset = location.addr - spinnaker_app.core_map_sdram_addr(),
+				data_offset   = ( config_root.data_offset
+				                  + spinnaker_app.SDRAM_BASE_UNBUF
+				                  - spinnaker_app.core_map_sdram_addr()
+				                ),
+				config_root   = config_root,
+			))
+		
+		return image_cache.ChipTemplate( layout    = None
+		                               , image     = bytearray(image)
+		                               , locations = locations
+		                               , cores     = cores
+		                               )
+	
+	
+	def write_images(self, directory, phases = None, search = None):
+		"""
+		Build the SDRAM image of every chip (see build_images) and write each to a
+		file "x_y.dat" in directory along with a ybug script, "load.ybug", which
+		loads them all, e.g. in place of the single image loaded by
+		spinnaker_app/run_simple_test_driver.ybug.
+		"""
+		if not os.path.isdir(directory):
+			os.makedirs(directory)
+		
+		images = self.build_images(phases, search)
+		with open(os.path.join(directory, "load.ybug"), "w") as script:
+			for (x,y), image in sorted(images.iteritems()):
+				filename = os.path.join(directory, "%d_%d.dat"%(x,y))
+				with open(filename, "wb") as f:
+					f.write(image)
+				script.write("sp %d %d 0\n"%(x,y))
+				script.write("sload %s %08x\n"%(os.path.abspath(filename), spinnaker_app.core_map_sdram_addr()))
+			script.write("sp 0 0 0\n")
+	
+	
+	def _load_configs(self, transport, phases = None, search = None):
+		"""
+		Build (see build_images) and load the coremap and configuration data for all
+		chips/cores on the system. Each chip's data is written in a single block,
+		chips being loaded concurrently. If a list of Phases is given the app runs
+		each in turn (or, given a SaturationSearch, runs the search).
+		"""
+		chip_data = self.build_images(phases, search)
+		
+		# Load every chip's configuration
+		def load_chip(coord):
+			x, y = coord
+			transport.write_mem((x,y,0), spinnaker_app.core_map_sdram_addr(), chip_data[coord])
+		transport.map(load_chip, chip_data)
+	
+	
+	def _run_app(self, conn, transport, phases = None):
+		"""
+		Run the application on the machine and block until the experiment (or every
+		phase of a sweep) is complete.
+		"""
+		# The cores running each build of the app (see build_images) {variant:
+		# {(x,y): core_mask, ...}, ...}
+		variant_core_masks = defaultdict(lambda: defaultdict(int))
+		for coord, variants in self._core_variants.iteritems():
+			for core_id, variant in variants.iteritems():
+				variant_core_masks[variant][coord] |= 1 << core_id
+		
+		# Each build is loaded in turn through the same buffer. The lead core of
+		# each chip is marked in its configuration (see CONFIG_FLAG_LEAD) so the
+		# order doesn't matter.
+		for num, (variant, core_masks) in enumerate(sorted( variant_core_masks.iteritems()
+		                                                  , key = lambda (variant, _): variant.aplx
+		                                                  )):
+			aplx = open(variant.aplx,"rb").read()
+			
+			# The cores started with the previous build must have copied it out of
+			# the buffer first
+			if num:
+				self._wait_for_start(transport, previous_core_masks)
+			previous_core_masks = core_masks
+			
+			# Load the spinnaker app onto the chips running this build
+			def load_aplx(coord):
+				x, y = coord
+				# Apps must be loaded via the monitor processor
+				# XXX: Shouldn't this be defined in the SCP module...
+				transport.write_mem((x,y,0), 0x67800000, aplx)
+			transport.map(load_aplx, core_masks)
+			
+			# Start the app on the cores running this build
+			for (x,y), core_mask in core_masks.iteritems():
+				# Apps must be started via the monitor processor
+				conn.selected_cpu_coords = (x,y,0)
+				# Cause the APLX to be loaded into ITCM and executed on the cores
+				conn.reset_aplx(core_mask, 16)
 		
 		# Wait until when the experiment is expected to have finished.
-		time.sleep(self.warmup + self.duration + 0.1)
+		if phases:
+			run_time = sum( (config_phase.warmup_duration + config_phase.duration) * self.tick_period
+			                + self.drain
+			                for config_phase, _ in self._phase_parameters(phases)
+			              )
+		else:
+			run_time = self.warmup + self.duration
+		time.sleep(run_time)
 		
-		# Explicitly check cores until every core reports completion, create a list
-		# of bad cores.
+		self._wait_for_completion(transport)
+	
+	
+	def _wait_for_start(self, transport, core_masks):
+		"""
+		Block until every core in core_masks {(x,y): core_mask, ...} has started
+		(and so has copied the APLX it was loaded from out of SDRAM) as recorded
+		in its chip's status. Raises an ExperimentFailed if any core hasn't
+		started after APLX_START_TIMEOUT.
+		"""
+		def read_core_started(coord):
+			x, y = coord
+			data = transport.read_mem( (x,y,0)
+			                         , spinnaker_app.chip_status_core_started_sdram_addr()
+			                         , spinnaker_app.chip_status_core_started_t.size
+			                         )
+			return spinnaker_app.chip_status_core_started_t.unpack(data)
+		
+		deadline = time.time() + APLX_START_TIMEOUT
+		waiting = dict(core_masks)
+		poll_interval = self.poll_interval_min
+		while waiting:
+			for coord, core_started in zip(waiting.keys(), transport.map(read_core_started, waiting.keys())):
+				waiting[coord] &= ~sum(1<<core_id for core_id, started in enumerate(core_started) if started)
+				if not waiting[coord]:
+					del waiting[coord]
+			
+			if waiting:
+				if time.time() > deadline:
+					raise ExperimentFailed( "%d cores did not start."%sum(bin(mask).count("1") for mask in waiting.itervalues())
+					                      , [ self.chips[coord].cores[core_id]
+					                          for coord, mask in waiting.iteritems()
+					                          for core_id in self.chips[coord].cores
+					                          if mask & (1<<core_id)
+					                        ]
+					                      )
+				time.sleep(poll_interval)
+				poll_interval = min(self.poll_interval_max, poll_interval * 2)
+	
+	
+	def _wait_for_completion(self, transport):
+		"""
+		Block until every chip has finished running the application. Raises an
+		ExperimentFailed if any core failed.
+		
+		The lead core of each chip aggregates the completion of the chip's cores
+		into a single status. Every chip's status is polled at once until all have
+		finished, backing off while any are still running.
+		"""
+		def read_chip_status(coord):
+			x, y = coord
+			try:
+				data = transport.read_mem( (x,y,0)
+				                         , spinnaker_app.chip_status_sdram_addr()
+				                         , spinnaker_app.chip_status_t.size
+				                         )
+			except scp_transport.SCPError:
+				# The chip isn't responding
+				return None
+			return spinnaker_app.chip_status_tuple(*spinnaker_app.chip_status_t.unpack(data))
+		
+		self._chip_statuses = {}
 		bad_cores = []
-		for (x,y), chip in self.chips.iteritems():
-			conn.selected_cpu_coords = (x,y,0)
-			for core_id, core in chip.cores.iteritems():
-				while True:
-					addr = spinnaker_app.config_root_sdram_addr(core_id)
-					data = conn.read_mem(addr, scp.TYPE_BYTE, spinnaker_app.completion_state_t.size)
-					completion_state = spinnaker_app.completion_state_t.unpack(data)[0]
-					
-					if completion_state == spinnaker_app.COMPLETION_STATE_RUNNING:
-						# Make sure the chip is actually up
-						try:
-							conn.version()
-						except:
-							bad_cores.append(core)
-							break
-						
-						# Wait a bit longer...
-						time.sleep(1)
-						sys.stderr.write("Waiting for core %d,%d:%d...\n"%(x,y,core_id))
-						
-					elif completion_state == spinnaker_app.COMPLETION_STATE_SUCCESS:
-						# Move onto the next chip
-						sys.stderr.write("Success for core %d,%d:%d...\n"%(x,y,core_id))
-						break
-					else:
-						# Something failed!
-						bad_cores.append(core)
-						break
+		# Only a chip's lead core writes its status, so chips without cores are
+		# never polled (they would never appear to finish)
+		running = [coord for coord, chip in self.chips.iteritems() if chip.cores]
+		poll_interval = self.poll_interval_min
+		while running:
+			still_running = []
+			for (x,y), chip_status in zip(running, transport.map(read_chip_status, running)):
+				chip = self.chips[(x,y)]
+				if chip_status is None:
+					# All cores on a dead chip are bad
+					bad_cores.extend(chip.cores.itervalues())
+				elif chip_status.completion_state == spinnaker_app.COMPLETION_STATE_RUNNING:
+					still_running.append((x,y))
+				else:
+					self._chip_statuses[(x,y)] = chip_status
+					bad_cores.extend(core for core_id, core in chip.cores.iteritems()
+					                 if chip_status.bad_cores & (1<<core_id))
+					if chip_status.completion_state == spinnaker_app.COMPLETION_STATE_SUCCESS:
+						sys.stderr.write("Success for chip %d,%d...\n"%(x,y))
+			running = still_running
+			
+			if running:
+				# Wait a bit longer...
+				sys.stderr.write("Waiting for %d chips...\n"%len(running))
+				time.sleep(poll_interval)
+				poll_interval = min(self.poll_interval_max, poll_interval * 2)
 		
 		# If any cores failed, throw an exception
 		if bad_cores:
 			raise ExperimentFailed("%d cores reported failiure while executing the experiment."%len(bad_cores), bad_cores)
 	
 	
-	def _collect_results(self, conn):
+	def _parse_core_results(self, core, data, offset, samples_data, samples_offset):
 		"""
-		Collect and collate the results from the system into a Results object.
+		Unpack the results of a core: its config_root, sources, sinks and latency
+		histograms start at offset in data and its sample ring buffer at
+		samples_offset in samples_data. Each array is decoded in place by a single
+		unpack.
+		
+		Returns a tuple (config_root, CoreResults).
 		"""
-		results = {}
+		num_sources    = len(self.core_generators[core])
+		num_sinks      = len(self.core_consumers[core])
+		num_histograms = num_sinks if self.measure_latency else 0
 		
-		for (x,y), chip in self.chips.iteritems():
-			# Select the chip to download the data from
-			conn.selected_cpu_coords = (x,y,0)
+		# Locations of each array in data
+		sources_offset    = offset            + spinnaker_app.config_root_t.size
+		sinks_offset      = sources_offset    + spinnaker_app.config_source_t.size * num_sources
+		histograms_offset = sinks_offset      + spinnaker_app.config_sink_t.size   * num_sinks
+		end_offset        = histograms_offset + spinnaker_app.config_latency_histogram_t.size * num_histograms
+		assert end_offset <= len(data)
+		
+		# Pull out the root block
+		config_root = spinnaker_app.config_root_tuple._make(
+			spinnaker_app.config_root_t.unpack_from(data, offset)
+		)
+		
+		# Make sure the results read back are those the core wrote
+		if ( spinnaker_app.result_checksum(data, sources_offset, end_offset - sources_offset)
+		     != config_root.result_checksum
+		   ):
+			raise Exception("Results of core %d read back with a bad checksum."%(core.core_id))
+		
+		# Pull out the sources, sinks and latency histograms (one per sink)
+		config_sources = spinnaker_app.unpack_array( spinnaker_app.config_source_t
+		                                           , num_sources, data, sources_offset
+		                                           )
+		config_sinks = spinnaker_app.unpack_array( spinnaker_app.config_sink_t
+		                                         , num_sinks, data, sinks_offset
+		                                         )
+		latency_histograms = spinnaker_app.unpack_array( spinnaker_app.config_latency_histogram_t
+		                                               , num_histograms, data, histograms_offset
+		                                               )
+		
+		source_keys = [source[0] for source in config_sources]
+		sink_keys   = [sink[0]   for sink   in config_sinks]
+		
+		# Extract the core's results. The results are the last fields of each
+		# config_source and are in the same order as those of SourceResults.
+		num_source_results = len(SourceResults._fields)
+		sources = dict(zip( source_keys
+		                  , (SourceResults._make(source[-num_source_results:])
+		                     for source in config_sources)
+		                  ))
+		if self.measure_latency:
+			latency_bin_width = ( (1 << config_root.latency_bin_shift)
+			                    / (config_root.result_cpu_clk * 1000000.0)
+			                    )
+		else:
+			latency_bin_width  = None
+			latency_histograms = [None] * num_sinks
+		sinks = {}
+		for (routing_key, packets_arrived), latency_histogram in zip(config_sinks, latency_histograms):
+			sinks[routing_key] = SinkResults( packets_arrived   = packets_arrived
+			                                , latency_histogram = latency_histogram
+			                                , latency_bin_width = latency_bin_width
+			                                )
+		
+		# Extract the core's samples, oldest first
+		samples = []
+		num_samples = min(config_root.result_num_samples, config_root.num_samples)
+		first_slot  = (config_root.result_num_samples - num_samples) % max(1, config_root.num_samples)
+		size = spinnaker_app.sample_size(num_sources, num_sinks)
+		sample_t = struct.Struct( spinnaker_app.config_sample_t.format
+		                        + "%dI"%(num_sources + num_sinks)
+		                        )
+		for sample_num in range(num_samples):
+			values = sample_t.unpack_from(
+				samples_data,
+				samples_offset + ((first_slot + sample_num) % config_root.num_samples) * size
+			)
+			tick, forwarded_packets, dropped_packets = values[:3]
+			samples.append(Sample( tick              = tick
+			                     , forwarded_packets = forwarded_packets
+			                     , dropped_packets   = dropped_packets
+			                     , packets_sent      = dict(zip(source_keys, values[3:3 + num_sources]))
+			                     , packets_arrived   = dict(zip(sink_keys,   values[3 + num_sources:]))
+			                     ))
+		
+		return (config_root, CoreResults( sources            = sources
+		                                , sinks              = sinks
+		                                , load_time          = config_root.result_load_time
+		                                , store_time         = config_root.result_store_time
+		                                , samples            = samples
+		                                , samples_dropped    = config_root.result_samples_dropped
+		                                , tx_queue_max_depth = config_root.result_tx_queue_max_depth
+		                                , timing             = self._callback_timing(config_root)
+		                                ))
+	
+	
+	def _callback_timing(self, config_root):
+		"""
+		Decode the callback timing results in a config_root as a CallbackTiming.
+		"""
+		cycle = 1.0 / (max(1, config_root.result_cpu_clk) * 1000000.0)
+		bins  = spinnaker_app.CALLBACK_HISTOGRAM_BINS
+		tick_histogram_index = spinnaker_app.config_root_tuple._fields.index("result_tick_histogram_0")
+		packet_histogram_index = spinnaker_app.config_root_tuple._fields.index("result_packet_histogram_0")
+		
+		return CallbackTiming( ticks               = config_root.duration
+		                     , ticks_elapsed       = config_root.result_ticks_elapsed
+		                     , tick_overruns       = config_root.result_tick_overruns
+		                     , tick_max_duration   = config_root.result_tick_max_cycles * cycle
+		                     , tick_max_latency    = config_root.result_tick_max_latency * cycle
+		                     , tick_histogram      = list(config_root[tick_histogram_index:tick_histogram_index + bins])
+		                     , packet_max_duration = config_root.result_packet_max_cycles * cycle
+		                     , packet_histogram    = list(config_root[packet_histogram_index:packet_histogram_index + bins])
+		                     , histogram_bin_width = (1 << spinnaker_app.CALLBACK_HISTOGRAM_SHIFT) * cycle
+		                     , kept_up             = ( config_root.result_tick_overruns == 0
+		                                             and config_root.result_ticks_elapsed <= config_root.duration
+		                                             )
+		                     )
+	
+	
+	def _collect_results(self, transport, phases = None, search = None):
+		"""
+		Collect and collate the results from the system into a Results object (or,
+		for a sweep, a list of Results objects, one per phase). Chips are read back
+		concurrently. For a saturation search returns a tuple (SearchResults,
+		[Results, ...]) with a Results object per window.
+		"""
+		if search is not None:
+			phases = self._search_phases(search)
+		
+		# The injection scale of each phase, as reported by every core
+		phase_scales = [set() for _ in (phases or [None])]
+		
+		num_result_sets = len(phases) if phases else 1
+		
+		# Where the counts of the router diagnostic counters start in a config_root
+		result_counters_index = spinnaker_app.config_root_tuple._fields.index("result_counter_0")
+		
+		# Download and unpack the results of a chip, returning a ChipResults for each
+		# phase
+		def collect_chip(coord):
+			x, y = coord
+			chip = self.chips[coord]
 			
-			router_results = None
-			core_results = {}
+			# Chips without cores have no results
+			if not chip.cores:
+				return [ChipResults(router = None, cores = {})] * num_result_sets
 			
-			for index, core in enumerate(chip.cores.itervalues()):
-				# Arbitarily choose one core to load the router results from (since
-				# they're all identical)
-				downloads_router_results = index == 0
-				
-				# Download the data from this core
-				addr = spinnaker_app.config_root_sdram_addr(core.core_id)
-				data = conn.read_mem(addr, scp.TYPE_BYTE,
+			# The size of the results (i.e. the config_root, sources, sinks and
+			# latency histograms) at the start of each core's configuration block (and
+			# in each of its phase result slots)
+			results_size = {}
+			for core in chip.cores.itervalues():
+				results_size[core.core_id] = (
 					spinnaker_app.config_root_t.size
 					+ spinnaker_app.config_source_t.size * len(self.core_generators[core])
 					+ spinnaker_app.config_sink_t.size   * len(self.core_consumers[core])
+					+ ( spinnaker_app.config_latency_histogram_t.size * len(self.core_consumers[core])
+					    if self.measure_latency else 0
+					  )
 				)
+			
+			# The location of the results and samples of each core in each phase
+			addrs = self._core_config_addrs[(x,y)]
+			def results_addr(core_id, phase):
+				if phases:
+					return addrs[core_id].phase_results_addr + phase * results_size[core_id]
+				else:
+					return addrs[core_id].addr
+			def samples_addr(core_id, phase):
+				return ( addrs[core_id].samples_addr
+				       + phase * (addrs[core_id].samples_length / num_result_sets)
+				       )
+			
+			# Download the results of every core on the chip at once
+			start_addr = min(results_addr(core_id, 0) for core_id in addrs)
+			end_addr   = max(results_addr(core_id, num_result_sets - 1) + results_size[core_id]
+			                 for core_id in addrs)
+			
+			# And all their samples (in the same batch of requests)
+			samples_start_addr = min(loc.samples_addr for loc in addrs.itervalues())
+			samples_end_addr   = max(loc.samples_addr + loc.samples_length
+			                         for loc in addrs.itervalues())
+			chip_data, chip_samples_data = transport.read_mems(
+				(x,y,0),
+				[ (start_addr, end_addr - start_addr)
+				, (samples_start_addr, max(0, samples_end_addr - samples_start_addr))
+				]
+			)
+			
+			chip_results = []
+			for phase in range(num_result_sets):
+				router_results = None
+				core_results = {}
+				checksum = 0
 				
-				# Pull out the root block
-				config_root = spinnaker_app.config_root_tuple(
-					*spinnaker_app.config_root_t.unpack(data[:spinnaker_app.config_root_t.size])
-				)
-				data = data[spinnaker_app.config_root_t.size:]
-				
-				# Pull out the sources blocks
-				config_sources = []
-				for _ in self.core_generators[core]:
-					config_sources.append(spinnaker_app.config_source_tuple(
-						*spinnaker_app.config_source_t.unpack(data[:spinnaker_app.config_source_t.size])
-					))
-					data = data[spinnaker_app.config_source_t.size:]
-				
-				# Pull out the sinks blocks
-				config_sinks = []
-				for _ in self.core_consumers[core]:
-					config_sinks.append(spinnaker_app.config_sink_tuple(
-						*spinnaker_app.config_sink_t.unpack(data[:spinnaker_app.config_sink_t.size])
-					))
-					data = data[spinnaker_app.config_sink_t.size:]
-				
-				# Should have now processed all the data
-				assert data == ""
-				
-				# Extract the router results
-				if downloads_router_results:
-					router_results = RouterResults( forwarded_packets  = config_root.result_forwarded_packets
-					                              , dropped_packets    = config_root.result_dropped_packets
-					                              , num_router_entries = config_root.num_router_entries
-					                              )
-				sources = {}
-				sinks   = {}
+				for core in chip.cores.itervalues():
+					# Decode this core's results in place
+					config_root, core_results[core.core_id] = self._parse_core_results(
+						core,
+						chip_data,         results_addr(core.core_id, phase) - start_addr,
+						chip_samples_data, samples_addr(core.core_id, phase) - samples_start_addr,
+					)
+					checksum += config_root.result_checksum
+					phase_scales[phase].add(config_root.result_search_scale)
+					
+					# Load the router results from the core marked as the lead: every core
+					# reports the same counters but only the lead reinjects dropped
+					# packets
+					if config_root.flags & spinnaker_app.CONFIG_FLAG_LEAD:
+						router_results = RouterResults( forwarded_packets  = config_root.result_forwarded_packets
+						                              , dropped_packets    = config_root.result_dropped_packets
+						                              , num_router_entries = config_root.num_router_entries
+						                              , counters           = dict(
+						                                  (name, config_root[result_counters_index + counter])
+						                                  for name, (counter, _) in self.router_counters.iteritems()
+						                                )
+						                              , reinjection        = ReinjectionResults(
+						                                  *(getattr(config_root, "result_reinject_%s"%field)
+						                                    for field in ReinjectionResults._fields)
+						                                )
+						                              )
 				
-				# Extract the core's results
-				for source in config_sources:
-					sources[source.routing_key] = SourceResults( packets_generated = source.result_packets_generated
-					                                           , packets_sent      = source.result_packets_sent
-					                                           )
-				for sink in config_sinks:
-					sinks[sink.routing_key] = SinkResults(packets_arrived = sink.result_packets_arrived)
+				# The chip's status covers the results stored in place (i.e. those read
+				# back when not running a sweep)
+				if not phases and (checksum & 0xFFFFFFFF) != self._chip_statuses[(x,y)].checksum:
+					raise Exception("Results of chip %d,%d do not match its status checksum."%(x,y))
 				
-				core_results[core.core_id] = CoreResults( sources = sources
-				                                        , sinks   = sinks
-				                                        )
+				chip_results.append(ChipResults(router = router_results, cores = core_results))
+			
+			return chip_results
+		
+		results = [{} for _ in range(num_result_sets)]
+		for coord, chip_results in zip(self.chips, transport.map(collect_chip, self.chips)):
+			for phase, chip_result in enumerate(chip_results):
+				results[phase][coord] = chip_result
+		
+		# Flag runs in which the traffic offered was lower than configured because
+		# cores couldn't keep up with their ticks
+		lagging = set()
+		for phase_results in results:
+			for (x,y), core_id, timing in lagging_cores(phase_results):
+				lagging.add((x,y,core_id))
+		if lagging:
+			msg = "%d cores fell behind their timer ticks (e.g. core %d,%d,%d)."%(
+				len(lagging), min(lagging)[0], min(lagging)[1], min(lagging)[2]
+			)
+			if self.reject_lagging_runs:
+				raise ExperimentFailed(msg, [ self.chips[(x,y)].cores[core_id]
+				                              for x, y, core_id in sorted(lagging)
+				                            ])
+			sys.stderr.write("Warning: %s Offered load may be lower than configured.\n"%msg)
+		
+		if search is not None:
+			return (self._search_results(search, results, phase_scales), results)
+		else:
+			return results if phases else results[0]
+	
+	
+	def _search_results(self, search, results, phase_scales):
+		"""
+		Collate the Results of each window of a saturation search (and the
+		injection scales reported by the cores in each) into SearchResults.
+		"""
+		points = []
+		for window_results, scales in zip(results, phase_scales):
+			if len(scales) != 1:
+				raise Exception("Cores disagree on the injection scale of a window: %s."%(
+					", ".join(str(scale) for scale in sorted(scales))
+				))
 			
-			results[(x,y)] = ChipResults(router = router_results, cores = core_results)
+			cores = [core for chip in window_results.itervalues() for core in chip.cores.itervalues()]
+			points.append(SearchPoint(
+				scale     = float(scales.pop()) / spinnaker_app.SEARCH_SCALE_ONE,
+				generated = sum(source.packets_generated for core in cores for source in core.sources.itervalues()),
+				sent      = sum(source.packets_sent      for core in cores for source in core.sources.itervalues()),
+				arrived   = sum(sink.packets_arrived     for core in cores for sink   in core.sinks.itervalues()),
+				forwarded = sum(chip.router.forwarded_packets for chip in window_results.itervalues()),
+				dropped   = sum(chip.router.dropped_packets   for chip in window_results.itervalues()),
+				saturated = None,
+			))
 		
-		return results
+		points = [point._replace(saturated = _search_saturated(search, point, points[0]))
+		          for point in points]
+		return SearchResults( points           = points
+		                    , saturation_scale = max([point.scale for point in points
+		                                              if not point.saturated] or [0.0])
+		                    )
 	
 	
 	def run(self, hostname):
@@ -519,14 +1925,87 @@ class NetworkExperiment(object):
 		
 		Returns a Results object once simulation has completed.
 		"""
+		return self._run(hostname)
+	
+	
+	def run_sweep(self, hostname, phases):
+		"""
+		Run a sweep on the selected (booted) SpiNNaker board: each of a list of
+		Phases is run in turn by a single load of the app, the network being
+		allowed to drain for self.drain seconds between phases.
+		
+		Returns a list of Results objects, one per phase.
+		"""
+		return self._run(hostname, phases)
+	
+	
+	def run_saturation_search(self, hostname, search = SaturationSearch()):
+		"""
+		Search for the injection scale at which the network saturates on the
+		selected (booted) SpiNNaker board (see SaturationSearch). The app bisects
+		the scale itself, running every window in a single load.
+		
+		Returns a tuple (SearchResults, [Results, ...]) with a Results object per
+		window.
+		"""
+		return self._run(hostname, search = search)
+	
+	
+	def simulate(self, phases = None, threads = None, options = ()):
+		"""
+		Run the experiment (or, given a list of Phases, a sweep) on the host-native
+		network simulator rather than a SpiNNaker board. The simulator runs exactly
+		the configuration which would be loaded onto a board using threads host
+		threads (default: one per CPU). Further command line options for the
+		simulator (e.g. its timing parameters) may be given in options.
+		
+		Returns a Results object (or a list, one per phase) as run (or run_sweep).
+		"""
+		return self._simulate(phases, threads, options)
+	
+	
+	def simulate_saturation_search(self, search = SaturationSearch(), threads = None, options = ()):
+		"""
+		As run_saturation_search but on the network simulator (see simulate).
+		"""
+		return self._simulate(None, threads, options, search)
+	
+	
+	def _simulate(self, phases, threads, options, search = None):
+		transport = simulator.SimulatorTransport(threads = threads, options = options)
+		try:
+			self._load_configs(transport, phases, search)
+			
+			# Make room for the results written beyond the configuration
+			for coord, locations in self._core_config_addrs.iteritems():
+				for location in locations.itervalues():
+					transport.reserve(coord, location.phase_results_addr, location.phase_results_length)
+					transport.reserve(coord, location.samples_addr,       location.samples_length)
+			
+			transport.run()
+			self._wait_for_completion(transport)
+			return self._collect_results(transport, phases, search)
+		finally:
+			transport.close()
+	
+	
+	def _run(self, hostname, phases = None, search = None):
 		# Connect to the board
 		conn = scp.SCPConnection(hostname)
 		conn.version()
+		transport = scp_transport.SCPTransport( hostname
+		                                      , num_workers = self.scp_workers
+		                                      , window      = self.scp_window
+		                                      )
 		
-		# Run the experiment, fetch the results
-		self._load_coremaps(conn)
-		self._load_configs(conn)
-		self._run_app(conn)
-		return self._collect_results(conn)
+		# Run the experiment (or every phase), fetch the results
+		try:
+			self._load_configs(transport, phases, search)
+			self._run_app( conn, transport
+			             , self._search_phases(search) if search is not None else phases
+			             )
+			return self._collect_results(transport, phases, search)
+		finally:
+			transport.close()
 
 
@@ -4,7 +4,11 @@
 Utility functions for producing result files from experimental runs.
 """
 
-from collections import defaultdict
+import mmap
+import array
+import struct
+
+from collections import defaultdict, OrderedDict
 
 def tsv(column_names, rows):
 	"""
@@ -13,19 +17,255 @@ def tsv(column_names, rows):
 	is inserted.
 	"""
 	# Add the column headings
-	out = "%s\n"%("\t".join(map(str,column_names)))
+	lines = ["\t".join(map(str,column_names))]
 	
 	# Add the data
-	for row in rows:
+	lines.extend("" if row is None else "\t".join(map(str,row)) for row in rows)
+	
+	return "\n".join(lines).rstrip("\n")
+
+
+################################################################################
+# Streaming writers
+################################################################################
+
+class TSVWriter(object):
+	"""
+	Writes rows to a file as they are produced in the same format as tsv() (but
+	terminated by a newline). Blank lines are only written once a further row
+	follows them.
+	"""
+	
+	def __init__(self, f):
+		self.f = f
+		self._blank_lines = 0
+	
+	
+	def start(self, column_names):
+		self.f.write("\t".join(map(str,column_names)))
+		self._blank_lines = 0
+		return self
+	
+	
+	def append(self, row):
+		if row is None:
+			self._blank_lines += 1
+		else:
+			self.f.write("\n" * (self._blank_lines + 1))
+			self.f.write("\t".join(map(str,row)))
+			self._blank_lines = 0
+	
+	
+	def finish(self):
+		self.f.write("\n")
+
+
+# The binary columnar format written by ColumnWriter (all values little endian):
+#
+#   columns_header_t
+#   For each column: columns_column_t, its name and, for a string column, each
+#   of its distinct values as a uint16 length followed by the string
+#   Each column's values (8 bytes each) starting at its (8-byte aligned) offset
+#
+# Values are float64 ('d') or, for strings ('s'), a float64 index into the
+# column's distinct values (all counters fit exactly in a float64). Since each
+# column is contiguous it may be memory mapped directly, e.g. with numpy.memmap,
+# using the offsets given by read_column_layout.
+COLUMNS_MAGIC = "SPNTDCOL"
+
+columns_header_t = struct.Struct( "<" # Little endian, standard sizes
+                                + "8s" # magic
+                                + "I"  # num_columns
+                                + "Q"  # num_rows
+                                )
+
+columns_column_t = struct.Struct( "<" # Little endian, standard sizes
+                                + "c" # typecode ('d' or 's')
+                                + "H" # name length
+                                + "I" # num_strings
+                                + "Q" # offset of values from start of file
+                                )
+
+
+def _column_string(value):
+	"""
+	The value stored in a string column for a given value.
+	"""
+	if isinstance(value, basestring):
+		return value
+	elif isinstance(value, float):
+		return repr(value)
+	else:
+		return str(value)
+
+
+class ColumnWriter(object):
+	"""
+	Writes rows to a file in a binary columnar format (see COLUMNS_MAGIC) which
+	can be loaded by read_columns without parsing text. Rows are accumulated in
+	compact typed arrays and written when finish() is called. Blank (None) rows
+	are skipped.
+	
+	A column holds numbers (float64) unless any of its values is not a number in
+	which case it holds strings.
+	"""
+	
+	def __init__(self, f):
+		self.f = f
+	
+	
+	def start(self, column_names):
+		self.column_names = list(column_names)
+		self.columns      = [array.array("d") for _ in self.column_names]
+		
+		# For each string column, a dict {string: index, ...} of its values
+		self.strings = [None for _ in self.column_names]
+		
+		return self
+	
+	
+	def _convert_to_strings(self, column_num):
+		strings = self.strings[column_num] = OrderedDict()
+		self.columns[column_num] = array.array("d", (
+			strings.setdefault(_column_string(value), len(strings))
+			for value in self.columns[column_num]
+		))
+	
+	
+	def append(self, row):
 		if row is None:
-			out += "\n"
+			return
+		
+		for column_num, value in enumerate(row):
+			if ( self.strings[column_num] is None
+			     and not isinstance(value, (int, long, float))
+			   ):
+				self._convert_to_strings(column_num)
+			
+			strings = self.strings[column_num]
+			if strings is None:
+				self.columns[column_num].append(value)
+			else:
+				self.columns[column_num].append(
+					strings.setdefault(_column_string(value), len(strings))
+				)
+	
+	
+	def finish(self):
+		num_rows = len(self.columns[0]) if self.columns else 0
+		
+		# Build the header to find where the values start
+		descriptions = []
+		for name, column, strings in zip(self.column_names, self.columns, self.strings):
+			name = str(name)
+			typecode = "d" if strings is None else "s"
+			descriptions.append((typecode, name, list(strings or [])))
+		header_length = columns_header_t.size + sum(
+			columns_column_t.size + len(name) + sum(2 + len(s) for s in strings)
+			for typecode, name, strings in descriptions
+		)
+		offset = (header_length + 7) & ~7
+		
+		self.f.write(columns_header_t.pack(COLUMNS_MAGIC, len(self.columns), num_rows))
+		for typecode, name, strings in descriptions:
+			self.f.write(columns_column_t.pack(typecode, len(name), len(strings), offset))
+			self.f.write(name)
+			for string in strings:
+				self.f.write(struct.pack("<H", len(string)) + string)
+			offset += 8 * num_rows
+		self.f.write("\0" * (((header_length + 7) & ~7) - header_length))
+		
+		for column in self.columns:
+			if struct.pack("=H", 1) != struct.pack("<H", 1):
+				column = array.array(column.typecode, column)
+				column.byteswap()
+			column.tofile(self.f)
+
+
+def read_column_layout(filename):
+	"""
+	Read the header of a file written by ColumnWriter. Returns a tuple (num_rows,
+	columns) where columns is an OrderedDict {name: (typecode, offset, strings),
+	...}.
+	"""
+	with open(filename, "rb") as f:
+		magic, num_columns, num_rows = columns_header_t.unpack(f.read(columns_header_t.size))
+		if magic != COLUMNS_MAGIC:
+			raise Exception("%s is not a columnar results file."%filename)
+		
+		columns = OrderedDict()
+		for _ in range(num_columns):
+			typecode, name_length, num_strings, offset = \
+				columns_column_t.unpack(f.read(columns_column_t.size))
+			name = f.read(name_length)
+			strings = []
+			for _ in range(num_strings):
+				length, = struct.unpack("<H", f.read(2))
+				strings.append(f.read(length))
+			columns[name] = (typecode, offset, strings)
+	
+	return (num_rows, columns)
+
+
+def read_columns(filename):
+	"""
+	Load a file written by ColumnWriter via a memory map. Returns an OrderedDict
+	{name: values, ...} where values is an array.array for numeric columns or a
+	list of strings.
+	"""
+	num_rows, layout = read_column_layout(filename)
+	
+	columns = OrderedDict()
+	with open(filename, "rb") as f:
+		if num_rows == 0:
+			data = ""
 		else:
-			out += "%s\n"%("\t".join(map(str,row)))
+			data = mmap.mmap(f.fileno(), 0, access = mmap.ACCESS_READ)
+		
+		for name, (typecode, offset, strings) in layout.iteritems():
+			values = array.array("d")
+			values.fromstring(data[offset:offset + 8 * num_rows])
+			if struct.pack("=H", 1) != struct.pack("<H", 1):
+				values.byteswap()
+			columns[name] = [strings[int(i)] for i in values] if typecode == "s" else values
+		
+		if num_rows != 0:
+			data.close()
+	
+	return columns
+
+
+def latency_percentile(sinks, percentile):
+	"""
+	Given an iterable of SinkResults, estimate the given percentile (0-100) of the
+	latency (seconds) of the packets which arrived at them from their combined
+	latency histograms, interpolating linearly within a bin. Returns inf if the
+	percentile lies in the final (unbounded) bin and nan if there are no
+	latency measurements.
+	"""
+	histograms = [sink.latency_histogram for sink in sinks if sink.latency_histogram is not None]
+	if not histograms:
+		return float("nan")
+	bin_width = [sink.latency_bin_width for sink in sinks if sink.latency_histogram is not None][0]
 	
-	return out.rstrip("\n")
+	histogram = map(sum, zip(*histograms))
+	total     = sum(histogram)
+	if total == 0:
+		return float("nan")
+	
+	target = total * percentile / 100.0
+	below  = 0
+	for bin_num, count in enumerate(histogram):
+		if count and below + count >= target:
+			if bin_num == len(histogram) - 1:
+				return float("inf")
+			return (bin_num + (target - below) / float(count)) * bin_width
+		below += count
+	
+	return float("inf")
 
 
-def global_results(variable_fields_names, data):
+def global_results(variable_fields_names, data, writer = None):
 	"""
 	Produces TSV formatted, GNUplot compatible data files given a set of results.
 	For each result, a single row will be produced containing system-wide
@@ -39,6 +279,10 @@ def global_results(variable_fields_names, data):
 	values representing the free-variable values for a given run of the
 	experiment. The final value in the tuple must be the results object to be
 	produced.
+	
+	If a writer (e.g. a TSVWriter or ColumnWriter) is given, each row is passed
+	to it as it is produced and nothing is returned. Otherwise the TSV data is
+	returned as a string.
 	"""
 	
 	column_names = list(variable_fields_names) + [ "total_dropped"
@@ -53,7 +297,7 @@ def global_results(variable_fields_names, data):
 	                                             , "num_router_entries"
 	                                             ]
 	
-	rows = []
+	rows = [] if writer is None else writer.start(column_names)
 	for datum in data:
 		assert len(datum) == len(variable_fields_names) + 1\
 		     , "Must have the same number of variables as variable field names."
@@ -100,13 +344,16 @@ def global_results(variable_fields_names, data):
 		                                   , num_router_entries
 		                                   ])
 	
-	return tsv(column_names, rows)
+	if writer is None:
+		return tsv(column_names, rows)
+	writer.finish()
 
 
 def per_chip_results( variable_fields_names, data
                     , square_off = True
                     , sentinel = 0
                     , gnuplot_comaptible = True
+                    , writer = None
                     ):
 	"""
 	Produces TSV formatted, GNUplot compatible data files given a set of results.
@@ -121,6 +368,10 @@ def per_chip_results( variable_fields_names, data
 	experiment. The final value in the tuple must be the results object to be
 	produced.
 	
+	If a writer (e.g. a TSVWriter or ColumnWriter) is given, each row is passed
+	to it as it is produced and nothing is returned. Otherwise the TSV data is
+	returned as a string.
+	
 	square_off will insert extra rows corresponding to chips which don't exist
 	within the rectangular boundary of the system, e.g. for 48-node baord systems.
 	
@@ -141,9 +392,17 @@ def per_chip_results( variable_fields_names, data
 	                                             , "num_sources"
 	                                             , "num_sinks"
 	                                             , "num_router_entries"
+	                                             , "reinject_dumped"
+	                                             , "reinject_missed"
+	                                             , "reinject_reinjected"
+	                                             , "reinject_redropped"
+	                                             , "reinject_not_redropped_locally"
+	                                             , "reinject_abandoned"
+	                                             , "reinject_unconfirmed"
+	                                             , "reinject_unrouted"
 	                                             ]
 	
-	rows = []
+	rows = [] if writer is None else writer.start(column_names)
 	for datum in data:
 		assert len(datum) == len(variable_fields_names) + 1\
 		     , "Must have the same number of variables as variable field names."
@@ -179,6 +438,8 @@ def per_chip_results( variable_fields_names, data
 					                         for core in chip.cores.itervalues())
 					
 					num_router_entries = chip.router.num_router_entries
+					
+					reinjection        = list(chip.router.reinjection)
 				else:
 					dropped         = sentinel
 					forwarded       = sentinel
@@ -188,7 +449,8 @@ def per_chip_results( variable_fields_names, data
 					num_cores       = sentinel
 					num_sources     = sentinel
 					num_sinks       = sentinel
-					
+					num_router_entries = sentinel
+					reinjection     = [sentinel] * 8 # The reinject_* columns
 				
 				if square_off or (x,y) in results:
 					rows.append(list(free_variables) + [ x
@@ -202,16 +464,65 @@ def per_chip_results( variable_fields_names, data
 					                                   , num_sources
 					                                   , num_sinks
 					                                   , num_router_entries
-					                                   ])
+					                                   ] + reinjection)
 			
 			# Add blank lines after each row for gnuplot compatibility
 			if gnuplot_comaptible:
 				rows.append(None)
 	
-	return tsv(column_names, rows)
+	if writer is None:
+		return tsv(column_names, rows)
+	writer.finish()
 
 
-def per_core_results(variable_fields_names, data):
+def router_counter_results(variable_fields_names, data, writer = None):
+	"""
+	Produces TSV formatted, GNUplot compatible data files given a set of results.
+	For each result, a row will be printed for each router diagnostic counter of
+	each chip (see NetworkExperiment.router_counters).
+	
+	variable_fields_names is a list which maps the index of the free
+	variable columns to a name string.
+	
+	data is an iterable which contains one tuple for each experemental run. The
+	tuple is of the form (var0,var1,...,varN, results) where var0-N are arbitary
+	values representing the free-variable values for a given run of the
+	experiment. The final value in the tuple must be the results object to be
+	produced.
+	
+	If a writer (e.g. a TSVWriter or ColumnWriter) is given, each row is passed
+	to it as it is produced and nothing is returned. Otherwise the TSV data is
+	returned as a string.
+	"""
+	
+	column_names = list(variable_fields_names) + [ "x"
+	                                             , "y"
+	                                             , "counter"
+	                                             , "count"
+	                                             ]
+	
+	rows = [] if writer is None else writer.start(column_names)
+	for datum in data:
+		assert len(datum) == len(variable_fields_names) + 1\
+		     , "Must have the same number of variables as variable field names."
+		
+		free_variables = datum[:-1]
+		results        = datum[-1]
+		
+		for (x,y), chip in sorted(results.iteritems()):
+			for name, count in sorted(chip.router.counters.iteritems()):
+				rows.append(list(free_variables) + [ x
+				                                   , y
+				                                   , name
+				                                   , count
+				                                   ])
+	
+	if writer is None:
+		return tsv(column_names, rows)
+	writer.finish()
+
+
+def per_core_results(variable_fields_names, data, writer = None):
 	"""
 	Produces TSV formatted, GNUplot compatible data files given a set of results.
 	For each result, a row will be printed for each core.
@@ -224,6 +535,10 @@ def per_core_results(variable_fields_names, data):
 	values representing the free-variable values for a given run of the
 	experiment. The final value in the tuple must be the results object to be
 	produced.
+	
+	If a writer (e.g. a TSVWriter or ColumnWriter) is given, each row is passed
+	to it as it is produced and nothing is returned. Otherwise the TSV data is
+	returned as a string.
 	"""
 	
 	column_names = list(variable_fields_names) + [ "x"
@@ -234,9 +549,14 @@ def per_core_results(variable_fields_names, data):
 	                                             , "total_arrived"
 	                                             , "num_sources"
 	                                             , "num_sinks"
+	                                             , "load_time"
+	                                             , "store_time"
+	                                             , "tx_queue_max_depth"
+	                                             , "total_deferred"
+	                                             , "total_discarded"
 	                                             ]
 	
-	rows = []
+	rows = [] if writer is None else writer.start(column_names)
 	for datum in data:
 		assert len(datum) == len(variable_fields_names) + 1\
 		     , "Must have the same number of variables as variable field names."
@@ -251,6 +571,8 @@ def per_core_results(variable_fields_names, data):
 				# Calculate chip-wide information
 				total_generated    = sum(source.packets_generated for source in core.sources.itervalues())
 				total_sent         = sum(source.packets_sent for source in core.sources.itervalues())
+				total_deferred     = sum(source.packets_deferred for source in core.sources.itervalues())
+				total_discarded    = sum(source.packets_discarded for source in core.sources.itervalues())
 				
 				total_arrived      = sum(sink.packets_arrived for sink in core.sinks.itervalues())
 				
@@ -265,12 +587,19 @@ def per_core_results(variable_fields_names, data):
 				                                   , total_arrived
 				                                   , num_sources
 				                                   , num_sinks
+				                                   , core.load_time
+				                                   , core.store_time
+				                                   , core.tx_queue_max_depth
+				                                   , total_deferred
+				                                   , total_discarded
 				                                   ])
 	
-	return tsv(column_names, rows)
+	if writer is None:
+		return tsv(column_names, rows)
+	writer.finish()
 
 
-def per_stream_results(variable_fields_names, data):
+def per_stream_results(variable_fields_names, data, writer = None):
 	"""
 	Produces TSV formatted, GNUplot compatible data files given a set of results.
 	For each result, a row will be printed for each stream (i.e. routing key).
@@ -283,6 +612,10 @@ def per_stream_results(variable_fields_names, data):
 	values representing the free-variable values for a given run of the
 	experiment. The final value in the tuple must be the results object to be
 	produced.
+	
+	If a writer (e.g. a TSVWriter or ColumnWriter) is given, each row is passed
+	to it as it is produced and nothing is returned. Otherwise the TSV data is
+	returned as a string.
 	"""
 	
 	column_names = list(variable_fields_names) + [ "routing_key"
@@ -291,9 +624,14 @@ def per_stream_results(variable_fields_names, data):
 	                                             , "total_arrived"
 	                                             , "num_sources"
 	                                             , "num_sinks"
+	                                             , "latency_p50"
+	                                             , "latency_p90"
+	                                             , "latency_p99"
+	                                             , "total_deferred"
+	                                             , "total_discarded"
 	                                             ]
 	
-	rows = []
+	rows = [] if writer is None else writer.start(column_names)
 	for datum in data:
 		assert len(datum) == len(variable_fields_names) + 1\
 		     , "Must have the same number of variables as variable field names."
@@ -315,6 +653,8 @@ def per_stream_results(variable_fields_names, data):
 				# Calculate chip-wide information
 				total_generated    = sum(source.packets_generated for source in sources)
 				total_sent         = sum(source.packets_sent for source in sources)
+				total_deferred     = sum(source.packets_deferred for source in sources)
+				total_discarded    = sum(source.packets_discarded for source in sources)
 				
 				total_arrived      = sum(sink.packets_arrived for sink in sinks)
 				
@@ -327,6 +667,74 @@ def per_stream_results(variable_fields_names, data):
 				                                   , total_arrived
 				                                   , num_sources
 				                                   , num_sinks
+				                                   , latency_percentile(sinks, 50)
+				                                   , latency_percentile(sinks, 90)
+				                                   , latency_percentile(sinks, 99)
+				                                   , total_deferred
+				                                   , total_discarded
 				                                   ])
 	
-	return tsv(column_names, rows)
+	if writer is None:
+		return tsv(column_names, rows)
+	writer.finish()
+
+
+def per_core_time_series(variable_fields_names, data, writer = None):
+	"""
+	Produces TSV formatted, GNUplot compatible data files given a set of results.
+	For each result, a row will be printed for each sample taken by each core
+	(see NetworkExperiment.sample_interval) in order of time, with a blank line
+	between cores. Counters are cumulative since the end of the warmup.
+	
+	variable_fields_names is a list which maps the index of the free
+	variable columns to a name string.
+	
+	data is an iterable which contains one tuple for each experemental run. The
+	tuple is of the form (var0,var1,...,varN, results) where var0-N are arbitary
+	values representing the free-variable values for a given run of the
+	experiment. The final value in the tuple must be the results object to be
+	produced.
+	
+	If a writer (e.g. a TSVWriter or ColumnWriter) is given, each row is passed
+	to it as it is produced and nothing is returned. Otherwise the TSV data is
+	returned as a string.
+	"""
+	
+	column_names = list(variable_fields_names) + [ "x"
+	                                             , "y"
+	                                             , "core_id"
+	                                             , "tick"
+	                                             , "forwarded"
+	                                             , "dropped"
+	                                             , "total_sent"
+	                                             , "total_arrived"
+	                                             ]
+	
+	rows = [] if writer is None else writer.start(column_names)
+	for datum in data:
+		assert len(datum) == len(variable_fields_names) + 1\
+		     , "Must have the same number of variables as variable field names."
+		
+		free_variables = datum[:-1]
+		results        = datum[-1]
+		
+		for (x,y), chip in results.iteritems():
+			for core_id, core in chip.cores.iteritems():
+				if not core.samples:
+					continue
+				
+				for sample in core.samples:
+					rows.append(list(free_variables) + [ x
+					                                   , y
+					                                   , core_id
+					                                   , sample.tick
+					                                   , sample.forwarded_packets
+					                                   , sample.dropped_packets
+					                                   , sum(sample.packets_sent.itervalues())
+					                                   , sum(sample.packets_arrived.itervalues())
+					                                   ])
+				rows.append(None)
+	
+	if writer is None:
+		return tsv(column_names, rows)
+	writer.finish()
@@ -0,0 +1,175 @@
+#!/usr/bin/env python
+
+"""
+Minimisation of SpiNNaker multicast routing tables.
+
+A router table is a list of entries (key, mask, route) searched in order: a
+packet takes the route of the first entry for which (packet_key & mask) == key.
+Packets matching no entry are default routed (sent straight through the chip
+when they arrived on a link, dropped when sent by a local core).
+
+Since add_stream allocates routing keys sequentially, the tables generated for
+an experiment contain runs of entries with consecutive keys sharing a route,
+which can be merged into a single key/mask entry. The minimiser only guarantees
+that the routing of a given set of keys (i.e. every key the experiment sends)
+is preserved: any other key may be routed differently. This freedom allows
+entries to cover the keys in between those which are actually used.
+
+The minimised table is built from the binary trie of the keys. Each subtree
+(the keys sharing a prefix) is either covered by one entry with its most common
+route (placed after the entries its exceptions need, so they take priority) or
+left to its children. A subtree containing a default-routed key is never
+covered. The choice which gives the fewest entries is made for every subtree,
+given the route of the entry covering it, if any.
+"""
+
+import bisect
+
+from collections import defaultdict
+
+from spinn_test_driver import spinnaker_app
+
+
+def unpack_entries(num_entries, data):
+	"""
+	Unpack a packed routing table into a list of config_router_entry_tuple.
+	"""
+	return [ spinnaker_app.config_router_entry_tuple(*entry)
+	         for entry in spinnaker_app.unpack_array( spinnaker_app.config_router_entry_t
+	                                                , num_entries, data
+	                                                )
+	       ]
+
+
+def pack_entries(entries):
+	"""
+	Pack a list of config_router_entry_tuple into a routing table.
+	"""
+	return "".join(spinnaker_app.config_router_entry_t.pack(*entry) for entry in entries)
+
+
+def routes_of(entries, keys):
+	"""
+	Look up each of a list of keys in a routing table returning a list giving the
+	route of each or None if it would be default routed.
+	"""
+	# Entries grouped by mask {mask: {key: (index, route), ...}, ...} with only the
+	# first of any duplicate entries kept.
+	by_mask = defaultdict(dict)
+	for index, entry in enumerate(entries):
+		by_mask[entry.mask].setdefault(entry.key, (index, entry.route))
+	
+	routes = []
+	for key in keys:
+		matches = [ match
+		            for match in (table.get(key & mask) for mask, table in by_mask.iteritems())
+		            if match is not None
+		          ]
+		routes.append(min(matches)[1] if matches else None)
+	return routes
+
+
+def _prefix_mask(a, b):
+	"""
+	The mask of the longest common prefix of two 32-bit keys.
+	"""
+	return ~((1 << (a ^ b).bit_length()) - 1) & 0xFFFFFFFF
+
+
+def minimise(entries, keys):
+	"""
+	Minimise a routing table (a list of config_router_entry_tuple) preserving the
+	routing of every key given. Returns a (possibly) shorter list of
+	config_router_entry_tuple which is never longer than the original.
+	"""
+	keys   = sorted(set(keys))
+	routes = routes_of(entries, keys)
+	
+	# Split the subtree of the trie keys[lo:hi] into its two children, returning
+	# the index where the keys with the bit after their common prefix set begin.
+	def split(lo, hi):
+		mask = _prefix_mask(keys[lo], keys[hi-1])
+		bit  = (~mask & 0xFFFFFFFF).bit_length() - 1
+		return bisect.bisect_left(keys, (keys[lo] & mask) | (1 << bit), lo, hi)
+	
+	# The most common route in the subtree keys[lo:hi] (or None if any key in it
+	# is default routed) and the number of keys taking each route.
+	majorities = {}
+	def majority(lo, hi):
+		if (lo, hi) not in majorities:
+			if hi - lo == 1:
+				majorities[(lo, hi)] = (routes[lo], {routes[lo]: 1})
+			else:
+				mid = split(lo, hi)
+				counts = dict(majority(lo, mid)[1])
+				for route, count in majority(mid, hi)[1].iteritems():
+					counts[route] = counts.get(route, 0) + count
+				if None in counts:
+					majorities[(lo, hi)] = (None, counts)
+				else:
+					majorities[(lo, hi)] = (max(counts, key = lambda r: (counts[r], r)), counts)
+		return majorities[(lo, hi)]
+	
+	# {(lo, hi, background): (num_entries, covering_route), ...} where background
+	# is the route of the entry covering the subtree (if any) and covering_route
+	# that of the entry chosen to cover it (or None).
+	costs = {}
+	def cost(lo, hi, background):
+		if (lo, hi, background) in costs:
+			return costs[(lo, hi, background)][0]
+		
+		if hi - lo == 1:
+			# A single key needs its own entry unless it is already routed by the
+			# covering entry
+			best = (0 if routes[lo] == background else 1, None)
+		else:
+			mid = split(lo, hi)
+			best = (cost(lo, mid, background) + cost(mid, hi, background), None)
+			
+			route = majority(lo, hi)[0]
+			if route is not None and route != background:
+				best = min(best, (1 + cost(lo, mid, route) + cost(mid, hi, route), route))
+		
+		costs[(lo, hi, background)] = best
+		return best[0]
+	
+	def build(lo, hi, background, out):
+		_, route = costs[(lo, hi, background)]
+		if hi - lo == 1:
+			if routes[lo] != background:
+				out.append(spinnaker_app.config_router_entry_tuple( key   = keys[lo]
+				                                                  , mask  = 0xFFFFFFFF
+				                                                  , route = routes[lo]
+				                                                  ))
+		else:
+			mid = split(lo, hi)
+			build(lo, mid, background if route is None else route, out)
+			build(mid, hi, background if route is None else route, out)
+			if route is not None:
+				mask = _prefix_mask(keys[lo], keys[hi-1])
+				out.append(spinnaker_app.config_router_entry_tuple( key   = keys[lo] & mask
+				                                                  , mask  = mask
+				                                                  , route = route
+				                                                  ))
+	
+	if not keys:
+		return entries
+	
+	cost(0, len(keys), None)
+	minimised = []
+	build(0, len(keys), None, minimised)
+	
+	return minimised if len(minimised) < len(entries) else entries
+
+
+def verify(entries, minimised, keys):
+	"""
+	Check that a minimised routing table routes every key given exactly as the
+	original, raising an Exception if not.
+	"""
+	keys = sorted(set(keys))
+	for key, route, minimised_route in zip(keys, routes_of(entries, keys), routes_of(minimised, keys)):
+		if route != minimised_route:
+			raise Exception("Minimised routing table routes key 0x%08x to %s rather than %s."%(
+				key, minimised_route, route
+			))
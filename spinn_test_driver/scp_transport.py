@@ -0,0 +1,356 @@
+#!/usr/bin/env python
+
+"""
+A concurrent SCP transport for bulk memory reads and writes.
+
+Every request sent by pacman103.scp.SCPConnection is a blocking round trip and
+a whole machine is loaded (and read back) one chip at a time. This transport
+instead keeps a window of requests in flight on each of its channels (UDP
+sockets) and runs per-chip work on a pool of worker threads, each with its own
+channel. Requests which time out (or are refused by a busy chip) are re-sent
+together once the rest of the batch has been given a chance to complete rather
+than each being retried after a sleep.
+"""
+
+import time
+import socket
+import struct
+import threading
+
+from collections import deque
+
+from multiprocessing.pool import ThreadPool
+
+
+################################################################################
+# Protocol definitions
+################################################################################
+
+# UDP port SC&MP listens for SDP packets on
+SCP_PORT = 17893
+
+# SCP commands
+CMD_VER   = 0
+CMD_READ  = 2
+CMD_WRITE = 3
+
+# Access types for read and write commands
+TYPE_BYTE  = 0
+TYPE_SHORT = 1
+TYPE_WORD  = 2
+
+# SCP return codes
+RC_OK          = 0x80
+RC_LEN         = 0x81
+RC_SUM         = 0x82
+RC_CMD         = 0x83
+RC_ARG         = 0x84
+RC_PORT        = 0x85
+RC_TIMEOUT     = 0x86
+RC_ROUTE       = 0x87
+RC_CPU         = 0x88
+RC_DEAD        = 0x89
+RC_BUF         = 0x8A
+RC_P2P_NOREPLY = 0x8B
+RC_P2P_REJECT  = 0x8C
+RC_P2P_BUSY    = 0x8D
+RC_P2P_TIMEOUT = 0x8E
+RC_PKT_TX      = 0x8F
+
+# Return codes which indicate a request may succeed if simply sent again
+TRANSIENT_RCS = frozenset(( RC_TIMEOUT
+                          , RC_P2P_NOREPLY
+                          , RC_P2P_REJECT
+                          , RC_P2P_BUSY
+                          , RC_P2P_TIMEOUT
+                          , RC_PKT_TX
+                          ))
+
+# Maximum number of bytes of data carried by a single SCP packet
+SCP_DATA_LENGTH = 256
+
+# Two bytes of padding followed by the SDP header
+sdp_header_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                              "2x" # Padding
+                              "B"  # flags
+                              "B"  # tag
+                              "B"  # dest_port_cpu
+                              "B"  # srce_port_cpu
+                              "B"  # dest_y
+                              "B"  # dest_x
+                              "B"  # srce_y
+                              "B"  # srce_x
+                            )
+
+# The SCP header of a request
+scp_request_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                               "H" # cmd_rc
+                               "H" # seq
+                               "I" # arg1
+                               "I" # arg2
+                               "I" # arg3
+                             )
+
+# The SCP header of a response (any arguments are returned as data)
+scp_response_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                                "H" # cmd_rc
+                                "H" # seq
+                              )
+
+# SDP flags for a request which expects a reply and the tag used for replies to
+# the host.
+SDP_FLAGS_REPLY = 0x87
+SDP_TAG_REPLY   = 0xFF
+
+
+class SCPError(Exception):
+	"""
+	Exception thrown when a chip rejects a request or does not respond to it.
+	"""
+	def __init__(self, msg, rc = None):
+		Exception.__init__(self, msg)
+		self.rc = rc
+
+
+################################################################################
+# Channels
+################################################################################
+
+class _Channel(object):
+	"""
+	A UDP socket over which a window of SCP requests may be in flight at once.
+	Channels are not thread safe: each worker thread uses its own.
+	"""
+	
+	def __init__(self, address, window, timeout, retries):
+		self.address = address
+		self.window  = window
+		self.timeout = timeout
+		self.retries = retries
+		
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.sock.connect(address)
+		
+		self._next_seq = 0
+	
+	
+	def close(self):
+		self.sock.close()
+	
+	
+	def _pack(self, seq, request):
+		(x,y,p), cmd, arg1, arg2, arg3, data = request
+		return ( sdp_header_t.pack( SDP_FLAGS_REPLY, SDP_TAG_REPLY
+		                          , p & 0x1F, 0xFF
+		                          , y, x, 0, 0
+		                          )
+		       + scp_request_t.pack(cmd, seq, arg1, arg2, arg3)
+		       + data
+		       )
+	
+	
+	def transact(self, requests):
+		"""
+		Send a list of requests, each a tuple ((x,y,p), cmd, arg1, arg2, arg3, data),
+		keeping up to self.window in flight at once. Returns a list of the data
+		returned by each (in the same order).
+		
+		Requests which time out or receive a transient error are re-sent (with a
+		fresh sequence number so late replies to earlier attempts are ignored)
+		once the window has drained. An SCPError is raised if any request
+		receives a non-transient error or exhausts its retries.
+		"""
+		responses = [None] * len(requests)
+		attempts  = [0] * len(requests)
+		
+		# Indices of requests waiting to be sent and those which must be re-sent
+		pending = deque(xrange(len(requests)))
+		retry   = []
+		
+		# {seq: (index, deadline), ...}
+		in_flight = {}
+		
+		while pending or retry or in_flight:
+			# Re-send failed requests in a batch once nothing else is outstanding
+			if not pending and not in_flight:
+				pending.extend(retry)
+				del retry[:]
+			
+			# Fill the window
+			while pending and len(in_flight) < self.window:
+				index = pending.popleft()
+				if attempts[index] > self.retries:
+					(x,y,p), cmd = requests[index][:2]
+					raise SCPError("No response to command %d from %d,%d:%d after %d attempts."%(
+						cmd, x, y, p, attempts[index]
+					))
+				attempts[index] += 1
+				
+				seq = self._next_seq
+				self._next_seq = (self._next_seq + 1) & 0xFFFF
+				
+				self.sock.send(self._pack(seq, requests[index]))
+				in_flight[seq] = (index, time.time() + self.timeout)
+			
+			# Wait for the next response
+			now = time.time()
+			self.sock.settimeout(max(0.0, min(d for _, d in in_flight.itervalues()) - now))
+			try:
+				packet = self.sock.recv(65536)
+			except socket.timeout:
+				packet = None
+			except socket.error:
+				# E.g. ICMP port unreachable: treat as a lost packet
+				packet = None
+			
+			if packet is not None and len(packet) >= sdp_header_t.size + scp_response_t.size:
+				rc, seq = scp_response_t.unpack_from(packet, sdp_header_t.size)
+				if seq in in_flight:
+					index, _ = in_flight.pop(seq)
+					if rc == RC_OK:
+						responses[index] = packet[sdp_header_t.size + scp_response_t.size:]
+					elif rc in TRANSIENT_RCS:
+						retry.append(index)
+					else:
+						(x,y,p), cmd = requests[index][:2]
+						raise SCPError("Command %d to %d,%d:%d failed with RC 0x%02X."%(
+							cmd, x, y, p, rc
+						), rc)
+			
+			# Expire any requests which have passed their deadline
+			now = time.time()
+			for seq, (index, deadline) in in_flight.items():
+				if deadline <= now:
+					del in_flight[seq]
+					retry.append(index)
+		
+		return responses
+
+
+################################################################################
+# Transport
+################################################################################
+
+class SCPTransport(object):
+	"""
+	A pool of channels to a SpiNNaker machine's Ethernet-attached chip.
+	"""
+	
+	def __init__( self, hostname, port = SCP_PORT
+	            , num_workers = 8, window = 4, timeout = 0.5, retries = 10
+	            ):
+		"""
+		num_workers threads (each with its own channel) are used to execute
+		functions passed to map(). Each channel keeps up to window requests in
+		flight, waits timeout seconds for each response and re-sends a request at
+		most retries times.
+		"""
+		self.address = (socket.gethostbyname(hostname), port)
+		
+		self.num_workers = num_workers
+		self.window      = window
+		self.timeout     = timeout
+		self.retries     = retries
+		
+		self._local = threading.local()
+		
+		# All channels opened (by any thread)
+		self._channels      = []
+		self._channels_lock = threading.Lock()
+		
+		self._pool = None
+	
+	
+	def _channel(self):
+		"""
+		Get the calling thread's channel.
+		"""
+		channel = getattr(self._local, "channel", None)
+		if channel is None:
+			channel = _Channel(self.address, self.window, self.timeout, self.retries)
+			self._local.channel = channel
+			with self._channels_lock:
+				self._channels.append(channel)
+		return channel
+	
+	
+	def close(self):
+		if self._pool is not None:
+			self._pool.close()
+			self._pool.join()
+			self._pool = None
+		with self._channels_lock:
+			for channel in self._channels:
+				channel.close()
+			del self._channels[:]
+		self._local = threading.local()
+	
+	
+	def map(self, f, iterable):
+		"""
+		Call f on every item of iterable using the worker pool, returning the list
+		of results. Typically each item is a chip so that every chip's requests are
+		issued concurrently.
+		"""
+		if self._pool is None:
+			self._pool = ThreadPool(self.num_workers)
+		
+		# map_async followed by get with a timeout allows KeyboardInterrupts to
+		# reach the main thread.
+		return self._pool.map_async(f, list(iterable)).get(1e9)
+	
+	
+	def version(self, coords):
+		"""
+		Request the version of the software running on the core coords (x,y,p).
+		Returns the raw response data.
+		"""
+		return self._channel().transact([(coords, CMD_VER, 0, 0, 0, "")])[0]
+	
+	
+	def read_mem(self, coords, addr, length):
+		"""
+		Read length bytes from addr via the core coords (x,y,p), every chunk of the
+		read being in flight at once.
+		"""
+		requests = []
+		for offset in xrange(0, length, SCP_DATA_LENGTH):
+			chunk_length = min(SCP_DATA_LENGTH, length - offset)
+			requests.append((coords, CMD_READ, addr + offset, chunk_length, TYPE_BYTE, ""))
+		return "".join(self._channel().transact(requests))
+	
+	
+	def read_mems(self, coords, reads):
+		"""
+		Perform a list of reads [(addr, length), ...] via the core coords (x,y,p) in
+		a single batch, returning a list of the data read.
+		"""
+		requests = []
+		for addr, length in reads:
+			for offset in xrange(0, length, SCP_DATA_LENGTH):
+				chunk_length = min(SCP_DATA_LENGTH, length - offset)
+				requests.append((coords, CMD_READ, addr + offset, chunk_length, TYPE_BYTE, ""))
+		responses = self._channel().transact(requests)
+		
+		data = []
+		for addr, length in reads:
+			num_chunks = (length + SCP_DATA_LENGTH - 1) // SCP_DATA_LENGTH
+			data.append("".join(responses[:num_chunks]))
+			responses = responses[num_chunks:]
+		return data
+	
+	
+	def write_mem(self, coords, addr, data):
+		"""
+		Write data to addr via the core coords (x,y,p), every chunk of the write
+		being in flight at once. Word-aligned chunks are written as words.
+		"""
+		requests = []
+		for offset in xrange(0, len(data), SCP_DATA_LENGTH):
+			chunk = data[offset:offset + SCP_DATA_LENGTH]
+			if (addr + offset) % 4 == 0 and len(chunk) % 4 == 0:
+				access_type = TYPE_WORD
+			else:
+				access_type = TYPE_BYTE
+			requests.append((coords, CMD_WRITE, addr + offset, len(chunk), access_type, chunk))
+		self._channel().transact(requests)
@@ -0,0 +1,179 @@
+#!/usr/bin/env python
+
+"""
+Runs experiments on a host-native discrete-event simulator of the SpiNNaker
+network (spinnaker_app/host/netsim.c, built with "make -C spinnaker_app sim")
+instead of a machine.
+
+The simulator takes exactly the SDRAM image the host would load onto each chip
+and gives it back with the results in place, just as the application leaves
+them. A SimulatorTransport stands in for the SCP transport: writes build up each
+chip's image in memory, run() passes the images through the simulator and reads
+are then answered from the images it returns.
+
+Images are passed to and from the simulator in a file consisting of
+image_header_t followed, for each chip, by an image_chip_t and the chip's image
+(its SDRAM from SDRAM_BASE_UNBUF).
+"""
+
+import os
+import shutil
+import struct
+import tempfile
+import subprocess
+
+from spinn_test_driver import spinnaker_app
+
+
+################################################################################
+# Image files
+################################################################################
+
+IMAGE_MAGIC = "SPNTDIMG"
+
+image_header_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                                "8s" # magic
+                                "I"  # num_chips
+                              )
+
+image_chip_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                              "I" # x
+                              "I" # y
+                              "I" # length
+                            )
+
+
+def write_images(f, images):
+	"""
+	Write a dict {(x,y): image, ...} to the file f.
+	"""
+	f.write(image_header_t.pack(IMAGE_MAGIC, len(images)))
+	for (x,y), image in sorted(images.iteritems()):
+		f.write(image_chip_t.pack(x, y, len(image)))
+		f.write(image)
+
+
+def read_images(f):
+	"""
+	Read a dict {(x,y): bytearray, ...} from the file f.
+	"""
+	magic, num_chips = image_header_t.unpack(f.read(image_header_t.size))
+	if magic != IMAGE_MAGIC:
+		raise Exception("Not a simulator image file.")
+	
+	images = {}
+	for _ in range(num_chips):
+		x, y, length = image_chip_t.unpack(f.read(image_chip_t.size))
+		images[(x,y)] = bytearray(f.read(length))
+		if len(images[(x,y)]) != length:
+			raise Exception("Simulator image file is truncated.")
+	return images
+
+
+################################################################################
+# Transport
+################################################################################
+
+class SimulatorTransport(object):
+	"""
+	A stand-in for scp_transport.SCPTransport whose chips' memory is the SDRAM
+	images given to the simulator.
+	"""
+	
+	def __init__(self, simulator = spinnaker_app.SPINNAKER_APP_SIM, threads = None, options = ()):
+		"""
+		simulator is the path of the simulator, threads the number of host threads
+		it uses (default: one per CPU) and options a list of any further command
+		line options (e.g. to change its timing parameters).
+		"""
+		self.simulator = simulator
+		self.threads   = threads
+		self.options   = list(options)
+		
+		# {(x,y): bytearray, ...}
+		self._images = {}
+	
+	
+	def close(self):
+		self._images.clear()
+	
+	
+	def map(self, f, iterable):
+		"""
+		Call f on every item of iterable in turn (the memory of every chip is
+		local).
+		"""
+		return map(f, iterable)
+	
+	
+	def _offset(self, addr, length):
+		"""
+		Get the offset of an SDRAM address in a chip's image.
+		"""
+		offset = addr - spinnaker_app.SDRAM_BASE_UNBUF
+		if offset < 0 or length < 0:
+			raise ValueError("Address 0x%08X is not in SDRAM."%addr)
+		return offset
+	
+	
+	def reserve(self, coords, addr, length):
+		"""
+		Make sure a chip's image covers length bytes from addr (i.e. space the
+		application writes results into but the host doesn't load).
+		"""
+		x, y = coords[:2]
+		offset = self._offset(addr, length)
+		image = self._images.setdefault((x,y), bytearray())
+		if len(image) < offset + length:
+			image.extend("\0" * (offset + length - len(image)))
+	
+	
+	def version(self, coords):
+		return "netsim"
+	
+	
+	def write_mem(self, coords, addr, data):
+		x, y = coords[:2]
+		offset = self._offset(addr, len(data))
+		self.reserve(coords, addr, len(data))
+		self._images[(x,y)][offset:offset + len(data)] = data
+	
+	
+	def read_mem(self, coords, addr, length):
+		x, y = coords[:2]
+		offset = self._offset(addr, length)
+		data = str(self._images.get((x,y), bytearray())[offset:offset + length])
+		return data.ljust(length, "\0")
+	
+	
+	def read_mems(self, coords, reads):
+		return [self.read_mem(coords, addr, length) for addr, length in reads]
+	
+	
+	def run(self):
+		"""
+		Run the simulator on the chips' images, replacing them with those it
+		returns.
+		"""
+		if not os.path.exists(self.simulator):
+			raise Exception("The simulator (%s) has not been built: run \"make -C spinnaker_app sim\"."%(
+				self.simulator
+			))
+		
+		temp_dir = tempfile.mkdtemp(prefix = "spinn_test_driver_sim")
+		try:
+			input_filename  = os.path.join(temp_dir, "input")
+			output_filename = os.path.join(temp_dir, "output")
+			with open(input_filename, "wb") as f:
+				write_images(f, self._images)
+			
+			command = [self.simulator]
+			if self.threads:
+				command += ["-t", str(self.threads)]
+			command += self.options + [input_filename, output_filename]
+			subprocess.check_call(command)
+			
+			with open(output_filename, "rb") as f:
+				self._images = read_images(f)
+		finally:
+			shutil.rmtree(temp_dir)
@@ -6,6 +6,7 @@ the SpiNNaker-based test driver program.
 """
 
 import os
+import math
 import struct
 
 from collections import namedtuple
@@ -22,14 +23,118 @@ def _union(*member_definitions):
 
 # Values for the enum temporal_dist in config_source_t.
 TEMPORAL_DIST_BERNOULLI = 0
+TEMPORAL_DIST_POISSON   = 1
+TEMPORAL_DIST_ON_OFF    = 2
+TEMPORAL_DIST_PERIODIC  = 3
+TEMPORAL_DIST_TRACE     = 4
 
 # Maximum number of source/sink structures per core. Used to statically allocate
-# sufficient memory for these structures in a core's RAM.
+# sufficient memory for these structures in a core's RAM. These are the limits of
+# the generic build: role-specialised builds have their own (see APP_VARIANTS).
 MAX_SOURCES_PER_CORE = 256
 MAX_SINKS_PER_CORE   = 256
-MAX_ROUTES_PER_CORE  = 1000
 MAX_DIMENSION_SIZE   = 24
 
+# Maximum number of router entries per chip: the router's multicast table
+# entries available to applications (one is reserved by the system).
+MAX_ROUTER_ENTRIES = 1023
+
+# Bits of a router entry's route: links 0-5 (east, north-east, north, west,
+# south-west, south) followed by the cores.
+NUM_LINKS = 6
+
+def route_link(link):
+	return 1 << link
+
+def route_core(core_id):
+	return 1 << (NUM_LINKS + core_id)
+
+# Number of bins in each sink's latency histogram (the last also counts longer
+# latencies) and the maximum number of sinks per core when measuring latency.
+LATENCY_HISTOGRAM_BINS     = 16
+MAX_LATENCY_SINKS_PER_CORE = 64
+
+# Number of bins in the histograms of the time taken by the timer tick and packet
+# arrival callbacks. Bin n counts callbacks taking [2**n, 2**(n+1)) times
+# 2**CALLBACK_HISTOGRAM_SHIFT CPU cycles (the first also counts shorter callbacks
+# and the last longer ones).
+CALLBACK_HISTOGRAM_BINS  = 16
+CALLBACK_HISTOGRAM_SHIFT = 6
+
+# Bits of the flags field of config_root
+CONFIG_FLAG_LATENCY  = 1<<0
+CONFIG_FLAG_SEARCH   = 1<<1
+CONFIG_FLAG_REINJECT = 1<<2
+CONFIG_FLAG_LEAD     = 1<<3
+
+# Saturation search control packets: offsets of their routing keys from
+# search_control_key, the mask covering them all and the injection scale of
+# one.
+SEARCH_KEY_ARRIVED   = 0
+SEARCH_KEY_GENERATED = 1
+SEARCH_KEY_DROPPED   = 2
+SEARCH_KEY_FORWARDED = 3
+SEARCH_KEY_SCALE     = 4
+SEARCH_KEY_MASK      = ~7 & 0xFFFFFFFF
+SEARCH_SCALE_ONE     = 1<<16
+
+# Number of the router's diagnostic counters and the counters reported as the
+# packets forwarded and dropped by the router.
+NUM_ROUTER_COUNTERS = 16
+FWD_CNTR            = 12
+DRP_CNTR            = 13
+
+# Fields of a router diagnostic counter filter (RTR_DGFn, see the SpiNNaker
+# datasheet): a packet is counted if, for every field, a bit describing it is
+# set.
+COUNTER_TYPE_MC         = 1<<0
+COUNTER_TYPE_P2P        = 1<<1
+COUNTER_TYPE_NN         = 1<<2
+COUNTER_TYPE_FR         = 1<<3
+COUNTER_ER_NORMAL       = 1<<4 # Emergency routing field of the packet: 0-3
+COUNTER_ER_FIRST_STAGE  = 1<<5
+COUNTER_ER_SECOND_STAGE = 1<<6
+COUNTER_ER_RESERVED     = 1<<7
+COUNTER_ER_OUTGOING     = 1<<8 # Match the field of outgoing (not incoming) packets
+COUNTER_NON_DEFAULT     = 1<<10
+COUNTER_DEFAULT         = 1<<11
+COUNTER_NO_PAYLOAD      = 1<<12
+COUNTER_PAYLOAD         = 1<<13
+COUNTER_LOCAL           = 1<<14 # Sent by a core of this chip
+COUNTER_EXTERNAL        = 1<<15 # Arrived over a link
+COUNTER_DEST_DROPPED    = 1<<16
+COUNTER_DEST_CORE       = 1<<17
+COUNTER_DEST_MONITOR    = 1<<18
+COUNTER_DEST_LINK_0     = 1<<19 # Links 0-5 in successive bits
+
+def counter_dest_link(link):
+	return COUNTER_DEST_LINK_0 << link
+
+COUNTER_TYPE_ALL   = 0xF<<0 
+COUNTER_ER_ALL     = 0xF<<4
+COUNTER_DEF_ALL    = COUNTER_NON_DEFAULT | COUNTER_DEFAULT
+COUNTER_PL_ALL     = COUNTER_NO_PAYLOAD  | COUNTER_PAYLOAD
+COUNTER_LOC_ALL    = COUNTER_LOCAL       | COUNTER_EXTERNAL
+COUNTER_DEST_LINKS = 0x3F<<19
+
+def counter_filter( types   = COUNTER_TYPE_MC
+                  , er      = COUNTER_ER_ALL
+                  , default = COUNTER_DEF_ALL
+                  , payload = COUNTER_PL_ALL
+                  , loc     = COUNTER_LOC_ALL
+                  , dest    = COUNTER_DEST_LINKS | COUNTER_DEST_CORE
+                  ):
+	"""
+	Build a router diagnostic counter filter from each of its fields (given as
+	the bitwise OR of the COUNTER_* bits matched). By default, multicast packets
+	routed anywhere but dropped are counted.
+	"""
+	return types | er | default | payload | loc | dest
+
+# Number of cores on a chip (including the monitor), each of which has an entry
+# in the configuration directory.
+MAX_CORES_PER_CHIP = 18
+
 # Allowable values of completion_state
 COMPLETION_STATE_RUNNING  = 0
 COMPLETION_STATE_SUCCESS  = 1
@@ -42,6 +147,67 @@ completion_state_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-
                                   )
 
 
+# The aggregate completion of a chip's cores (without the per-core reports which
+# follow it)
+chip_status_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                             + "I" # enum   completion_state
+                             + "I" # uint   bad_cores
+                             + "I" # uint   checksum
+                             )
+chip_status_tuple = namedtuple( "chip_status_tuple"
+                              , [ "completion_state"
+                                , "bad_cores"
+                                , "checksum"
+                                ]
+                              )
+
+# Whether each core has started (and so copied the APLX it was loaded from out
+# of SDRAM), which follows the per-core reports in the chip status
+chip_status_core_started_t = struct.Struct("<" + "I" * MAX_CORES_PER_CHIP)
+
+# The size of the whole chip_status structure including the completion state
+# and checksum reported by each core and whether each has started
+CHIP_STATUS_SIZE = ( chip_status_t.size
+                   + 2 * struct.calcsize("I") * MAX_CORES_PER_CHIP
+                   + chip_status_core_started_t.size
+                   )
+
+
+def result_checksum(data, offset = 0, length = None):
+	"""
+	The checksum recorded in result_checksum: the sum (modulo 2^32) of every word
+	of the source, sink and latency histogram results in the length bytes of
+	data starting at offset (by default, all of it).
+	"""
+	if length is None:
+		length = len(data) - offset
+	return sum(struct.unpack_from("<%dI"%(length/4), data, offset)) & 0xFFFFFFFF
+
+
+# Structs for arrays of records, built on demand: {(format, num_records): Struct, ...}
+_array_structs = {}
+
+def unpack_array(record_t, num_records, data, offset = 0):
+	"""
+	Unpack an array of num_records consecutive record_t structs from data
+	starting at offset. The whole array is unpacked by a single call without
+	copying data.
+	
+	Returns a list of tuples, one per record, of the record's fields.
+	"""
+	if num_records == 0:
+		return []
+	
+	array_t = _array_structs.get((record_t.format, num_records))
+	if array_t is None:
+		array_t = struct.Struct("<" + record_t.format.lstrip("<") * num_records)
+		_array_structs[(record_t.format, num_records)] = array_t
+	
+	values = array_t.unpack_from(data, offset)
+	num_fields = len(values) / num_records
+	return [values[i:i + num_fields] for i in xrange(0, len(values), num_fields)]
+
+
 config_root_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
                              + "I" # enum   completion_state
                              + "I" # uint   seed
@@ -50,8 +216,55 @@ config_root_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte
                              + "I" # uint   duration
                              + "H" # ushort rtr_drop_e
                              + "H" # ushort rtr_drop_m
+                             + "I" # uint   flags
+                             + "I" # uint   latency_bin_shift
+                             + "I" # uint   data_offset
+                             + "I" # uint   num_phases
+                             + "I" # uint   phases_offset
+                             + "I" # uint   drain_duration
+                             + "I" # uint   phase_results_offset
+                             + "I" # uint   sample_interval
+                             + "I" # uint   num_samples
+                             + "I" # uint   samples_offset
+                             + "I" # uint   counter_mask
+                             + "%dI"%NUM_ROUTER_COUNTERS # uint counter_filters[NUM_ROUTER_COUNTERS]
+                             + "I" # uint   search_control_key
+                             + "I" # uint   search_master
+                             + "I" # uint   search_num_reports
+                             + "I" # uint   search_initial_scale
+                             + "I" # uint   search_min_acceptance
+                             + "I" # uint   search_max_drop_rate
+                             + "I" # uint   search_report_delay
+                             + "I" # uint   search_timeout
+                             + "I" # uint   reinject_max_retries
+                             + "I" # uint   reinject_backoff
+                             + "I" # uint   reinject_queue_size
+                             + "I" # uint   result_num_samples
+                             + "I" # uint   result_samples_dropped
                              + "I" # uint   result_dropped_packets
                              + "I" # uint   result_forwarded_packets
+                             + "%dI"%NUM_ROUTER_COUNTERS # uint result_counters[NUM_ROUTER_COUNTERS]
+                             + "I" # uint   result_load_time
+                             + "I" # uint   result_store_time
+                             + "I" # uint   result_cpu_clk
+                             + "I" # uint   result_tx_queue_max_depth
+                             + "I" # uint   result_tick_overruns
+                             + "I" # uint   result_tick_max_cycles
+                             + "I" # uint   result_tick_max_latency
+                             + "I" # uint   result_ticks_elapsed
+                             + "I" # uint   result_packet_max_cycles
+                             + "%dI"%CALLBACK_HISTOGRAM_BINS # uint result_tick_histogram[CALLBACK_HISTOGRAM_BINS]
+                             + "%dI"%CALLBACK_HISTOGRAM_BINS # uint result_packet_histogram[CALLBACK_HISTOGRAM_BINS]
+                             + "I" # uint   result_search_scale
+                             + "I" # uint   result_reinject_dumped
+                             + "I" # uint   result_reinject_missed
+                             + "I" # uint   result_reinject_reinjected
+                             + "I" # uint   result_reinject_redropped
+                             + "I" # uint   result_reinject_not_redropped_locally
+                             + "I" # uint   result_reinject_abandoned
+                             + "I" # uint   result_reinject_unconfirmed
+                             + "I" # uint   result_reinject_unrouted
+                             + "I" # uint   result_checksum
                              + "I" # uint   num_sources
                              + "I" # uint   num_sinks
                              + "I" # uint   num_router_entries
@@ -64,8 +277,58 @@ config_root_tuple = namedtuple( "config_root_tuple"
                                 , "duration"
                                 , "rtr_drop_e"
                                 , "rtr_drop_m"
+                                , "flags"
+                                , "latency_bin_shift"
+                                , "data_offset"
+                                , "num_phases"
+                                , "phases_offset"
+                                , "drain_duration"
+                                , "phase_results_offset"
+                                , "sample_interval"
+                                , "num_samples"
+                                , "samples_offset"
+                                , "counter_mask"
+                                ]
+                              + [ "counter_filter_%d"%i for i in range(NUM_ROUTER_COUNTERS) ]
+                              + [ "search_control_key"
+                                , "search_master"
+                                , "search_num_reports"
+                                , "search_initial_scale"
+                                , "search_min_acceptance"
+                                , "search_max_drop_rate"
+                                , "search_report_delay"
+                                , "search_timeout"
+                                , "reinject_max_retries"
+                                , "reinject_backoff"
+                                , "reinject_queue_size"
+                                , "result_num_samples"
+                                , "result_samples_dropped"
                                 , "result_dropped_packets"
                                 , "result_forwarded_packets"
+                                ]
+                              + [ "result_counter_%d"%i for i in range(NUM_ROUTER_COUNTERS) ]
+                              + [ "result_load_time"
+                                , "result_store_time"
+                                , "result_cpu_clk"
+                                , "result_tx_queue_max_depth"
+                                , "result_tick_overruns"
+                                , "result_tick_max_cycles"
+                                , "result_tick_max_latency"
+                                , "result_ticks_elapsed"
+                                , "result_packet_max_cycles"
+                                ]
+                              + [ "result_tick_histogram_%d"%i for i in range(CALLBACK_HISTOGRAM_BINS) ]
+                              + [ "result_packet_histogram_%d"%i for i in range(CALLBACK_HISTOGRAM_BINS) ]
+                              + [ "result_search_scale"
+                                , "result_reinject_dumped"
+                                , "result_reinject_missed"
+                                , "result_reinject_reinjected"
+                                , "result_reinject_redropped"
+                                , "result_reinject_not_redropped_locally"
+                                , "result_reinject_abandoned"
+                                , "result_reinject_unconfirmed"
+                                , "result_reinject_unrouted"
+                                , "result_checksum"
                                 , "num_sources"
                                 , "num_sinks"
                                 , "num_router_entries"
@@ -73,20 +336,137 @@ config_root_tuple = namedtuple( "config_root_tuple"
                               )
 
 bernoulli_packet_prob_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
-                                       + "f" # bernoulli_packet_prob
+                                       + "I" # uint bernoulli_threshold
+                                       + "I" # uint bernoulli_interval_scale
                                        )
 bernoulli_packet_prob_tuple = namedtuple( "bernoulli_packet_prob_tuple"
-                                        , [ "bernoulli_packet_prob"
+                                        , [ "bernoulli_threshold"
+                                          , "bernoulli_interval_scale"
                                           ]
                                         )
 
+def bernoulli_threshold(probability):
+	"""
+	Returns the bernoulli_threshold for a given packet probability: the
+	probability scaled by 2^32 (saturating) which the SpiNNaker app compares
+	against a 32-bit random number.
+	"""
+	return max(0, min(int(probability * (1 << 32)), 0xFFFFFFFF))
+
+# Number of fractional bits in bernoulli_interval_scale
+BERNOULLI_INTERVAL_SCALE_BITS = 12
+
+def bernoulli_interval_scale(probability):
+	"""
+	Returns the bernoulli_interval_scale for a given packet probability: the
+	fixed-point value of 1/-log2(1-probability) which the SpiNNaker app uses to
+	draw the geometrically distributed number of ticks between packets.
+	Saturates for vanishingly small probabilities.
+	"""
+	if probability >= 1.0:
+		return 0
+	if probability <= 0.0:
+		return 0xFFFFFFFF
+	
+	scale = (1 << BERNOULLI_INTERVAL_SCALE_BITS) / (-math.log1p(-probability) / math.log(2))
+	return min(int(round(scale)), 0xFFFFFFFF)
+
+poisson_packet_rate_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                                     + "I" # uint interval_scale
+                                     )
+poisson_packet_rate_tuple = namedtuple( "poisson_packet_rate_tuple"
+                                      , [ "interval_scale"
+                                        ]
+                                      )
+
+# Number of fractional bits in poisson interval_scale
+POISSON_INTERVAL_SCALE_BITS = 16
+
+def poisson_interval_scale(rate):
+	"""
+	Returns the interval_scale for a Poisson source generating a mean of rate
+	packets per tick: the fixed-point value of ln(2)/rate which the SpiNNaker
+	app uses to draw the exponentially distributed time between packets. A rate
+	of zero (no packets) is encoded as zero; vanishingly small rates saturate.
+	"""
+	if rate <= 0.0:
+		return 0
+	
+	scale = (1 << POISSON_INTERVAL_SCALE_BITS) * math.log(2) / rate
+	return min(int(round(scale)), 0xFFFFFFFF)
+
+on_off_packet_prob_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                                    + "I" # uint threshold
+                                    + "I" # uint on_interval_scale
+                                    + "I" # uint off_interval_scale
+                                    )
+on_off_packet_prob_tuple = namedtuple( "on_off_packet_prob_tuple"
+                                     , [ "threshold"
+                                       , "on_interval_scale"
+                                       , "off_interval_scale"
+                                       ]
+                                     )
+
+periodic_packet_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                                 + "I" # uint period
+                                 + "I" # uint phase
+                                 )
+periodic_packet_tuple = namedtuple( "periodic_packet_tuple"
+                                  , [ "period"
+                                    , "phase"
+                                    ]
+                                  )
+
+trace_packet_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                              + "I" # uint offset
+                              + "I" # uint length
+                              )
+trace_packet_tuple = namedtuple( "trace_packet_tuple"
+                               , [ "offset"
+                                 , "length"
+                                 ]
+                               )
+
+def trace_pack(ticks):
+	"""
+	Encode a trace for a TEMPORAL_DIST_TRACE source. ticks is an iterable of the
+	ticks (counting from 1, the first tick of the warmup) in which a packet is
+	generated, a tick appearing once per packet. The intervals between packets
+	are encoded as unsigned LEB128 varints so that sparse traces take roughly a
+	byte per packet.
+	"""
+	out  = []
+	last = 0
+	for tick in sorted(ticks):
+		if tick < 1:
+			raise ValueError("Trace ticks must be at least 1, not %d."%tick)
+		
+		interval = tick - last
+		last     = tick
+		while interval >= 0x80:
+			out.append(chr(0x80 | (interval & 0x7F)))
+			interval >>= 7
+		out.append(chr(interval))
+	
+	return "".join(out)
+
+# union temporal_dist_data
+temporal_dist_data_t = _union( bernoulli_packet_prob_t # bernoulli
+                             , poisson_packet_rate_t   # poisson
+                             , on_off_packet_prob_t    # on_off
+                             , periodic_packet_t       # periodic
+                             , trace_packet_t          # trace
+                             )
+
 config_source_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
                                + "I" # uint routing_key
                                + "I" # enum temporal_dist
-                               + _union( bernoulli_packet_prob_t # bernoulli_packet_prob
-                                       ) # union temporal_dist_data
+                               + temporal_dist_data_t # temporal_dist_data
                                + "I" # uint result_packets_generated
                                + "I" # uint result_packets_sent
+                               + "I" # uint result_packets_deferred
+                               + "I" # uint result_packets_deferred_sent
+                               + "I" # uint result_packets_discarded
                                )
 config_source_tuple = namedtuple( "config_source_tuple"
                                 , [ "routing_key"
@@ -94,9 +474,38 @@ config_source_tuple = namedtuple( "config_source_tuple"
                                   , "temporal_dist_data"
                                   , "result_packets_generated"
                                   , "result_packets_sent"
+                                  , "result_packets_deferred"
+                                  , "result_packets_deferred_sent"
+                                  , "result_packets_discarded"
                                   ]
                                 )
 
+# The parameters of one phase of a sweep. Followed by a config_phase_source_t
+# for each source.
+config_phase_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                              + "I" # uint   warmup_duration
+                              + "I" # uint   duration
+                              + "H" # ushort rtr_drop_e
+                              + "H" # ushort rtr_drop_m
+                              )
+config_phase_tuple = namedtuple( "config_phase_tuple"
+                               , [ "warmup_duration"
+                                 , "duration"
+                                 , "rtr_drop_e"
+                                 , "rtr_drop_m"
+                                 ]
+                               )
+
+config_phase_source_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                                     + "I" # enum temporal_dist
+                                     + temporal_dist_data_t # temporal_dist_data
+                                     )
+config_phase_source_tuple = namedtuple( "config_phase_source_tuple"
+                                      , [ "temporal_dist"
+                                        , "temporal_dist_data"
+                                        ]
+                                      )
+
 config_sink_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
                              + "I" # uint routing_key
                              + "I" # uint result_packets_arrived
@@ -107,6 +516,32 @@ config_sink_tuple = namedtuple( "config_sink_tuple"
                                 ]
                               )
 
+config_latency_histogram_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                                          + "I"*LATENCY_HISTOGRAM_BINS # uint result_bins[]
+                                          )
+
+# The header of each sample of a core's counters. Followed by the
+# result_packets_sent of each source and then the result_packets_arrived of each
+# sink.
+config_sample_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                               + "I" # uint tick
+                               + "I" # uint forwarded_packets
+                               + "I" # uint dropped_packets
+                               )
+config_sample_tuple = namedtuple( "config_sample_tuple"
+                                , [ "tick"
+                                  , "forwarded_packets"
+                                  , "dropped_packets"
+                                  ]
+                                )
+
+def sample_size(num_sources, num_sinks):
+	"""
+	Returns the size (bytes) of a sample for a core with the given number of
+	sources and sinks.
+	"""
+	return config_sample_t.size + struct.calcsize("I") * (num_sources + num_sinks)
+
 config_router_entry_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
                                      + "I" # uint key
                                      + "I" # uint mask
@@ -119,6 +554,16 @@ config_router_entry_tuple = namedtuple( "config_router_entry_tuple"
                                         ]
                                       )
 
+config_directory_entry_t = struct.Struct( "<" # Little endian, standard sizes (i.e. 2-byte short, 4-byte int)
+                                        + "I" # uint offset
+                                        + "I" # uint length
+                                        )
+config_directory_entry_tuple = namedtuple( "config_directory_entry_tuple"
+                                         , [ "offset"
+                                           , "length"
+                                           ]
+                                         )
+
 def core_map_struct_pack(core_map):
 	"""
 	Returns the packed struct of the provided coremap which should be a dict
@@ -163,25 +608,202 @@ def core_map_sdram_addr():
 	"""
 	return SDRAM_BASE_UNBUF
 
-def config_root_sdram_addr(core):
+def config_directory_sdram_addr():
 	"""
-	Given a core number, return the address in SDRAM where the configuration data
-	will be loaded.
+	Return the address in SDRAM of the configuration directory (which follows
+	the coremap).
 	"""
-	return ( SDRAM_BASE_UNBUF
+	return ( core_map_sdram_addr()
 	       + ( (MAX_DIMENSION_SIZE*MAX_DIMENSION_SIZE+2)
 	         * struct.calcsize("I")
 	         )
-	       + (core-1) * ( config_root_t.size
-	                    + config_source_t.size
-	                      * MAX_SOURCES_PER_CORE
-	                    + config_sink_t.size
-	                      * MAX_SINKS_PER_CORE
-	                    + config_router_entry_t.size
-	                      * MAX_ROUTES_PER_CORE
-	                    )
 	       )
 
+def chip_status_sdram_addr():
+	"""
+	Return the address in SDRAM of the chip status (which follows the
+	configuration directory).
+	"""
+	return config_directory_sdram_addr() + config_directory_entry_t.size * MAX_CORES_PER_CHIP
+
+def chip_status_core_started_sdram_addr():
+	"""
+	Return the address in SDRAM of the chip status' record of which cores have
+	started.
+	"""
+	return ( chip_status_sdram_addr()
+	       + chip_status_t.size
+	       + 2 * struct.calcsize("I") * MAX_CORES_PER_CHIP
+	       )
+
+def config_blocks_sdram_addr():
+	"""
+	Return the address in SDRAM where the per-core configuration blocks begin
+	(after the chip status).
+	"""
+	return chip_status_sdram_addr() + CHIP_STATUS_SIZE
+
+# The configuration of a core as given to chip_config_pack: its configuration
+# block, its bulk data (the traces and phases its configuration refers to by
+# offsets from config_root.data_offset) and the space (bytes) to allocate for
+# its sample ring buffers and phase result slots.
+CoreConfig = namedtuple( "CoreConfig"
+                       , [ "core_id"
+                         , "config"
+                         , "data"
+                         , "samples_length"
+                         , "phase_results_length"
+                         ]
+                       )
+
+# The location of a core's configuration block (and so its results) in SDRAM
+# and of the ring buffers its samples and the slots the results of each phase
+# of a sweep are written to.
+CoreConfigLocation = namedtuple( "CoreConfigLocation"
+                               , [ "addr"
+                                 , "length"
+                                 , "samples_addr"
+                                 , "samples_length"
+                                 , "phase_results_addr"
+                                 , "phase_results_length"
+                                 ]
+                               )
+
+def chip_config_pack(core_map, core_configs):
+	"""
+	Pack the complete SDRAM image for a chip: the coremap, followed by the
+	configuration directory, an empty chip status, each core's configuration
+	block packed back-to-back and then each core's bulk data. The image is
+	written to core_map_sdram_addr() in one go. Space for the cores' phase result slots and
+	sample ring buffers is allocated (but not written) after the image. The
+	locations of a core's bulk data, phase result slots and sample ring buffers
+	are recorded in the data_offset, phase_results_offset and samples_offset of
+	its config_root.
+	
+	core_map is as given to core_map_struct_pack and core_configs is a list of
+	CoreConfig giving the blocks in the order they are to be placed in SDRAM.
+	
+	Returns a tuple (image, locations) where locations is a dict {core_id:
+	CoreConfigLocation, ...}.
+	"""
+	core_map_size = config_directory_sdram_addr() - core_map_sdram_addr()
+	
+	core_map_packed = core_map_struct_pack(core_map)
+	assert len(core_map_packed) <= core_map_size
+	
+	# Bulk data is padded to keep everything after it word aligned
+	core_configs = [ c._replace(data = c.data.ljust((len(c.data) + 3) & ~3, "\0"))
+	                 for c in core_configs
+	               ]
+	
+	directory          = [config_directory_entry_tuple(offset = 0, length = 0)] * MAX_CORES_PER_CHIP
+	locations          = {}
+	blocks             = []
+	addr               = config_blocks_sdram_addr()
+	data_addr          = addr               + sum(len(c.config)          for c in core_configs)
+	phase_results_addr = data_addr          + sum(len(c.data)            for c in core_configs)
+	samples_addr       = phase_results_addr + sum(c.phase_results_length for c in core_configs)
+	for c in core_configs:
+		directory[c.core_id] = config_directory_entry_tuple( offset = addr - SDRAM_BASE_UNBUF
+		                                                   , length = len(c.config)
+		                                                   )
+		locations[c.core_id] = CoreConfigLocation( addr                 = addr
+		                                         , length               = len(c.config)
+		                                         , samples_addr         = samples_addr
+		                                         , samples_length       = c.samples_length
+		                                         , phase_results_addr   = phase_results_addr
+		                                         , phase_results_length = c.phase_results_length
+		                                         )
+		
+		# Point the core at its bulk data, phase result slots and sample ring
+		# buffers
+		config_root = config_root_tuple(*config_root_t.unpack(c.config[:config_root_t.size]))
+		config_root = config_root._replace( data_offset          = data_addr          - SDRAM_BASE_UNBUF
+		                                  , phase_results_offset = phase_results_addr - SDRAM_BASE_UNBUF
+		                                  , samples_offset       = samples_addr       - SDRAM_BASE_UNBUF
+		                                  )
+		blocks.append(config_root_t.pack(*config_root) + c.config[config_root_t.size:])
+		
+		addr               += len(c.config)
+		data_addr          += len(c.data)
+		phase_results_addr += c.phase_results_length
+		samples_addr       += c.samples_length
+	
+	image = ( core_map_packed.ljust(core_map_size, "\0")
+	        + "".join(config_directory_entry_t.pack(*entry) for entry in directory)
+	        + "\0" * CHIP_STATUS_SIZE
+	        + "".join(blocks)
+	        + "".join(c.data for c in core_configs)
+	        )
+	
+	return (image, locations)
+
+
+def _aplx(name):
+	return os.path.join(os.path.dirname(__file__), "..", "spinnaker_app/%s.aplx"%name)
 
 # The path of the compiled SpiNNaker app APLX file.
-SPINNAKER_APP_APLX = os.path.join(os.path.dirname(__file__), "..", "spinnaker_app/spinn_test_driver.aplx")
+SPINNAKER_APP_APLX = _aplx("spinn_test_driver")
+
+# A build of the SpiNNaker app (see "Build variants" in spinn_test_driver.h):
+# its APLX file, the most sources, sinks and sinks measuring latency it allows a
+# core, whether it must (True), may (None) or must not (False) run on a chip's
+# lead core (which loads the routing table) and the temporal distributions its
+# sources may use (None for any).
+AppVariant = namedtuple( "AppVariant"
+                       , [ "aplx"
+                         , "max_sources"
+                         , "max_sinks"
+                         , "max_latency_sinks"
+                         , "lead"
+                         , "temporal_dists"
+                         ]
+                       )
+
+# The generic build, which can do everything.
+GENERIC_APP_VARIANT = AppVariant( aplx              = SPINNAKER_APP_APLX
+                                , max_sources       = MAX_SOURCES_PER_CORE
+                                , max_sinks         = MAX_SINKS_PER_CORE
+                                , max_latency_sinks = MAX_LATENCY_SINKS_PER_CORE
+                                , lead              = None
+                                , temporal_dists    = None
+                                )
+
+# The role-specialised builds (made by "make variants"), most specialised first.
+APP_VARIANTS = [ AppVariant(_aplx("spinn_test_driver_router"), 0,   0,    0,   True,  None)
+               , AppVariant(_aplx("spinn_test_driver_source"), 512, 0,    0,   None,  None)
+               , AppVariant(_aplx("spinn_test_driver_sink"),   0,   1024, 128, None,  None)
+               ] + [ AppVariant( _aplx("spinn_test_driver_%s"%name)
+                               , MAX_SOURCES_PER_CORE, MAX_SINKS_PER_CORE, MAX_LATENCY_SINKS_PER_CORE
+                               , False, frozenset([temporal_dist])
+                               )
+                     for name, temporal_dist in [ ("bernoulli", TEMPORAL_DIST_BERNOULLI)
+                                                , ("poisson",   TEMPORAL_DIST_POISSON)
+                                                , ("on_off",    TEMPORAL_DIST_ON_OFF)
+                                                , ("periodic",  TEMPORAL_DIST_PERIODIC)
+                                                , ("trace",     TEMPORAL_DIST_TRACE)
+                                                ]
+                   ]
+
+def app_variant(num_sources, num_sinks, num_latency_sinks, lead, temporal_dists):
+	"""
+	The most specialised build of the app (an AppVariant) which can run a core
+	with the given numbers of sources, sinks and sinks measuring latency whose
+	sources use the given set of temporal distributions, on a chip's lead core
+	or not. Role-specialised builds which haven't been made are skipped. Returns
+	None if none can.
+	"""
+	for variant in APP_VARIANTS + [GENERIC_APP_VARIANT]:
+		if variant is not GENERIC_APP_VARIANT and not os.path.isfile(variant.aplx):
+			continue
+		if ( num_sources           <= variant.max_sources
+		     and num_sinks         <= variant.max_sinks
+		     and num_latency_sinks <= variant.max_latency_sinks
+		     and variant.lead in (None, lead)
+		     and (variant.temporal_dists is None or temporal_dists <= variant.temporal_dists)
+		   ):
+			return variant
+	return None
+
+# The path of the host-native network simulator (see simulator.py).
+SPINNAKER_APP_SIM = os.path.join(os.path.dirname(__file__), "..", "spinnaker_app/spinn_test_driver_sim")
@@ -0,0 +1,233 @@
+#!/usr/bin/env python
+
+"""
+Standard synthetic traffic patterns for NetworkExperiment.add_streams.
+
+Each pattern takes a spinn_route network model {(x,y): chip, ...} and returns a
+list of streams [(source_core, [dest_core, ...]), ...] ordered by source (chip
+then core). with_traffic attaches a generator and consumer to each stream ready
+for add_streams, e.g.:
+
+    experiment.add_streams( traffic_patterns.with_traffic( traffic_patterns.transpose(chips)
+                                                         , BernoulliGeneration(0.1)
+                                                         , InstantConsumption()
+                                                         )
+                          , routing_algorithms
+                          )
+
+Patterns which map a core to another by its position (transpose, bit_complement
+and nearest_neighbour) send to the core with the same core number on the
+destination chip and skip destinations which don't exist.
+
+Run as a script to compare the time taken to build a pattern stream by stream
+(add_stream) and in bulk (add_streams) against machine size:
+
+    python -m spinn_test_driver.traffic_patterns --sizes 4 8 16 24 --pattern all_to_all
+"""
+
+import random
+
+
+# The offsets of the chips at the end of each of a chip's six links (east,
+# north-east, north, west, south-west and south)
+NEIGHBOUR_OFFSETS = [(1,0), (1,1), (0,1), (-1,0), (-1,-1), (0,-1)]
+
+
+def _size(chips):
+	"""
+	The width and height of a network model.
+	"""
+	return ( max(x for (x,y) in chips) + 1
+	       , max(y for (x,y) in chips) + 1
+	       )
+
+
+def _cores(chips):
+	"""
+	Every core in a network model as a list [((x,y), core), ...] ordered by chip
+	then core number.
+	"""
+	return [ ((x,y), core)
+	         for (x,y), chip in sorted(chips.iteritems())
+	         for core_id, core in sorted(chip.cores.iteritems())
+	       ]
+
+
+def _core_at(chips, coord, core_id):
+	"""
+	The core with the given number on the given chip or None if there isn't one.
+	"""
+	chip = chips.get(coord)
+	return chip.cores.get(core_id) if chip is not None else None
+
+
+def _mapped(chips, mapping):
+	"""
+	Streams from every core to the core with the same number on the chip given
+	by mapping((x,y)), skipping cores mapped to themselves or to missing cores.
+	"""
+	streams = []
+	for coord, core in _cores(chips):
+		dest = _core_at(chips, mapping(coord), core.core_id)
+		if dest is not None and dest is not core:
+			streams.append((core, [dest]))
+	return streams
+
+
+def uniform_random(chips, fanout = 1, streams_per_core = 1, rng = random):
+	"""
+	streams_per_core streams from every core, each to fanout distinct cores
+	(other than the source) chosen uniformly at random.
+	"""
+	cores = [core for _, core in _cores(chips)]
+	streams = []
+	for source in cores:
+		others = [core for core in cores if core is not source]
+		for _ in range(streams_per_core):
+			streams.append((source, rng.sample(others, min(fanout, len(others)))))
+	return streams
+
+
+def transpose(chips):
+	"""
+	Every core sends to the same core on the chip at its transposed position,
+	i.e. (x,y) sends to (y,x).
+	"""
+	return _mapped(chips, lambda (x,y): (y,x))
+
+
+def bit_complement(chips):
+	"""
+	Every core sends to the same core on the chip at its complemented position,
+	i.e. (x,y) sends to (w-1-x, h-1-y) (the bitwise complement of each
+	coordinate when the width and height are powers of two).
+	"""
+	w, h = _size(chips)
+	return _mapped(chips, lambda (x,y): (w-1-x, h-1-y))
+
+
+def hotspot(chips, hotspots, fraction, fanout = 1, rng = random):
+	"""
+	One stream from every core. With the given probability a stream goes to one
+	of the cores in the list hotspots (chosen at random) otherwise it goes to
+	fanout cores chosen uniformly at random (like uniform_random).
+	"""
+	cores = [core for _, core in _cores(chips)]
+	streams = []
+	for source in cores:
+		targets = [core for core in hotspots if core is not source]
+		if targets and rng.random() < fraction:
+			streams.append((source, [rng.choice(targets)]))
+		else:
+			others = [core for core in cores if core is not source]
+			streams.append((source, rng.sample(others, min(fanout, len(others)))))
+	return streams
+
+
+def nearest_neighbour(chips, wrap = True):
+	"""
+	One stream from every core multicast to the same core on each of the (up to)
+	six neighbouring chips. If wrap is set the machine is treated as a torus.
+	"""
+	w, h = _size(chips)
+	streams = []
+	for (x,y), core in _cores(chips):
+		dests = []
+		for dx, dy in NEIGHBOUR_OFFSETS:
+			nx, ny = x + dx, y + dy
+			if wrap:
+				nx, ny = nx % w, ny % h
+			dest = _core_at(chips, (nx, ny), core.core_id)
+			if dest is not None and dest is not core and dest not in dests:
+				dests.append(dest)
+		if dests:
+			streams.append((core, dests))
+	return streams
+
+
+def all_to_all(chips):
+	"""
+	One stream from every core multicast to every other core.
+	"""
+	cores = [core for _, core in _cores(chips)]
+	return [ (source, [core for core in cores if core is not source])
+	         for source in cores
+	       ]
+
+
+def with_traffic(streams, gen, con):
+	"""
+	Attach a generator to every source and a consumer to every destination of a
+	list of streams giving the arguments expected by add_streams [((source, gen),
+	[(dest, con), ...]), ...].
+	"""
+	return [ ((source, gen), [(dest, con) for dest in dests])
+	         for source, dests in streams
+	       ]
+
+
+PATTERNS = { "uniform_random"    : uniform_random
+           , "transpose"         : transpose
+           , "bit_complement"    : bit_complement
+           , "nearest_neighbour" : nearest_neighbour
+           , "all_to_all"        : all_to_all
+           }
+
+
+if __name__ == "__main__":
+	import time
+	import argparse
+	
+	import spinn_route.model
+	import spinn_route.routers
+	
+	from spinn_test_driver import network_experiment
+	
+	parser = argparse.ArgumentParser(description = __doc__.strip().split("\n")[0])
+	parser.add_argument("--sizes", type = int, nargs = "+", default = [2, 4, 8],
+	                    help = "widths and heights of the machines built (chips)")
+	parser.add_argument("--cores", type = int, default = 16,
+	                    help = "application cores per chip")
+	parser.add_argument("--pattern", choices = sorted(PATTERNS), default = "uniform_random",
+	                    help = "traffic pattern")
+	parser.add_argument("--workers", type = int, default = None,
+	                    help = "worker processes used by add_streams (default: one per CPU)")
+	parser.add_argument("--no-serial", action = "store_true",
+	                    help = "only time add_streams (add_stream is slow on large machines)")
+	args = parser.parse_args()
+	
+	routing_algorithms = [spinn_route.routers.dimension_order_route]
+	gen = network_experiment.BernoulliGeneration(0.1)
+	con = network_experiment.InstantConsumption()
+	
+	def build(size, bulk):
+		chips = spinn_route.model.make_rectangular_board(size, size)
+		for chip in chips.itervalues():
+			for core_id in list(chip.cores):
+				if not 1 <= core_id <= args.cores:
+					del chip.cores[core_id]
+		experiment = network_experiment.NetworkExperiment(chips)
+		if args.pattern == "uniform_random":
+			pattern = uniform_random(chips, rng = random.Random(0))
+		else:
+			pattern = PATTERNS[args.pattern](chips)
+		streams = with_traffic(pattern, gen, con)
+		
+		before = time.time()
+		if bulk:
+			experiment.add_streams(streams, routing_algorithms, workers = args.workers)
+		else:
+			for source_, destinations in streams:
+				experiment.add_stream(source_, destinations, routing_algorithms)
+		return len(streams), time.time() - before
+	
+	print "%8s %8s %12s %12s %8s"%("chips", "streams", "add_stream", "add_streams", "speedup")
+	for size in args.sizes:
+		num_streams, bulk_time = build(size, True)
+		if args.no_serial:
+			print "%8s %8d %12s %10.3f s %8s"%("%dx%d"%(size, size), num_streams, "-", bulk_time, "-")
+		else:
+			_, serial_time = build(size, False)
+			print "%8s %8d %10.3f s %10.3f s %7.2fx"%(
+				"%dx%d"%(size, size), num_streams, serial_time, bulk_time, serial_time / bulk_time
+			)
@@ -0,0 +1,544 @@
+/**
+ * Micro-benchmarks for the spinn_test_driver callbacks, run on a Linux host
+ * against the stand-in spin1 API.
+ *
+ * For a range of source/sink counts up to the MAX_*_PER_CORE limits a
+ * configuration is written into the fake SDRAM and the cost of each of
+ * load_config, setup_router, on_timer_tick, on_mc_packet_received and
+ * store_results is reported in nanoseconds and host cycles per call.
+ *
+ * With -l packets are timestamped and sinks record latency histograms. With -i
+ * the counters are sampled every given number of ticks. With -d sources use
+ * the given temporal distribution (bernoulli, poisson, onoff or periodic) with
+ * a mean of probability packets per tick. With -q only the given number of
+ * packets may be sent each tick, the rest being deferred to the application's
+ * software transmit queue or discarded. With -P the configuration is a sweep of
+ * the given number of (identical) phases and the cost of moving between phases
+ * is also reported.
+ *
+ * With -s the per-source cost of traffic generation is instead reported for a
+ * range of packet probabilities, alongside that of the original scheme (a
+ * soft-float trial of rand() for every source every tick) for comparison.
+ *
+ * Host figures are only a proxy for the ARM968: they're useful for comparing
+ * implementations and spotting super-linear behaviour, not for predicting the
+ * absolute per-tick budget on the chip. In particular the host has an FPU so
+ * the reference scheme's float arithmetic is far cheaper here than on the chip.
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "spinnaker.h"
+#include "spin1_api.h"
+
+#include "spinn_test_driver.h"
+#include "spinn_test_driver_core.h"
+
+#define MIN(a,b) (((a)<(b)) ? (a) : (b))
+#define MAX(a,b) (((a)<(b)) ? (b) : (a))
+
+
+/******************************************************************************
+ * Application symbols under test
+ ******************************************************************************/
+
+void load_config(void);
+void setup_router(void);
+void begin_experiment(core_state_t *core);
+void store_results(void);
+void on_timer_tick(uint _1, uint _2);
+void on_mc_packet_received(uint key, uint payload);
+void on_dma_transfer_done(uint id, uint tag);
+void store_phase_results(uint phase);
+void start_phase(core_state_t *core, uint phase);
+void report_completion(void);
+void aggregate_chip_status(void);
+
+extern config_root_t config_root;
+extern config_source_t config_sources[];
+extern core_state_t this_core;
+
+
+/******************************************************************************
+ * Options
+ ******************************************************************************/
+
+static uint  opt_reps    = 100;
+static uint  opt_stride  = 1;
+static uint  opt_ticks   = 10000;
+static uint  opt_packets = 1000000;
+static float opt_prob    = 0.1f;
+static uint  opt_flags   = 0u;
+static uint  opt_sample  = 0u;
+static uint  opt_dist    = TEMPORAL_DIST_BERNOULLI;
+static int   opt_tx_space = -1;
+static uint  opt_phases  = 0u;
+
+
+/******************************************************************************
+ * Timing
+ ******************************************************************************/
+
+static inline unsigned long long
+read_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static inline unsigned long long
+read_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+
+typedef struct measurement {
+	unsigned long long ns;
+	unsigned long long cycles;
+} measurement_t;
+
+
+#define MEASURE(m, stmt) do { \
+		unsigned long long _ns     = read_ns();     \
+		unsigned long long _cycles = read_cycles(); \
+		stmt;                                       \
+		(m).cycles += read_cycles() - _cycles;      \
+		(m).ns     += read_ns()     - _ns;          \
+	} while (0)
+
+
+static void
+report(const char *name, uint sources, uint sinks, uint routes,
+       unsigned long calls, measurement_t m)
+{
+	printf( "%-24s %7u %7u %7u %9lu %12.1f %12.1f\n"
+	      , name, sources, sinks, routes, calls
+	      , (double)m.ns / (double)calls
+	      , (double)m.cycles / (double)calls
+	      );
+}
+
+
+/******************************************************************************
+ * Configuration image
+ ******************************************************************************/
+
+/**
+ * Host-side encoding of a Bernoulli source's threshold (see
+ * spinnaker_app.bernoulli_threshold).
+ */
+static uint
+bernoulli_threshold(double probability)
+{
+	double threshold = probability * 4294967296.0;
+	if (threshold <= 0.0)
+		return 0u;
+	return (threshold >= 4294967295.0) ? 0xFFFFFFFFu : (uint)threshold;
+}
+
+
+/**
+ * Host-side encoding of a Bernoulli source's interval scale (see
+ * spinnaker_app.bernoulli_interval_scale).
+ */
+static uint
+bernoulli_interval_scale(double probability)
+{
+	if (probability >= 1.0)
+		return 0u;
+	if (probability <= 0.0)
+		return 0xFFFFFFFFu;
+
+	double scale = (double)(1u << BERNOULLI_INTERVAL_SCALE_BITS)
+	             / (-log1p(-probability) / log(2.0));
+	return (scale >= 4294967295.0) ? 0xFFFFFFFFu : (uint)(scale + 0.5);
+}
+
+
+/**
+ * Host-side encoding of a Poisson source's interval scale (see
+ * spinnaker_app.poisson_interval_scale).
+ */
+static uint
+poisson_interval_scale(double rate)
+{
+	if (rate <= 0.0)
+		return 0u;
+
+	double scale = (double)(1u << POISSON_INTERVAL_SCALE_BITS) * log(2.0) / rate;
+	return (scale >= 4294967295.0) ? 0xFFFFFFFFu : (uint)(scale + 0.5);
+}
+
+
+/**
+ * Configure source i to generate a mean of probability packets per tick using
+ * the distribution chosen by opt_dist. On/off sources send a packet every tick
+ * of on periods averaging 10 ticks; periodic sources are given staggered
+ * phases.
+ */
+static void
+write_source(config_source_t *source, uint i, float probability)
+{
+	memset(source, 0, sizeof(*source));
+	source->routing_key   = i * opt_stride;
+	source->temporal_dist = opt_dist;
+	switch (opt_dist) {
+		case TEMPORAL_DIST_BERNOULLI:
+			source->temporal_dist_data.bernoulli.threshold      = bernoulli_threshold(probability);
+			source->temporal_dist_data.bernoulli.interval_scale = bernoulli_interval_scale(probability);
+			break;
+
+		case TEMPORAL_DIST_POISSON:
+			source->temporal_dist_data.poisson.interval_scale = poisson_interval_scale(probability);
+			break;
+
+		case TEMPORAL_DIST_ON_OFF:
+			source->temporal_dist_data.on_off.threshold          = bernoulli_threshold(probability > 0.0f);
+			source->temporal_dist_data.on_off.on_interval_scale  = bernoulli_interval_scale(0.1);
+			source->temporal_dist_data.on_off.off_interval_scale =
+				bernoulli_interval_scale(probability / (10.0 * (1.0 - MIN(probability, 0.999))));
+			break;
+
+		case TEMPORAL_DIST_PERIODIC:
+			source->temporal_dist_data.periodic.period = probability > 0.0f ? (uint)(1.0f / probability + 0.5f) : 0u;
+			source->temporal_dist_data.periodic.phase  = i;
+			break;
+	}
+}
+
+
+/**
+ * Report the stub core's completion and, as the lead core, aggregate the chip
+ * status.
+ */
+static void
+report_chip_completion(void)
+{
+	report_completion();
+	aggregate_chip_status();
+}
+
+
+/**
+ * Write a configuration for the stub core into the fake SDRAM: a 1x1 system
+ * (with only the stub core in the configuration directory) whose sources and sinks use routing keys 0, stride, ..., (n-1)*stride such
+ * that every generated packet would be accepted by a sink when looped back.
+ */
+static void
+write_config(uint num_sources, uint num_sinks, uint num_router_entries,
+             float probability)
+{
+	uint *core_map = CORE_MAP_SDRAM_ADDR;
+	core_map[0] = 1;
+	core_map[1] = 1;
+	core_map[2] = 1u << stub_core_id;
+
+	config_directory_entry_t *directory = CONFIG_DIRECTORY_SDRAM_ADDR;
+	memset(directory, 0, sizeof(*directory) * MAX_CORES_PER_CHIP);
+	memset((void *)CHIP_STATUS_SDRAM_ADDR, 0, sizeof(chip_status_t));
+	directory[stub_core_id].offset = (uint)(CHIP_STATUS_SDRAM_ADDR + 1) - SDRAM_BASE_UNBUF;
+	uint num_histograms = (opt_flags & CONFIG_FLAG_LATENCY) ? num_sinks : 0u;
+	directory[stub_core_id].length = sizeof(config_root_t)
+	                               + sizeof(config_source_t)            * num_sources
+	                               + sizeof(config_sink_t)              * num_sinks
+	                               + sizeof(config_latency_histogram_t) * num_histograms
+	                               + sizeof(config_router_entry_t)      * num_router_entries
+	                               ;
+	
+	config_root_t *root = CONFIG_ROOT_SDRAM_ADDR(stub_core_id);
+	memset(root, 0, sizeof(*root));
+	root->completion_state   = COMPLETION_STATE_RUNNING;
+	root->seed               = 0xC0FFEEu;
+	root->tick_microseconds  = 1000;
+	root->warmup_duration    = 0;
+	root->duration           = ~0u;
+	root->flags              = opt_flags | CONFIG_FLAG_LEAD;
+	root->latency_bin_shift  = 8;
+	root->sample_interval    = opt_sample;
+	root->num_samples        = 64;
+	root->num_phases         = opt_phases;
+	root->num_sources        = num_sources;
+	root->num_sinks          = num_sinks;
+	root->num_router_entries = num_router_entries;
+
+	config_source_t *sources = (config_source_t *)(root + 1);
+	for (uint i = 0; i < num_sources; i++)
+		write_source(&sources[i], i, probability);
+
+	config_sink_t *sinks = (config_sink_t *)(sources + num_sources);
+	for (uint i = 0; i < num_sinks; i++) {
+		sinks[i].routing_key            = i * opt_stride;
+		sinks[i].result_packets_arrived = 0;
+	}
+
+	config_latency_histogram_t *histograms = (config_latency_histogram_t *)(sinks + num_sinks);
+	memset(histograms, 0, sizeof(*histograms) * num_histograms);
+
+	config_router_entry_t *entries = (config_router_entry_t *)(histograms + num_histograms);
+	for (uint i = 0; i < num_router_entries; i++) {
+		entries[i].key   = i;
+		entries[i].mask  = 0xFFFFFFFFu;
+		entries[i].route = 1u << (6 + stub_core_id);
+	}
+
+	// The block is followed by the bulk data (the phases), the phase result
+	// slots and then the sample ring buffers
+	uint results_length = sizeof(config_root_t)
+	                    + sizeof(config_source_t)            * num_sources
+	                    + sizeof(config_sink_t)              * num_sinks
+	                    + sizeof(config_latency_histogram_t) * num_histograms
+	                    ;
+	root->data_offset          = directory[stub_core_id].offset
+	                           + directory[stub_core_id].length;
+	root->phases_offset        = 0u;
+	root->phase_results_offset = root->data_offset
+	                           + ( sizeof(config_phase_t)
+	                             + sizeof(config_phase_source_t) * num_sources
+	                             ) * opt_phases;
+	root->samples_offset       = root->phase_results_offset
+	                           + results_length * opt_phases;
+
+	config_phase_t *phase = (config_phase_t *)((uchar *)(SDRAM_BASE_UNBUF) + root->data_offset);
+	for (uint p = 0; p < opt_phases; p++) {
+		phase->warmup_duration = root->warmup_duration;
+		phase->duration        = root->duration;
+		phase->rtr_drop_e      = root->rtr_drop_e;
+		phase->rtr_drop_m      = root->rtr_drop_m;
+
+		config_phase_source_t *phase_sources = (config_phase_source_t *)(phase + 1);
+		for (uint i = 0; i < num_sources; i++) {
+			phase_sources[i].temporal_dist      = sources[i].temporal_dist;
+			phase_sources[i].temporal_dist_data = sources[i].temporal_dist_data;
+		}
+		phase = (config_phase_t *)(phase_sources + num_sources);
+	}
+}
+
+
+/******************************************************************************
+ * Benchmarks
+ ******************************************************************************/
+
+static void
+bench_size(uint n)
+{
+	uint num_sources = MIN(n, MAX_SOURCES_PER_CORE);
+	uint num_sinks   = MIN(n, (opt_flags & CONFIG_FLAG_LATENCY) ? MAX_LATENCY_SINKS_PER_CORE
+	                                                            : MAX_SINKS_PER_CORE);
+	uint num_routes  = MAX_ROUTER_ENTRIES;
+	measurement_t m;
+
+	write_config(num_sources, num_sinks, num_routes, opt_prob);
+
+	// load_config
+	memset(&m, 0, sizeof(m));
+	for (uint i = 0; i < opt_reps; i++)
+		MEASURE(m, load_config());
+	report("load_config", num_sources, num_sinks, num_routes, opt_reps, m);
+
+	// setup_router
+	memset(&m, 0, sizeof(m));
+	for (uint i = 0; i < opt_reps; i++)
+		MEASURE(m, setup_router());
+	report("setup_router", num_sources, num_sinks, num_routes, opt_reps, m);
+
+	begin_experiment(&this_core);
+
+	// on_timer_tick (post-warmup, never reaching the end of the experiment)
+	this_core.simulation_warmup  = false;
+	this_core.simulation_ticks   = 0u;
+	this_core.ticks_until_sample = opt_sample;
+	unsigned long sent_before = stub_packets_sent;
+	memset(&m, 0, sizeof(m));
+	MEASURE(m, for (uint i = 0; i < opt_ticks; i++) {
+		stub_tx_space = opt_tx_space;
+		on_timer_tick(i, 0);
+	});
+	stub_tx_space = -1;
+	report("on_timer_tick", num_sources, num_sinks, num_routes, opt_ticks, m);
+	printf( "  (%.2f packets/tick)\n"
+	      , (double)(stub_packets_sent - sent_before) / (double)opt_ticks
+	      );
+	if (opt_tx_space >= 0) {
+		unsigned long deferred = 0, discarded = 0;
+		for (uint i = 0; i < num_sources; i++) {
+			deferred  += config_sources[i].result_packets_deferred;
+			discarded += config_sources[i].result_packets_discarded;
+		}
+		printf( "  (%.2f deferred/tick, %.2f discarded/tick, max queue depth %u)\n"
+		      , (double)deferred  / (double)opt_ticks
+		      , (double)discarded / (double)opt_ticks
+		      , config_root.result_tx_queue_max_depth
+		      );
+	}
+
+	// on_mc_packet_received, cycling through every sink's key
+	if (num_sinks) {
+		memset(&m, 0, sizeof(m));
+		MEASURE(m, for (uint i = 0; i < opt_packets; i++)
+		             on_mc_packet_received((i % num_sinks) * opt_stride, 0u));
+		report("on_mc_packet_received", num_sources, num_sinks, num_routes, opt_packets, m);
+	}
+
+	// store_results
+	memset(&m, 0, sizeof(m));
+	for (uint i = 0; i < opt_reps; i++)
+		MEASURE(m, store_results());
+	report("store_results", num_sources, num_sinks, num_routes, opt_reps, m);
+
+	// Reporting completion (as the lead core) in the chip status
+	memset(&m, 0, sizeof(m));
+	for (uint i = 0; i < opt_reps; i++)
+		MEASURE(m, report_chip_completion());
+	report("report_completion", num_sources, num_sinks, num_routes, opt_reps, m);
+
+	// Moving between phases of a sweep
+	if (opt_phases) {
+		memset(&m, 0, sizeof(m));
+		for (uint i = 0; i < opt_reps; i++)
+			MEASURE(m, store_phase_results(i % opt_phases));
+		report("store_phase_results", num_sources, num_sinks, num_routes, opt_reps, m);
+
+		memset(&m, 0, sizeof(m));
+		for (uint i = 0; i < opt_reps; i++)
+			MEASURE(m, start_phase(&this_core, i % opt_phases));
+		report("start_phase", num_sources, num_sinks, num_routes, opt_reps, m);
+	}
+
+	if (config_root.completion_state == COMPLETION_STATE_FAILIURE)
+		printf("  (warning: application reported failure)\n");
+}
+
+
+/**
+ * The original traffic generator: a float trial of rand() per source per tick.
+ */
+static void
+reference_tick(uint num_sources, float probability)
+{
+	for (uint i = 0; i < num_sources; i++)
+		if (((float)rand() / (float)RAND_MAX) < probability)
+			spin1_send_mc_packet(i, 0u, false);
+}
+
+
+/**
+ * Report the per-source cost of traffic generation at a given probability.
+ */
+static void
+bench_source_cost(float probability)
+{
+	uint num_sources = MAX_SOURCES_PER_CORE;
+	measurement_t m, ref;
+
+	write_config(num_sources, 0, 0, probability);
+	load_config();
+	begin_experiment(&this_core);
+
+	this_core.simulation_warmup = false;
+	this_core.simulation_ticks  = 0u;
+	unsigned long sent_before = stub_packets_sent;
+	memset(&m, 0, sizeof(m));
+	MEASURE(m, for (uint i = 0; i < opt_ticks; i++) on_timer_tick(i, 0));
+	double packets = (double)(stub_packets_sent - sent_before);
+
+	memset(&ref, 0, sizeof(ref));
+	MEASURE(ref, for (uint i = 0; i < opt_ticks; i++) reference_tick(num_sources, probability));
+
+	double ns_per_source     = (double)m.ns   / ((double)opt_ticks * num_sources);
+	double ref_ns_per_source = (double)ref.ns / ((double)opt_ticks * num_sources);
+	printf( "%-12g %7u %12.2f %12.2f %12.2f %12.2f %8.2f\n"
+	      , probability, num_sources
+	      , packets / (double)opt_ticks
+	      , ns_per_source
+	      , packets ? (double)m.ns / packets : 0.0
+	      , ref_ns_per_source
+	      , ref_ns_per_source / ns_per_source
+	      );
+}
+
+
+static void
+usage(const char *name)
+{
+	fprintf( stderr
+	       , "usage: %s [-s] [-l] [-i sample interval] [-d distribution] [-q packets/tick] [-P phases] [-p probability] [-k key stride] [-t ticks] [-m packets] [-r reps] [-v]\n"
+	       , name
+	       );
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int source_cost = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "sli:d:q:P:p:k:t:m:r:v")) != -1) {
+		switch (opt) {
+			case 's': source_cost = 1;                      break;
+			case 'l': opt_flags  |= CONFIG_FLAG_LATENCY;    break;
+			case 'i': opt_sample  = atoi(optarg);           break;
+			case 'd':
+				if      (strcmp(optarg, "bernoulli") == 0) opt_dist = TEMPORAL_DIST_BERNOULLI;
+				else if (strcmp(optarg, "poisson")   == 0) opt_dist = TEMPORAL_DIST_POISSON;
+				else if (strcmp(optarg, "onoff")     == 0) opt_dist = TEMPORAL_DIST_ON_OFF;
+				else if (strcmp(optarg, "periodic")  == 0) opt_dist = TEMPORAL_DIST_PERIODIC;
+				else usage(argv[0]);
+				break;
+			case 'q': opt_tx_space = atoi(optarg);          break;
+			case 'P': opt_phases   = atoi(optarg);          break;
+			case 'p': opt_prob    = atof(optarg);           break;
+			case 'k': opt_stride  = atoi(optarg);           break;
+			case 't': opt_ticks   = atoi(optarg);           break;
+			case 'm': opt_packets = atoi(optarg);           break;
+			case 'r': opt_reps    = atoi(optarg);           break;
+			case 'v': stub_verbose = 1;                     break;
+			default:  usage(argv[0]);
+		}
+	}
+
+	stub_init();
+	spin1_callback_on(DMA_TRANSFER_DONE, on_dma_transfer_done, 0);
+
+	if (source_cost) {
+		static const float probabilities[] = {0.0001f, 0.001f, 0.01f, 0.1f, 0.25f, 0.5f, 1.0f};
+
+		printf( "%-12s %7s %12s %12s %12s %12s %8s\n"
+		      , "# probability", "sources", "packets/tick", "ns/source", "ns/packet"
+		      , "ref ns/src", "speedup"
+		      );
+		for (uint i = 0; i < sizeof(probabilities)/sizeof(probabilities[0]); i++)
+			bench_source_cost(probabilities[i]);
+		return 0;
+	}
+
+	printf( "%-24s %7s %7s %7s %9s %12s %12s\n"
+	      , "# callback", "sources", "sinks", "routes", "calls", "ns/call", "cycles/call"
+	      );
+
+	uint max = MAX(MAX_SOURCES_PER_CORE, MAX_SINKS_PER_CORE);
+	for (uint n = 1; n < max; n *= 4)
+		bench_size(n);
+	bench_size(max);
+
+	return 0;
+}
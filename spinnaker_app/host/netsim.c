@@ -0,0 +1,1787 @@
+/**
+ * A discrete-event simulator of a SpiNNaker machine running spinn_test_driver,
+ * for checking configurations and pre-screening sweeps without a board.
+ *
+ * The simulator reads the SDRAM image of every chip exactly as the host loads
+ * it (see spinn_test_driver/simulator.py for the file format), runs the
+ * experiment and writes the images back with the results in place: each
+ * core's config_root, sources, sinks and latency histograms, its phase result
+ * slots and sample ring buffers and the chip status, just as the application
+ * leaves them.
+ *
+ * Each core runs the application's own per-core logic (see
+ * spinn_test_driver_core.c): the same random number generator and seed,
+ * temporal distributions, software transmit queue and tick, warmup, drain and
+ * phase sequencing, so a source generates packets on exactly the ticks it would
+ * on the chip. The network is modelled a packet at a
+ * time:
+ *
+ * - Chips form a hexagonal torus of the coremap's width and height. A link
+ *   serialises packets at a fixed number of nanoseconds per bit and delivers
+ *   them after a fixed latency into a small input buffer at the far end, which
+ *   returns a credit once the far router has taken the packet.
+ * - A router takes one packet at a time from its links and cores (round robin),
+ *   looks it up in its multicast table (packets from links with no entry are
+ *   default routed straight through) and waits until every output the packet
+ *   is routed to can accept it. The whole router stalls meanwhile and, after
+ *   the wait1 time encoded by rtr_drop_e/m, drops the packet. Emergency routing
+ *   is not modelled.
+ * - Cores spend a fixed time generating each packet and receiving each packet.
+ *   The spin1 API's transmit queue feeds the router directly.
+ * - When reinjecting dropped packets, the router dumps each packet it drops
+ *   after timing out to the lead core, whose interrupt handler takes as long
+ *   to read it as receiving a packet. Packets dumped meanwhile are lost.
+ *
+ * Chips are divided between threads by rows. Since no chip can affect another
+ * sooner than the link latency, each thread simulates its own chips a window of
+ * that length at a time and the events destined for other threads' chips are
+ * exchanged at a barrier between windows.
+ *
+ * Usage:
+ *
+ *     spinn_test_driver_sim [options] input_image output_image
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "spinnaker.h"
+
+#include "spinn_test_driver.h"
+#include "spinn_test_driver_core.h"
+
+#define MIN(a,b) (((a)<(b)) ? (a) : (b))
+#define MAX(a,b) (((a)<(b)) ? (b) : (a))
+
+
+/******************************************************************************
+ * Model parameters
+ ******************************************************************************/
+
+/**
+ * Clock frequencies of the cores (which timestamp packets in CPU cycles) and
+ * of the router (whose wait1 timeout counts router cycles).
+ */
+#define CPU_CLK_MHZ    200u
+#define ROUTER_CLK_MHZ 133u
+
+/**
+ * Capacity of the spin1 API's transmit queue.
+ */
+#define API_TX_QUEUE_SIZE 16u
+
+/**
+ * Packets buffered at each router output link awaiting transmission and at
+ * each router input link awaiting routing.
+ */
+#define LINK_OUT_FIFO_SIZE 2u
+#define LINK_IN_FIFO_SIZE  4u
+
+/**
+ * Bits transmitted over a link for a packet without and with a payload.
+ */
+#define PACKET_BITS         40u
+#define PACKET_PAYLOAD_BITS 72u
+
+/**
+ * Entries in each router's cache of routing table lookups (a power of two).
+ */
+#define ROUTE_CACHE_SIZE 1024u
+
+/**
+ * Timing parameters (nanoseconds), which may be changed on the command line.
+ */
+static uint opt_link_latency_ns = 200u;
+static uint opt_link_ns_per_bit = 4u;
+static uint opt_router_ns       = 8u;
+static uint opt_core_tx_ns      = 500u;
+static uint opt_core_rx_ns      = 500u;
+
+static uint opt_threads = 0u;
+static int  opt_verbose = 0;
+
+
+/******************************************************************************
+ * Machine state
+ ******************************************************************************/
+
+/**
+ * Simulation time in nanoseconds.
+ */
+typedef unsigned long long sim_time_t;
+
+#define SIM_TIME_NEVER (~0ull)
+
+/**
+ * Links, numbered as by the router: east, north-east, north, west, south-west
+ * and south. A packet arriving on link l from a neighbour is travelling in the
+ * direction of link (l+3)%6.
+ */
+#define NUM_LINKS 6u
+
+static const int link_dx[NUM_LINKS] = {+1, +1,  0, -1, -1,  0};
+static const int link_dy[NUM_LINKS] = { 0, +1, +1,  0, -1, -1};
+
+#define OPPOSITE_LINK(l) (((l) + 3u) % NUM_LINKS)
+
+/**
+ * Router inputs: a link or a core's transmit queue.
+ */
+#define LINK_INPUT(l) (l)
+#define CORE_INPUT(c) (NUM_LINKS + (c))
+#define NUM_INPUTS    (NUM_LINKS + MAX_CORES_PER_CHIP)
+
+/**
+ * Route bits: links in bits 0-5 followed by a bit per core.
+ */
+#define ROUTE_LINKS   ((1u << NUM_LINKS) - 1u)
+#define ROUTE_CORE(c) (1u << (NUM_LINKS + (c)))
+#define ROUTE_MASK    ((1u << NUM_INPUTS) - 1u)
+
+/**
+ * The route given by route lookups which match no entry.
+ */
+#define NO_ROUTE 0xFFFFFFFFu
+
+/**
+ * Fields of a router diagnostic counter filter (RTR_DGFn). A packet is counted
+ * if, for every field, the bit describing it is set. Packets are multicast and
+ * never emergency routed.
+ */
+#define FILTER_TYPE_MC          (1u << 0)
+#define FILTER_TYPE             (0xFu << 0)
+#define FILTER_ER_NORMAL        (1u << 4)
+#define FILTER_ER               (0xFu << 4)
+#define FILTER_DEF_NON_DEFAULT  (1u << 10)
+#define FILTER_DEF_DEFAULT      (1u << 11)
+#define FILTER_DEF              (0x3u << 10)
+#define FILTER_PL_NO_PAYLOAD    (1u << 12)
+#define FILTER_PL_PAYLOAD       (1u << 13)
+#define FILTER_PL               (0x3u << 12)
+#define FILTER_LOC_LOCAL        (1u << 14)
+#define FILTER_LOC_EXTERNAL     (1u << 15)
+#define FILTER_LOC              (0x3u << 14)
+#define FILTER_DEST_DROPPED     (1u << 16)
+#define FILTER_DEST_CORE        (1u << 17)
+#define FILTER_DEST_MONITOR     (1u << 18)
+#define FILTER_DEST_LINK(l)     (1u << (19u + (l)))
+#define FILTER_DEST             (0x1FFu << 16)
+
+
+struct chip;
+
+
+/**
+ * A core running the application: its configuration and the state the
+ * application keeps for it plus the spin1 API transmit queue and the core's
+ * busy times.
+ */
+typedef struct core {
+	struct chip *chip;
+	uint id;
+
+	// Byte offset of the config_root in the chip's image
+	uint config_offset;
+
+	config_root_t root;
+	core_state_t  state;
+
+	packet_t api_tx_queue[API_TX_QUEUE_SIZE];
+	uint api_tx_queue_head;
+	uint api_tx_queue_length;
+
+	bool stopped;
+
+	// The time the clock used to timestamp packets was started
+	sim_time_t timer_start;
+
+	// Sources whose packets are still to be generated this tick, in order. The
+	// core takes opt_core_tx_ns to generate each.
+	ushort *generate;
+	uint    generate_head;
+	uint    generate_length;
+	uint    generate_capacity;
+	bool    generate_scheduled;
+
+	// The time at which the packets queued by the last tick will have been
+	// generated (i.e. when its callback would have finished)
+	sim_time_t tick_busy_until;
+
+	// The time until which the core is busy receiving a packet
+	sim_time_t rx_busy_until;
+} core_t;
+
+
+/**
+ * An output link: packets waiting to be transmitted and the space left in the
+ * input buffer at the far end.
+ */
+typedef struct link_out {
+	packet_t fifo[LINK_OUT_FIFO_SIZE];
+	uint head;
+	uint length;
+	uint credits;
+
+	sim_time_t busy_until;
+	bool       tx_done_scheduled;
+} link_out_t;
+
+
+/**
+ * An input link's buffer of packets awaiting the router.
+ */
+typedef struct link_in {
+	packet_t fifo[LINK_IN_FIFO_SIZE];
+	uint head;
+	uint length;
+} link_in_t;
+
+
+/**
+ * A cached routing table lookup.
+ */
+typedef struct route_cache_entry {
+	uint key;
+	uint route;
+	bool valid;
+} route_cache_entry_t;
+
+
+typedef enum router_state {
+	ROUTER_IDLE,
+
+	// Routing a packet (until a ROUTER_DONE event)
+	ROUTER_BUSY,
+
+	// Waiting for the packet's outputs
+	ROUTER_BLOCKED,
+} router_state_t;
+
+
+/**
+ * A chip: its SDRAM image, cores, router and links.
+ */
+typedef struct chip {
+	uint x;
+	uint y;
+	uint index;
+
+	// The partition (thread) simulating this chip
+	uint owner;
+
+	// The chip's SDRAM from SDRAM_BASE_UNBUF (NULL for chips not in the input)
+	uchar *image;
+	uint   image_length;
+
+	core_t *cores[MAX_CORES_PER_CHIP];
+	core_t *lead;
+	uint    num_cores_running;
+
+	// The cores' timers tick together with the first core's period (the host
+	// gives every core the same)
+	sim_time_t tick_ns;
+
+	config_router_entry_t router_entries[MAX_ROUTER_ENTRIES];
+	uint                  num_router_entries;
+	route_cache_entry_t  *route_cache;
+
+	sim_time_t wait1_ns;
+
+	// The diagnostic counters of the lead core's counter profile
+	bool counters_enabled;
+	uint counter_mask;
+	uint counter_filters[NUM_ROUTER_COUNTERS];
+	uint counters[NUM_ROUTER_COUNTERS];
+
+	// Bitmap of router inputs with packets waiting and the input the round robin
+	// considers first
+	uint inputs_waiting;
+	uint next_input;
+
+	router_state_t router_state;
+	packet_t       router_packet;
+	uint           router_input;
+	uint           router_route;
+	bool           router_default_routed;
+	uint           router_serial;
+
+	// The time until which the router's dump registers hold the last packet
+	// dumped, i.e. until the lead core's interrupt handler has read them
+	sim_time_t dump_busy_until;
+
+	link_in_t  links_in[NUM_LINKS];
+	link_out_t links_out[NUM_LINKS];
+	struct chip *neighbours[NUM_LINKS];
+} chip_t;
+
+
+static uint system_width;
+static uint system_height;
+static chip_t *chips;
+static uint num_chips;
+
+
+/******************************************************************************
+ * Events and partitions
+ ******************************************************************************/
+
+/**
+ * Event types, in the order events at the same time are processed: resources
+ * are freed before they are claimed and a stalled router gives up last.
+ */
+typedef enum event_type {
+	EV_TX_DONE        = 0, // An output link finished transmitting (port: link)
+	EV_CREDIT         = 1, // An output link regained a credit (port: link)
+	EV_ARRIVE         = 2, // A packet arrived on an input link (port: link)
+	EV_TICK           = 3, // The chip's cores' timers ticked
+	EV_GENERATE       = 4, // A core generates its next packet (port: core)
+	EV_ROUTER_DONE    = 5, // The router looked up its packet
+	EV_ROUTER_RETRY   = 6, // A stalled router's outputs may have become free
+	EV_ROUTER_TIMEOUT = 7, // A stalled router's wait1 expired (arg: packet serial)
+} event_type_t;
+
+/**
+ * An event. Events are ordered by a key made of their time followed by their
+ * type, chip and port, so every run is the same whatever the number of threads.
+ */
+typedef struct event {
+	unsigned long long key;
+	uint               arg;
+	packet_t           packet;
+} event_t;
+
+#define EVENT_KEY(time, type, chip, port) \
+	(((unsigned long long)(time) << 18) | ((type) << 15) | ((chip) << 5) | (port))
+#define EVENT_TIME(key) ((sim_time_t)((key) >> 18))
+#define EVENT_TYPE(key) ((uint)((key) >> 15) & 0x7u)
+#define EVENT_CHIP(key) ((uint)((key) >> 5) & 0x3FFu)
+#define EVENT_PORT(key) ((uint)(key) & 0x1Fu)
+
+
+/**
+ * A growable array of events.
+ */
+typedef struct event_list {
+	event_t *events;
+	uint     length;
+	uint     capacity;
+} event_list_t;
+
+
+/**
+ * The chips simulated by a thread and its pending events.
+ */
+typedef struct partition {
+	uint id;
+	pthread_t thread;
+
+	// A binary min-heap of pending events for this partition's chips
+	event_list_t heap;
+
+	// Events for other partitions' chips: [window parity][partition]
+	event_list_t *outboxes[2];
+
+	// The earliest event sent to another partition this window
+	sim_time_t sent_min;
+
+	// The earliest pending event and number of cores still running, published at
+	// the end of each window: [window parity]
+	sim_time_t next_time[2];
+	uint       running_cores[2];
+
+	uint running;
+
+	unsigned long long events_processed;
+	unsigned long long packets_injected;
+	unsigned long long packets_routed;
+} partition_t;
+
+static partition_t *partitions;
+static uint num_partitions;
+static pthread_barrier_t window_barrier;
+
+
+static void
+event_list_append(event_list_t *list, const event_t *event)
+{
+	if (list->length == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2u : 256u;
+		list->events = realloc(list->events, sizeof(event_t) * list->capacity);
+		if (!list->events) {
+			fprintf(stderr, "netsim: out of memory.\n");
+			exit(1);
+		}
+	}
+	list->events[list->length++] = *event;
+}
+
+
+static inline bool
+event_before(const event_t *a, const event_t *b)
+{
+	return a->key < b->key;
+}
+
+
+static void
+heap_push(event_list_t *heap, const event_t *event)
+{
+	event_list_append(heap, event);
+
+	uint pos = heap->length - 1u;
+	while (pos) {
+		uint parent = (pos - 1u) / 2u;
+		if (!event_before(event, &heap->events[parent]))
+			break;
+		heap->events[pos] = heap->events[parent];
+		pos = parent;
+	}
+	heap->events[pos] = *event;
+}
+
+
+static void
+heap_pop(event_list_t *heap, event_t *event)
+{
+	*event = heap->events[0];
+
+	event_t last = heap->events[--heap->length];
+	uint pos = 0u;
+	for (;;) {
+		uint child = 2u*pos + 1u;
+		if (child >= heap->length)
+			break;
+		if (child + 1u < heap->length && event_before(&heap->events[child+1u], &heap->events[child]))
+			child++;
+		if (!event_before(&heap->events[child], &last))
+			break;
+		heap->events[pos] = heap->events[child];
+		pos = child;
+	}
+	if (heap->length)
+		heap->events[pos] = last;
+}
+
+
+/**
+ * The partition whose events are being processed by the calling thread.
+ */
+static __thread partition_t *current_partition;
+
+/**
+ * The window into which the calling thread's partition sends events for other
+ * partitions.
+ */
+static __thread uint current_window;
+
+
+/**
+ * Schedule an event for a chip, sending it to the chip's partition if it is
+ * not the caller's.
+ */
+static void
+schedule( sim_time_t time, event_type_t type, chip_t *chip, uint port
+        , uint arg, const packet_t *packet
+        )
+{
+	event_t event = { .key = EVENT_KEY(time, type, chip->index, port)
+	                , .arg = arg
+	                };
+	if (packet)
+		event.packet = *packet;
+
+	partition_t *p = current_partition;
+	if (chip->owner == p->id) {
+		heap_push(&p->heap, &event);
+	} else {
+		event_list_append(&p->outboxes[current_window & 1u][chip->owner], &event);
+		p->sent_min = MIN(p->sent_min, time);
+	}
+}
+
+
+/******************************************************************************
+ * SDRAM images
+ ******************************************************************************/
+
+/**
+ * The byte offset of an SDRAM address in a chip's image.
+ */
+#define SDRAM_OFFSET(addr) ((uint)((size_t)(addr) - SDRAM_BASE_UNBUF))
+
+
+/**
+ * Get a pointer to length bytes at the given offset into a chip's image,
+ * exiting if they fall outside it.
+ */
+static void *
+sdram(chip_t *chip, uint offset, uint length)
+{
+	if (offset > chip->image_length || length > chip->image_length - offset) {
+		fprintf( stderr, "netsim: chip %u,%u: %u bytes at SDRAM offset 0x%08x lie outside its image of %u bytes.\n"
+		       , chip->x, chip->y, length, offset, chip->image_length
+		       );
+		exit(1);
+	}
+	return chip->image + offset;
+}
+
+
+static config_directory_entry_t *
+config_directory(chip_t *chip)
+{
+	return sdram( chip, SDRAM_OFFSET(CONFIG_DIRECTORY_SDRAM_ADDR)
+	            , sizeof(config_directory_entry_t) * MAX_CORES_PER_CHIP
+	            );
+}
+
+
+static chip_status_t *
+chip_status(chip_t *chip)
+{
+	return sdram(chip, SDRAM_OFFSET(CHIP_STATUS_SDRAM_ADDR), sizeof(chip_status_t));
+}
+
+
+static void
+sim_printf(chip_t *chip, core_t *core, const char *format, ...)
+{
+	if (!opt_verbose)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	fprintf(stderr, "%u,%u:%u: ", chip->x, chip->y, core ? core->id : 0u);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+
+/******************************************************************************
+ * Per-core logic (that of the application)
+ ******************************************************************************/
+
+/**
+ * The time of the event this thread is processing, at which the platform
+ * functions below act.
+ */
+static __thread sim_time_t current_time;
+
+
+/**
+ * The core whose state is given.
+ */
+static inline core_t *
+core_of(core_state_t *state)
+{
+	return (core_t *)((uchar *)state - offsetof(core_t, state));
+}
+
+
+#define CORE_PRINTF(state, ...) sim_printf(core_of(state)->chip, core_of(state), __VA_ARGS__)
+
+#include "spinn_test_driver_core.c"
+
+
+/**
+ * The size of a core's results (its config_root, sources, sinks and latency
+ * histograms).
+ */
+static inline uint
+results_size(core_t *core)
+{
+	return sizeof(config_root_t)
+	     + sizeof(config_source_t)            * core->root.num_sources
+	     + sizeof(config_sink_t)              * core->root.num_sinks
+	     + sizeof(config_latency_histogram_t) * num_latency_histograms(&core->state)
+	     ;
+}
+
+
+/**
+ * The router's wait1 time (nanoseconds) given by an exponent and mantissa.
+ */
+static sim_time_t
+router_wait1_ns(uint e, uint m)
+{
+	uint cycles = (e <= 4u) ? (m + 16u - (1u << (4u - e))) << e
+	                        : (m + 16u) << e;
+	return (sim_time_t)cycles * 1000u / ROUTER_CLK_MHZ;
+}
+
+
+static void
+platform_set_router_timeout(core_state_t *state)
+{
+	core_t *core = core_of(state);
+	chip_t *chip = core->chip;
+	if (lead_core(state)) {
+		chip->wait1_ns = router_wait1_ns(core->root.rtr_drop_e, core->root.rtr_drop_m);
+		chip->counter_mask = core->root.counter_mask;
+		memcpy(chip->counter_filters, core->root.counter_filters, sizeof(chip->counter_filters));
+		memset(chip->counters, 0, sizeof(chip->counters));
+	}
+}
+
+
+static void
+platform_hold_router(core_state_t *state)
+{
+	if (lead_core(state))
+		core_of(state)->chip->wait1_ns = router_wait1_ns(15u, 15u);
+}
+
+
+/**
+ * The count of a diagnostic counter if it is in the counter profile, otherwise
+ * zero.
+ */
+static inline uint
+router_counter(const chip_t *chip, uint counter)
+{
+	return (chip->counter_mask & (1u << counter)) ? chip->counters[counter] : 0u;
+}
+
+
+static uint
+platform_router_counter(core_state_t *state, uint counter)
+{
+	return router_counter(core_of(state)->chip, counter);
+}
+
+
+static void *
+platform_sdram(core_state_t *state, uint offset, uint length)
+{
+	return sdram(core_of(state)->chip, offset, length);
+}
+
+
+static inline uint
+sum_words(const void *data, uint bytes)
+{
+	const uint *words = data;
+	uint sum = 0u;
+	for (uint i = 0u; i < bytes / sizeof(uint); i++)
+		sum += words[i];
+	return sum;
+}
+
+
+/**
+ * Write a core's results (and its config_root) at the given offset in its
+ * chip's image.
+ */
+static void
+write_results(core_t *core, uint offset)
+{
+	chip_t *chip = core->chip;
+	uint sources_size    = sizeof(config_source_t)            * core->root.num_sources;
+	uint sinks_size      = sizeof(config_sink_t)              * core->root.num_sinks;
+	uint histograms_size = sizeof(config_latency_histogram_t) * num_latency_histograms(&core->state);
+
+	uchar *dst = sdram(chip, offset, results_size(core));
+	memcpy(dst + sizeof(config_root_t), core->state.sources, sources_size);
+	memcpy(dst + sizeof(config_root_t) + sources_size, core->state.sinks, sinks_size);
+	memcpy(dst + sizeof(config_root_t) + sources_size + sinks_size, core->state.histograms, histograms_size);
+
+	core->root.result_forwarded_packets = router_counter(chip, FWD_CNTR);
+	core->root.result_dropped_packets   = router_counter(chip, DRP_CNTR);
+	for (uint i = 0u; i < NUM_ROUTER_COUNTERS; i++)
+		core->root.result_counters[i] = router_counter(chip, i);
+	core->root.result_checksum = sum_words(core->state.sources,    sources_size)
+	                           + sum_words(core->state.sinks,      sinks_size)
+	                           + sum_words(core->state.histograms, histograms_size);
+
+	memcpy(dst, &core->root, sizeof(config_root_t));
+}
+
+
+static void
+platform_store_phase_results(core_state_t *state, uint phase)
+{
+	core_t *core = core_of(state);
+	write_results(core, core->root.phase_results_offset + phase * results_size(core));
+}
+
+
+/**
+ * Store a core's results in place and report its completion in the chip status
+ * which, once every core on the chip has finished, is aggregated as by the
+ * lead core.
+ */
+static void
+store_results(core_t *core)
+{
+	chip_t *chip = core->chip;
+
+	core->root.result_store_time = 0u;
+	write_results(core, core->config_offset);
+
+	chip_status_t *status = chip_status(chip);
+	status->core_checksums[core->id] = core->root.result_checksum;
+	status->core_states[core->id] = ( core->root.completion_state == COMPLETION_STATE_RUNNING
+	                                ? COMPLETION_STATE_FAILIURE
+	                                : core->root.completion_state
+	                                );
+
+	if (--chip->num_cores_running)
+		return;
+
+	config_directory_entry_t *directory = config_directory(chip);
+	uint bad_cores = 0u;
+	uint checksum  = 0u;
+	for (uint c = 0u; c < MAX_CORES_PER_CHIP; c++) {
+		if (directory[c].length == 0u)
+			continue;
+		if (status->core_states[c] == COMPLETION_STATE_SUCCESS)
+			checksum += status->core_checksums[c];
+		else
+			bad_cores |= 1u << c;
+	}
+	status->bad_cores = bad_cores;
+	status->checksum  = checksum;
+	status->completion_state = bad_cores ? COMPLETION_STATE_FAILIURE
+	                                     : COMPLETION_STATE_SUCCESS;
+}
+
+
+static void
+platform_take_sample(core_state_t *state)
+{
+	core_t *core = core_of(state);
+	uint words = SAMPLE_WORDS(core->root.num_sources, core->root.num_sinks);
+
+	// The ring buffer has no room for any samples
+	if (core->root.num_samples == 0u) {
+		core->root.result_num_samples++;
+		return;
+	}
+
+	uint *slot = sdram( core->chip
+	                  , core->root.samples_offset
+	                    + ( state->current_phase * core->root.num_samples
+	                      + state->next_sample_slot
+	                      ) * words * sizeof(uint)
+	                  , words * sizeof(uint)
+	                  );
+	sample_counters(state, (config_sample_t *)slot);
+
+	core->root.result_num_samples++;
+	if (++state->next_sample_slot == core->root.num_samples)
+		state->next_sample_slot = 0u;
+}
+
+
+static void router_wake(chip_t *chip, sim_time_t now);
+
+
+/**
+ * Attempt to place a packet in the spin1 API's transmit queue, returning false
+ * if it is full.
+ */
+static bool
+platform_send_mc_packet(core_state_t *state, uint key, uint payload, bool has_payload)
+{
+	core_t *core = core_of(state);
+	if (core->api_tx_queue_length == API_TX_QUEUE_SIZE)
+		return false;
+
+	packet_t *packet = &core->api_tx_queue[ (core->api_tx_queue_head + core->api_tx_queue_length)
+	                                      % API_TX_QUEUE_SIZE
+	                                      ];
+	packet->key         = key;
+	packet->has_payload = has_payload;
+	packet->payload     = has_payload ? payload : 0u;
+	core->api_tx_queue_length++;
+	current_partition->packets_injected++;
+
+	core->chip->inputs_waiting |= 1u << CORE_INPUT(core->id);
+	router_wake(core->chip, current_time);
+	return true;
+}
+
+
+/**
+ * The clock used to timestamp packets: CPU cycles since the timer was started.
+ */
+static uint
+platform_experiment_time(core_state_t *state)
+{
+	return (uint)(((current_time - core_of(state)->timer_start) * CPU_CLK_MHZ) / 1000u);
+}
+
+
+static void
+platform_warmup_ended(core_state_t *state)
+{
+	chip_t *chip = core_of(state)->chip;
+	if (lead_core(state)) {
+		memset(chip->counters, 0, sizeof(chip->counters));
+		chip->counters_enabled = true;
+	}
+}
+
+
+static void
+platform_experiment_ended(core_state_t *state)
+{
+	if (lead_core(state))
+		core_of(state)->chip->counters_enabled = false;
+
+	// Simulated ticks are never delayed or lost
+	state->root->result_ticks_elapsed = state->root->duration;
+}
+
+
+/******************************************************************************
+ * Callback timing (as in the application)
+ ******************************************************************************/
+
+static inline uint
+ns_to_cycles(sim_time_t ns)
+{
+	return (uint)((ns * CPU_CLK_MHZ) / 1000u);
+}
+
+
+static inline uint
+callback_histogram_bin(uint cycles)
+{
+	uint bin = 31u - __builtin_clz((cycles >> CALLBACK_HISTOGRAM_SHIFT) | 1u);
+	return MIN(bin, CALLBACK_HISTOGRAM_BINS - 1u);
+}
+
+
+/**
+ * Record the timing of a tick which started at the given time and queued the
+ * given number of packets. A tick's callback is modelled as taking
+ * opt_core_tx_ns per packet generated and as starting late if the packets of
+ * earlier ticks have not all been generated.
+ */
+static void
+record_tick_timing(core_t *core, uint generated, sim_time_t now)
+{
+	sim_time_t start = MAX(now, core->tick_busy_until);
+	sim_time_t ns    = (sim_time_t)generated * opt_core_tx_ns;
+	core->tick_busy_until = start + ns;
+
+	// Only ticks after the warmup are recorded
+	if (core->state.simulation_warmup)
+		return;
+
+	uint cycles  = ns_to_cycles(ns);
+	uint latency = ns_to_cycles(start - now);
+
+	if (cycles > ns_to_cycles(core->chip->tick_ns))
+		core->root.result_tick_overruns++;
+	core->root.result_tick_max_cycles  = MAX(core->root.result_tick_max_cycles, cycles);
+	core->root.result_tick_max_latency = MAX(core->root.result_tick_max_latency, latency);
+	core->root.result_tick_histogram[callback_histogram_bin(cycles)]++;
+}
+
+
+static void
+record_packet_timing(core_t *core)
+{
+	uint cycles = ns_to_cycles(opt_core_rx_ns);
+	core->root.result_packet_max_cycles = MAX(core->root.result_packet_max_cycles, cycles);
+	core->root.result_packet_histogram[callback_histogram_bin(cycles)]++;
+}
+
+
+/******************************************************************************
+ * Traffic generation
+ ******************************************************************************/
+
+/**
+ * Queue a packet from the given source to be generated once the core has
+ * generated those before it. The random numbers drawn are the same as the
+ * application's since generating a packet draws none.
+ */
+static void
+platform_generate_packet(core_state_t *state, uint source_index)
+{
+	core_t *core = core_of(state);
+	if (core->generate_length == core->generate_capacity) {
+		core->generate_capacity = core->generate_capacity ? core->generate_capacity * 2u : 64u;
+		core->generate = realloc(core->generate, sizeof(ushort) * core->generate_capacity);
+		if (!core->generate) {
+			fprintf(stderr, "netsim: out of memory.\n");
+			exit(1);
+		}
+	}
+	core->generate[core->generate_length++] = source_index;
+}
+
+
+/**
+ * A timer tick, as the application's on_timer_tick. Returns false once the
+ * core has stopped.
+ */
+static bool
+on_timer_tick(core_t *core, sim_time_t now)
+{
+	if (core->state.simulation_warmup && core->state.simulation_ticks == 0u)
+		core->timer_start = now;
+
+	uint phase = core->state.current_phase;
+	tick_action_t action = experiment_tick(&core->state);
+
+	// Packets the last phase had yet to generate are abandoned along with its
+	// transmit queue
+	if (core->state.current_phase != phase) {
+		core->generate_head   = 0u;
+		core->generate_length = 0u;
+	}
+
+	switch (action) {
+		case TICK_GENERATE:
+			break;
+
+		case TICK_IDLE:
+			return true;
+
+		case TICK_STOP:
+			core->stopped = true;
+			return false;
+	}
+
+	uint queued = core->generate_length;
+	generate_traffic(&core->state);
+	record_tick_timing(core, core->generate_length - queued, now);
+
+	return true;
+}
+
+
+/**
+ * Generate the next of the packets queued by the core's ticks.
+ */
+static void
+on_generate(core_t *core, sim_time_t now)
+{
+	core->generate_scheduled = false;
+	if (core->stopped || core->generate_head == core->generate_length)
+		return;
+
+	generate_packet(&core->state, core->generate[core->generate_head++]);
+
+	if (core->generate_head == core->generate_length) {
+		core->generate_head   = 0u;
+		core->generate_length = 0u;
+	} else {
+		core->generate_scheduled = true;
+		schedule(now + opt_core_tx_ns, EV_GENERATE, core->chip, core->id, 0u, NULL);
+	}
+}
+
+
+/******************************************************************************
+ * Traffic consumption
+ ******************************************************************************/
+
+static config_sink_t *
+platform_find_sink(core_state_t *state, uint key)
+{
+	uint lo = 0u;
+	uint hi = state->root->num_sinks;
+	while (lo < hi) {
+		uint mid = (lo + hi) / 2u;
+		if (state->sinks[mid].routing_key < key)
+			lo = mid + 1u;
+		else
+			hi = mid;
+	}
+	if (lo < state->root->num_sinks && state->sinks[lo].routing_key == key)
+		return &state->sinks[lo];
+	return NULL;
+}
+
+
+static void
+on_mc_packet_received(core_t *core, const packet_t *packet, sim_time_t now)
+{
+	core->rx_busy_until = now + opt_core_rx_ns;
+
+	if (receive_packet(&core->state, packet->key, packet->payload))
+		record_packet_timing(core);
+}
+
+
+/******************************************************************************
+ * Dropped packet reinjection
+ ******************************************************************************/
+
+/**
+ * The router has dropped its packet having timed out: the lead core's dump
+ * interrupt handler captures it unless the dump registers still hold the last
+ * packet dumped, in which case it is lost.
+ */
+static void
+reinject_on_dump(chip_t *chip, sim_time_t now)
+{
+	core_t *core = chip->lead;
+	if (!core || core->stopped || !reinject_core(&core->state))
+		return;
+
+	if (chip->dump_busy_until > now) {
+		if (reinject_counting(&core->state))
+			core->root.result_reinject_missed++;
+		return;
+	}
+	chip->dump_busy_until = now + opt_core_rx_ns;
+
+	reinject_dumped( &core->state
+	               , chip->router_packet.key
+	               , chip->router_packet.payload
+	               , chip->router_packet.has_payload
+	               );
+}
+
+
+/******************************************************************************
+ * Routers and links
+ ******************************************************************************/
+
+/**
+ * Look up a key in a chip's routing table: the first matching entry wins.
+ */
+static uint
+route_lookup(chip_t *chip, uint key)
+{
+	route_cache_entry_t *cached = &chip->route_cache[(key * 0x9E3779B1u) >> 22];
+	if (cached->valid && cached->key == key)
+		return cached->route;
+
+	uint route = NO_ROUTE;
+	for (uint i = 0u; i < chip->num_router_entries; i++) {
+		if ((key & chip->router_entries[i].mask) == chip->router_entries[i].key) {
+			route = chip->router_entries[i].route & ROUTE_MASK;
+			break;
+		}
+	}
+
+	cached->key   = key;
+	cached->route = route;
+	cached->valid = true;
+	return route;
+}
+
+
+static bool
+platform_routed(core_state_t *state, uint key)
+{
+	return route_lookup(core_of(state)->chip, key) != NO_ROUTE;
+}
+
+
+/**
+ * The time taken to transmit a packet over a link.
+ */
+static inline sim_time_t
+link_packet_ns(const packet_t *packet)
+{
+	return (sim_time_t)opt_link_ns_per_bit
+	       * (packet->has_payload ? PACKET_PAYLOAD_BITS : PACKET_BITS);
+}
+
+
+static void router_try_output(chip_t *chip, sim_time_t now);
+
+
+/**
+ * Start transmitting the next packet waiting for a link if the link is free and
+ * the far end has room for it.
+ */
+static void
+link_try_send(chip_t *chip, uint l, sim_time_t now)
+{
+	link_out_t *link = &chip->links_out[l];
+
+	if (link->length && link->credits && link->busy_until <= now) {
+		packet_t *packet = &link->fifo[link->head];
+		link->head = (link->head + 1u) % LINK_OUT_FIFO_SIZE;
+		link->length--;
+		link->credits--;
+		link->busy_until = now + link_packet_ns(packet);
+
+		schedule( link->busy_until + opt_link_latency_ns, EV_ARRIVE
+		        , chip->neighbours[l], OPPOSITE_LINK(l), 0u, packet
+		        );
+
+		// Room has been made for a stalled router
+		if (chip->router_state == ROUTER_BLOCKED)
+			router_try_output(chip, now);
+	}
+
+	// Come back when the transmission ends if anything is waiting
+	if (link->length && link->busy_until > now && !link->tx_done_scheduled) {
+		link->tx_done_scheduled = true;
+		schedule(link->busy_until, EV_TX_DONE, chip, l, 0u, NULL);
+	}
+}
+
+
+/**
+ * Count the router's packet, leaving by the given destinations (FILTER_DEST_*),
+ * in every enabled diagnostic counter whose filter matches it.
+ */
+static void
+router_count(chip_t *chip, uint dest)
+{
+	if (!chip->counters_enabled)
+		return;
+
+	uint fields = FILTER_TYPE_MC
+	            | FILTER_ER_NORMAL
+	            | (chip->router_default_routed        ? FILTER_DEF_DEFAULT  : FILTER_DEF_NON_DEFAULT)
+	            | (chip->router_packet.has_payload    ? FILTER_PL_PAYLOAD   : FILTER_PL_NO_PAYLOAD)
+	            | (chip->router_input < NUM_LINKS     ? FILTER_LOC_EXTERNAL : FILTER_LOC_LOCAL)
+	            | dest
+	            ;
+	static const uint groups[] = { FILTER_TYPE, FILTER_ER, FILTER_DEF
+	                             , FILTER_PL, FILTER_LOC, FILTER_DEST
+	                             };
+
+	for (uint i = 0u; i < NUM_ROUTER_COUNTERS; i++) {
+		if (!(chip->counter_mask & (1u << i)))
+			continue;
+
+		bool match = true;
+		for (uint g = 0u; g < sizeof(groups) / sizeof(groups[0]); g++)
+			if (!(chip->counter_filters[i] & fields & groups[g]))
+				match = false;
+		if (match)
+			chip->counters[i]++;
+	}
+}
+
+
+static void
+router_drop(chip_t *chip, sim_time_t now)
+{
+	router_count(chip, FILTER_DEST_DROPPED);
+
+	// Packets which timed out (rather than having nowhere to go) are dumped
+	if (chip->router_route)
+		reinject_on_dump(chip, now);
+
+	chip->router_state = ROUTER_IDLE;
+	router_wake(chip, now);
+}
+
+
+/**
+ * Send the router's packet to all of its outputs if they can all accept it,
+ * otherwise stall (dropping the packet straight away if wait1 is zero).
+ */
+static void
+router_try_output(chip_t *chip, sim_time_t now)
+{
+	uint route = chip->router_route;
+
+	// Find when every output will be ready (or that a link is full)
+	bool       links_full  = false;
+	sim_time_t cores_ready = now;
+	for (uint l = 0u; l < NUM_LINKS; l++)
+		if ((route & (1u << l)) && chip->links_out[l].length == LINK_OUT_FIFO_SIZE)
+			links_full = true;
+	for (uint c = 0u; c < MAX_CORES_PER_CHIP; c++)
+		if ((route & ROUTE_CORE(c)) && chip->cores[c])
+			cores_ready = MAX(cores_ready, chip->cores[c]->rx_busy_until);
+
+	if (!links_full && cores_ready <= now) {
+		chip->router_state = ROUTER_IDLE;
+
+		uint dest = 0u;
+		for (uint l = 0u; l < NUM_LINKS; l++)
+			if (route & (1u << l))
+				dest |= FILTER_DEST_LINK(l);
+		if (route & ~ROUTE_LINKS)
+			dest |= FILTER_DEST_CORE;
+		router_count(chip, dest);
+		current_partition->packets_routed++;
+
+		for (uint l = 0u; l < NUM_LINKS; l++) {
+			if (route & (1u << l)) {
+				link_out_t *link = &chip->links_out[l];
+				link->fifo[(link->head + link->length) % LINK_OUT_FIFO_SIZE] = chip->router_packet;
+				link->length++;
+				link_try_send(chip, l, now);
+			}
+		}
+		for (uint c = 0u; c < MAX_CORES_PER_CHIP; c++)
+			if ((route & ROUTE_CORE(c)) && chip->cores[c])
+				on_mc_packet_received(chip->cores[c], &chip->router_packet, now);
+
+		router_wake(chip, now);
+		return;
+	}
+
+	if (chip->router_state == ROUTER_BUSY) {
+		if (chip->wait1_ns == 0u) {
+			router_drop(chip, now);
+			return;
+		}
+		chip->router_state = ROUTER_BLOCKED;
+		schedule(now + chip->wait1_ns, EV_ROUTER_TIMEOUT, chip, 0u, chip->router_serial, NULL);
+	}
+
+	// Links wake the router as they free up but busy cores don't
+	if (cores_ready > now)
+		schedule(cores_ready, EV_ROUTER_RETRY, chip, 0u, 0u, NULL);
+}
+
+
+/**
+ * Start routing the next waiting packet if the router is idle.
+ */
+static void
+router_wake(chip_t *chip, sim_time_t now)
+{
+	if (chip->router_state != ROUTER_IDLE || !chip->inputs_waiting)
+		return;
+
+	// Round robin: the first waiting input at or after next_input
+	uint rotated = (chip->inputs_waiting >> chip->next_input)
+	             | (chip->inputs_waiting << (NUM_INPUTS - chip->next_input));
+	uint input = (chip->next_input + __builtin_ctz(rotated & ROUTE_MASK)) % NUM_INPUTS;
+	chip->next_input = (input + 1u) % NUM_INPUTS;
+
+	if (input < NUM_LINKS) {
+		link_in_t *link = &chip->links_in[input];
+		chip->router_packet = link->fifo[link->head];
+		link->head = (link->head + 1u) % LINK_IN_FIFO_SIZE;
+		if (--link->length == 0u)
+			chip->inputs_waiting &= ~(1u << input);
+
+		// The sender may use the space freed
+		schedule( now + opt_link_latency_ns, EV_CREDIT
+		        , chip->neighbours[input], OPPOSITE_LINK(input), 0u, NULL
+		        );
+	} else {
+		core_t *core = chip->cores[input - NUM_LINKS];
+		chip->router_packet = core->api_tx_queue[core->api_tx_queue_head];
+		core->api_tx_queue_head = (core->api_tx_queue_head + 1u) % API_TX_QUEUE_SIZE;
+		if (--core->api_tx_queue_length == 0u)
+			chip->inputs_waiting &= ~(1u << input);
+	}
+
+	uint route = route_lookup(chip, chip->router_packet.key);
+	chip->router_default_routed = route == NO_ROUTE;
+	if (route == NO_ROUTE)
+		// Default routing: packets from links carry straight on, those from cores
+		// go nowhere
+		route = (input < NUM_LINKS) ? 1u << OPPOSITE_LINK(input) : 0u;
+
+	chip->router_input = input;
+	chip->router_route = route;
+	chip->router_serial++;
+	chip->router_state = ROUTER_BUSY;
+	schedule(now + opt_router_ns, EV_ROUTER_DONE, chip, 0u, 0u, NULL);
+}
+
+
+static void
+on_router_done(chip_t *chip, sim_time_t now)
+{
+	if (chip->router_route == 0u)
+		router_drop(chip, now);
+	else
+		router_try_output(chip, now);
+}
+
+
+static void
+on_arrive(chip_t *chip, uint l, const packet_t *packet, sim_time_t now)
+{
+	link_in_t *link = &chip->links_in[l];
+	link->fifo[(link->head + link->length) % LINK_IN_FIFO_SIZE] = *packet;
+	link->length++;
+	chip->inputs_waiting |= 1u << LINK_INPUT(l);
+	router_wake(chip, now);
+}
+
+
+/******************************************************************************
+ * Simulation
+ ******************************************************************************/
+
+static void
+process_event(partition_t *p, const event_t *event)
+{
+	chip_t *chip = &chips[EVENT_CHIP(event->key)];
+	uint    port = EVENT_PORT(event->key);
+	sim_time_t now = EVENT_TIME(event->key);
+
+	p->events_processed++;
+	current_time = now;
+
+	switch (EVENT_TYPE(event->key)) {
+		case EV_TX_DONE:
+			chip->links_out[port].tx_done_scheduled = false;
+			link_try_send(chip, port, now);
+			break;
+
+		case EV_CREDIT:
+			chip->links_out[port].credits++;
+			link_try_send(chip, port, now);
+			break;
+
+		case EV_ARRIVE:
+			on_arrive(chip, port, &event->packet, now);
+			break;
+
+		case EV_TICK:
+			for (uint c = 0u; c < MAX_CORES_PER_CHIP; c++) {
+				core_t *core = chip->cores[c];
+				if (!core || core->stopped)
+					continue;
+
+				if (on_timer_tick(core, now)) {
+					if (core->generate_length && !core->generate_scheduled) {
+						core->generate_scheduled = true;
+						schedule(now, EV_GENERATE, chip, c, 0u, NULL);
+					}
+				} else {
+					store_results(core);
+					p->running--;
+				}
+			}
+			if (chip->num_cores_running)
+				schedule(now + chip->tick_ns, EV_TICK, chip, 0u, 0u, NULL);
+			break;
+
+		case EV_GENERATE:
+			on_generate(chip->cores[port], now);
+			break;
+
+		case EV_ROUTER_DONE:
+			on_router_done(chip, now);
+			break;
+
+		case EV_ROUTER_RETRY:
+			if (chip->router_state == ROUTER_BLOCKED)
+				router_try_output(chip, now);
+			break;
+
+		case EV_ROUTER_TIMEOUT:
+			if (chip->router_state == ROUTER_BLOCKED && chip->router_serial == event->arg)
+				router_drop(chip, now);
+			break;
+	}
+}
+
+
+/**
+ * Simulate a partition's chips in windows of opt_link_latency_ns until every
+ * core has stopped.
+ */
+static void *
+run_partition(void *arg)
+{
+	partition_t *p = arg;
+	current_partition = p;
+
+	for (uint window = 0u;; window++) {
+		uint parity = window & 1u;
+
+		// Publish this partition's progress and wait for every other
+		p->next_time[parity]     = MIN(p->heap.length ? EVENT_TIME(p->heap.events[0].key) : SIM_TIME_NEVER, p->sent_min);
+		p->running_cores[parity] = p->running;
+		p->sent_min = SIM_TIME_NEVER;
+		pthread_barrier_wait(&window_barrier);
+
+		sim_time_t start   = SIM_TIME_NEVER;
+		uint       running = 0u;
+		for (uint i = 0u; i < num_partitions; i++) {
+			start    = MIN(start, partitions[i].next_time[parity]);
+			running += partitions[i].running_cores[parity];
+		}
+		if (!running || start == SIM_TIME_NEVER)
+			break;
+
+		// Take delivery of the events sent in the last window
+		for (uint i = 0u; i < num_partitions; i++) {
+			event_list_t *inbox = &partitions[i].outboxes[parity][p->id];
+			for (uint n = 0u; n < inbox->length; n++)
+				heap_push(&p->heap, &inbox->events[n]);
+			inbox->length = 0u;
+		}
+
+		// No event in the window can cause another partition's events before its
+		// end. Those it does cause are delivered after the next barrier.
+		sim_time_t end = start + opt_link_latency_ns;
+		current_window = window + 1u;
+		while (p->heap.length && EVENT_TIME(p->heap.events[0].key) < end) {
+			event_t event;
+			heap_pop(&p->heap, &event);
+			process_event(p, &event);
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Load a core's configuration, as the application's load_config,
+ * schedule_sources and setup_router.
+ */
+static core_t *
+load_core(chip_t *chip, uint core_id)
+{
+	config_directory_entry_t *directory = config_directory(chip);
+
+	core_t *core = calloc(1, sizeof(core_t));
+	core->chip          = chip;
+	core->id            = core_id;
+	core->config_offset = directory[core_id].offset;
+	memcpy(&core->root, sdram(chip, core->config_offset, sizeof(config_root_t)), sizeof(config_root_t));
+	core->state.root    = &core->root;
+
+	uint length = results_size(core)
+	            + sizeof(config_router_entry_t) * core->root.num_router_entries
+	            ;
+	if (   core->root.num_sources        > MAX_SOURCES_ANY_BUILD
+	    || core->root.num_sinks          > MAX_SINKS_ANY_BUILD
+	    || num_latency_histograms(&core->state) > MAX_LATENCY_SINKS_ANY_BUILD
+	    || core->root.num_router_entries > MAX_ROUTER_ENTRIES
+	    || (core->root.counter_mask >> NUM_ROUTER_COUNTERS)
+	    || ((core->root.flags & CONFIG_FLAG_SEARCH) && !core->root.num_phases)
+	    || length                        > directory[core_id].length) {
+		sim_printf(chip, core, "Config of %u bytes at offset 0x%08x does not fit.\n", length, core->config_offset);
+		core->root.completion_state   = COMPLETION_STATE_FAILIURE;
+		core->root.num_sources        = 0u;
+		core->root.num_sinks          = 0u;
+		core->root.num_router_entries = 0u;
+		core->root.num_phases         = 0u;
+		core->root.counter_mask       = 0u;
+		core->root.flags             &= ~CONFIG_FLAG_SEARCH;
+	}
+
+	uchar *config = sdram(chip, core->config_offset, results_size(core));
+	uint sources_size = sizeof(config_source_t) * core->root.num_sources;
+	uint sinks_size   = sizeof(config_sink_t)   * core->root.num_sinks;
+	core->state.sources    = malloc(sources_size + 1u);
+	core->state.sinks      = malloc(sinks_size + 1u);
+	core->state.histograms = calloc(num_latency_histograms(&core->state) + 1u, sizeof(config_latency_histogram_t));
+	memcpy(core->state.sources, config + sizeof(config_root_t), sources_size);
+	memcpy(core->state.sinks, config + sizeof(config_root_t) + sources_size, sinks_size);
+
+	core->state.source_states = calloc(core->root.num_sources + 1u, sizeof(source_state_t));
+	core->state.dense_sources = calloc(core->root.num_sources + 1u, sizeof(ushort));
+	core->state.source_heap   = calloc(core->root.num_sources + 1u, sizeof(ushort));
+	core->state.reinject_queue = calloc(core->root.reinject_queue_size + 1u, sizeof(reinject_entry_t));
+
+	core->root.result_cpu_clk         = CPU_CLK_MHZ;
+	core->root.result_num_samples     = 0u;
+	core->root.result_samples_dropped = 0u;
+	core->root.result_load_time       = 0u;
+
+	begin_experiment(&core->state);
+
+	// Install the router entries
+	config_router_entry_t *entries = sdram( chip, core->config_offset + results_size(core)
+	                                      , sizeof(config_router_entry_t) * core->root.num_router_entries
+	                                      );
+	for (uint i = 0u; i < core->root.num_router_entries; i++) {
+		chip->router_entries[i] = entries[i];
+		chip->num_router_entries = MAX(chip->num_router_entries, i + 1u);
+	}
+
+	return core;
+}
+
+
+static void
+load_chip(chip_t *chip)
+{
+	uint *core_map = sdram(chip, 0u, sizeof(uint) * 2u);
+	if (core_map[0] != system_width || core_map[1] != system_height) {
+		fprintf(stderr, "netsim: chip %u,%u has a different core map.\n", chip->x, chip->y);
+		exit(1);
+	}
+
+	config_directory_entry_t *directory = config_directory(chip);
+	for (uint c = 0u; c < MAX_CORES_PER_CHIP; c++) {
+		if (directory[c].length == 0u)
+			continue;
+		chip->cores[c] = load_core(chip, c);
+		chip->num_cores_running++;
+		chip_status(chip)->core_started[c] = 1u;
+		if (chip->cores[c]->root.flags & CONFIG_FLAG_LEAD)
+			chip->lead = chip->cores[c];
+		if (!chip->tick_ns)
+			chip->tick_ns = (sim_time_t)MAX(1u, chip->cores[c]->root.tick_microseconds) * 1000u;
+	}
+
+	if (chip->lead)
+		platform_set_router_timeout(&chip->lead->state);
+}
+
+
+/******************************************************************************
+ * Image files
+ ******************************************************************************/
+
+/**
+ * Image files begin with this magic number and the number of chips. Each chip's
+ * image follows: its x and y coordinates, its length and that many bytes of
+ * SDRAM from SDRAM_BASE_UNBUF. All fields are little-endian uints.
+ */
+#define IMAGE_MAGIC "SPNTDIMG"
+
+
+static uint
+read_uint(FILE *f, const char *filename)
+{
+	uchar bytes[4];
+	if (fread(bytes, 1, 4, f) != 4) {
+		fprintf(stderr, "netsim: %s is truncated.\n", filename);
+		exit(1);
+	}
+	return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint)bytes[3] << 24;
+}
+
+
+static void
+write_uint(FILE *f, uint value)
+{
+	uchar bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+	fwrite(bytes, 1, 4, f);
+}
+
+
+/**
+ * Read every chip's image, creating the machine's chips.
+ */
+static void
+read_images(const char *filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		perror(filename);
+		exit(1);
+	}
+
+	char magic[8];
+	if (fread(magic, 1, 8, f) != 8 || memcmp(magic, IMAGE_MAGIC, 8) != 0) {
+		fprintf(stderr, "netsim: %s is not an image file.\n", filename);
+		exit(1);
+	}
+
+	uint num_images = read_uint(f, filename);
+	struct { uint x, y, length; uchar *data; } *images = calloc(num_images + 1u, sizeof(*images));
+	for (uint i = 0u; i < num_images; i++) {
+		images[i].x      = read_uint(f, filename);
+		images[i].y      = read_uint(f, filename);
+		images[i].length = read_uint(f, filename);
+		images[i].data   = malloc(images[i].length + 1u);
+		if (fread(images[i].data, 1, images[i].length, f) != images[i].length) {
+			fprintf(stderr, "netsim: %s is truncated.\n", filename);
+			exit(1);
+		}
+	}
+	fclose(f);
+
+	if (!num_images || images[0].length < 2u * sizeof(uint)) {
+		fprintf(stderr, "netsim: %s has no core map.\n", filename);
+		exit(1);
+	}
+	system_width  = ((uint *)images[0].data)[0];
+	system_height = ((uint *)images[0].data)[1];
+	if (   system_width  == 0u || system_width  > MAX_DIMENSION_SIZE
+	    || system_height == 0u || system_height > MAX_DIMENSION_SIZE) {
+		fprintf(stderr, "netsim: invalid system size %ux%u.\n", system_width, system_height);
+		exit(1);
+	}
+
+	num_chips = system_width * system_height;
+	chips = calloc(num_chips, sizeof(chip_t));
+	for (uint y = 0u; y < system_height; y++) {
+		for (uint x = 0u; x < system_width; x++) {
+			chip_t *chip = &chips[y * system_width + x];
+			chip->x     = x;
+			chip->y     = y;
+			chip->index = y * system_width + x;
+			chip->route_cache = calloc(ROUTE_CACHE_SIZE, sizeof(route_cache_entry_t));
+
+			for (uint l = 0u; l < NUM_LINKS; l++) {
+				uint nx = (x + system_width  + link_dx[l]) % system_width;
+				uint ny = (y + system_height + link_dy[l]) % system_height;
+				chip->neighbours[l]        = &chips[ny * system_width + nx];
+				chip->links_out[l].credits = LINK_IN_FIFO_SIZE;
+			}
+		}
+	}
+
+	for (uint i = 0u; i < num_images; i++) {
+		if (images[i].x >= system_width || images[i].y >= system_height) {
+			fprintf(stderr, "netsim: chip %u,%u is outside the %ux%u system.\n"
+			       , images[i].x, images[i].y, system_width, system_height
+			       );
+			exit(1);
+		}
+		chip_t *chip = &chips[images[i].y * system_width + images[i].x];
+		chip->image        = images[i].data;
+		chip->image_length = images[i].length;
+		load_chip(chip);
+	}
+
+	free(images);
+}
+
+
+static void
+write_images(const char *filename)
+{
+	FILE *f = fopen(filename, "wb");
+	if (!f) {
+		perror(filename);
+		exit(1);
+	}
+
+	uint num_images = 0u;
+	for (uint i = 0u; i < num_chips; i++)
+		num_images += chips[i].image != NULL;
+
+	fwrite(IMAGE_MAGIC, 1, 8, f);
+	write_uint(f, num_images);
+	for (uint i = 0u; i < num_chips; i++) {
+		if (!chips[i].image)
+			continue;
+		write_uint(f, chips[i].x);
+		write_uint(f, chips[i].y);
+		write_uint(f, chips[i].image_length);
+		fwrite(chips[i].image, 1, chips[i].image_length, f);
+	}
+
+	if (fclose(f) != 0) {
+		perror(filename);
+		exit(1);
+	}
+}
+
+
+/******************************************************************************
+ * Main
+ ******************************************************************************/
+
+static inline unsigned long long
+read_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/**
+ * Divide the chips between partitions by rows and schedule every core's first
+ * tick.
+ */
+static void
+create_partitions(void)
+{
+	num_partitions = opt_threads ? opt_threads : (uint)sysconf(_SC_NPROCESSORS_ONLN);
+	num_partitions = MAX(1u, MIN(num_partitions, system_height));
+	partitions = calloc(num_partitions, sizeof(partition_t));
+
+	for (uint i = 0u; i < num_partitions; i++) {
+		partition_t *p = &partitions[i];
+		p->id       = i;
+		p->sent_min = SIM_TIME_NEVER;
+		p->outboxes[0] = calloc(num_partitions, sizeof(event_list_t));
+		p->outboxes[1] = calloc(num_partitions, sizeof(event_list_t));
+	}
+
+	for (uint i = 0u; i < num_chips; i++) {
+		chip_t *chip = &chips[i];
+		partition_t *p = &partitions[(chip->y * num_partitions) / system_height];
+		chip->owner = p->id;
+
+		current_partition = p;
+		if (chip->num_cores_running)
+			schedule(chip->tick_ns, EV_TICK, chip, 0u, 0u, NULL);
+		p->running += chip->num_cores_running;
+	}
+	current_partition = NULL;
+
+	pthread_barrier_init(&window_barrier, NULL, num_partitions);
+}
+
+
+static void
+usage(const char *name)
+{
+	fprintf( stderr
+	       , "usage: %s [-t threads] [-l link latency ns] [-b link ns/bit] [-r router ns/packet] [-g core ns/packet sent] [-c core ns/packet received] [-v] input_image output_image\n"
+	       , name
+	       );
+	exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "t:l:b:r:g:c:v")) != -1) {
+		switch (opt) {
+			case 't': opt_threads         = atoi(optarg); break;
+			case 'l': opt_link_latency_ns = atoi(optarg); break;
+			case 'b': opt_link_ns_per_bit = atoi(optarg); break;
+			case 'r': opt_router_ns       = atoi(optarg); break;
+			case 'g': opt_core_tx_ns      = atoi(optarg); break;
+			case 'c': opt_core_rx_ns      = atoi(optarg); break;
+			case 'v': opt_verbose         = 1;            break;
+			default:  usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2)
+		usage(argv[0]);
+
+	// The link latency is the lookahead between partitions
+	if (opt_link_latency_ns == 0u) {
+		fprintf(stderr, "netsim: the link latency must be at least 1 ns.\n");
+		return 1;
+	}
+
+	read_images(argv[optind]);
+	create_partitions();
+
+	unsigned long long start_ns = read_ns();
+	for (uint i = 0u; i < num_partitions; i++)
+		pthread_create(&partitions[i].thread, NULL, run_partition, &partitions[i]);
+	for (uint i = 0u; i < num_partitions; i++)
+		pthread_join(partitions[i].thread, NULL);
+	double seconds = (read_ns() - start_ns) / 1e9;
+
+	write_images(argv[optind + 1]);
+
+	unsigned long long events = 0ull, injected = 0ull, routed = 0ull;
+	for (uint i = 0u; i < num_partitions; i++) {
+		events   += partitions[i].events_processed;
+		injected += partitions[i].packets_injected;
+		routed   += partitions[i].packets_routed;
+	}
+	fprintf( stderr
+	       , "Simulated %ux%u chips on %u threads in %.2f s: %llu packets sent (%.0f/s), %llu routed (%.0f/s), %llu events (%.0f/s).\n"
+	       , system_width, system_height, num_partitions, seconds
+	       , injected, injected / seconds
+	       , routed,   routed   / seconds
+	       , events,   events   / seconds
+	       );
+
+	return 0;
+}
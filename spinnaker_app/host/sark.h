@@ -0,0 +1,59 @@
+/**
+ * Host-native stand-in for the SARK runtime header.
+ */
+
+#ifndef SARK_H
+#define SARK_H
+
+#include "spinnaker.h"
+
+
+/******************************************************************************
+ * System variables
+ ******************************************************************************/
+
+typedef struct sv {
+	ushort cpu_clk; // CPU (and timer) clock frequency in MHz
+} sv_t;
+
+extern sv_t *sv;
+
+
+/******************************************************************************
+ * Diagnostic output
+ ******************************************************************************/
+
+#define IO_STD  ((char *) 0)
+#define IO_DBG  ((char *) 1)
+#define IO_BUF  ((char *) 2)
+#define IO_NULL ((char *) 3)
+
+/**
+ * Writes to stderr when stub_verbose is set, otherwise discarded so that
+ * benchmark timings aren't dominated by console output.
+ */
+void io_printf(char *stream, char *format, ...);
+
+
+/******************************************************************************
+ * Interrupts
+ ******************************************************************************/
+
+#define INT_HANDLER void
+
+typedef void (*int_handler)(void);
+
+typedef enum vic_slot {
+	SLOT_0,  SLOT_1,  SLOT_2,  SLOT_3,  SLOT_4,  SLOT_5,  SLOT_6,  SLOT_7,
+	SLOT_8,  SLOT_9,  SLOT_10, SLOT_11, SLOT_12, SLOT_13, SLOT_14, SLOT_15,
+	SLOT_MAX,
+} vic_slot;
+
+/**
+ * Install an interrupt handler in a vectored interrupt slot. Host builds never
+ * raise interrupts: the handler is only recorded.
+ */
+void sark_vic_set(vic_slot slot, uint num, uint enable, int_handler handler);
+
+
+#endif /* SARK_H */
@@ -0,0 +1,136 @@
+/**
+ * Host-native stand-in for the spin1 API header.
+ *
+ * Provides the subset of the spin1 API used by spinn_test_driver along with a
+ * handful of stub_* hooks which let a host program (e.g. the benchmark harness)
+ * inspect and steer the fake hardware.
+ */
+
+#ifndef SPIN1_API_H
+#define SPIN1_API_H
+
+#include <stdbool.h>
+
+#include "spinnaker.h"
+#include "sark.h"
+
+
+/******************************************************************************
+ * Constants
+ ******************************************************************************/
+
+#define SUCCESS 1
+#define FAILURE 0
+
+// DMA directions
+#define DMA_READ  0
+#define DMA_WRITE 1
+
+// Event IDs accepted by spin1_callback_on
+#define MC_PACKET_RECEIVED 0
+#define DMA_TRANSFER_DONE  1
+#define TIMER_TICK         2
+#define SDP_PACKET_RX      3
+#define USER_EVENT         4
+#define NUM_EVENTS         5
+
+// LED control words
+#define LED_ON(n)  (1 << ((n) + 16))
+#define LED_OFF(n) (1 << (n))
+#define LED_INV(n) (1 << ((n) + 8))
+
+// Number of multicast routing table entries available to applications
+#define MC_TABLE_SIZE 1024
+
+
+/******************************************************************************
+ * API
+ ******************************************************************************/
+
+typedef void (*callback_t)(uint, uint);
+
+void spin1_callback_on(uint event_id, callback_t cback, int priority);
+void spin1_callback_off(uint event_id);
+
+void spin1_set_timer_tick(uint time);
+uint spin1_start(void);
+void spin1_stop(void);
+
+uint spin1_send_mc_packet(uint key, uint data, uint load);
+
+uint spin1_set_mc_table_entry(uint entry, uint key, uint mask, uint route);
+
+void spin1_application_core_map(uint chips_x, uint chips_y,
+                                uint core_map[chips_x][chips_y]);
+
+uint spin1_get_core_id(void);
+uint spin1_get_chip_id(void);
+
+void spin1_led_control(uint p);
+void spin1_delay_us(uint n);
+void spin1_memcpy(void *dst, void const *src, uint len);
+void *spin1_malloc(uint bytes);
+
+uint spin1_dma_transfer(uint tag, void *system_address, void *tcm_address,
+                        uint direction, uint length);
+
+void spin1_srand(uint seed);
+uint spin1_rand(void);
+
+
+/******************************************************************************
+ * Stub hooks (host builds only)
+ ******************************************************************************/
+
+// Print io_printf output to stderr when non-zero
+extern int stub_verbose;
+
+// Core ID reported by spin1_get_core_id
+extern uint stub_core_id;
+
+// When non-zero, spin1_send_mc_packet fails rather than sending
+extern int stub_tx_fail;
+
+// When non-negative, the number of further packets spin1_send_mc_packet will
+// accept before failing (decremented by each packet sent). Emulates a transmit
+// queue which is drained more slowly than packets are generated.
+extern int stub_tx_space;
+
+// Total number of packets accepted by spin1_send_mc_packet
+extern unsigned long stub_packets_sent;
+
+// A copy of the multicast routing table as written by the application
+typedef struct stub_mc_table_entry {
+	uint key;
+	uint mask;
+	uint route;
+} stub_mc_table_entry_t;
+extern stub_mc_table_entry_t stub_mc_table[MC_TABLE_SIZE];
+
+/**
+ * Perform a DMA transfer between SDRAM and a core-local buffer synchronously.
+ *
+ * Writes to the fake DMA controller's registers can't be observed so the
+ * application's DMA_ISSUE, which programs the controller directly on the chip,
+ * is replaced by this copy in host builds. The controller's status register
+ * always reads as idle.
+ */
+void stub_dma_issue(void *sdram, void *tcm, uint direction, uint length);
+#define DMA_ISSUE(sdram, tcm, direction, length) \
+	stub_dma_issue((sdram), (tcm), (direction), (length))
+
+/**
+ * Map the fake SDRAM and peripheral register regions at their real addresses.
+ * Must be called once before any application code runs.
+ */
+void stub_init(void);
+
+/**
+ * Deliver any packets sent since the last call back to this core's
+ * MC_PACKET_RECEIVED callback (i.e. a loop-back network). Returns the number
+ * of packets delivered.
+ */
+uint stub_deliver_packets(void);
+
+
+#endif /* SPIN1_API_H */
@@ -0,0 +1,319 @@
+/**
+ * Host-native stand-in for the spin1 API and SARK runtime.
+ *
+ * The SDRAM and peripheral register regions are backed by anonymous memory
+ * mapped at the addresses the real chip uses. DMA transfers complete
+ * immediately. Multicast packets are queued in a
+ * loop-back buffer and may be delivered back to the core's packet-received
+ * callback, either explicitly (stub_deliver_packets) or by the fake event loop
+ * in spin1_start.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "spinnaker.h"
+#include "spin1_api.h"
+
+
+/******************************************************************************
+ * Stub state
+ ******************************************************************************/
+
+static sv_t sv_stub = { .cpu_clk = 200 };
+sv_t *sv = &sv_stub;
+
+int  stub_verbose = 0;
+uint stub_core_id = 1;
+int  stub_tx_fail = 0;
+int  stub_tx_space = -1;
+
+unsigned long stub_packets_sent = 0;
+
+stub_mc_table_entry_t stub_mc_table[MC_TABLE_SIZE];
+
+static callback_t callbacks[NUM_EVENTS];
+
+static volatile bool stopped;
+
+static int_handler vic_handlers[SLOT_MAX];
+
+/**
+ * Loop-back packet buffer. When full the oldest packets are overwritten (the
+ * benchmark generates far more packets than it ever delivers).
+ */
+#define STUB_TX_BUFFER_SIZE 4096
+static struct { uint key; uint data; } tx_buffer[STUB_TX_BUFFER_SIZE];
+static uint tx_head = 0;
+static uint tx_count = 0;
+
+
+/******************************************************************************
+ * Fake hardware
+ ******************************************************************************/
+
+static void
+map_fixed(uint addr, uint size)
+{
+	void *p = mmap( (void *)(size_t)addr, size
+	              , PROT_READ | PROT_WRITE
+	              , MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE
+	              , -1, 0
+	              );
+	if (p != (void *)(size_t)addr) {
+		fprintf(stderr, "stub: could not map fake hardware at 0x%08x.\n", addr);
+		exit(1);
+	}
+}
+
+
+void
+stub_init(void)
+{
+	map_fixed(SDRAM_BASE_UNBUF, SDRAM_SIZE);
+	map_fixed(RTR_BASE_UNBUF,   RTR_SIZE);
+	map_fixed(TIMER_BASE_UNBUF, TIMER_SIZE);
+	map_fixed(DMA_BASE_UNBUF,   DMA_SIZE);
+	map_fixed(VIC_BASE_UNBUF,   VIC_SIZE);
+}
+
+
+void
+stub_dma_issue(void *sdram, void *tcm, uint direction, uint length)
+{
+	if (direction == DMA_READ)
+		memcpy(tcm, sdram, length);
+	else
+		memcpy(sdram, tcm, length);
+}
+
+
+uint
+stub_deliver_packets(void)
+{
+	uint delivered = 0;
+
+	while (tx_count) {
+		uint i = (tx_head + STUB_TX_BUFFER_SIZE - tx_count) % STUB_TX_BUFFER_SIZE;
+		tx_count--;
+
+		if (callbacks[MC_PACKET_RECEIVED])
+			callbacks[MC_PACKET_RECEIVED](tx_buffer[i].key, tx_buffer[i].data);
+		delivered++;
+	}
+
+	return delivered;
+}
+
+
+/******************************************************************************
+ * SARK
+ ******************************************************************************/
+
+void
+io_printf(char *stream, char *format, ...)
+{
+	if (!stub_verbose || stream == IO_NULL)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+
+void
+sark_vic_set(vic_slot slot, uint num, uint enable, int_handler handler)
+{
+	(void)num;
+	(void)enable;
+	vic_handlers[slot] = handler;
+}
+
+
+/******************************************************************************
+ * spin1 API
+ ******************************************************************************/
+
+void
+spin1_callback_on(uint event_id, callback_t cback, int priority)
+{
+	(void)priority;
+	callbacks[event_id] = cback;
+}
+
+
+void
+spin1_callback_off(uint event_id)
+{
+	callbacks[event_id] = NULL;
+}
+
+
+void
+spin1_set_timer_tick(uint time)
+{
+	(void)time;
+}
+
+
+/**
+ * A minimal event loop: fire timer ticks back-to-back, delivering any packets
+ * sent during a tick before the next one, until spin1_stop is called.
+ */
+uint
+spin1_start(void)
+{
+	uint ticks = 0;
+
+	stopped = false;
+	while (!stopped) {
+		if (callbacks[TIMER_TICK])
+			callbacks[TIMER_TICK](ticks++, 0);
+		else
+			break;
+
+		stub_deliver_packets();
+	}
+
+	return 0;
+}
+
+
+void
+spin1_stop(void)
+{
+	stopped = true;
+}
+
+
+uint
+spin1_send_mc_packet(uint key, uint data, uint load)
+{
+	(void)load;
+
+	if (stub_tx_fail || stub_tx_space == 0)
+		return FAILURE;
+	if (stub_tx_space > 0)
+		stub_tx_space--;
+
+	tx_buffer[tx_head].key  = key;
+	tx_buffer[tx_head].data = data;
+	tx_head = (tx_head + 1) % STUB_TX_BUFFER_SIZE;
+	if (tx_count < STUB_TX_BUFFER_SIZE)
+		tx_count++;
+
+	stub_packets_sent++;
+	return SUCCESS;
+}
+
+
+uint
+spin1_set_mc_table_entry(uint entry, uint key, uint mask, uint route)
+{
+	if (entry >= MC_TABLE_SIZE)
+		return FAILURE;
+
+	stub_mc_table[entry].key   = key;
+	stub_mc_table[entry].mask  = mask;
+	stub_mc_table[entry].route = route;
+	return SUCCESS;
+}
+
+
+void
+spin1_application_core_map(uint chips_x, uint chips_y,
+                           uint core_map[chips_x][chips_y])
+{
+	(void)chips_x;
+	(void)chips_y;
+	(void)core_map;
+}
+
+
+uint
+spin1_get_core_id(void)
+{
+	return stub_core_id;
+}
+
+
+uint
+spin1_get_chip_id(void)
+{
+	return 0;
+}
+
+
+void
+spin1_led_control(uint p)
+{
+	(void)p;
+}
+
+
+void
+spin1_delay_us(uint n)
+{
+	// Real delays would only distort benchmark timings.
+	(void)n;
+}
+
+
+void
+spin1_memcpy(void *dst, void const *src, uint len)
+{
+	memcpy(dst, src, len);
+}
+
+
+void *
+spin1_malloc(uint bytes)
+{
+	return malloc(bytes);
+}
+
+
+/**
+ * DMA transfers complete immediately, the DMA_TRANSFER_DONE callback being
+ * called before returning.
+ */
+uint
+spin1_dma_transfer(uint tag, void *system_address, void *tcm_address,
+                   uint direction, uint length)
+{
+	static uint id = 1; // Zero is FAILURE
+	
+	stub_dma_issue(system_address, tcm_address, direction, length);
+	
+	if (callbacks[DMA_TRANSFER_DONE])
+		callbacks[DMA_TRANSFER_DONE](id, tag);
+	
+	return id++;
+}
+
+
+static uint rand_state = 1;
+
+void
+spin1_srand(uint seed)
+{
+	rand_state = seed ? seed : 1;
+}
+
+
+uint
+spin1_rand(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
@@ -0,0 +1,143 @@
+/**
+ * Host-native stand-in for the SpiNNaker hardware definitions header.
+ *
+ * Only the definitions used by spinn_test_driver are provided. Peripheral
+ * addresses match the real chip: the stub library (spin1_stub.c) maps ordinary
+ * memory at these addresses so that the application's register and SDRAM
+ * accesses (including its pointer-to-uint casts) work unchanged on a 64-bit
+ * Linux host.
+ */
+
+#ifndef SPINNAKER_H
+#define SPINNAKER_H
+
+#include <stddef.h>
+
+
+/******************************************************************************
+ * Basic types
+ ******************************************************************************/
+
+typedef unsigned char  uchar;
+typedef unsigned short ushort;
+typedef unsigned int   uint;
+
+
+/******************************************************************************
+ * Memory map
+ ******************************************************************************/
+
+#define SDRAM_BASE_UNBUF 0x70000000
+#define SDRAM_SIZE       (128 * 1024 * 1024)
+
+#define RTR_BASE_UNBUF   0xe1000000
+#define RTR_SIZE         0x00010000
+
+#define TIMER_BASE_UNBUF 0x11000000
+#define TIMER_SIZE       0x00001000
+
+#define DMA_BASE_UNBUF   0x30000000
+#define DMA_SIZE         0x00001000
+
+#define VIC_BASE_UNBUF   0x1f000000
+#define VIC_SIZE         0x00001000
+
+
+/******************************************************************************
+ * Timer registers (word offsets from TIMER_BASE_UNBUF)
+ ******************************************************************************/
+
+#define T1_LOAD     0
+#define T1_COUNT    1
+#define T1_CONTROL  2
+#define T1_INT_CLR  3
+#define T1_RAW_INT  4
+#define T1_MASK_INT 5
+#define T1_BG_LOAD  6
+
+#define T2_LOAD     8
+#define T2_COUNT    9
+#define T2_CONTROL  10
+#define T2_INT_CLR  11
+#define T2_RAW_INT  12
+#define T2_MASK_INT 13
+#define T2_BG_LOAD  14
+
+
+/******************************************************************************
+ * DMA controller registers (word offsets from DMA_BASE_UNBUF)
+ ******************************************************************************/
+
+#define DMA_ADRS 0
+#define DMA_ADRT 1
+#define DMA_DESC 2
+#define DMA_CTRL 3
+#define DMA_STAT 4
+#define DMA_GCTL 5
+
+
+/******************************************************************************
+ * Interrupt controller registers (word offsets from VIC_BASE_UNBUF) and
+ * interrupt numbers
+ ******************************************************************************/
+
+#define VIC_ENABLE  4
+#define VIC_DISABLE 5
+#define VIC_VADDR   12
+
+#define RTR_DUMP_INT 16
+
+
+/******************************************************************************
+ * Router registers (word offsets from RTR_BASE_UNBUF)
+ ******************************************************************************/
+
+#define RTR_CONTROL 0
+#define RTR_STATUS  1
+#define RTR_EHDR    2
+#define RTR_EKEY    3
+#define RTR_EDAT    4
+#define RTR_ESTAT   5
+#define RTR_DHDR    6
+#define RTR_DKEY    7
+#define RTR_DDAT    8
+#define RTR_DLINK   9
+#define RTR_DSTAT   10
+#define RTR_DGEN    11
+
+#define RTR_DGF0    (0x200 / 4)
+#define RTR_DGF1    (0x204 / 4)
+#define RTR_DGF2    (0x208 / 4)
+#define RTR_DGF3    (0x20c / 4)
+#define RTR_DGF4    (0x210 / 4)
+#define RTR_DGF5    (0x214 / 4)
+#define RTR_DGF6    (0x218 / 4)
+#define RTR_DGF7    (0x21c / 4)
+#define RTR_DGF8    (0x220 / 4)
+#define RTR_DGF9    (0x224 / 4)
+#define RTR_DGF10   (0x228 / 4)
+#define RTR_DGF11   (0x22c / 4)
+#define RTR_DGF12   (0x230 / 4)
+#define RTR_DGF13   (0x234 / 4)
+#define RTR_DGF14   (0x238 / 4)
+#define RTR_DGF15   (0x23c / 4)
+
+#define RTR_DGC0    (0x300 / 4)
+#define RTR_DGC1    (0x304 / 4)
+#define RTR_DGC2    (0x308 / 4)
+#define RTR_DGC3    (0x30c / 4)
+#define RTR_DGC4    (0x310 / 4)
+#define RTR_DGC5    (0x314 / 4)
+#define RTR_DGC6    (0x318 / 4)
+#define RTR_DGC7    (0x31c / 4)
+#define RTR_DGC8    (0x320 / 4)
+#define RTR_DGC9    (0x324 / 4)
+#define RTR_DGC10   (0x328 / 4)
+#define RTR_DGC11   (0x32c / 4)
+#define RTR_DGC12   (0x330 / 4)
+#define RTR_DGC13   (0x334 / 4)
+#define RTR_DGC14   (0x338 / 4)
+#define RTR_DGC15   (0x33c / 4)
+
+
+#endif /* SPINNAKER_H */
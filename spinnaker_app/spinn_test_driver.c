@@ -12,7 +12,168 @@
 #define MIN(a,b) (((a)<(b)) ? (a) : (b))
 #define MAX(a,b) (((a)<(b)) ? (b) : (a))
 
+/**
+ * Messages from the per-core logic go to the core's IO buffer.
+ */
+#define CORE_PRINTF(core, ...) io_printf(IO_BUF, __VA_ARGS__)
+
+#include "spinn_test_driver_core.c"
+
 static volatile uint * const rtr_unbuf = (uint *) RTR_BASE_UNBUF;
+static volatile uint * const dma_unbuf = (uint *) DMA_BASE_UNBUF;
+static volatile uint * const tc_unbuf  = (uint *) TIMER_BASE_UNBUF;
+static volatile uint * const vic_unbuf = (uint *) VIC_BASE_UNBUF;
+
+/**
+ * The state of this core (see spinn_test_driver_core.h), pointed at the
+ * configuration and runtime arrays below by load_config.
+ */
+core_state_t this_core;
+
+/**
+ * Is this core the chip's lead, responsible for the router and the chip's
+ * status? The host marks the lead (see CONFIG_FLAG_LEAD) rather than leaving it
+ * to whichever core the spin1 API picks.
+ */
+#define LEAD_CORE lead_core(&this_core)
+
+
+/******************************************************************************
+ * DMA and timing
+ ******************************************************************************/
+
+/**
+ * DMA controller status bits.
+ */
+#define DMA_STAT_TRANSFERRING (1u<<0)
+#define DMA_STAT_QUEUE_FULL   (1u<<2)
+
+/**
+ * DMA controller control bit which clears the transfer-done interrupt.
+ */
+#define DMA_CTRL_CLEAR_DONE (1u<<3)
+
+/**
+ * Hand a transfer of length bytes between SDRAM and DTCM to the DMA controller.
+ * The controller must have space in its queue. Host builds supply their own
+ * definition.
+ */
+#ifndef DMA_ISSUE
+#define DMA_ISSUE(sdram, tcm, direction, length) do { \
+		dma_unbuf[DMA_ADRS] = (uint)(sdram);          \
+		dma_unbuf[DMA_ADRT] = (uint)(tcm);            \
+		dma_unbuf[DMA_DESC] = 1u<<24 /* Word width */ \
+		                    | 4u<<21 /* Burst 16 */   \
+		                    | (direction)<<19         \
+		                    | (length)                \
+		                    ;                         \
+	} while (0)
+#endif
+
+
+/**
+ * Is spin1_start running? Until it is, the spin1 API's own DMA queue (and
+ * completion callbacks) are not serviced so the controller is driven directly.
+ * Once it is, transfers must go through spin1_dma_transfer: the spin1 API
+ * assumes each transfer-done interrupt completes the transfer at the head of
+ * its queue (e.g. a sample still being written) and acknowledging one directly
+ * would leave that transfer's callback uncalled.
+ */
+bool dma_via_spin1 = false;
+
+/**
+ * The tag given to transfers started by dma_start through spin1_dma_transfer
+ * (tags below this are those of the sample buffers) and the number of them yet
+ * to complete, counted down by on_dma_transfer_done.
+ */
+#define DMA_TAG_DIRECT 2u
+volatile uint dma_direct_outstanding = 0u;
+
+/**
+ * Start a DMA transfer between SDRAM and DTCM without waiting for it to
+ * complete. The DMA controller holds one transfer in progress and one queued so
+ * this only blocks while two earlier transfers are outstanding (or, while
+ * spin1_start is running, while the spin1 API's queue is full).
+ */
+void
+dma_start(void *sdram, void *tcm, uint direction, uint length)
+{
+	if (length == 0u)
+		return;
+	
+	if (dma_via_spin1) {
+		dma_direct_outstanding++;
+		while (spin1_dma_transfer(DMA_TAG_DIRECT, sdram, tcm, direction, length) == FAILURE)
+			;
+		return;
+	}
+	
+	while (dma_unbuf[DMA_STAT] & DMA_STAT_QUEUE_FULL)
+		;
+	
+	DMA_ISSUE(sdram, tcm, direction, length);
+}
+
+
+/**
+ * Wait for all outstanding DMA transfers started by dma_start to complete.
+ */
+void
+dma_wait(void)
+{
+	if (dma_via_spin1) {
+		while (dma_direct_outstanding)
+			;
+		return;
+	}
+	
+	while (dma_unbuf[DMA_STAT] & (DMA_STAT_TRANSFERRING | DMA_STAT_QUEUE_FULL))
+		;
+	
+	dma_unbuf[DMA_CTRL] = DMA_CTRL_CLEAR_DONE;
+}
+
+
+/**
+ * Wait for all but the most recently started DMA transfer to complete
+ * (transfers complete in the order they were started).
+ */
+void
+dma_wait_previous(void)
+{
+	if (dma_via_spin1) {
+		while (dma_direct_outstanding > 1u)
+			;
+		return;
+	}
+	
+	while (dma_unbuf[DMA_STAT] & DMA_STAT_QUEUE_FULL)
+		;
+}
+
+
+/**
+ * Start timer 2 (unused by the spin1 API) free-running from 0xFFFFFFFF at the
+ * CPU clock rate so that the time taken to load and store the configuration
+ * can be measured.
+ */
+void
+timer2_start(void)
+{
+	tc_unbuf[T2_CONTROL] = 0u;
+	tc_unbuf[T2_LOAD]    = 0xFFFFFFFFu;
+	tc_unbuf[T2_CONTROL] = 0x82u; // Enabled, free-running, 32-bit, no prescale
+}
+
+
+/**
+ * Get the number of microseconds elapsed since the given value of timer 2.
+ */
+static inline uint
+timer2_elapsed_us(uint start)
+{
+	return (start - tc_unbuf[T2_COUNT]) / sv->cpu_clk;
+}
 
 
 /******************************************************************************
@@ -34,132 +195,502 @@ config_root_t config_root;
 /**
  * Core-local versions of the source/sink data structures for this core.
  */
-config_source_t       config_sources[MAX_SOURCES_PER_CORE];
-config_sink_t         config_sinks[MAX_SINKS_PER_CORE];
-config_router_entry_t config_router_entries[MAX_ROUTES_PER_CORE];
+config_source_t config_sources[ARRAY_LENGTH(MAX_SOURCES_PER_CORE)];
+config_sink_t   config_sinks[ARRAY_LENGTH(MAX_SINKS_PER_CORE)];
+
+/**
+ * Latency histograms for each sink (when CONFIG_FLAG_LATENCY is set).
+ */
+config_latency_histogram_t config_latency_histograms[ARRAY_LENGTH(MAX_LATENCY_SINKS_PER_CORE)];
+
+/**
+ * The runtime state of each source, the sources given a trial every tick and
+ * the heap of the others (see core_state_t).
+ */
+source_state_t source_states[ARRAY_LENGTH(MAX_SOURCES_PER_CORE)];
+ushort         dense_sources[ARRAY_LENGTH(MAX_SOURCES_PER_CORE)];
+ushort         source_heap[ARRAY_LENGTH(MAX_SOURCES_PER_CORE)];
+
+
+/**
+ * Marks an unused sink_table entry.
+ */
+#define SINK_TABLE_EMPTY 0xFFFFu
+
+/**
+ * A table mapping routing keys to indices into config_sinks, built by
+ * build_sink_table. When sink_table_hashed is false this is indexed directly by
+ * (key - sink_key_base) for keys up to sink_key_base + sink_table_span - 1.
+ * Otherwise it is an open-addressed (linearly probed) hash table of
+ * sink_table_span entries.
+ */
+ushort sink_table[SINK_TABLE_SIZE];
+bool   sink_table_hashed;
+uint   sink_key_base;
+uint   sink_table_span;
+uint   sink_table_hash_shift;
+
+
+/**
+ * Hash a routing key into a sink_table of 2^(32-sink_table_hash_shift) entries
+ * (Fibonacci hashing).
+ */
+static inline uint
+sink_hash(uint key)
+{
+	return (key * 0x9E3779B1u) >> sink_table_hash_shift;
+}
+
+
+/**
+ * Build the sink lookup table for the sinks in config_sinks. Since add_stream
+ * assigns sequential routing keys the sinks of a core usually occupy a dense
+ * range of keys and so can be directly indexed.
+ */
+void
+build_sink_table(void)
+{
+	uint num_sinks = config_root.num_sinks;
+	
+	for (int i = 0; i < SINK_TABLE_SIZE; i++)
+		sink_table[i] = SINK_TABLE_EMPTY;
+	
+	// Sinks are sorted by routing key so their extent is easily found.
+	if (num_sinks == 0
+	    || config_sinks[num_sinks-1].routing_key - config_sinks[0].routing_key < SINK_TABLE_SIZE) {
+		sink_table_hashed = false;
+		sink_key_base     = num_sinks ? config_sinks[0].routing_key : 0u;
+		sink_table_span   = num_sinks ? config_sinks[num_sinks-1].routing_key - sink_key_base + 1 : 0u;
+		
+		for (int i = 0; i < num_sinks; i++)
+			sink_table[config_sinks[i].routing_key - sink_key_base] = i;
+	} else {
+		// Pick the smallest power-of-two table at least twice the number of sinks
+		sink_table_hashed     = true;
+		sink_table_hash_shift = 31;
+		while ((1u << (32 - sink_table_hash_shift)) < 2*num_sinks)
+			sink_table_hash_shift--;
+		sink_table_span = 1u << (32 - sink_table_hash_shift);
+		
+		for (int i = 0; i < num_sinks; i++) {
+			uint slot = sink_hash(config_sinks[i].routing_key);
+			while (sink_table[slot] != SINK_TABLE_EMPTY)
+				slot = (slot + 1) & (sink_table_span - 1);
+			sink_table[slot] = i;
+		}
+	}
+}
+
+
+/**
+ * Find the sink for a given routing key, returning NULL if this core has no
+ * sink for the key.
+ */
+static inline config_sink_t *
+platform_find_sink(core_state_t *core, uint key)
+{
+	if (!HAS_SINKS)
+		return NULL;
+	
+	if (!sink_table_hashed) {
+		uint offset = key - sink_key_base;
+		if (offset < sink_table_span && sink_table[offset] != SINK_TABLE_EMPTY)
+			return &config_sinks[sink_table[offset]];
+		return NULL;
+	}
+	
+	uint slot = sink_hash(key);
+	while (sink_table[slot] != SINK_TABLE_EMPTY) {
+		if (config_sinks[sink_table[slot]].routing_key == key)
+			return &config_sinks[sink_table[slot]];
+		slot = (slot + 1) & (sink_table_span - 1);
+	}
+	return NULL;
+}
+
+
+
+/**
+ * Get the SDRAM addresses of the source, sink, latency histogram and router
+ * entry arrays which follow this core's config_root.
+ */
+static inline config_source_t *
+config_sources_sdram_addr(config_root_t *config_root_sdram_addr)
+{
+	return (config_source_t *)(config_root_sdram_addr + 1);
+}
+
+static inline config_sink_t *
+config_sinks_sdram_addr(config_root_t *config_root_sdram_addr)
+{
+	return (config_sink_t *)( config_sources_sdram_addr(config_root_sdram_addr)
+	                        + config_root.num_sources
+	                        );
+}
+
+static inline config_latency_histogram_t *
+config_latency_histograms_sdram_addr(config_root_t *config_root_sdram_addr)
+{
+	return (config_latency_histogram_t *)( config_sinks_sdram_addr(config_root_sdram_addr)
+	                                     + config_root.num_sinks
+	                                     );
+}
+
+static inline config_router_entry_t *
+config_router_entries_sdram_addr(config_root_t *config_root_sdram_addr)
+{
+	return (config_router_entry_t *)( config_latency_histograms_sdram_addr(config_root_sdram_addr)
+	                                + num_latency_histograms(&this_core)
+	                                );
+}
 
 
 /**
  * A function which will load the configuration (for this core only) from the
  * shared SDRAM into the core-local variables above.
  *
- * Note that this is currently implemented the slow way using memcpy rather than
- * DMA to simplify programing as the penalty for the one-off copy is not too
- * significant.
+ * The config_root must arrive first since it gives the size of the remaining
+ * arrays. These are then fetched by DMA with the sinks first: the sink table is
+ * built while the sources are still in flight and the core map is copied in
+ * the meantime. Router entries are left in SDRAM for setup_router.
  */
 void
 load_config(void)
 {
+	timer2_start();
+	uint start_time = tc_unbuf[T2_COUNT];
+	
+	this_core.root          = &config_root;
+	this_core.sources       = config_sources;
+	this_core.sinks         = config_sinks;
+	this_core.histograms    = config_latency_histograms;
+	this_core.source_states = source_states;
+	this_core.dense_sources = dense_sources;
+	this_core.source_heap   = source_heap;
+	
+	// Load the config_root for this core
+	config_root_t *config_root_sdram_addr = CONFIG_ROOT_SDRAM_ADDR(spin1_get_core_id());
+	dma_start(config_root_sdram_addr, &config_root, DMA_READ, sizeof(config_root_t));
+	dma_wait();
+	
+	// Make sure the configuration fits the space the host gave it, the local
+	// arrays and the router (and that this build can load router entries and
+	// take the lead), otherwise run (and fail) without any sources, sinks or
+	// router entries.
+	uint length = sizeof(config_root_t)
+	            + sizeof(config_source_t)            * config_root.num_sources
+	            + sizeof(config_sink_t)              * config_root.num_sinks
+	            + sizeof(config_latency_histogram_t) * num_latency_histograms(&this_core)
+	            + sizeof(config_router_entry_t)      * config_root.num_router_entries
+	            ;
+	if (   config_root.num_sources        > MAX_SOURCES_PER_CORE
+	    || config_root.num_sinks          > MAX_SINKS_PER_CORE
+	    || num_latency_histograms(&this_core)       > MAX_LATENCY_SINKS_PER_CORE
+	    || config_root.num_router_entries > (HAS_LEAD ? MAX_ROUTER_ENTRIES : 0u)
+	    || ((config_root.flags & CONFIG_FLAG_LEAD) && !HAS_LEAD)
+	    || (config_root.counter_mask >> NUM_ROUTER_COUNTERS)
+	    || ((config_root.flags & CONFIG_FLAG_SEARCH) && !config_root.num_phases)
+	    || length                         > CONFIG_DIRECTORY_SDRAM_ADDR[spin1_get_core_id()].length) {
+		io_printf( IO_BUF, "Config of %d bytes at 0x%08x does not fit.\n"
+		         , length
+		         , (uint)config_root_sdram_addr
+		         );
+		config_root.completion_state   = COMPLETION_STATE_FAILIURE;
+		config_root.num_sources        = 0u;
+		config_root.num_sinks          = 0u;
+		config_root.num_router_entries = 0u;
+		config_root.num_phases         = 0u;
+		config_root.counter_mask       = 0u;
+		config_root.flags             &= ~CONFIG_FLAG_SEARCH;
+	}
+	
+	// Fetch the sink and source arrays
+	dma_start( config_sinks_sdram_addr(config_root_sdram_addr)
+	         , config_sinks
+	         , DMA_READ
+	         , sizeof(config_sink_t) * config_root.num_sinks
+	         );
+	dma_start( config_sources_sdram_addr(config_root_sdram_addr)
+	         , config_sources
+	         , DMA_READ
+	         , sizeof(config_source_t) * config_root.num_sources
+	         );
+	
+	// Index the sinks by routing key once they've arrived (i.e. when only the
+	// sources remain in flight)
+	if (config_root.num_sources)
+		dma_wait_previous();
+	else
+		dma_wait();
+	build_sink_table();
+	
 	// Load the core-map for this core
 	uint *core_map_root = CORE_MAP_SDRAM_ADDR;
 	system_width  = core_map_root[0];
 	system_height = core_map_root[1];
 	spin1_memcpy(core_map, &(core_map_root[2]), sizeof(uint)*system_width*system_height);
 	
-	// Load the config_root for this core
-	config_root_t *config_root_sdram_addr = CONFIG_ROOT_SDRAM_ADDR(spin1_get_core_id());
-	spin1_memcpy(&config_root, config_root_sdram_addr, sizeof(config_root_t));
-	
-	// Seed the random number generator
-	spin1_srand(config_root.seed);
-	
-	// Calculate the address of the source & sink arrays and copy them across.
-	config_source_t *config_sources_sdram_addr = (config_source_t *)(
-		((uint)config_root_sdram_addr)
-		+ sizeof(config_root_t)
-	);
-	config_sink_t *config_sinks_sdram_addr = (config_sink_t *)(
-		((uint)config_root_sdram_addr)
-		+ sizeof(config_root_t)
-		+ sizeof(config_source_t) * config_root.num_sources
-	);
-	config_router_entry_t *config_router_entries_sdram_addr = (config_router_entry_t *)(
-		((uint)config_root_sdram_addr)
-		+ sizeof(config_root_t)
-		+ sizeof(config_source_t) * config_root.num_sources
-		+ sizeof(config_sink_t)   * config_root.num_sinks
-	);
-	spin1_memcpy( &config_sources
-	            , config_sources_sdram_addr
-	            , sizeof(config_source_t) * config_root.num_sources
-	            );
-	spin1_memcpy( &config_sinks
-	            , config_sinks_sdram_addr
-	            , sizeof(config_sink_t) * config_root.num_sinks
-	            );
-	spin1_memcpy( &config_router_entries
-	            , config_router_entries_sdram_addr
-	            , sizeof(config_router_entry_t) * config_root.num_router_entries
-	            );
-	
-	io_printf( IO_BUF, "Loaded root config from 0x%08x with %d sources, %d sinks and %d router entries and %d/%d warmup/experiment cycles.\n"
+	// Clear the latency histograms
+	for (int i = 0; i < num_latency_histograms(&this_core); i++)
+		for (int bin = 0; bin < LATENCY_HISTOGRAM_BINS; bin++)
+			config_latency_histograms[i].result_bins[bin] = 0u;
+	config_root.result_cpu_clk = sv->cpu_clk;
+	
+	config_root.result_num_samples     = 0u;
+	config_root.result_samples_dropped = 0u;
+	
+	dma_wait();
+	
+	config_root.result_load_time = timer2_elapsed_us(start_time);
+	
+	io_printf( IO_BUF, "Loaded root config from 0x%08x with %d sources, %d sinks and %d router entries and %d/%d warmup/experiment cycles in %d us.\n"
 	         , (uint)config_root_sdram_addr
 	         , config_root.num_sources
 	         , config_root.num_sinks
 	         , config_root.num_router_entries
 	         , config_root.warmup_duration
 	         , config_root.duration
+	         , config_root.result_load_time
 	         );
 }
 
 
+/**
+ * Get the SDRAM address of the slot the results of the given phase of a sweep
+ * are written to.
+ */
+static inline config_root_t *
+phase_results_sdram_addr(uint phase)
+{
+	uint size = sizeof(config_root_t)
+	          + sizeof(config_source_t)            * config_root.num_sources
+	          + sizeof(config_sink_t)              * config_root.num_sinks
+	          + sizeof(config_latency_histogram_t) * num_latency_histograms(&this_core)
+	          ;
+	return (config_root_t *)( (uchar *)(SDRAM_BASE_UNBUF)
+	                        + config_root.phase_results_offset
+	                        + phase * size
+	                        );
+}
+
+
+/**
+ * Sum (modulo 2^32) every word of an array.
+ */
+static inline uint
+sum_words(const void *data, uint bytes)
+{
+	const uint *words = data;
+	uint sum = 0u;
+	for (uint i = 0u; i < bytes / sizeof(uint); i++)
+		sum += words[i];
+	return sum;
+}
+
+
+/**
+ * The count of a router diagnostic counter if it is in the experiment's counter
+ * profile, otherwise zero.
+ */
+static inline uint
+router_counter(uint counter)
+{
+	return (config_root.counter_mask & (1u << counter)) ? rtr_unbuf[RTR_DGC0 + counter] : 0u;
+}
+
+/**
+ * Router counters are read directly.
+ */
+static uint
+platform_router_counter(core_state_t *core, uint counter)
+{
+	return router_counter(counter);
+}
+
+
+/**
+ * Write the source, sink and latency histogram results into the arrays
+ * following the config_root at the given SDRAM address and record the router
+ * counters and a checksum of the arrays in the config_root. The (local)
+ * config_root is not written.
+ */
+static void
+write_result_arrays(config_root_t *config_root_sdram_addr)
+{
+	// Copy source, sink and latency histogram results back.
+	dma_start( config_sources_sdram_addr(config_root_sdram_addr)
+	         , config_sources
+	         , DMA_WRITE
+	         , sizeof(config_source_t) * config_root.num_sources
+	         );
+	dma_start( config_sinks_sdram_addr(config_root_sdram_addr)
+	         , config_sinks
+	         , DMA_WRITE
+	         , sizeof(config_sink_t) * config_root.num_sinks
+	         );
+	dma_start( config_latency_histograms_sdram_addr(config_root_sdram_addr)
+	         , config_latency_histograms
+	         , DMA_WRITE
+	         , sizeof(config_latency_histogram_t) * num_latency_histograms(&this_core)
+	         );
+	
+	// Record router counters
+	config_root.result_forwarded_packets = router_counter(FWD_CNTR);
+	config_root.result_dropped_packets   = router_counter(DRP_CNTR);
+	for (uint i = 0u; i < NUM_ROUTER_COUNTERS; i++)
+		config_root.result_counters[i] = router_counter(i);
+	
+	// Checksum the results while they're being written
+	config_root.result_checksum = sum_words(config_sources, sizeof(config_source_t) * config_root.num_sources)
+	                            + sum_words(config_sinks,   sizeof(config_sink_t)   * config_root.num_sinks)
+	                            + sum_words( config_latency_histograms
+	                                       , sizeof(config_latency_histogram_t) * num_latency_histograms(&this_core)
+	                                       );
+	
+	dma_wait();
+}
+
+
+/**
+ * Write the results of the phase of a sweep which has just ended into its
+ * slot in SDRAM.
+ */
+void
+store_phase_results(uint phase)
+{
+	config_root_t *config_root_sdram_addr = phase_results_sdram_addr(phase);
+	
+	write_result_arrays(config_root_sdram_addr);
+	dma_start(config_root_sdram_addr, &config_root, DMA_WRITE, sizeof(config_root_t));
+	dma_wait();
+}
+
+/**
+ * Phase results are stored by DMA.
+ */
+static void
+platform_store_phase_results(core_state_t *core, uint phase)
+{
+	store_phase_results(phase);
+}
+
+
 /**
  * A function which will store a copy of the results in SDRAM, overwriting the
  * original configuration.
  *
- * Note that this is currently implemented the slow way using memcpy rather than
- * DMA to simplify programing as the penalty for the one-off copy is not too
- * significant.
+ * The source and sink results are written back by DMA while the router's
+ * counters are read. The config_root is written once they're complete.
  */
 void
 store_results(void)
 {
 	// Turn on LED until results written
-	if (leadAp)
+	if (LEAD_CORE)
 		spin1_led_control(LED_ON(BLINK_LED));
 	
-	// Copy source results back.
-	config_source_t *config_sources_sdram_addr = (config_source_t *)( ((uint)CONFIG_ROOT_SDRAM_ADDR(spin1_get_core_id()))
-	                                                                  + sizeof(config_root_t)
-	                                                                )
-	                                           ;
-	spin1_memcpy( config_sources_sdram_addr
-	            , &config_sources
-	            , sizeof(config_source_t) * config_root.num_sources
-	            );
-	
-	// Copy sink results back.
-	config_sink_t *config_sinks_sdram_addr = (config_sink_t *)( ((uint)CONFIG_ROOT_SDRAM_ADDR(spin1_get_core_id()))
-	                                                            + sizeof(config_root_t)
-	                                                            + sizeof(config_source_t) * config_root.num_sources
-	                                                          )
-	                                         ;
-	spin1_memcpy( config_sinks_sdram_addr
-	            , &config_sinks
-	            , sizeof(config_sink_t) * config_root.num_sinks
-	            );
+	timer2_start();
+	uint start_time = tc_unbuf[T2_COUNT];
 	
-	// Record router counters
-	config_root.result_forwarded_packets = rtr_unbuf[FWD_CNTR_CNT];
-	config_root.result_dropped_packets   = rtr_unbuf[DRP_CNTR_CNT];
+	config_root_t *config_root_sdram_addr = CONFIG_ROOT_SDRAM_ADDR(spin1_get_core_id());
+	
+	write_result_arrays(config_root_sdram_addr);
+	
+	config_root.result_store_time = timer2_elapsed_us(start_time);
 	
 	// Copy root config results back last so that the completion_state is only
-	// updated when most of the data is coppied back.
-	config_root_t *config_root_sdram_addr = CONFIG_ROOT_SDRAM_ADDR(spin1_get_core_id());
-	spin1_memcpy(config_root_sdram_addr, &config_root, sizeof(config_root_t));
+	// updated when the rest of the data is coppied back.
+	dma_start(config_root_sdram_addr, &config_root, DMA_WRITE, sizeof(config_root_t));
+	dma_wait();
 	
 	// Note that routes are not copied back because they aren't changed.
 	
-	io_printf( IO_BUF, "Stored results back into 0x%08x.\n"
+	io_printf( IO_BUF, "Stored results back into 0x%08x in %d us.\n"
 	         , (uint)config_root_sdram_addr
+	         , config_root.result_store_time
 	         );
 	
 	// Turn off LED on completion.
-	if (leadAp)
+	if (LEAD_CORE)
 		spin1_led_control(LED_OFF(BLINK_LED));
 }
 
 
+/**
+ * Record in the chip status that this core has started (and so no longer
+ * needs the APLX it was loaded from).
+ */
+void
+report_started(void)
+{
+	volatile chip_status_t *chip_status = CHIP_STATUS_SDRAM_ADDR;
+	chip_status->core_started[spin1_get_core_id()] = 1u;
+}
+
+
+/**
+ * Record this core's completion state and result checksum in the chip status
+ * once its results have been stored.
+ */
+void
+report_completion(void)
+{
+	volatile chip_status_t *chip_status = CHIP_STATUS_SDRAM_ADDR;
+	uint core = spin1_get_core_id();
+	
+	// The checksum must be in place before the state says it is valid
+	chip_status->core_checksums[core] = config_root.result_checksum;
+	chip_status->core_states[core] = ( config_root.completion_state == COMPLETION_STATE_RUNNING
+	                                 ? COMPLETION_STATE_FAILIURE
+	                                 : config_root.completion_state
+	                                 );
+}
+
+
+/**
+ * Wait for every core on the chip with a configuration to report completion
+ * (or for CHIP_STATUS_TIMEOUT_US to pass) and then publish the chip's
+ * aggregate status. Called by the lead core only, once its own results are
+ * stored.
+ */
+void
+aggregate_chip_status(void)
+{
+	volatile chip_status_t *chip_status = CHIP_STATUS_SDRAM_ADDR;
+	
+	uint bad_cores = 0u;
+	uint checksum  = 0u;
+	uint waited    = 0u;
+	
+	for (uint core = 0u; core < MAX_CORES_PER_CHIP; core++) {
+		// Cores without a configuration take no part
+		if (CONFIG_DIRECTORY_SDRAM_ADDR[core].length == 0u)
+			continue;
+		
+		while (chip_status->core_states[core] == COMPLETION_STATE_RUNNING
+		       && waited < CHIP_STATUS_TIMEOUT_US) {
+			spin1_delay_us(CHIP_STATUS_POLL_US);
+			waited += CHIP_STATUS_POLL_US;
+		}
+		
+		if (chip_status->core_states[core] == COMPLETION_STATE_SUCCESS)
+			checksum += chip_status->core_checksums[core];
+		else
+			bad_cores |= 1u << core;
+	}
+	
+	chip_status->bad_cores = bad_cores;
+	chip_status->checksum  = checksum;
+	chip_status->completion_state = bad_cores ? COMPLETION_STATE_FAILIURE
+	                                          : COMPLETION_STATE_SUCCESS;
+	
+	io_printf( IO_BUF, "Chip status: bad cores 0x%05x, checksum 0x%08x.\n"
+	         , bad_cores
+	         , checksum
+	         );
+}
+
+
 /******************************************************************************
  * Router config/state access functions
  ******************************************************************************/
@@ -168,71 +699,116 @@ store_results(void)
 // started.
 uint rtr_control_orig_state;
 
+// The original filters and enable bits (RTR_DGEN) of the diagnostic counters in
+// the experiment's counter profile.
+uint rtr_counter_filters_orig_state[NUM_ROUTER_COUNTERS];
+uint rtr_dgen_orig_state;
+
+// Buffers into which successive chunks of router entries are fetched from
+// SDRAM: one is installed while the next chunk arrives in the other. Only
+// builds with a lead core's duties load router entries.
+config_router_entry_t router_entry_buffers[2][HAS_LEAD ? ROUTER_ENTRY_CHUNK : 1u];
+
+
+/**
+ * Set the router's packet drop timeout to that of the current experiment (or
+ * phase). Only one core configures the router.
+ */
+static void
+platform_set_router_timeout(core_state_t *core)
+{
+	if (LEAD_CORE)
+		rtr_unbuf[RTR_CONTROL] = (rtr_unbuf[RTR_CONTROL] & ~0x00FF8000u)
+		                       | (config_root.rtr_drop_e<<4 | config_root.rtr_drop_m) << 16
+		                       | 1<<15 // Re-initialise counters
+		                       ;
+}
+
+
+/**
+ * Set the router's packet drop timeout to its longest while a saturation
+ * search's control packets are exchanged: the reports of every core converge
+ * on the master at once.
+ */
+static void
+platform_hold_router(core_state_t *core)
+{
+	if (LEAD_CORE)
+		rtr_unbuf[RTR_CONTROL] = (rtr_unbuf[RTR_CONTROL] & ~0x00FF8000u)
+		                       | 0xFFu << 16
+		                       ;
+}
+
 
 /**
  * Load the routing tables and router parameters as required by the current
- * experiment. The existing router parameters are stored into the
- * rtr_control_orig_state to be restored by cleanup_router at the end of the
- * experiment.
+ * experiment. The existing router parameters (and the filters of the counters
+ * in the counter profile) are stored into the rtr_*_orig_state to be restored
+ * by cleanup_router at the end of the experiment.
  */
 void
 setup_router(void)
 {
-	// Install the router entries
-	for (int i = 0; i < config_root.num_router_entries; i++) {
-		if (!spin1_set_mc_table_entry( i
-		                             , config_router_entries[i].key
-		                             , config_router_entries[i].mask
-		                             , config_router_entries[i].route
-		                             )) {
-			io_printf( IO_BUF, "Could not load routing table entry %d with key 0x%08x"
-			         , i
-			         , config_router_entries[i].key
+	// Install the router entries, streaming them from SDRAM a chunk at a time
+	config_router_entry_t *config_router_entries_sdram =
+		config_router_entries_sdram_addr(CONFIG_ROOT_SDRAM_ADDR(spin1_get_core_id()));
+	uint num_router_entries = HAS_LEAD ? config_root.num_router_entries : 0u;
+	
+	dma_start( config_router_entries_sdram
+	         , router_entry_buffers[0]
+	         , DMA_READ
+	         , sizeof(config_router_entry_t) * MIN(num_router_entries, ROUTER_ENTRY_CHUNK)
+	         );
+	for (uint chunk = 0; chunk * ROUTER_ENTRY_CHUNK < num_router_entries; chunk++) {
+		uint first = chunk * ROUTER_ENTRY_CHUNK;
+		uint next  = first + ROUTER_ENTRY_CHUNK;
+		config_router_entry_t *entries = router_entry_buffers[chunk % 2];
+		
+		// Fetch the next chunk while this one is installed
+		if (next < num_router_entries) {
+			dma_start( config_router_entries_sdram + next
+			         , router_entry_buffers[(chunk + 1) % 2]
+			         , DMA_READ
+			         , sizeof(config_router_entry_t) * MIN(num_router_entries - next, ROUTER_ENTRY_CHUNK)
 			         );
-			config_root.completion_state = COMPLETION_STATE_FAILIURE;
+			dma_wait_previous();
+		} else {
+			dma_wait();
+		}
+		
+		for (uint i = first; i < MIN(next, num_router_entries); i++) {
+			if (!spin1_set_mc_table_entry( i
+			                             , entries[i - first].key
+			                             , entries[i - first].mask
+			                             , entries[i - first].route
+			                             )) {
+				io_printf( IO_BUF, "Could not load routing table entry %d with key 0x%08x"
+				         , i
+				         , entries[i - first].key
+				         );
+				config_root.completion_state = COMPLETION_STATE_FAILIURE;
+			}
 		}
 	}
 	
 	// Only one core should configure the router
-	if (leadAp) {
+	if (LEAD_CORE) {
 		// Store the current router configuration
 		rtr_control_orig_state = rtr_unbuf[RTR_CONTROL];
 		
 		// Set up the packet drop timeout
-		rtr_unbuf[RTR_CONTROL] = (rtr_unbuf[RTR_CONTROL] & ~0x00FF8000u)
-		                       | (config_root.rtr_drop_e<<4 | config_root.rtr_drop_m) << 16
-		                       | 1<<15 // Re-initialise counters
-		                       ;
-		
-		// Configure forwarded packets counter
-		rtr_unbuf[FWD_CNTR_CFG] = (0x1<< 0) // Type = nn
-		                        | (0x1<< 4) // ER = 0 (non-emergency-routed packets)
-		                        | (  0<< 8) // M = 0 (match emergency flag on incoming packets)
-		                        | (0x3<<10) // Def = Match default and non-default routed packets
-		                        | (0x3<<12) // PL = Match packets with and without payloads
-		                        | (0x3<<14) // Loc = Match local and external packets
-		                        | ( (0x1F<<19) // Match all external links
-		                          | (   0<<18) // Don't match monitor packets
-		                          | (   1<<17) // Match packets to local non-monitor cores
-		                          | (   0<<16) // Don't match dropped packets
-		                          ) // Dest = Which destinations should be matched
-		                        | (  0<<30) // E = Don't enable interrupt on event
-		                        ;
+		platform_set_router_timeout(&this_core);
 		
-		// Configure dropped packets counter
-		rtr_unbuf[DRP_CNTR_CFG] = (0x1<< 0) // Type = nn
-		                        | (0x1<< 4) // ER = 0 (non-emergency-routed packets)
-		                        | (  0<< 8) // M = 0 (match emergency flag on incoming packets)
-		                        | (0x3<<10) // Def = Match default and non-default routed packets
-		                        | (0x3<<12) // PL = Match packets with and without payloads
-		                        | (0x3<<14) // Loc = Match local and external packets
-		                        | ( (0x00<<19) // Don't match external links
-		                          | (   0<<18) // Don't match monitor packets
-		                          | (   0<<17) // Don't match packets to local non-monitor cores
-		                          | (   1<<16) // Match dropped packets
-		                          ) // Dest = Which destinations should be matched
-		                        | (  0<<30) // E = Don't enable interrupt on event
-		                        ;
+		// Program the counters of the counter profile, disabled until the warmup
+		// ends
+		rtr_dgen_orig_state = rtr_unbuf[RTR_DGEN];
+		rtr_unbuf[RTR_DGEN] &= ~config_root.counter_mask;
+		for (uint i = 0u; i < NUM_ROUTER_COUNTERS; i++) {
+			if (config_root.counter_mask & (1u << i)) {
+				rtr_counter_filters_orig_state[i] = rtr_unbuf[RTR_DGF0 + i];
+				rtr_unbuf[RTR_DGF0 + i] = config_root.counter_filters[i];
+			}
+		}
 	}
 	
 	// Allow change to make it into the router
@@ -247,7 +823,7 @@ void
 cleanup_router(void)
 {
 	// Only one core should restore the router config.
-	if (leadAp) {
+	if (LEAD_CORE) {
 		// Restore router configuration (and reinitialise timers to clear deadlocks)
 		rtr_unbuf[RTR_CONTROL] = rtr_control_orig_state | 1<<15;
 		spin1_delay_us(10000);
@@ -255,6 +831,14 @@ cleanup_router(void)
 		// Set the timer reset bit back to the original value again
 		rtr_unbuf[RTR_CONTROL] = rtr_control_orig_state;
 		spin1_delay_us(10000);
+		
+		// Restore the counters borrowed by the counter profile
+		for (uint i = 0u; i < NUM_ROUTER_COUNTERS; i++)
+			if (config_root.counter_mask & (1u << i))
+				rtr_unbuf[RTR_DGF0 + i] = rtr_counter_filters_orig_state[i];
+		rtr_unbuf[RTR_DGEN] = (rtr_unbuf[RTR_DGEN]  & ~config_root.counter_mask)
+		                    | (rtr_dgen_orig_state &  config_root.counter_mask)
+		                    ;
 	}
 }
 
@@ -264,38 +848,352 @@ cleanup_router(void)
  ******************************************************************************/
 
 /**
- * The number of timer ticks the experiment has been running.
+ * The experiment_time at which the current tick started.
  */
-uint simulation_ticks = 0u;
+uint this_tick_start = 0u;
 
 /**
- * Is the simulation currently warming up?
+ * The experiment_time at which the last tick after the warmup started and the
+ * number of CPU clock cycles from the first tick after the warmup until then.
+ * Accumulated tick by tick so that timer 2 may wrap during long experiments.
  */
-volatile bool simulation_warmup = true;
+uint last_tick_start = 0u;
+unsigned long long experiment_cycles = 0ull;
+
+
+/**
+ * The number of CPU clock cycles since the first timer tick (modulo 2^32),
+ * used to timestamp packets when measuring latency. Timer 2 is restarted on
+ * the first tick so that it runs from the same point on every core.
+ */
+static inline uint
+experiment_time(void)
+{
+	return ~tc_unbuf[T2_COUNT];
+}
+
+/**
+ * Packets are timestamped with the experiment_time.
+ */
+static uint
+platform_experiment_time(core_state_t *core)
+{
+	return experiment_time();
+}
 
 
 /******************************************************************************
- * Traffic Generation
+ * Callback timing
  ******************************************************************************/
 
+/**
+ * The number of CPU clock cycles in a timer tick.
+ */
+static inline uint
+tick_cycles(void)
+{
+	return config_root.tick_microseconds * sv->cpu_clk;
+}
+
+
+/**
+ * The bin of a callback timing histogram counting a callback which took the
+ * given number of CPU clock cycles.
+ */
+static inline uint
+callback_histogram_bin(uint cycles)
+{
+	uint bin = 31u - __builtin_clz((cycles >> CALLBACK_HISTOGRAM_SHIFT) | 1u);
+	return MIN(bin, CALLBACK_HISTOGRAM_BINS - 1u);
+}
+
+
+/**
+ * Account for the time from the start of the last tick until that of the tick
+ * starting at the given experiment_time.
+ */
+static inline void
+advance_experiment_cycles(uint tick_start)
+{
+	experiment_cycles += tick_start - last_tick_start;
+	last_tick_start = tick_start;
+}
+
+
+/**
+ * Record the timing of a tick callback which started at the given
+ * experiment_time (and has just finished).
+ */
+static inline void
+record_tick_timing(uint tick_start)
+{
+	uint cycles = experiment_time() - tick_start;
+	
+	// When the tick was due given the start of the first tick after the warmup
+	unsigned long long due = (unsigned long long)(this_core.simulation_ticks - 1u) * tick_cycles();
+	uint latency = (experiment_cycles > due) ? (uint)(experiment_cycles - due) : 0u;
+	
+	if (cycles > tick_cycles())
+		config_root.result_tick_overruns++;
+	config_root.result_tick_max_cycles  = MAX(config_root.result_tick_max_cycles, cycles);
+	config_root.result_tick_max_latency = MAX(config_root.result_tick_max_latency, latency);
+	config_root.result_tick_histogram[callback_histogram_bin(cycles)]++;
+}
+
+
+/**
+ * Record the number of ticks which elapsed during the experiment given the
+ * experiment_time at which the tick ending it started.
+ */
+static inline void
+record_ticks_elapsed(uint tick_start)
+{
+	advance_experiment_cycles(tick_start);
+	
+	// Only the overrun beyond the configured duration is divided so that 32-bit
+	// division suffices.
+	unsigned long long due = (unsigned long long)config_root.duration * tick_cycles();
+	uint late = (experiment_cycles > due) ? (uint)MIN(experiment_cycles - due, 0xFFFFFFFFull) : 0u;
+	config_root.result_ticks_elapsed = config_root.duration
+	                                 + (late + tick_cycles() / 2u) / tick_cycles()
+	                                 ;
+}
+
+
+/**
+ * Record the timing of a packet arrival callback which started at the given
+ * experiment_time (and has just finished).
+ */
+static inline void
+record_packet_timing(uint packet_start)
+{
+	uint cycles = experiment_time() - packet_start;
+	config_root.result_packet_max_cycles = MAX(config_root.result_packet_max_cycles, cycles);
+	config_root.result_packet_histogram[callback_histogram_bin(cycles)]++;
+}
+
+
+/******************************************************************************
+ * Counter sampling
+ ******************************************************************************/
+
+/**
+ * Buffers in which samples are assembled before being written into the ring
+ * buffer in SDRAM by DMA. A buffer is busy until its DMA completes, and a
+ * sample is dropped rather than waiting if the next buffer is still busy.
+ */
+uint sample_buffers[2][SAMPLE_WORDS(MAX_SOURCES_PER_CORE, MAX_SINKS_PER_CORE)];
+volatile uint sample_buffers_busy = 0u;
+uint next_sample_buffer = 0u;
+
+
+/**
+ * Snapshot this core's counters (and the router's) and start writing them into
+ * the next slot of the sample ring buffer in SDRAM without waiting for the
+ * write to complete.
+ */
+static void
+platform_take_sample(core_state_t *core)
+{
+	uint buffer = next_sample_buffer;
+	uint words  = SAMPLE_WORDS(config_root.num_sources, config_root.num_sinks);
+	
+	if (sample_buffers_busy & (1u << buffer)) {
+		config_root.result_samples_dropped++;
+		return;
+	}
+	
+	config_sample_t *sample = (config_sample_t *)sample_buffers[buffer];
+	sample_counters(core, sample);
+	
+	uint *slot_sdram_addr = (uint *)( (uchar *)(SDRAM_BASE_UNBUF)
+	                                + config_root.samples_offset
+	                                )
+	                      + (core->current_phase * config_root.num_samples + core->next_sample_slot) * words;
+	sample_buffers_busy |= 1u << buffer;
+	if (spin1_dma_transfer(buffer, slot_sdram_addr, sample, DMA_WRITE, words * sizeof(uint)) == FAILURE) {
+		sample_buffers_busy &= ~(1u << buffer);
+		config_root.result_samples_dropped++;
+		return;
+	}
+	
+	config_root.result_num_samples++;
+	next_sample_buffer ^= 1u;
+	if (++core->next_sample_slot == config_root.num_samples)
+		core->next_sample_slot = 0u;
+}
+
 
+/**
+ * Callback on completion of a DMA started by spin1_dma_transfer: either a
+ * sample's, whose buffer (the tag) may be reused, or one started by dma_start.
+ * Registered as non-queueable so that dma_wait may be called from within a
+ * queued callback.
+ */
 void
-generate_packet(uint source_index)
+on_dma_transfer_done(uint _id, uint tag)
+{
+	if (tag == DMA_TAG_DIRECT)
+		dma_direct_outstanding--;
+	else
+		sample_buffers_busy &= ~(1u << tag);
+}
+
+
+/******************************************************************************
+ * Dropped packet reinjection
+ ******************************************************************************/
+
+// Fields of the router's control register and dumped packet registers
+#define RTR_CONTROL_DUMP_INT (1u << 2)  // Dump interrupt enable
+#define RTR_DSTAT_OVERFLOW   (1u << 30) // Packets were dumped before the last was read
+#define RTR_DHDR_PAYLOAD     (1u << 17) // The packet has a payload
+#define RTR_DHDR_TYPE        (3u << 22) // The packet's type (zero for multicast)
+
+/**
+ * The vectored interrupt slot of the dump interrupt handler (one the spin1 API
+ * leaves free).
+ */
+#define REINJECT_VIC_SLOT SLOT_10
+
+/**
+ * Router dump interrupt handler: capture the packet the router has just
+ * dropped. Reading the dump status lets the router dump another packet; any
+ * dumped before then are lost (the overflow flag counting them as one).
+ */
+INT_HANDLER
+reinject_on_dump(void)
 {
-	if (!simulation_warmup)
-		config_sources[source_index].result_packets_generated ++;
+	uint hdr     = rtr_unbuf[RTR_DHDR];
+	uint key     = rtr_unbuf[RTR_DKEY];
+	uint payload = rtr_unbuf[RTR_DDAT];
+	uint status  = rtr_unbuf[RTR_DSTAT];
 	
-	if (spin1_send_mc_packet(config_sources[source_index].routing_key, 0u, false)) {
-		if (!simulation_warmup)
-			config_sources[source_index].result_packets_sent ++;
-	} else {
-		io_printf(IO_BUF, "Could not generate packet with key 0x%08x at time %d (%s).\n"
-		         , config_sources[source_index].routing_key
-		         , simulation_ticks
-		         , simulation_warmup ? "warmup" : "post-warmup"
+	if (reinject_counting(&this_core) && (status & RTR_DSTAT_OVERFLOW))
+		config_root.result_reinject_missed++;
+	
+	// Only multicast packets are reinjected
+	if ((hdr & RTR_DHDR_TYPE) == 0u)
+		reinject_dumped(&this_core, key, payload, (hdr & RTR_DHDR_PAYLOAD) != 0u);
+	
+	// Acknowledge the interrupt
+	vic_unbuf[VIC_VADDR] = 1u;
+}
+
+
+/**
+ * Allocate the reinjection queue and start capturing the packets the router
+ * drops. Must be called after setup_router (whose saved router configuration,
+ * restored by cleanup_router, leaves the dump interrupt as it was). Without
+ * room for the queue every packet dumped is abandoned and the core fails.
+ */
+void
+reinject_setup(void)
+{
+	this_core.reinject_queue =
+		spin1_malloc(sizeof(reinject_entry_t) * config_root.reinject_queue_size);
+	if (!this_core.reinject_queue) {
+		io_printf( IO_BUF, "No room for a reinjection queue of %d packets.\n"
+		         , config_root.reinject_queue_size
 		         );
-		config_root.completion_state = COMPLETION_STATE_FAILIURE;
+		config_root.completion_state    = COMPLETION_STATE_FAILIURE;
+		config_root.reinject_queue_size = 0u;
 	}
+	
+	sark_vic_set(REINJECT_VIC_SLOT, RTR_DUMP_INT, 1, reinject_on_dump);
+	rtr_unbuf[RTR_CONTROL] |= RTR_CONTROL_DUMP_INT;
+}
+
+
+/**
+ * Routing entries aren't kept in DTCM so a dumped packet's key is looked up in
+ * the copy in SDRAM from which the router was loaded. This happens once for
+ * each packet first dumped (not for re-drops) and only on the lead core.
+ */
+static bool
+platform_routed(core_state_t *core, uint key)
+{
+	config_router_entry_t *entries =
+		config_router_entries_sdram_addr(CONFIG_ROOT_SDRAM_ADDR(spin1_get_core_id()));
+	
+	for (uint i = 0u; i < core->root->num_router_entries; i++)
+		if ((key & entries[i].mask) == entries[i].key)
+			return true;
+	return false;
+}
+
+
+/**
+ * Stop capturing the packets the router drops.
+ */
+void
+reinject_cleanup(void)
+{
+	rtr_unbuf[RTR_CONTROL] &= ~RTR_CONTROL_DUMP_INT;
+	vic_unbuf[VIC_DISABLE] = 1u << RTR_DUMP_INT;
+}
+
+
+/******************************************************************************
+ * Traffic Generation
+ ******************************************************************************/
+
+/**
+ * Packets are sent, traces read and packets generated directly (see the
+ * platform functions in spinn_test_driver_core.c).
+ */
+static bool
+platform_send_mc_packet(core_state_t *core, uint key, uint payload, bool has_payload)
+{
+	return spin1_send_mc_packet(key, payload, has_payload);
+}
+
+static void *
+platform_sdram(core_state_t *core, uint offset, uint length)
+{
+	return (uchar *)(SDRAM_BASE_UNBUF) + offset;
+}
+
+static void
+platform_generate_packet(core_state_t *core, uint source_index)
+{
+	generate_packet(core, source_index);
+}
+
+
+/**
+ * The warmup has ended on this tick: callback timing starts and the router's
+ * counters are reset and enabled.
+ */
+static void
+platform_warmup_ended(core_state_t *core)
+{
+	io_printf(IO_BUF, "Warmup ended, starting main experiment...\n");
+	
+	// Callbacks are timed relative to this tick
+	last_tick_start   = this_tick_start;
+	experiment_cycles = 0ull;
+	
+	// Reset and enable counters
+	if (LEAD_CORE)
+		rtr_unbuf[RTR_DGEN] |=  config_root.counter_mask
+		                     | (config_root.counter_mask<<16)
+		                     ;
+}
+
+
+/**
+ * The experiment (or phase) has ended on this tick: the router's counters are
+ * disabled and the ticks it took recorded.
+ */
+static void
+platform_experiment_ended(core_state_t *core)
+{
+	// Disable counters
+	if (LEAD_CORE)
+		rtr_unbuf[RTR_DGEN] &= ~config_root.counter_mask;
+	
+	record_ticks_elapsed(this_tick_start);
 }
 
 
@@ -306,68 +1204,46 @@ void
 on_timer_tick(uint _1, uint _2)
 {
 	// Experiment management
-	if (simulation_warmup && simulation_ticks == 0) {
+	if (this_core.simulation_warmup && this_core.simulation_ticks == 0) {
 		// Start of warmup
 		io_printf(IO_BUF, "Warmup starting...\n");
-	}
-	
-	// Start of warmup, start of experiment
-	if (simulation_warmup && simulation_ticks >= config_root.warmup_duration) {
-		simulation_ticks = 0u;
-		simulation_warmup = false;
-		io_printf(IO_BUF, "Warmup ended, starting main experiment...\n");
 		
-		// Reset and enable counters
-		if (leadAp)
-			rtr_unbuf[RTR_DGEN] |=  (FWD_CNTR_BIT | DRP_CNTR_BIT)
-			                     | ((FWD_CNTR_BIT | DRP_CNTR_BIT)<<16)
-			                     ;
+		// Start the clock used to timestamp packets
+		timer2_start();
 	}
 	
-	// End of experiment
-	if (!simulation_warmup && simulation_ticks >= config_root.duration) {
-		// Disable counters
-		if (leadAp)
-			rtr_unbuf[RTR_DGEN] &= ~(FWD_CNTR_BIT | DRP_CNTR_BIT);
+	// Read only once timer 2 has been started above
+	this_tick_start = experiment_time();
+	
+	switch (experiment_tick(&this_core)) {
+		case TICK_GENERATE:
+			break;
 		
-		if (config_root.completion_state != COMPLETION_STATE_FAILIURE)
-			config_root.completion_state = COMPLETION_STATE_SUCCESS;
+		case TICK_IDLE:
+			return;
 		
-		spin1_stop();
-		return;
+		case TICK_STOP:
+			spin1_stop();
+			return;
 	}
 	
-	simulation_ticks ++;
+	if (!this_core.simulation_warmup)
+		advance_experiment_cycles(this_tick_start);
 	
 	// Show current status using LEDs
-	if (leadAp) {
+	if (LEAD_CORE) {
 		// Drive with 1/16% brightness in warmup
-		if (simulation_warmup)
-			spin1_led_control((simulation_ticks%16 == 0) ? LED_ON(BLINK_LED) : LED_OFF(BLINK_LED));
+		if (this_core.simulation_warmup)
+			spin1_led_control((this_core.simulation_ticks%16 == 0) ? LED_ON(BLINK_LED) : LED_OFF(BLINK_LED));
 		else
 			spin1_led_control(LED_ON(BLINK_LED));
 	}
 	
+	if (HAS_SOURCES)
+		generate_traffic(&this_core);
 	
-	// Generate traffic
-	for (int i = 0; i < config_root.num_sources; i++) {
-		switch (config_sources[i].temporal_dist) {
-			case TEMPORAL_DIST_BERNOULLI:
-				if (((float)rand() / (float)RAND_MAX) < config_sources[i].temporal_dist_data.bernoulli_packet_prob) {
-					generate_packet(i);
-				}
-				break;
-			
-			default:
-				// Unrecognised temporal distribution do nothing...
-				io_printf(IO_BUF, "Unrecognised traffic distribution '%d' for source with key 0x%08x.\n"
-				         , config_sources[i].temporal_dist
-				         , config_sources[i].routing_key
-				         );
-				config_root.completion_state = COMPLETION_STATE_FAILIURE;
-				break;
-		}
-	}
+	if (!this_core.simulation_warmup)
+		record_tick_timing(this_tick_start);
 }
 
 
@@ -380,40 +1256,47 @@ on_timer_tick(uint _1, uint _2)
  * Callback for multicast packet arrival. Simply count the arrival of the packet
  * in the sinks table.
  *
- * Binary searches the list of sinks to find the entry corresponding to the
- * given key.
+ * The sink corresponding to the given key is found in constant time using the
+ * table built by build_sink_table. When latency is being measured the payload
+ * holds the packet's generation time.
  */
 void
 on_mc_packet_received(uint key, uint payload)
 {
-	// During warmup and upon completion, no results need be recorded.
-	if (simulation_warmup || simulation_ticks >= config_root.duration)
-		return;
+	uint packet_start = experiment_time();
 	
-	// Binary search variables
-	uint min    = 0;
-	uint max    = config_root.num_sinks-1;
-	uint cursor = min + ((max-min)/2);
-	
-	while (min < max && config_sinks[cursor].routing_key != key) {
-		if (key < config_sinks[cursor].routing_key) {
-			max = cursor - 1;
-		} else {
-			min = cursor + 1;
-		}
-		cursor = min + ((max-min)/2);
-	}
-	
-	// Increment the counter if a match was found
-	if (config_sinks[cursor].routing_key == key) {
-		config_sinks[cursor].result_packets_arrived++;
-	} else {
-		io_printf(IO_BUF, "Got unexpected packet with routing key = 0x%08x.\n", key);
-		config_root.completion_state = COMPLETION_STATE_FAILIURE;
-	}
+	if (receive_packet(&this_core, key, payload))
+		record_packet_timing(packet_start);
 }
 
 
+/******************************************************************************
+ * DTCM budget
+ ******************************************************************************/
+
+/**
+ * The statically allocated data must leave the rest of DTCM to SARK and the
+ * spin1 API (see DTCM_STATIC_BUDGET). Only the arrays and structures are
+ * counted: the remaining variables take a few dozen bytes.
+ */
+_Static_assert( sizeof(this_core)
+              + sizeof(config_root)
+              + sizeof(core_map)
+              + sizeof(config_sources)
+              + sizeof(config_sinks)
+              + sizeof(config_latency_histograms)
+              + sizeof(source_states)
+              + sizeof(dense_sources)
+              + sizeof(source_heap)
+              + sizeof(sink_table)
+              + sizeof(rtr_counter_filters_orig_state)
+              + sizeof(router_entry_buffers)
+              + sizeof(sample_buffers)
+              <= DTCM_STATIC_BUDGET
+              , "Statically allocated data does not fit DTCM_STATIC_BUDGET"
+              );
+
+
 /******************************************************************************
  * Main (system initialisation/world starts here)
  ******************************************************************************/
@@ -421,9 +1304,16 @@ on_mc_packet_received(uint key, uint payload)
 void
 c_main()
 {
+	// Let the host know the next build of the app may be loaded
+	report_started();
+	
 	// Copy this core's experimental configuration from SDRAM
 	load_config();
 	
+	// Seed the random number generator, load the first phase of a sweep and
+	// decide when each source will first generate a packet
+	begin_experiment(&this_core);
+	
 	// Set up the core map
 	spin1_application_core_map( system_width, system_height
 	                          , (uint (*)[system_height])&core_map[0]
@@ -436,15 +1326,32 @@ c_main()
 	spin1_set_timer_tick(config_root.tick_microseconds);
 	spin1_callback_on(TIMER_TICK, on_timer_tick, 3);
 	
+	// Counter samples (and phase results) are written to SDRAM in the background
+	spin1_callback_on(DMA_TRANSFER_DONE, on_dma_transfer_done, 0);
+	
 	setup_router();
 	
+	// Capture the packets the router drops for reinjection
+	if (reinject_core(&this_core))
+		reinject_setup();
+	
 	// Report that we're ready
 	io_printf(IO_BUF, "Waiting for spin1_start barrier...\n");
 	
 	// Run the experiment
+	dma_via_spin1 = true;
 	spin1_start();
+	dma_via_spin1 = false;
+	
+	if (reinject_core(&this_core))
+		reinject_cleanup();
 	
 	cleanup_router();
 	
 	store_results();
+	
+	// Let the host know this core (and, once every core has, the chip) is done
+	report_completion();
+	if (LEAD_CORE)
+		aggregate_chip_status();
 }
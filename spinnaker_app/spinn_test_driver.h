@@ -15,15 +15,69 @@
 
 
 /**
- * Macros for accessing the router's diagnostic counters.
+ * Number of the router's diagnostic counters. Those used by an experiment and
+ * what each counts are given by its counter profile (see
+ * config_root_t.counter_mask).
  */
-#define FWD_CNTR_CFG RTR_DGF12
-#define FWD_CNTR_CNT RTR_DGC12
-#define FWD_CNTR_BIT    (1<<12)
+#define NUM_ROUTER_COUNTERS 16u
 
-#define DRP_CNTR_CFG RTR_DGF13
-#define DRP_CNTR_CNT RTR_DGC13
-#define DRP_CNTR_BIT    (1<<13)
+/**
+ * The diagnostic counters reported as the packets forwarded and dropped by the
+ * router (and recorded in each sample). The host's default counter profile
+ * programs them to count exactly that.
+ */
+#define FWD_CNTR 12u
+#define DRP_CNTR 13u
+
+
+/******************************************************************************
+ * Build variants
+ ******************************************************************************/
+
+/**
+ * The application may be built for a single role (see the Makefile's
+ * variants), leaving out the code and tables the role doesn't need and giving
+ * the space saved to those it does:
+ *
+ *   ROLE_SOURCE            Sources only.
+ *   ROLE_SINK              Sinks only.
+ *   ROLE_ROUTER_LOADER     Neither: only loads the routing table, configures
+ *                          the router and aggregates the chip's status.
+ *   SINGLE_TEMPORAL_DIST=d Sources (all with temporal_dist_t d) and sinks.
+ *
+ * The generic build (none of these) does everything. All but the
+ * SINGLE_TEMPORAL_DIST builds have a lead core's duties (HAS_LEAD) and so may
+ * load the routing table: a chip whose lowest core only sends or only receives
+ * needn't run the generic build there. The others reject configurations they
+ * can't run.
+ */
+#if defined(ROLE_SOURCE)
+	#define HAS_SOURCES 1
+	#define HAS_SINKS   0
+	#define HAS_LEAD    1
+#elif defined(ROLE_SINK)
+	#define HAS_SOURCES 0
+	#define HAS_SINKS   1
+	#define HAS_LEAD    1
+#elif defined(ROLE_ROUTER_LOADER)
+	#define HAS_SOURCES 0
+	#define HAS_SINKS   0
+	#define HAS_LEAD    1
+#elif defined(SINGLE_TEMPORAL_DIST)
+	#define HAS_SOURCES 1
+	#define HAS_SINKS   1
+	#define HAS_LEAD    0
+#else
+	#define HAS_SOURCES 1
+	#define HAS_SINKS   1
+	#define HAS_LEAD    1
+#endif
+
+/**
+ * The length of a statically allocated array of up to n entries, which may be
+ * zero in some builds.
+ */
+#define ARRAY_LENGTH(n) ((n) ? (n) : 1u)
 
 
 /******************************************************************************
@@ -31,14 +85,114 @@
  ******************************************************************************/
 
 /**
- * Maximum number of source/sink/router entry structures per core. Used to
- * statically allocate sufficient memory for these structures in a core's RAM.
+ * The bytes of an ARM968's 64 KB DTCM which the application's statically
+ * allocated data may use (checked when it is compiled). The rest is left to
+ * SARK and the spin1 API (their data, stacks and heap, from which the
+ * reinjection queue is also allocated).
+ */
+#define DTCM_STATIC_BUDGET (48u * 1024u)
+
+/**
+ * The most sources, sinks and sinks measuring latency any build allows a core.
+ * These are the limits of the host-native simulator, which allocates them
+ * dynamically.
+ */
+#define MAX_SOURCES_ANY_BUILD       512u
+#define MAX_SINKS_ANY_BUILD         1024u
+#define MAX_LATENCY_SINKS_ANY_BUILD 128u
+
+/**
+ * Maximum number of source/sink structures per core. Used to statically
+ * allocate sufficient memory for these structures in a core's RAM (see
+ * DTCM_STATIC_BUDGET). Builds without sources or sinks (see "Build variants")
+ * spend the space on more of the other.
  */
-#define MAX_SOURCES_PER_CORE 256u
-#define MAX_SINKS_PER_CORE   256u
-#define MAX_ROUTES_PER_CORE  1000u
+#if !HAS_SOURCES
+	#define MAX_SOURCES_PER_CORE 0u
+	#define MAX_SINKS_PER_CORE   (HAS_SINKS ? MAX_SINKS_ANY_BUILD : 0u)
+#elif !HAS_SINKS
+	#define MAX_SOURCES_PER_CORE MAX_SOURCES_ANY_BUILD
+	#define MAX_SINKS_PER_CORE   0u
+#else
+	#define MAX_SOURCES_PER_CORE 256u
+	#define MAX_SINKS_PER_CORE   256u
+#endif
 #define MAX_DIMENSION_SIZE   24u
 
+/**
+ * Maximum number of router entries for a chip: the multicast routing table
+ * entries available to applications (one of the router's 1024 is reserved by
+ * the system). Router entries are installed straight from SDRAM and so are
+ * not limited by a core's RAM.
+ */
+#define MAX_ROUTER_ENTRIES 1023u
+
+/**
+ * Number of router entries fetched from SDRAM at a time when installing the
+ * routing table.
+ */
+#define ROUTER_ENTRY_CHUNK 64u
+
+/**
+ * Number of bins in each sink's latency histogram (the last of which also
+ * counts all longer latencies) and the maximum number of sinks per core when
+ * latencies are measured. Used to statically allocate the histograms in a
+ * core's RAM.
+ */
+#define LATENCY_HISTOGRAM_BINS     16u
+#if !HAS_SINKS
+	#define MAX_LATENCY_SINKS_PER_CORE 0u
+#elif !HAS_SOURCES
+	#define MAX_LATENCY_SINKS_PER_CORE MAX_LATENCY_SINKS_ANY_BUILD
+#else
+	#define MAX_LATENCY_SINKS_PER_CORE 64u
+#endif
+
+/**
+ * Number of bins in the histograms of the time taken by the timer tick and
+ * packet arrival callbacks. Bin n counts callbacks taking at least 2^n (and
+ * less than 2^(n+1)) times 2^CALLBACK_HISTOGRAM_SHIFT CPU clock cycles, the
+ * first bin also counting shorter callbacks and the last longer ones.
+ */
+#define CALLBACK_HISTOGRAM_BINS  16u
+#define CALLBACK_HISTOGRAM_SHIFT 6u
+
+/**
+ * Number of entries in the table used to look up a sink given a routing key.
+ * Sinks whose keys span no more than this many values are looked up by direct
+ * indexing, otherwise a hash table (of at least twice the number of sinks) is
+ * used.
+ */
+#define SINK_TABLE_SIZE ARRAY_LENGTH(2u * MAX_SINKS_PER_CORE)
+
+/**
+ * Number of generated packets which may wait in a core's software transmit
+ * queue when the spin1 API's own (small) transmit queue is full. Packets
+ * generated while it is full are discarded. Must be a power of two.
+ */
+#define TX_QUEUE_SIZE (HAS_SOURCES ? 128u : 1u)
+
+/**
+ * Number of packets dumped by the router which may await the next tick (a power
+ * of two). Packets dumped while it is full are missed. The reinjection queue
+ * itself is allocated from the heap at startup (see
+ * config_root_t.reinject_queue_size).
+ */
+#define REINJECT_CAPTURE_SIZE (HAS_LEAD ? 64u : 1u)
+
+/**
+ * Number of ticks after a packet is reinjected in which it must be dropped
+ * again to count as re-dropped. Reinjected packets not dumped again in this time
+ * have at least left this chip's router (their delivery isn't known).
+ */
+#define REINJECT_CONFIRM_TICKS 2u
+
+/**
+ * Number of cores on a chip (including the monitor). Each has an entry in the
+ * configuration directory.
+ */
+#define MAX_CORES_PER_CHIP 18u
+
 /**
  * A macro defining the address of the coremap in memory. The first two words
  * after this address define the width and height of the system in chips and
@@ -48,25 +202,58 @@
 #define CORE_MAP_SDRAM_ADDR ((uint *)(SDRAM_BASE_UNBUF))
 
 /**
- * A macro which yields the address in SDRAM of a core's config_root. Core 1
- * will have its config root at the base of SDRAM after the core map.
- */
-#define CONFIG_ROOT_SDRAM_ADDR(core) ( (config_root_t *)((SDRAM_BASE_UNBUF)          \
-                                       + ( (MAX_DIMENSION_SIZE*MAX_DIMENSION_SIZE+2) \
-                                         * sizeof(uint)                              \
-                                         )                                           \
-                                       + (core-1) * ( sizeof(config_root_t)          \
-                                                    + sizeof(config_source_t)        \
-                                                      * MAX_SOURCES_PER_CORE         \
-                                                    + sizeof(config_sink_t)          \
-                                                      * MAX_SINKS_PER_CORE           \
-                                                    + sizeof(config_router_entry_t)  \
-                                                      * MAX_ROUTES_PER_CORE          \
-                                                    )                                \
-                                       )                                             \
+ * A macro defining the address of the configuration directory which follows the
+ * core map: an array of MAX_CORES_PER_CHIP config_directory_entry_t indexed by
+ * core ID giving the location of each core's configuration.
+ */
+#define CONFIG_DIRECTORY_SDRAM_ADDR ( (config_directory_entry_t *)( CORE_MAP_SDRAM_ADDR  \
+                                                                  + MAX_DIMENSION_SIZE   \
+                                                                    * MAX_DIMENSION_SIZE \
+                                                                  + 2                    \
+                                                                  )                      \
+                                    )
+
+/**
+ * A macro defining the address of the chip's chip_status_t which follows the
+ * configuration directory. The per-core configuration blocks follow it.
+ */
+#define CHIP_STATUS_SDRAM_ADDR ( (volatile chip_status_t *)( CONFIG_DIRECTORY_SDRAM_ADDR \
+                                                           + MAX_CORES_PER_CHIP          \
+                                                           )                             \
+                               )
+
+/**
+ * The time (microseconds) for which the lead core waits for the other cores on
+ * its chip to report completion before declaring those still running bad, and
+ * the interval at which it checks on them.
+ */
+#define CHIP_STATUS_TIMEOUT_US 1000000u
+#define CHIP_STATUS_POLL_US    10u
+
+/**
+ * A macro which yields the address in SDRAM of a core's config_root. Each
+ * core's configuration (its config_root followed by its sources, sinks and
+ * router entries) is packed after the directory and is only as large as its
+ * own sources, sinks and router entries require. Results are written back in
+ * place.
+ */
+#define CONFIG_ROOT_SDRAM_ADDR(core) ( (config_root_t *)( (uchar *)(SDRAM_BASE_UNBUF)                 \
+                                                        + CONFIG_DIRECTORY_SDRAM_ADDR[(core)].offset \
+                                                        )                                            \
                                      )
 
 
+/**
+ * An entry in the configuration directory.
+ */
+typedef struct config_directory_entry {
+	// Byte offset of the core's config_root from SDRAM_BASE_UNBUF
+	uint offset;
+	
+	// Length of the core's configuration (bytes) or zero if the core has none
+	uint length;
+} config_directory_entry_t;
+
 
 /**
  * Completion states of the system.
@@ -78,6 +265,89 @@ typedef enum completion_state {
 } completion_state_t;
 
 
+/**
+ * The completion of every core on a chip aggregated by the lead core so that
+ * the host need only poll a single word per chip.
+ *
+ * Each core records its own completion state and checksum in core_states and
+ * core_checksums once its results are in SDRAM. When every configured core has
+ * done so (or the lead core gives up waiting) the lead core fills in bad_cores
+ * and checksum and finally completion_state.
+ *
+ * Every core also sets its core_started entry as soon as it starts, by which
+ * time it has copied the APLX it was loaded from out of SDRAM: the host waits
+ * for this before writing the next build of the app over it.
+ */
+typedef struct chip_status {
+	// COMPLETION_STATE_RUNNING until every core has finished, then
+	// COMPLETION_STATE_SUCCESS if all succeeded or COMPLETION_STATE_FAILIURE.
+	completion_state_t completion_state;
+	
+	// Bitmap (by core ID) of cores which failed or never finished
+	uint bad_cores;
+	
+	// Sum of the result_checksum of every core which finished
+	uint checksum;
+	
+	// Completion state and result_checksum reported by each core
+	completion_state_t core_states[MAX_CORES_PER_CHIP];
+	uint core_checksums[MAX_CORES_PER_CHIP];
+	
+	// Non-zero once each core has started
+	uint core_started[MAX_CORES_PER_CHIP];
+} chip_status_t;
+
+
+/**
+ * Flags which enable optional experiment features.
+ */
+typedef enum config_flag {
+	// Timestamp every packet and record a histogram of the latencies seen by
+	// each sink.
+	CONFIG_FLAG_LATENCY  = 1u<<0,
+	
+	// Search for the injection scale at which the network saturates: each phase
+	// of the sweep is a measurement window whose injection scale is chosen by
+	// bisection (see config_root_t.search_control_key).
+	CONFIG_FLAG_SEARCH   = 1u<<1,
+	
+	// The lead core of each chip services the router's dump interrupt,
+	// capturing the packets the router drops and reinjecting them (see
+	// config_root_t.reinject_max_retries).
+	CONFIG_FLAG_REINJECT = 1u<<2,
+	
+	// This is its chip's lead core: it loads the routing table, configures the
+	// router and its counters, reinjects dropped packets and aggregates the
+	// chip's status. The host sets this on exactly one core per chip, which
+	// must run a build with a lead core's duties (see HAS_LEAD).
+	CONFIG_FLAG_LEAD     = 1u<<3,
+} config_flag_t;
+
+
+/**
+ * Saturation search control packets, identified by their offset from
+ * config_root_t.search_control_key. At the end of each window every core sends
+ * the packets arriving at its sinks and generated by its sources to the search
+ * master, the lead core of every chip also sending its router's dropped and
+ * forwarded packet counts (all carried in the payload). Once it has every
+ * report, the master broadcasts the injection scale of the next window to
+ * every core.
+ */
+#define SEARCH_KEY_ARRIVED   0u
+#define SEARCH_KEY_GENERATED 1u
+#define SEARCH_KEY_DROPPED   2u
+#define SEARCH_KEY_FORWARDED 3u
+#define SEARCH_KEY_SCALE     4u
+#define SEARCH_KEY_MASK      (~7u)
+
+/**
+ * An injection scale of one: every packet the sources generate is sent. At a
+ * scale s (a fraction of SEARCH_SCALE_ONE) each packet is generated with
+ * probability s/SEARCH_SCALE_ONE.
+ */
+#define SEARCH_SCALE_ONE (1u << 16)
+
+
 /**
  * The basic configuration for an experiment for a specific core.
  */
@@ -103,12 +373,155 @@ typedef struct config_root{
 	ushort rtr_drop_e;
 	ushort rtr_drop_m;
 	
+	// A bitwise OR of config_flag_t values.
+	uint flags;
+	
+	// When CONFIG_FLAG_LATENCY is set, the width of each latency histogram bin is
+	// 2^latency_bin_shift timer (i.e. CPU) clock cycles.
+	uint latency_bin_shift;
+	
+	// Byte offset from SDRAM_BASE_UNBUF of this core's bulk data: the traces
+	// used by sources with TEMPORAL_DIST_TRACE and the phases of a sweep.
+	uint data_offset;
+	
+	// Number of phases of a sweep, run back-to-back, or zero for a single run
+	// with the parameters above. The phases (see config_phase_t) start
+	// phases_offset bytes into the bulk data.
+	uint num_phases;
+	uint phases_offset;
+	
+	// Number of ticks at the end of each run (or phase) during which no packets
+	// are generated or counted, allowing the network to drain before the next
+	// phase.
+	uint drain_duration;
+	
+	// Byte offset from SDRAM_BASE_UNBUF of the slots the results of each phase
+	// are written to. Each slot holds a copy of this structure followed by the
+	// source, sink and latency histogram arrays.
+	uint phase_results_offset;
+	
+	// Number of ticks between samples of this core's counters during the
+	// experiment (after the warmup) or zero to disable sampling.
+	uint sample_interval;
+	
+	// Capacity (in samples) of the ring buffer the samples are written into
+	// and the buffer's byte offset from SDRAM_BASE_UNBUF. See config_sample_t.
+	// Each phase of a sweep has its own ring buffer following the previous
+	// phase's.
+	uint num_samples;
+	uint samples_offset;
+	
+	// The counter profile: a bitmask of the router diagnostic counters (bit n
+	// for counter n) used during the experiment and the filter each is
+	// programmed with, i.e. the value written to its RTR_DGFn register. Other
+	// counters are left untouched.
+	uint counter_mask;
+	uint counter_filters[NUM_ROUTER_COUNTERS];
+	
+	// The saturation search (when CONFIG_FLAG_SEARCH is set): the base of the
+	// control packets' routing keys (see SEARCH_KEY_*), whether this core is the
+	// master which runs the bisection and, on the master, the number of reports
+	// it receives at the end of each window. The first window runs at
+	// search_initial_scale. A window is saturated when its fraction of
+	// generated packets dropped exceeds search_max_drop_rate or when its ratio
+	// of arrived to generated packets falls below search_min_acceptance times
+	// that of the first window (both fractions of SEARCH_SCALE_ONE). Cores
+	// report search_report_delay ticks after each window has drained (letting
+	// any packets still queued leave the network) and fail if they wait more
+	// than search_timeout ticks for the next scale.
+	uint search_control_key;
+	uint search_master;
+	uint search_num_reports;
+	uint search_initial_scale;
+	uint search_min_acceptance;
+	uint search_max_drop_rate;
+	uint search_report_delay;
+	uint search_timeout;
+	
+	// Dropped packet reinjection (when CONFIG_FLAG_REINJECT is set): a packet
+	// dumped by the router is reinjected on the first tick at least
+	// reinject_backoff ticks later and, each time it is dropped again, waits
+	// twice as long as before. A packet dropped again after
+	// reinject_max_retries reinjections is abandoned. The lead core allocates a
+	// queue for reinject_queue_size packets from its heap, abandoning any
+	// dumped while it is full.
+	uint reinject_max_retries;
+	uint reinject_backoff;
+	uint reinject_queue_size;
+	
+	// (Result) Number of samples written into the ring buffer. If greater than
+	// num_samples, only the most recent num_samples remain, the oldest being in
+	// slot result_num_samples % num_samples.
+	uint result_num_samples;
+	
+	// (Result) Number of samples which were skipped because the previous
+	// samples had not yet been written to SDRAM.
+	uint result_samples_dropped;
+	
 	// (Result) Number of packets dropped at this core
 	uint result_dropped_packets;
 	
 	// (Result) Number of packets forwarded by this core
 	uint result_forwarded_packets;
 	
+	// (Result) The count of each diagnostic counter in counter_mask (zero for
+	// the others)
+	uint result_counters[NUM_ROUTER_COUNTERS];
+	
+	// (Result) Time taken to load this core's configuration from SDRAM
+	// (microseconds)
+	uint result_load_time;
+	
+	// (Result) Time taken to store this core's results back into SDRAM, excluding
+	// the final write of this structure (microseconds)
+	uint result_store_time;
+	
+	// (Result) The CPU (and timer) clock frequency of this core (MHz)
+	uint result_cpu_clk;
+	
+	// (Result) The greatest number of packets waiting in the software transmit
+	// queue at once after the warmup
+	uint result_tx_queue_max_depth;
+	
+	// (Result) Timing of the callbacks after the warmup, in CPU clock cycles. A
+	// tick overruns when its callback takes longer than tick_microseconds. The
+	// latency of a tick is how long after it was due (i.e. a whole number of
+	// ticks after the first tick following the warmup) its callback started. The
+	// experiment should take duration ticks: result_ticks_elapsed gives the
+	// number of ticks which actually elapsed (rounded to the nearest).
+	uint result_tick_overruns;
+	uint result_tick_max_cycles;
+	uint result_tick_max_latency;
+	uint result_ticks_elapsed;
+	uint result_packet_max_cycles;
+	uint result_tick_histogram[CALLBACK_HISTOGRAM_BINS];
+	uint result_packet_histogram[CALLBACK_HISTOGRAM_BINS];
+	
+	// (Result) The injection scale (see SEARCH_SCALE_ONE) of this run or phase
+	uint result_search_scale;
+	
+	// (Result) Dropped packet reinjection by the lead core after the warmup (zero
+	// on other cores): the packets dumped by the router, those dumped while the
+	// previous dumped packet had not been read (and so lost), the reinjections
+	// made, the reinjected packets dropped again and those not dropped again by
+	// this chip's router within REINJECT_CONFIRM_TICKS (which may yet be dropped
+	// elsewhere). Also those given up on (having reached reinject_max_retries or
+	// found the reinjection queue full), those reinjected too late in the run to
+	// be confirmed either way and those which match no routing entry (default
+	// routed packets, which a core can't reinject, and so lost).
+	uint result_reinject_dumped;
+	uint result_reinject_missed;
+	uint result_reinject_reinjected;
+	uint result_reinject_redropped;
+	uint result_reinject_not_redropped_locally;
+	uint result_reinject_abandoned;
+	uint result_reinject_unconfirmed;
+	uint result_reinject_unrouted;
+	
+	// (Result) The sum of every word of the source, sink and latency histogram
+	// results written to SDRAM with this config_root
+	uint result_checksum;
+	
 	// Number of config_source entries which immediately follow this structure in
 	// SDRAM
 	uint num_sources;
@@ -119,7 +532,8 @@ typedef struct config_root{
 	uint num_sinks;
 	
 	// The number of router entries to populate for the experiment. Immediately
-	// follows the config_sink array in SDRAM.
+	// follows the config_sink array in SDRAM (or, when CONFIG_FLAG_LATENCY is
+	// set, the config_latency_histogram array which has an entry per sink).
 	uint num_router_entries;
 } config_root_t;
 
@@ -128,10 +542,103 @@ typedef struct config_root{
  * Types of packet generation distributions.
  */
 typedef enum temporal_dist {
+	// At most one packet per tick, each tick an independent trial
 	TEMPORAL_DIST_BERNOULLI = 0,
+	
+	// A Poisson process: any number of packets per tick
+	TEMPORAL_DIST_POISSON   = 1,
+	
+	// A two-state Markov-modulated source: while on, a Bernoulli trial each tick
+	TEMPORAL_DIST_ON_OFF    = 2,
+	
+	// One packet every period ticks
+	TEMPORAL_DIST_PERIODIC  = 3,
+	
+	// Replay of a trace of packet times from SDRAM
+	TEMPORAL_DIST_TRACE     = 4,
 } temporal_dist_t;
 
 
+/**
+ * Number of fractional bits in temporal_dist_data.bernoulli.interval_scale.
+ */
+#define BERNOULLI_INTERVAL_SCALE_BITS 12
+
+/**
+ * Number of fractional bits in temporal_dist_data.poisson.interval_scale.
+ */
+#define POISSON_INTERVAL_SCALE_BITS 16
+
+/**
+ * Bernoulli sources whose threshold is at least this value (i.e. a probability
+ * of 1/4 or more) fire so often that a trial every tick is cheaper than drawing
+ * and scheduling the interval to their next packet.
+ */
+#define BERNOULLI_DENSE_THRESHOLD 0x40000000u
+
+
+/**
+ * The parameters of a temporal distribution.
+ */
+typedef union temporal_dist_data {
+	// For bernoulli dist
+	struct {
+		// Probability of generating a packet in any given tick scaled by 2^32
+		// (saturating at 0xFFFFFFFF). A packet is generated when a uniformly
+		// distributed 32-bit random number is less than this threshold.
+		uint threshold;
+		
+		// 1/-log2(1 - probability) as an unsigned fixed point number with
+		// BERNOULLI_INTERVAL_SCALE_BITS fractional bits. Used to draw the
+		// (geometrically distributed) number of ticks until the next packet.
+		uint interval_scale;
+	} bernoulli;
+	
+	// For poisson dist
+	struct {
+		// ln(2)/rate, where rate is the mean number of packets per tick, as an
+		// unsigned fixed point number with POISSON_INTERVAL_SCALE_BITS
+		// fractional bits. Used to draw the (exponentially distributed)
+		// interval between packets.
+		uint interval_scale;
+	} poisson;
+	
+	// For on_off dist
+	struct {
+		// Probability of generating a packet in each tick while on, encoded as
+		// for bernoulli.threshold.
+		uint threshold;
+		
+		// Interval scales (as for bernoulli.interval_scale) for the
+		// probabilities of switching off after each tick on and of switching on
+		// after each tick off. Sources start off.
+		uint on_interval_scale;
+		uint off_interval_scale;
+	} on_off;
+	
+	// For periodic dist
+	struct {
+		// Number of ticks between packets (zero for none)
+		uint period;
+		
+		// The first packet is generated phase % period ticks after the first
+		// tick
+		uint phase;
+	} periodic;
+	
+	// For trace dist
+	struct {
+		// Byte offset of the trace from config_root.data_offset and its
+		// length. The trace is a sequence of unsigned LEB128 varints giving the
+		// number of ticks between successive packets, the first relative to the
+		// tick before the first tick (zero meaning a further packet in the same
+		// tick). Generation stops at the end of the trace.
+		uint offset;
+		uint length;
+	} trace;
+} temporal_dist_data_t;
+
+
 /**
  * A structure describing a desired packet generation scheme for a given key.
  */
@@ -142,19 +649,49 @@ typedef struct config_source {
 	// The temporal distribution to use to decide when to generate these packets
 	temporal_dist_t temporal_dist;
 	
-	union {
-		// For bernoulli dist
-		float bernoulli_packet_prob;
-	} temporal_dist_data;
+	// The parameters of that distribution
+	temporal_dist_data_t temporal_dist_data;
 	
 	// (Result) The number of packets generated (though sending may fail)
 	uint result_packets_generated;
 	
 	// (Result) The number of packets successfuly placed into the network
+	// (including those sent from the software transmit queue)
 	uint result_packets_sent;
+	
+	// (Result) The number of packets which could not be sent immediately and so
+	// were placed in the software transmit queue
+	uint result_packets_deferred;
+	
+	// (Result) The number of deferred packets which were eventually sent
+	uint result_packets_deferred_sent;
+	
+	// (Result) The number of packets discarded because the software transmit
+	// queue was full
+	uint result_packets_discarded;
 } config_source_t;
 
 
+/**
+ * The parameters of one phase of a sweep, replacing those in the config_root
+ * (and of each source) for the phase's duration. Followed in SDRAM by a
+ * config_phase_source_t for each source (in config order). Router counters are
+ * reset at the start of each phase.
+ */
+typedef struct config_phase {
+	uint warmup_duration;
+	uint duration;
+	
+	ushort rtr_drop_e;
+	ushort rtr_drop_m;
+} config_phase_t;
+
+typedef struct config_phase_source {
+	temporal_dist_t      temporal_dist;
+	temporal_dist_data_t temporal_dist_data;
+} config_phase_source_t;
+
+
 /**
  * A structure which provides a counter for packet arrivals with a given routing
  * key.
@@ -171,6 +708,46 @@ typedef struct config_sink {
 } config_sink_t;
 
 
+/**
+ * A histogram of the latencies of the packets which arrived at a sink. Only
+ * present when CONFIG_FLAG_LATENCY is set, in which case the config_sink array
+ * is followed by one of these for each sink (in the same order).
+ *
+ * Latency is measured from the time a packet is generated to the time it
+ * arrives using a timestamp in its payload. Timestamps count CPU clock cycles
+ * from each core's first timer tick so are subject to any skew between the
+ * start of the experiment on different chips.
+ */
+typedef struct config_latency_histogram {
+	// (Result) The number of packets whose latency, in units of
+	// 2^latency_bin_shift clock cycles, was 0, 1, ... The final bin also counts
+	// all packets with longer latencies.
+	uint result_bins[LATENCY_HISTOGRAM_BINS];
+} config_latency_histogram_t;
+
+
+/**
+ * A sample of a core's counters, taken every sample_interval ticks when
+ * sampling is enabled. Each sample in the ring buffer at samples_offset
+ * consists of this header followed by the result_packets_sent of each source
+ * and then the result_packets_arrived of each sink (in config order).
+ */
+typedef struct config_sample {
+	// The tick (after the warmup) at which the sample was taken
+	uint tick;
+	
+	// The router's forwarded and dropped packet counters
+	uint forwarded_packets;
+	uint dropped_packets;
+} config_sample_t;
+
+/**
+ * The size of a sample (in words) with a given number of sources and sinks.
+ */
+#define SAMPLE_WORDS(num_sources, num_sinks) \
+	(sizeof(config_sample_t)/sizeof(uint) + (num_sources) + (num_sinks))
+
+
 /**
  * A structure which defines routing entries used by the experiment.
  */
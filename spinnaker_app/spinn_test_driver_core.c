@@ -0,0 +1,1279 @@
+/**
+ * The per-core logic of spinn_test_driver: random number generation, traffic
+ * generation and the software transmit queue, the sequencing of the warmup,
+ * experiment, drain and phases of a sweep, the saturation search, dropped
+ * packet reinjection and the counting of arrivals.
+ *
+ * This file is not compiled on its own but included by both the application
+ * (spinn_test_driver.c) and the simulator (host/netsim.c) so that the two run
+ * the same code. Each function acts on the core_state_t it is given: the
+ * application passes its one this_core, the simulator each core it simulates.
+ *
+ * The includer provides the platform functions declared below (which send
+ * packets, read the clock, SDRAM and the router and so on) and must define
+ * CORE_PRINTF, MIN and MAX before including this file.
+ */
+
+#include "spinn_test_driver_core.h"
+
+
+/******************************************************************************
+ * Platform functions (provided by the includer)
+ ******************************************************************************/
+
+/**
+ * Attempt to send a multicast packet, returning false if the spin1 API's
+ * transmit queue was full.
+ */
+static bool platform_send_mc_packet(core_state_t *core, uint key, uint payload, bool has_payload);
+
+/**
+ * A source has fired: generate a packet from it (see generate_packet), either
+ * immediately (the application) or once the core has generated those before it
+ * (the simulator, which models the time each takes).
+ */
+static void platform_generate_packet(core_state_t *core, uint source_index);
+
+/**
+ * The clock used to timestamp packets: CPU clock cycles since the first timer
+ * tick (modulo 2^32).
+ */
+static uint platform_experiment_time(core_state_t *core);
+
+/**
+ * Get a pointer to length bytes at the given byte offset from SDRAM_BASE_UNBUF
+ * in this core's chip's SDRAM.
+ */
+static void *platform_sdram(core_state_t *core, uint offset, uint length);
+
+/**
+ * The count of a router diagnostic counter if it is in the experiment's
+ * counter profile, otherwise zero.
+ */
+static uint platform_router_counter(core_state_t *core, uint counter);
+
+/**
+ * Set the router's packet drop timeout to that of the current experiment (or
+ * phase) or, while a saturation search's control packets are exchanged, to its
+ * longest. Only the lead core configures the router.
+ */
+static void platform_set_router_timeout(core_state_t *core);
+static void platform_hold_router(core_state_t *core);
+
+/**
+ * Find this core's sink for a given routing key, returning NULL if it has none.
+ */
+static config_sink_t *platform_find_sink(core_state_t *core, uint key);
+
+/**
+ * Does a key match an entry of this core's chip's routing table? A packet sent
+ * by a core which matches none goes nowhere.
+ */
+static bool platform_routed(core_state_t *core, uint key);
+
+/**
+ * The warmup (of the experiment or a phase) has ended on this tick, as has the
+ * experiment (or phase) itself (but not yet its drain).
+ */
+static void platform_warmup_ended(core_state_t *core);
+static void platform_experiment_ended(core_state_t *core);
+
+/**
+ * Write the results of the phase of a sweep which has just ended into its slot
+ * in SDRAM.
+ */
+static void platform_store_phase_results(core_state_t *core, uint phase);
+
+/**
+ * Write a sample of the counters (see sample_counters) into the next slot of
+ * the sample ring buffer in SDRAM.
+ */
+static void platform_take_sample(core_state_t *core);
+
+
+/******************************************************************************
+ * Random number generation
+ ******************************************************************************/
+
+/**
+ * Seed the random number generator.
+ */
+void
+prng_seed(core_state_t *core, uint seed)
+{
+	core->prng_state = seed ? seed : 0x9E3779B9u;
+}
+
+
+/**
+ * Produce a uniformly distributed 32-bit random number (Marsaglia's xorshift32:
+ * a handful of shifts and XORs, cheap enough to inline into the packet
+ * generation loop).
+ */
+static inline uint
+prng(core_state_t *core)
+{
+	uint x = core->prng_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return core->prng_state = x;
+}
+
+
+/**
+ * log2(1 + i/64) for i in 0..64 as 6.26 fixed point numbers.
+ */
+static const uint log2_table[65] = {
+	0x00000000u, 0x0016e797u, 0x002d75a7u, 0x0043ace2u,
+	0x00598fdcu, 0x006f2109u, 0x008462c4u, 0x0099574fu,
+	0x00ae00d2u, 0x00c2615fu, 0x00d67af1u, 0x00ea4f72u,
+	0x00fde0b6u, 0x0111307eu, 0x0124407bu, 0x0137124du,
+	0x0149a785u, 0x015c01a4u, 0x016e221du, 0x01800a56u,
+	0x0191bba9u, 0x01a33761u, 0x01b47ebfu, 0x01c592fbu,
+	0x01d6753eu, 0x01e726aau, 0x01f7a857u, 0x0207fb51u,
+	0x021820a0u, 0x0228193fu, 0x0237e624u, 0x0247883bu,
+	0x02570069u, 0x02664f8du, 0x0275767fu, 0x02847610u,
+	0x02934f09u, 0x02a20231u, 0x02b09045u, 0x02bef9ffu,
+	0x02cd4012u, 0x02db632du, 0x02e963fbu, 0x02f7431fu,
+	0x0305013bu, 0x03129ee9u, 0x03201cc3u, 0x032d7b5au,
+	0x033abb40u, 0x0347dcfeu, 0x0354e11fu, 0x0361c825u,
+	0x036e9292u, 0x037b40e4u, 0x0387d394u, 0x03944b1cu,
+	0x03a0a7eeu, 0x03acea7cu, 0x03b91335u, 0x03c52286u,
+	0x03d118d6u, 0x03dcf68eu, 0x03e8bc11u, 0x03f469c2u,
+	0x04000000u,
+};
+
+
+/**
+ * Compute -log2(x / 2^32) for a non-zero x as a 6.26 fixed point number using
+ * a linearly interpolated table (absolute error < 1e-4).
+ */
+static inline uint
+neg_log2(uint x)
+{
+	uint n = __builtin_clz(x);
+	uint m = x << n; // Normalised so that bit 31 is set
+	
+	// Table index and 11-bit interpolation fraction (table deltas are < 2^21 so
+	// the product fits in 32 bits)
+	uint i    = (m >> 25) & 0x3Fu;
+	uint frac = (m >> 14) & 0x7FFu;
+	uint log2_mantissa = log2_table[i]
+	                   + (((log2_table[i+1] - log2_table[i]) * frac) >> 11);
+	
+	return ((n + 1) << 26) - log2_mantissa;
+}
+
+
+/**
+ * Draw the number of ticks until a Bernoulli source next fires, i.e. a sample
+ * from a geometric distribution with P(k) = (1-p)^(k-1) p, k >= 1, by
+ * inversion: k = 1 + floor(log2(U) / log2(1-p)).
+ */
+static inline uint
+bernoulli_interval(core_state_t *core, uint interval_scale)
+{
+	uint u = prng(core) | 1u;
+	return 1u + (uint)( ((unsigned long long)neg_log2(u) * interval_scale)
+	                  >> (26 + BERNOULLI_INTERVAL_SCALE_BITS)
+	                  );
+}
+
+
+/**
+ * Draw the interval until a Poisson source's next packet, an exponentially
+ * distributed number of ticks -ln(U)/rate, as a fixed point number with 32
+ * fractional bits.
+ */
+static inline unsigned long long
+poisson_interval(core_state_t *core, uint interval_scale)
+{
+	uint u = prng(core) | 1u;
+	return ((unsigned long long)neg_log2(u) * interval_scale)
+	       >> (26 + POISSON_INTERVAL_SCALE_BITS - 32);
+}
+
+
+/******************************************************************************
+ * Configuration and results
+ ******************************************************************************/
+
+/**
+ * Is this core the chip's lead, responsible for the router and the chip's
+ * status? The host marks the lead (see CONFIG_FLAG_LEAD). Builds without a lead
+ * core's duties (see HAS_LEAD) never are.
+ */
+static inline bool
+lead_core(const core_state_t *core)
+{
+	return HAS_LEAD && (core->root->flags & CONFIG_FLAG_LEAD);
+}
+
+
+/**
+ * The number of latency histograms in this core's configuration.
+ */
+static inline uint
+num_latency_histograms(const core_state_t *core)
+{
+	return (core->root->flags & CONFIG_FLAG_LATENCY) ? core->root->num_sinks : 0u;
+}
+
+
+/**
+ * Replace the experiment and source parameters with those of the given phase
+ * of a sweep. The phase's parameters are read directly from SDRAM: this
+ * happens only between phases.
+ */
+void
+load_phase(core_state_t *core, uint phase)
+{
+	uint size = sizeof(config_phase_t)
+	          + sizeof(config_phase_source_t) * core->root->num_sources
+	          ;
+	config_phase_t *config_phase = platform_sdram( core
+	                                             , core->root->data_offset
+	                                               + core->root->phases_offset
+	                                               + phase * size
+	                                             , size
+	                                             );
+	core->root->warmup_duration = config_phase->warmup_duration;
+	core->root->duration        = config_phase->duration;
+	core->root->rtr_drop_e      = config_phase->rtr_drop_e;
+	core->root->rtr_drop_m      = config_phase->rtr_drop_m;
+	
+	config_phase_source_t *config_phase_sources = (config_phase_source_t *)(config_phase + 1);
+	for (int i = 0; i < core->root->num_sources; i++) {
+		core->sources[i].temporal_dist      = config_phase_sources[i].temporal_dist;
+		core->sources[i].temporal_dist_data = config_phase_sources[i].temporal_dist_data;
+	}
+}
+
+
+/**
+ * Zero the result counters of the config_root, sources, sinks and latency
+ * histograms ready for the next phase of a sweep.
+ */
+void
+reset_results(core_state_t *core)
+{
+	config_root_t *root = core->root;
+	
+	for (int i = 0; i < root->num_sources; i++) {
+		core->sources[i].result_packets_generated     = 0u;
+		core->sources[i].result_packets_sent          = 0u;
+		core->sources[i].result_packets_deferred      = 0u;
+		core->sources[i].result_packets_deferred_sent = 0u;
+		core->sources[i].result_packets_discarded     = 0u;
+	}
+	
+	for (int i = 0; i < root->num_sinks; i++)
+		core->sinks[i].result_packets_arrived = 0u;
+	
+	for (int i = 0; i < num_latency_histograms(core); i++)
+		for (int bin = 0; bin < LATENCY_HISTOGRAM_BINS; bin++)
+			core->histograms[i].result_bins[bin] = 0u;
+	
+	root->result_num_samples        = 0u;
+	root->result_samples_dropped    = 0u;
+	root->result_dropped_packets    = 0u;
+	root->result_forwarded_packets  = 0u;
+	root->result_tx_queue_max_depth = 0u;
+	for (uint i = 0u; i < NUM_ROUTER_COUNTERS; i++)
+		root->result_counters[i] = 0u;
+	
+	root->result_tick_overruns     = 0u;
+	root->result_tick_max_cycles   = 0u;
+	root->result_tick_max_latency  = 0u;
+	root->result_ticks_elapsed     = 0u;
+	root->result_packet_max_cycles = 0u;
+	for (uint i = 0u; i < CALLBACK_HISTOGRAM_BINS; i++) {
+		root->result_tick_histogram[i]   = 0u;
+		root->result_packet_histogram[i] = 0u;
+	}
+	
+	root->result_reinject_dumped                = 0u;
+	root->result_reinject_missed                = 0u;
+	root->result_reinject_reinjected            = 0u;
+	root->result_reinject_redropped             = 0u;
+	root->result_reinject_not_redropped_locally = 0u;
+	root->result_reinject_abandoned             = 0u;
+	root->result_reinject_unconfirmed           = 0u;
+	root->result_reinject_unrouted              = 0u;
+}
+
+
+/******************************************************************************
+ * Counter sampling
+ ******************************************************************************/
+
+/**
+ * Snapshot this core's counters (and the router's) into a sample of
+ * SAMPLE_WORDS(num_sources, num_sinks) words.
+ */
+static void
+sample_counters(core_state_t *core, config_sample_t *sample)
+{
+	sample->tick              = core->simulation_ticks;
+	sample->forwarded_packets = platform_router_counter(core, FWD_CNTR);
+	sample->dropped_packets   = platform_router_counter(core, DRP_CNTR);
+	
+	uint *counts = (uint *)(sample + 1);
+	for (int i = 0; i < core->root->num_sources; i++)
+		*(counts++) = core->sources[i].result_packets_sent;
+	for (int i = 0; i < core->root->num_sinks; i++)
+		*(counts++) = core->sinks[i].result_packets_arrived;
+}
+
+
+/******************************************************************************
+ * Saturation search
+ ******************************************************************************/
+
+/**
+ * Send this core's counts for the window which has just ended to the master,
+ * indexed by SEARCH_KEY_*. Reports which don't fit in the (possibly still
+ * congested) transmit queue are sent when next called.
+ */
+static void
+search_report(core_state_t *core)
+{
+	uint counts[SEARCH_KEY_FORWARDED + 1u] = {0u, 0u, 0u, 0u};
+	
+	for (int i = 0; i < core->root->num_sinks; i++)
+		counts[SEARCH_KEY_ARRIVED] += core->sinks[i].result_packets_arrived;
+	for (int i = 0; i < core->root->num_sources; i++)
+		counts[SEARCH_KEY_GENERATED] += core->sources[i].result_packets_generated;
+	
+	// The router's counts are reported once per chip
+	counts[SEARCH_KEY_DROPPED]   = core->root->result_dropped_packets;
+	counts[SEARCH_KEY_FORWARDED] = core->root->result_forwarded_packets;
+	uint num_reports = lead_core(core) ? SEARCH_KEY_FORWARDED + 1u : SEARCH_KEY_GENERATED + 1u;
+	
+	while (core->search_reports_sent < num_reports
+	       && platform_send_mc_packet( core
+	                                 , core->root->search_control_key | core->search_reports_sent
+	                                 , counts[core->search_reports_sent], true
+	                                 ))
+		core->search_reports_sent++;
+}
+
+
+/**
+ * Reduce a pair of counts until both fit in 23 bits, preserving their ratio
+ * (approximately), so that products of counts fit in 64 bits.
+ */
+static inline void
+search_normalise(uint *a, uint *b)
+{
+	while ((*a | *b) >> 23) {
+		*a >>= 1u;
+		*b >>= 1u;
+	}
+}
+
+
+/**
+ * (Master) Decide whether the window which has just ended (whose reports are
+ * in search_sums) was saturated, narrow the bisection accordingly and return
+ * the scale of the next window.
+ */
+static uint
+search_bisect(core_state_t *core)
+{
+	uint arrived   = core->search_sums[SEARCH_KEY_ARRIVED];
+	uint generated = core->search_sums[SEARCH_KEY_GENERATED];
+	uint dropped   = core->search_sums[SEARCH_KEY_DROPPED];
+	
+	bool saturated = ((unsigned long long)dropped << 16)
+	                 > (unsigned long long)core->root->search_max_drop_rate * generated;
+	
+	if (core->current_phase == 0u) {
+		// The first window calibrates the fraction of packets which arrive (i.e.
+		// the fan-out) before the network is saturated
+		core->search_calibration_arrived   = arrived;
+		core->search_calibration_generated = generated;
+	} else if (core->search_calibration_arrived && generated) {
+		uint a  = arrived;
+		uint g  = generated;
+		uint ca = core->search_calibration_arrived;
+		uint cg = core->search_calibration_generated;
+		search_normalise(&a, &g);
+		search_normalise(&ca, &cg);
+		saturated |= (((unsigned long long)a * cg) << 16)
+		             < (unsigned long long)core->root->search_min_acceptance * g * ca;
+	}
+	
+	if (saturated)
+		core->search_hi = core->search_scale;
+	else
+		core->search_lo = core->search_scale;
+	
+	CORE_PRINTF( core, "Window %d at scale %d: %d arrived, %d generated, %d dropped (%s).\n"
+	           , core->current_phase, core->search_scale, arrived, generated, dropped
+	           , saturated ? "saturated" : "unsaturated"
+	           );
+	
+	return (core->search_lo + core->search_hi + 1u) / 2u;
+}
+
+
+/**
+ * Handle a saturation search control packet: a report (on the master) or the
+ * scale of the next window.
+ */
+static void
+search_on_control_packet(core_state_t *core, uint key, uint payload)
+{
+	uint type = key - core->root->search_control_key;
+	
+	if (type == SEARCH_KEY_SCALE) {
+		core->search_next_scale     = payload;
+		core->search_scale_received = true;
+		return;
+	}
+	
+	if (!core->root->search_master || type > SEARCH_KEY_FORWARDED) {
+		CORE_PRINTF(core, "Got unexpected search control packet with key = 0x%08x.\n", key);
+		core->root->completion_state = COMPLETION_STATE_FAILIURE;
+		return;
+	}
+	
+	core->search_sums[type] += payload;
+	if (++core->search_reports_received < core->root->search_num_reports)
+		return;
+	
+	uint scale = search_bisect(core);
+	
+	for (uint i = 0u; i <= SEARCH_KEY_FORWARDED; i++)
+		core->search_sums[i] = 0u;
+	core->search_reports_received = 0u;
+	
+	if (!platform_send_mc_packet(core, core->root->search_control_key | SEARCH_KEY_SCALE, scale, true)) {
+		CORE_PRINTF(core, "Could not broadcast the next injection scale.\n");
+		core->root->completion_state = COMPLETION_STATE_FAILIURE;
+	}
+}
+
+
+/**
+ * Called each tick once a window's results have been stored: once the network
+ * has emptied (after search_report_delay ticks) holds packets at the router
+ * then, from the next tick, reports the window's counts to the master and
+ * waits for the scale of the next window. Returns true once the scale has
+ * arrived (and been adopted) or, failing the experiment, once the core has
+ * waited search_timeout ticks.
+ */
+static bool
+search_wait_for_scale(core_state_t *core)
+{
+	if (!core->search_waiting) {
+		core->search_waiting      = true;
+		core->search_wait_ticks   = 0u;
+		core->search_reports_sent = 0u;
+	}
+	
+	// Holding packets is only safe once no stream packets remain: the control
+	// packets' routes can't form a cycle but the streams' may. The experiment's
+	// timeout is restored once the next scale arrives.
+	if (core->search_wait_ticks == core->root->search_report_delay)
+		platform_hold_router(core);
+	else if (core->search_wait_ticks > core->root->search_report_delay)
+		search_report(core);
+	
+	if (core->search_scale_ready) {
+		core->search_scale_received = false;
+		core->search_scale_ready    = false;
+		core->search_waiting        = false;
+		core->search_scale          = core->search_next_scale;
+		return true;
+	}
+	
+	// Stop holding packets a tick before any core starts the next window
+	if (core->search_scale_received) {
+		platform_set_router_timeout(core);
+		core->search_scale_ready = true;
+	}
+	
+	if (++core->search_wait_ticks > core->root->search_timeout) {
+		CORE_PRINTF(core, "Timed out waiting for the next injection scale.\n");
+		core->root->completion_state = COMPLETION_STATE_FAILIURE;
+		core->search_waiting = false;
+		return true;
+	}
+	
+	return false;
+}
+
+
+/******************************************************************************
+ * Dropped packet reinjection
+ ******************************************************************************/
+
+/**
+ * Does this core reinject the packets its router drops? Only the lead core
+ * services the dump interrupt.
+ */
+static inline bool
+reinject_core(const core_state_t *core)
+{
+	return lead_core(core) && (core->root->flags & CONFIG_FLAG_REINJECT);
+}
+
+
+/**
+ * Are dumped packets counted in the results? As with the router's counters,
+ * only those dumped after the warmup and before the drain are.
+ */
+static inline bool
+reinject_counting(const core_state_t *core)
+{
+	return !core->simulation_warmup && core->simulation_ticks < core->root->duration;
+}
+
+
+/**
+ * Capture a multicast packet the router has just dumped (from the dump
+ * interrupt handler) for the next tick to queue for reinjection. Packets
+ * dumped while the captures are full are missed.
+ */
+static inline void
+reinject_dumped(core_state_t *core, uint key, uint payload, bool has_payload)
+{
+	if (core->reinject_captures_in - core->reinject_captures_out < REINJECT_CAPTURE_SIZE) {
+		packet_t *capture =
+			&core->reinject_captures[core->reinject_captures_in & (REINJECT_CAPTURE_SIZE - 1u)];
+		capture->key         = key;
+		capture->payload     = payload;
+		capture->has_payload = has_payload;
+		core->reinject_captures_in++;
+	} else if (reinject_counting(core)) {
+		core->root->result_reinject_missed++;
+	}
+}
+
+
+/**
+ * Free an entry of the reinjection queue.
+ */
+static inline void
+reinject_free(core_state_t *core, reinject_entry_t *entry)
+{
+	entry->state = REINJECT_FREE;
+	while (core->reinject_queue_used
+	       && core->reinject_queue[core->reinject_queue_used - 1u].state == REINJECT_FREE)
+		core->reinject_queue_used--;
+}
+
+
+/**
+ * The reinjected packet which a captured packet is (or NULL if none). Packets
+ * are told apart by their key and payload alone so a stream's packets without
+ * a payload are indistinguishable: a re-drop may be charged to another packet
+ * of the same stream.
+ */
+static inline reinject_entry_t *
+reinject_find_sent(core_state_t *core, const packet_t *capture)
+{
+	for (uint i = 0u; i < core->reinject_queue_used; i++) {
+		reinject_entry_t *entry = &core->reinject_queue[i];
+		if (entry->state == REINJECT_SENT
+		    && entry->key == capture->key
+		    && entry->payload == capture->payload
+		    && entry->has_payload == capture->has_payload)
+			return entry;
+	}
+	return NULL;
+}
+
+
+/**
+ * Queue a captured packet for reinjection after its backoff or, having been
+ * reinjected reinject_max_retries times already (or finding the queue full),
+ * abandon it. Packets matching no routing entry were default routed through
+ * this chip: reinjected by a core they would go nowhere so they are lost.
+ */
+static inline void
+reinject_capture(core_state_t *core, const packet_t *capture)
+{
+	reinject_entry_t *entry = reinject_find_sent(core, capture);
+	
+	if (entry) {
+		if (entry->counted) {
+			core->root->result_reinject_dumped++;
+			core->root->result_reinject_redropped++;
+		}
+	} else {
+		bool counted = reinject_counting(core);
+		if (counted)
+			core->root->result_reinject_dumped++;
+		
+		if (!platform_routed(core, capture->key)) {
+			if (counted)
+				core->root->result_reinject_unrouted++;
+			return;
+		}
+		
+		// Find a free entry
+		for (uint i = 0u; i < core->root->reinject_queue_size && !entry; i++)
+			if (i == core->reinject_queue_used || core->reinject_queue[i].state == REINJECT_FREE)
+				entry = &core->reinject_queue[i];
+		if (!entry) {
+			if (counted)
+				core->root->result_reinject_abandoned++;
+			return;
+		}
+		core->reinject_queue_used = MAX( core->reinject_queue_used
+		                               , (uint)(entry - core->reinject_queue) + 1u
+		                               );
+		
+		entry->key         = capture->key;
+		entry->payload     = capture->payload;
+		entry->has_payload = capture->has_payload;
+		entry->counted     = counted;
+		entry->retries     = 0u;
+	}
+	
+	if (entry->retries >= core->root->reinject_max_retries) {
+		if (entry->counted)
+			core->root->result_reinject_abandoned++;
+		reinject_free(core, entry);
+		return;
+	}
+	
+	entry->state = REINJECT_WAITING;
+	entry->tick  = core->elapsed_ticks + (core->root->reinject_backoff << MIN(entry->retries, 16u));
+}
+
+
+/**
+ * Queue the packets captured since the last tick, reinject those which are due
+ * (as far as the spin1 API's transmit queue allows) and count those reinjected
+ * long enough ago without being dropped again by this chip's router.
+ */
+void
+reinject_tick(core_state_t *core)
+{
+	while (core->reinject_captures_out != core->reinject_captures_in) {
+		reinject_capture(core, &core->reinject_captures[ core->reinject_captures_out
+		                                               & (REINJECT_CAPTURE_SIZE - 1u)
+		                                               ]);
+		core->reinject_captures_out++;
+	}
+	
+	bool tx_full = false;
+	for (uint i = 0u; i < core->reinject_queue_used; i++) {
+		reinject_entry_t *entry = &core->reinject_queue[i];
+		if (entry->state == REINJECT_FREE || TICK_BEFORE(core->elapsed_ticks, entry->tick))
+			continue;
+		
+		if (entry->state == REINJECT_WAITING) {
+			if (tx_full || !platform_send_mc_packet(core, entry->key, entry->payload, entry->has_payload)) {
+				tx_full = true;
+				continue;
+			}
+			entry->state = REINJECT_SENT;
+			entry->tick  = core->elapsed_ticks + REINJECT_CONFIRM_TICKS;
+			entry->retries++;
+			if (entry->counted)
+				core->root->result_reinject_reinjected++;
+		} else {
+			if (entry->counted)
+				core->root->result_reinject_not_redropped_locally++;
+			reinject_free(core, entry);
+		}
+	}
+}
+
+
+/**
+ * Empty the reinjection queue at the end of a run (or phase): packets still
+ * waiting are abandoned and those reinjected within the last
+ * REINJECT_CONFIRM_TICKS are unconfirmed.
+ */
+void
+reinject_finish(core_state_t *core)
+{
+	for (uint i = 0u; i < core->reinject_queue_used; i++) {
+		reinject_entry_t *entry = &core->reinject_queue[i];
+		if (entry->counted && entry->state == REINJECT_WAITING)
+			core->root->result_reinject_abandoned++;
+		else if (entry->counted && entry->state == REINJECT_SENT)
+			core->root->result_reinject_unconfirmed++;
+		entry->state = REINJECT_FREE;
+	}
+	core->reinject_queue_used = 0u;
+}
+
+
+/******************************************************************************
+ * Traffic generation
+ ******************************************************************************/
+
+/**
+ * The temporal distribution of a source as far as this build is concerned. A
+ * build for a single distribution (SINGLE_TEMPORAL_DIST) treats any other as
+ * unrecognised so that only the code for its own remains.
+ */
+#ifdef SINGLE_TEMPORAL_DIST
+#define SOURCE_TEMPORAL_DIST(source) \
+	((source)->temporal_dist == (SINGLE_TEMPORAL_DIST) ? (SINGLE_TEMPORAL_DIST) : -1)
+#else
+#define SOURCE_TEMPORAL_DIST(source) ((source)->temporal_dist)
+#endif
+
+
+/**
+ * Read the next interval from a trace source's trace, returning false at the
+ * end of the trace. The trace is read directly from SDRAM: intervals are
+ * usually a single byte and each is read only once.
+ */
+static inline bool
+trace_next_interval(core_state_t *core, uint source_index, uint *interval)
+{
+	config_source_t *source = &core->sources[source_index];
+	source_state_t  *state  = &core->source_states[source_index];
+	uchar *trace = platform_sdram( core
+	                             , core->root->data_offset + source->temporal_dist_data.trace.offset
+	                             , source->temporal_dist_data.trace.length
+	                             );
+	uint pos   = state->trace_position;
+	uint value = 0u;
+	
+	for (uint shift = 0u; pos < source->temporal_dist_data.trace.length && shift < 32u; shift += 7u) {
+		uchar byte = trace[pos++];
+		value |= (uint)(byte & 0x7Fu) << shift;
+		if (!(byte & 0x80u)) {
+			state->trace_position = pos;
+			*interval = value;
+			return true;
+		}
+	}
+	
+	// End of trace (or a truncated final interval)
+	state->trace_position = pos;
+	return false;
+}
+
+
+/**
+ * Restore the heap property below the given heap position after the
+ * next_tick of the source there has increased (or during heap construction).
+ */
+static inline void
+source_heap_sift_down(core_state_t *core, uint pos)
+{
+	ushort *heap     = core->source_heap;
+	ushort source    = heap[pos];
+	uint   next_tick = core->source_states[source].next_tick;
+	
+	for (;;) {
+		uint child = 2*pos + 1;
+		if (child >= core->source_heap_size)
+			break;
+		
+		// Pick the earlier of the two children
+		if (child + 1 < core->source_heap_size
+		    && TICK_BEFORE( core->source_states[heap[child+1]].next_tick
+		                  , core->source_states[heap[child]].next_tick
+		                  ))
+			child++;
+		
+		if (!TICK_BEFORE(core->source_states[heap[child]].next_tick, next_tick))
+			break;
+		
+		heap[pos] = heap[child];
+		pos = child;
+	}
+	
+	heap[pos] = source;
+}
+
+
+/**
+ * Remove the source at the top of the heap.
+ */
+static inline void
+source_heap_pop(core_state_t *core)
+{
+	core->source_heap[0] = core->source_heap[--core->source_heap_size];
+	source_heap_sift_down(core, 0);
+}
+
+
+/**
+ * Draw the first packet time for every source and build the source heap and
+ * list of dense sources, abandoning any packets left in the transmit queue.
+ */
+void
+schedule_sources(core_state_t *core)
+{
+	core->source_heap_size  = 0u;
+	core->num_dense_sources = 0u;
+	
+	core->tx_queue_head   = 0u;
+	core->tx_queue_length = 0u;
+	
+	for (int i = 0; i < core->root->num_sources; i++) {
+		config_source_t *source = &core->sources[i];
+		source_state_t  *state  = &core->source_states[i];
+		
+		switch (SOURCE_TEMPORAL_DIST(source)) {
+			case TEMPORAL_DIST_BERNOULLI:
+				// Sources which never fire are never scheduled
+				if (source->temporal_dist_data.bernoulli.threshold == 0u)
+					continue;
+				
+				if (source->temporal_dist_data.bernoulli.threshold >= BERNOULLI_DENSE_THRESHOLD) {
+					core->dense_sources[core->num_dense_sources++] = i;
+					continue;
+				}
+				
+				// Sources are first visited in the tick after elapsed_ticks
+				state->next_tick = core->elapsed_ticks
+				                 + bernoulli_interval(core, source->temporal_dist_data.bernoulli.interval_scale);
+				break;
+			
+			case TEMPORAL_DIST_POISSON: {
+				if (source->temporal_dist_data.poisson.interval_scale == 0u)
+					continue;
+				
+				// The tick containing the first packet is the one after elapsed_ticks
+				// plus the whole part of the interval
+				unsigned long long interval = poisson_interval(core, source->temporal_dist_data.poisson.interval_scale);
+				state->next_tick          = core->elapsed_ticks + 1u + (uint)(interval >> 32);
+				state->next_tick_fraction = (uint)interval;
+				break;
+			}
+			
+			case TEMPORAL_DIST_ON_OFF:
+				if (source->temporal_dist_data.on_off.threshold == 0u)
+					continue;
+				
+				// Sources start off
+				state->on_ticks_remaining = 0u;
+				state->next_tick = core->elapsed_ticks
+				                 + bernoulli_interval(core, source->temporal_dist_data.on_off.off_interval_scale);
+				break;
+			
+			case TEMPORAL_DIST_PERIODIC:
+				if (source->temporal_dist_data.periodic.period == 0u)
+					continue;
+				
+				state->next_tick = core->elapsed_ticks + 1u
+				                 + ( source->temporal_dist_data.periodic.phase
+				                   % source->temporal_dist_data.periodic.period
+				                   );
+				break;
+			
+			case TEMPORAL_DIST_TRACE: {
+				// Empty traces are never scheduled
+				uint interval;
+				state->trace_position = 0u;
+				if (!trace_next_interval(core, i, &interval))
+					continue;
+				
+				state->next_tick = core->elapsed_ticks + interval;
+				break;
+			}
+			
+			default:
+				// Unrecognised temporal distribution do nothing...
+				CORE_PRINTF( core, "Unrecognised traffic distribution '%d' for source with key 0x%08x.\n"
+				           , source->temporal_dist
+				           , source->routing_key
+				           );
+				core->root->completion_state = COMPLETION_STATE_FAILIURE;
+				continue;
+		}
+		
+		core->source_heap[core->source_heap_size++] = i;
+	}
+	
+	for (int pos = (core->source_heap_size / 2) - 1; pos >= 0; pos--)
+		source_heap_sift_down(core, pos);
+}
+
+
+/**
+ * Attempt to send a packet from the given source, returning false if the spin1
+ * API's transmit queue was full.
+ */
+static inline bool
+send_packet(core_state_t *core, uint source_index, uint payload)
+{
+	// Packets carry their generation time when latency is being measured
+	if (core->root->flags & CONFIG_FLAG_LATENCY)
+		return platform_send_mc_packet(core, core->sources[source_index].routing_key, payload, true);
+	else
+		return platform_send_mc_packet(core, core->sources[source_index].routing_key, 0u, false);
+}
+
+
+/**
+ * Send as many packets from the software transmit queue as the spin1 API will
+ * accept.
+ */
+void
+tx_queue_drain(core_state_t *core)
+{
+	while (core->tx_queue_length) {
+		tx_queue_entry_t *entry = &core->tx_queue[core->tx_queue_head];
+		if (!send_packet(core, entry->source_index, entry->payload))
+			return;
+		
+		if (entry->counted) {
+			core->sources[entry->source_index].result_packets_sent ++;
+			core->sources[entry->source_index].result_packets_deferred_sent ++;
+		}
+		
+		core->tx_queue_head = (core->tx_queue_head + 1u) & (TX_QUEUE_SIZE - 1u);
+		core->tx_queue_length--;
+	}
+}
+
+
+/**
+ * Generate a packet from the given source. Packets which can't be sent
+ * immediately (or which would overtake packets already waiting) are placed in
+ * the software transmit queue or, if that is full, discarded. Either way the
+ * experiment continues: the counts separate the offered load from the load the
+ * network accepted.
+ */
+void
+generate_packet(core_state_t *core, uint source_index)
+{
+	config_source_t *source = &core->sources[source_index];
+	
+	bool counted = !core->simulation_warmup;
+	if (counted)
+		source->result_packets_generated ++;
+	
+	uint payload = (core->root->flags & CONFIG_FLAG_LATENCY) ? platform_experiment_time(core) : 0u;
+	
+	if (core->tx_queue_length)
+		tx_queue_drain(core);
+	
+	if (!core->tx_queue_length && send_packet(core, source_index, payload)) {
+		if (counted)
+			source->result_packets_sent ++;
+		return;
+	}
+	
+	if (core->tx_queue_length == TX_QUEUE_SIZE) {
+		if (counted)
+			source->result_packets_discarded ++;
+		return;
+	}
+	
+	tx_queue_entry_t *entry = &core->tx_queue[ (core->tx_queue_head + core->tx_queue_length)
+	                                         & (TX_QUEUE_SIZE - 1u)
+	                                         ];
+	entry->source_index = source_index;
+	entry->counted      = counted;
+	entry->payload      = payload;
+	core->tx_queue_length++;
+	
+	if (counted) {
+		source->result_packets_deferred ++;
+		if (core->tx_queue_length > core->root->result_tx_queue_max_depth)
+			core->root->result_tx_queue_max_depth = core->tx_queue_length;
+	}
+}
+
+
+/**
+ * The given source fires: during a saturation search only a fraction of its
+ * packets are generated.
+ */
+static inline void
+source_fire(core_state_t *core, uint source_index)
+{
+	if (core->search_scale < SEARCH_SCALE_ONE && (prng(core) >> 16) >= core->search_scale)
+		return;
+	
+	platform_generate_packet(core, source_index);
+}
+
+
+/**
+ * Fire the source at the top of the source heap which is due to fire this
+ * tick and reschedule (or, at the end of a trace, remove) it.
+ */
+static inline void
+fire_next_source(core_state_t *core)
+{
+	uint i = core->source_heap[0];
+	config_source_t *source = &core->sources[i];
+	source_state_t  *state  = &core->source_states[i];
+	
+	switch (SOURCE_TEMPORAL_DIST(source)) {
+		case TEMPORAL_DIST_BERNOULLI:
+			// Since the intervals are geometrically distributed this produces the
+			// same statistics as an independent trial per tick.
+			source_fire(core, i);
+			state->next_tick += bernoulli_interval(core, source->temporal_dist_data.bernoulli.interval_scale);
+			break;
+		
+		case TEMPORAL_DIST_POISSON: {
+			// Generate every packet whose time falls within this tick
+			unsigned long long time = ((unsigned long long)state->next_tick << 32)
+			                        | state->next_tick_fraction;
+			do {
+				source_fire(core, i);
+				time += poisson_interval(core, source->temporal_dist_data.poisson.interval_scale);
+			} while ((uint)(time >> 32) == state->next_tick);
+			state->next_tick          = (uint)(time >> 32);
+			state->next_tick_fraction = (uint)time;
+			break;
+		}
+		
+		case TEMPORAL_DIST_ON_OFF:
+			// Switching on: draw the length of the on period
+			if (state->on_ticks_remaining == 0u)
+				state->on_ticks_remaining = bernoulli_interval(core, source->temporal_dist_data.on_off.on_interval_scale);
+			
+			if (prng(core) < source->temporal_dist_data.on_off.threshold)
+				source_fire(core, i);
+			
+			if (--state->on_ticks_remaining)
+				state->next_tick++;
+			else
+				state->next_tick += bernoulli_interval(core, source->temporal_dist_data.on_off.off_interval_scale);
+			break;
+		
+		case TEMPORAL_DIST_PERIODIC:
+			source_fire(core, i);
+			state->next_tick += source->temporal_dist_data.periodic.period;
+			break;
+		
+		case TEMPORAL_DIST_TRACE: {
+			uint interval;
+			do {
+				source_fire(core, i);
+				if (!trace_next_interval(core, i, &interval)) {
+					source_heap_pop(core);
+					return;
+				}
+			} while (interval == 0u);
+			state->next_tick += interval;
+			break;
+		}
+	}
+	
+	source_heap_sift_down(core, 0);
+}
+
+
+/**
+ * Generate this tick's traffic.
+ */
+static inline void
+generate_traffic(core_state_t *core)
+{
+	// Packets left waiting from the previous tick go first
+	if (core->tx_queue_length)
+		tx_queue_drain(core);
+	
+	// Generate traffic from the dense sources with a trial each
+	for (int n = 0; n < core->num_dense_sources; n++) {
+		uint i = core->dense_sources[n];
+		if (prng(core) < core->sources[i].temporal_dist_data.bernoulli.threshold)
+			source_fire(core, i);
+	}
+	
+	// Generate traffic from the other sources due to fire this tick, drawing the time
+	// until each fires again.
+	while (core->source_heap_size
+	       && !TICK_BEFORE(core->elapsed_ticks, core->source_states[core->source_heap[0]].next_tick))
+		fire_next_source(core);
+}
+
+
+/******************************************************************************
+ * Experiment sequencing
+ ******************************************************************************/
+
+/**
+ * Begin the given phase of a sweep (with a warmup) on the next tick, the
+ * results of the previous phase having been stored.
+ */
+void
+start_phase(core_state_t *core, uint phase)
+{
+	core->current_phase = phase;
+	load_phase(core, phase);
+	
+	// Packets dropped since the previous phase was stored aren't reinjected
+	if (reinject_core(core))
+		reinject_finish(core);
+	
+	reset_results(core);
+	core->root->result_search_scale = core->search_scale;
+	platform_set_router_timeout(core);
+	
+	// Packets left over from the previous phase are abandoned
+	if (HAS_SOURCES)
+		schedule_sources(core);
+	
+	core->simulation_ticks  = 0u;
+	core->simulation_warmup = true;
+	core->next_sample_slot  = 0u;
+	
+	CORE_PRINTF(core, "Starting phase %d of %d...\n", phase + 1u, core->root->num_phases);
+}
+
+
+/**
+ * Prepare to run the experiment once this core's configuration has been
+ * loaded: the first tick starts the warmup.
+ */
+void
+begin_experiment(core_state_t *core)
+{
+	prng_seed(core, core->root->seed);
+	
+	core->simulation_ticks  = 0u;
+	core->simulation_warmup = true;
+	core->elapsed_ticks     = 0u;
+	
+	// A sweep begins with the parameters of its first phase
+	if (core->root->num_phases)
+		load_phase(core, 0u);
+	
+	// A saturation search begins at its initial injection scale
+	core->search_scale = (core->root->flags & CONFIG_FLAG_SEARCH)
+	                     ? core->root->search_initial_scale
+	                     : SEARCH_SCALE_ONE;
+	core->search_lo    = 0u;
+	core->search_hi    = SEARCH_SCALE_ONE;
+	core->root->result_search_scale = core->search_scale;
+	
+	// Decide when each source will first generate a packet
+	if (HAS_SOURCES)
+		schedule_sources(core);
+}
+
+
+/**
+ * Advance the experiment by a timer tick: end the warmup, reinject dropped
+ * packets, let the network drain at the end of the experiment (or a phase),
+ * store each phase's results and start the next, and sample the counters.
+ * Returns what remains for the tick to do.
+ */
+tick_action_t
+experiment_tick(core_state_t *core)
+{
+	config_root_t *root = core->root;
+	
+	// Start of experiment
+	if (core->simulation_warmup && core->simulation_ticks >= root->warmup_duration) {
+		core->simulation_ticks  = 0u;
+		core->simulation_warmup = false;
+		platform_warmup_ended(core);
+		
+		core->ticks_until_sample = root->sample_interval;
+	}
+	
+	// Dropped packets are reinjected throughout, including the warmup and drain
+	if (reinject_core(core))
+		reinject_tick(core);
+	
+	// End of experiment (or phase)
+	if (!core->simulation_warmup && core->simulation_ticks >= root->duration) {
+		if (core->simulation_ticks == root->duration)
+			platform_experiment_ended(core);
+		
+		// Let the network drain: no new packets are generated (or arrivals
+		// counted) but those still waiting to be sent may go. Since every core's
+		// ticks are in step this also acts as a barrier between phases. A
+		// saturation search holds them back: they would only keep the network
+		// busy when it must empty before the reports are sent.
+		if (core->simulation_ticks < root->duration + root->drain_duration) {
+			core->simulation_ticks ++;
+			core->elapsed_ticks ++;
+			if (HAS_SOURCES && core->tx_queue_length && !(root->flags & CONFIG_FLAG_SEARCH))
+				tx_queue_drain(core);
+			return TICK_IDLE;
+		}
+		
+		if (reinject_core(core) && !core->search_waiting)
+			reinject_finish(core);
+		
+		if (root->num_phases) {
+			if (!core->search_waiting)
+				platform_store_phase_results(core, core->current_phase);
+			
+			// A saturation search waits for the scale of the next window (even after
+			// the last, so that the master has every report before stopping)
+			if ((root->flags & CONFIG_FLAG_SEARCH) && !search_wait_for_scale(core))
+				return TICK_IDLE;
+			
+			if (core->current_phase + 1u < root->num_phases) {
+				start_phase(core, core->current_phase + 1u);
+				return TICK_IDLE;
+			}
+		}
+		
+		if (root->completion_state != COMPLETION_STATE_FAILIURE)
+			root->completion_state = COMPLETION_STATE_SUCCESS;
+		
+		return TICK_STOP;
+	}
+	
+	core->simulation_ticks ++;
+	core->elapsed_ticks ++;
+	
+	// Sample the counters
+	if (!core->simulation_warmup && root->sample_interval && --core->ticks_until_sample == 0u) {
+		core->ticks_until_sample = root->sample_interval;
+		platform_take_sample(core);
+	}
+	
+	return TICK_GENERATE;
+}
+
+
+/******************************************************************************
+ * Traffic consumption
+ ******************************************************************************/
+
+/**
+ * Handle the arrival of a multicast packet: a saturation search control packet
+ * or a packet of a stream, counted by its sink (and, when latency is being
+ * measured, binned by the generation time in its payload). Returns true if the
+ * packet was counted.
+ */
+bool
+receive_packet(core_state_t *core, uint key, uint payload)
+{
+	// Saturation search control packets may arrive at any time
+	if ((core->root->flags & CONFIG_FLAG_SEARCH)
+	    && (key & SEARCH_KEY_MASK) == core->root->search_control_key) {
+		search_on_control_packet(core, key, payload);
+		return false;
+	}
+	
+	// During warmup and upon completion, no results need be recorded.
+	if (core->simulation_warmup || core->simulation_ticks >= core->root->duration)
+		return false;
+	
+	config_sink_t *sink = platform_find_sink(core, key);
+	
+	// Increment the counter if a match was found
+	if (sink) {
+		sink->result_packets_arrived++;
+		
+		if (core->root->flags & CONFIG_FLAG_LATENCY) {
+			uint bin = (platform_experiment_time(core) - payload) >> core->root->latency_bin_shift;
+			core->histograms[sink - core->sinks]
+				.result_bins[MIN(bin, LATENCY_HISTOGRAM_BINS - 1u)]++;
+		}
+	} else {
+		CORE_PRINTF(core, "Got unexpected packet with routing key = 0x%08x.\n", key);
+		core->root->completion_state = COMPLETION_STATE_FAILIURE;
+	}
+	
+	return true;
+}
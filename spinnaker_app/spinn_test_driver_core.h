@@ -0,0 +1,223 @@
+/**
+ * The state of a core running spinn_test_driver, shared by the application
+ * and the host-native simulator (host/netsim.c). See spinn_test_driver_core.c
+ * for the logic which operates on it.
+ */
+
+#ifndef SPINN_TEST_DRIVER_CORE_H
+#define SPINN_TEST_DRIVER_CORE_H
+
+#include "spinn_test_driver.h"
+
+
+/**
+ * Is tick a before tick b (allowing for wrap-around)?
+ */
+#define TICK_BEFORE(a,b) (((int)((a)-(b))) < 0)
+
+
+/**
+ * A multicast packet.
+ */
+typedef struct packet {
+	uint key;
+	uint payload;
+	uint has_payload;
+} packet_t;
+
+
+/**
+ * The runtime state of each source.
+ */
+typedef struct source_state {
+	// The value of elapsed_ticks at which this source will next generate a packet
+	uint next_tick;
+	
+	union {
+		// Poisson: the fractional part of the time of the next packet, in units
+		// of 2^-32 ticks
+		uint next_tick_fraction;
+		
+		// On/off: the number of ticks remaining in the current on period (zero
+		// when off)
+		uint on_ticks_remaining;
+		
+		// Trace: the byte offset of the next interval in the trace
+		uint trace_position;
+	};
+} source_state_t;
+
+
+/**
+ * A packet waiting in the software transmit queue.
+ */
+typedef struct tx_queue_entry {
+	// The source which generated the packet
+	ushort source_index;
+	
+	// Was the packet generated after the warmup (and so counted in the results)?
+	ushort counted;
+	
+	// The packet's payload (its generation time when measuring latency)
+	uint payload;
+} tx_queue_entry_t;
+
+
+typedef enum reinject_state {
+	// The queue entry is unused
+	REINJECT_FREE,
+	
+	// Waiting for the tick on which it is reinjected
+	REINJECT_WAITING,
+	
+	// Reinjected: the packet has left this chip's router unless dumped again
+	// within REINJECT_CONFIRM_TICKS
+	REINJECT_SENT,
+} reinject_state_t;
+
+/**
+ * A dropped packet in the reinjection queue.
+ */
+typedef struct reinject_entry {
+	uint key;
+	uint payload;
+	
+	// The elapsed_ticks at which a waiting packet is due to be reinjected or by
+	// which a reinjected one counts as not dropped again
+	uint tick;
+	
+	// The number of times the packet has been reinjected
+	ushort retries;
+	
+	// A reinject_state_t
+	uchar state;
+	
+	uchar has_payload;
+	
+	// Was the packet first dumped during the experiment (and so counted in the
+	// results)?
+	uchar counted;
+} reinject_entry_t;
+
+
+/**
+ * What a core does with the rest of a timer tick once experiment_tick has
+ * advanced the experiment.
+ */
+typedef enum tick_action {
+	// Generate this tick's traffic
+	TICK_GENERATE,
+	
+	// Nothing: the network is draining or a phase of a sweep has just ended
+	TICK_IDLE,
+	
+	// Stop: the experiment is over
+	TICK_STOP,
+} tick_action_t;
+
+
+/**
+ * Everything a core keeps while running an experiment besides its
+ * configuration: the application has one, the simulator one for each core it
+ * simulates.
+ */
+typedef struct core_state {
+	// This core's configuration (into which results are accumulated)
+	config_root_t              *root;
+	config_source_t            *sources;
+	config_sink_t              *sinks;
+	config_latency_histogram_t *histograms;
+	
+	// State of the xorshift32 random number generator. Must never be zero.
+	uint prng_state;
+	
+	// The number of timer ticks the experiment (or phase) has been running and
+	// whether it is warming up
+	uint simulation_ticks;
+	volatile bool simulation_warmup;
+	
+	// The number of timer ticks since the experiment started (including the
+	// warmup). Unlike simulation_ticks this is never reset and so is used to
+	// schedule packet generation.
+	uint elapsed_ticks;
+	
+	// The phase of a sweep being run (when config_root.num_phases is non-zero)
+	uint current_phase;
+	
+	// The number of ticks until the counters are next sampled (when
+	// config_root.sample_interval is non-zero) and the ring buffer slot the
+	// next sample is written to
+	uint ticks_until_sample;
+	uint next_sample_slot;
+	
+	// The runtime state of each source (num_sources entries)
+	source_state_t *source_states;
+	
+	// Sources which fire with high probability (see BERNOULLI_DENSE_THRESHOLD)
+	// and so are simply given a trial every tick
+	ushort *dense_sources;
+	uint    num_dense_sources;
+	
+	// A binary min-heap of indices of sources which will fire at some point,
+	// ordered by source_states[].next_tick. Each tick only the sources which
+	// are due to fire are visited rather than performing a trial for every
+	// source.
+	ushort *source_heap;
+	uint    source_heap_size;
+	
+	// Packets which could not be sent when generated because the spin1 API's
+	// transmit queue was full, in the order generated. The queue is a ring
+	// buffer of tx_queue_length entries starting at tx_queue_head.
+	tx_queue_entry_t tx_queue[TX_QUEUE_SIZE];
+	uint tx_queue_head;
+	uint tx_queue_length;
+	
+	// The injection scale of the current window (see SEARCH_SCALE_ONE). Always
+	// one unless a saturation search is running.
+	uint search_scale;
+	
+	// Set by the packet callback when the master broadcasts the scale of the
+	// next window. The scale is adopted a tick after it is seen (once
+	// search_scale_ready is also set) by which time the broadcast has reached
+	// every core and every router has stopped holding packets: were a core to
+	// start the next window sooner its traffic could block the broadcast.
+	volatile bool search_scale_received;
+	volatile uint search_next_scale;
+	bool search_scale_ready;
+	
+	// Is the core waiting for the scale of the next window and for how many
+	// ticks has it waited? Also the number of its reports on the window sent so
+	// far.
+	bool search_waiting;
+	uint search_wait_ticks;
+	uint search_reports_sent;
+	
+	// (Master) The sums of the reports received for the current window (indexed
+	// by SEARCH_KEY_*) and the number of reports received.
+	uint search_sums[SEARCH_KEY_FORWARDED + 1u];
+	uint search_reports_received;
+	
+	// (Master) The bounds of the bisection: the greatest scale found unsaturated
+	// and the least found saturated. Also the arrived and generated packets of
+	// the first window which later windows are compared against.
+	uint search_lo;
+	uint search_hi;
+	uint search_calibration_arrived;
+	uint search_calibration_generated;
+	
+	// Packets captured by the dump interrupt handler which the next tick has yet
+	// to queue for reinjection. The handler and the tick each advance their own
+	// free-running count of the captures they have written and read.
+	packet_t reinject_captures[REINJECT_CAPTURE_SIZE];
+	volatile uint reinject_captures_in;
+	volatile uint reinject_captures_out;
+	
+	// The reinjection queue (config_root.reinject_queue_size entries, allocated
+	// when the core starts). Packets leave in any order so free entries are
+	// reused in place: only the first reinject_queue_used entries may be in use.
+	reinject_entry_t *reinject_queue;
+	uint reinject_queue_used;
+} core_state_t;
+
+
+#endif
@@ -0,0 +1,142 @@
+"""
+Tests of router_minimise.minimise, each result being checked by
+router_minimise.verify against the unminimised table.
+
+    python -m unittest discover tests
+"""
+
+import unittest
+
+from spinn_test_driver import router_minimise
+from spinn_test_driver.spinnaker_app import config_router_entry_tuple
+
+
+# Routes used by the tests (a link and two cores)
+EAST   = 1 << 0
+CORE_1 = 1 << 7
+CORE_2 = 1 << 8
+
+
+def table(routes, base = 0x00010000):
+	"""
+	A routing table with a single-key entry for each of a list of routes (keys
+	allocated sequentially from base, as add_stream does) skipping any None.
+	"""
+	return [ config_router_entry_tuple(key = base + i, mask = 0xFFFFFFFF, route = route)
+	         for i, route in enumerate(routes)
+	         if route is not None
+	       ]
+
+
+class MinimiseTest(unittest.TestCase):
+	
+	def minimise(self, entries, keys):
+		"""
+		Minimise a table, checking the result is accepted by verify and routes
+		every key as the original did.
+		"""
+		minimised = router_minimise.minimise(entries, keys)
+		router_minimise.verify(entries, minimised, keys)
+		self.assertEqual( router_minimise.routes_of(minimised, keys)
+		                , router_minimise.routes_of(entries, keys)
+		                )
+		self.assertLessEqual(len(minimised), len(entries))
+		return minimised
+	
+	
+	def test_consecutive_keys_sharing_route(self):
+		entries = table([CORE_1]*16)
+		minimised = self.minimise(entries, [e.key for e in entries])
+		self.assertEqual(minimised, [config_router_entry_tuple( key   = 0x00010000
+		                                                      , mask  = 0xFFFFFFF0
+		                                                      , route = CORE_1
+		                                                      )])
+	
+	
+	def test_unaligned_run(self):
+		# Keys 0x3-0xC: the run is not aligned but, since keys 0x0-0x2 and
+		# 0xD-0xF are never sent, may still be covered by a single entry
+		entries = table([CORE_1]*10, base = 0x00010003)
+		minimised = self.minimise(entries, [e.key for e in entries])
+		self.assertEqual(minimised, [config_router_entry_tuple( key   = 0x00010000
+		                                                      , mask  = 0xFFFFFFF0
+		                                                      , route = CORE_1
+		                                                      )])
+	
+	
+	def test_blocks_of_routes(self):
+		# Blocks of four keys alternating between two routes: one entry covers
+		# everything with one of the routes and each block of the other takes
+		# priority over it
+		entries = table(([CORE_1]*4 + [CORE_2]*4) * 2)
+		minimised = self.minimise(entries, [e.key for e in entries])
+		self.assertEqual(len(minimised), 3)
+	
+	
+	def test_interleaved_routes(self):
+		# Alternate keys have different routes: no key/mask prefix groups more
+		# than one key of the minority route so only the covering entry saves
+		# anything
+		entries = table([CORE_1, CORE_2] * 8)
+		minimised = self.minimise(entries, [e.key for e in entries])
+		self.assertEqual(len(minimised), 9)
+		
+		# Three routes in turn: a covering entry with the majority route
+		entries = table([CORE_1, CORE_2, EAST] * 4 + [CORE_1] * 4)
+		minimised = self.minimise(entries, [e.key for e in entries])
+		self.assertEqual(len(minimised), 1 + 8)
+	
+	
+	def test_default_routed_key_inside_covering_mask(self):
+		# Key 0x3 is sent but default routed, so no entry may cover it though
+		# every other key shares a route.
+		routes = [CORE_1]*3 + [None] + [CORE_1]*4
+		entries = table(routes)
+		keys = [0x00010000 + i for i in range(len(routes))]
+		minimised = self.minimise(entries, keys)
+		
+		# 0x0-0x1, 0x2 and 0x4-0x7
+		self.assertEqual(len(minimised), 3)
+		self.assertEqual(router_minimise.routes_of(minimised, [0x00010003]), [None])
+	
+	
+	def test_default_routed_keys_throughout(self):
+		# Every other key is default routed: nothing can be merged and the
+		# original table is returned
+		routes = [CORE_1, None] * 8
+		entries = table(routes)
+		keys = [0x00010000 + i for i in range(len(routes))]
+		self.assertEqual(self.minimise(entries, keys), entries)
+	
+	
+	def test_unsent_keys_may_be_covered(self):
+		# Keys which are never sent may be routed anywhere, allowing the entries
+		# either side of them to merge
+		routes = [CORE_1]*3 + [CORE_2] + [CORE_1]*4
+		entries = table(routes)
+		keys = [e.key for e in entries if e.route == CORE_1]
+		minimised = self.minimise(entries, keys)
+		self.assertEqual(len(minimised), 1)
+	
+	
+	def test_no_keys(self):
+		entries = table([CORE_1, CORE_2])
+		self.assertEqual(router_minimise.minimise(entries, []), entries)
+	
+	
+	def test_verify_rejects_misrouting(self):
+		entries = table([CORE_1]*3 + [CORE_2])
+		keys = [e.key for e in entries]
+		wrong = table([CORE_1]*4)
+		self.assertRaises(Exception, router_minimise.verify, entries, wrong, keys)
+		self.assertRaises(Exception, router_minimise.verify, entries, wrong[:3], keys)
+	
+	
+	def test_pack_round_trip(self):
+		entries = self.minimise(table([CORE_1]*5 + [CORE_2]*3), range(0x00010000, 0x00010008))
+		data = router_minimise.pack_entries(entries)
+		self.assertEqual(router_minimise.unpack_entries(len(entries), data), entries)
+
+
+if __name__ == "__main__":
+	unittest.main()
@@ -0,0 +1,140 @@
+"""
+Tests of scp_transport.SCPTransport against a fake_scp.FakeSCPServer which drops,
+refuses and reorders replies.
+
+    python -m unittest discover tests
+"""
+
+import time
+import random
+import unittest
+
+from spinn_test_driver import scp_transport
+from spinn_test_driver.fake_scp import FakeSCPServer
+
+
+class SCPTransportTest(unittest.TestCase):
+	
+	def start(self, timeout = 0.05, retries = 20, **kwargs):
+		"""
+		Start a fake machine (with the given FakeSCPServer arguments) and a
+		transport to it, both stopped when the test ends.
+		"""
+		kwargs.setdefault("latency", 0.002)
+		kwargs.setdefault("service_time", 0.0)
+		kwargs.setdefault("seed", 0)
+		self.server = FakeSCPServer(**kwargs).start()
+		self.addCleanup(self.server.stop)
+		
+		host, port = self.server.address
+		self.transport = scp_transport.SCPTransport( host, port
+		                                           , num_workers = 4, window = 8
+		                                           , timeout = timeout, retries = retries
+		                                           )
+		self.addCleanup(self.transport.close)
+	
+	
+	def random_data(self, length, seed = 0):
+		r = random.Random(seed)
+		return "".join(chr(r.randint(0, 255)) for _ in xrange(length))
+	
+	
+	def check_round_trip(self):
+		"""
+		Write different data to several chips at once (at an unaligned address, so
+		the chunks are a mixture of word and byte writes), then read it back with
+		read_mem and read_mems.
+		"""
+		addr   = 0x70000003
+		chips  = [(x, y) for x in range(3) for y in range(3)]
+		length = 5 * scp_transport.SCP_DATA_LENGTH + 17
+		data   = dict((coord, self.random_data(length, seed = n)) for n, coord in enumerate(chips))
+		
+		def write(coord):
+			self.transport.write_mem(coord + (0,), addr, data[coord])
+		self.assertEqual(self.transport.map(write, chips), [None] * len(chips))
+		
+		for coord in chips:
+			self.assertEqual(self.server.read(coord[0], coord[1], addr, length), data[coord])
+		
+		def read(coord):
+			return self.transport.read_mem(coord + (0,), addr, length)
+		self.assertEqual(self.transport.map(read, chips), [data[coord] for coord in chips])
+		
+		reads = [(addr, 1), (addr + 300, 600), (addr + length - 40, 40)]
+		for coord in chips:
+			self.assertEqual( self.transport.read_mems(coord + (0,), reads)
+			                , [data[coord][a - addr:a - addr + l] for a, l in reads]
+			                )
+		
+		# Two requests per chunk written and read, plus the read_mems
+		return len(chips) * (2 * 6 + 5)
+	
+	
+	def test_round_trip(self):
+		# Long enough that nothing times out, however slow the host
+		self.start(timeout = 0.5)
+		num_chunks = self.check_round_trip()
+		self.assertEqual(self.server.num_requests, num_chunks)
+	
+	
+	def test_round_trip_dropped_and_busy(self):
+		# Dropped and refused requests are sent again
+		self.start(loss = 0.1, busy = 0.1)
+		num_chunks = self.check_round_trip()
+		self.assertGreater(self.server.num_requests, num_chunks)
+	
+	
+	def test_round_trip_reordered(self):
+		# Replies overtaken by later ones (but arriving before the timeout) are
+		# matched to their requests by sequence number
+		self.start(reorder = 0.3, reorder_delay = 0.01, timeout = 0.5)
+		num_chunks = self.check_round_trip()
+		self.assertEqual(self.server.num_requests, num_chunks)
+	
+	
+	def test_round_trip_late_replies(self):
+		# Replies arriving after their request has timed out and been sent again
+		# are ignored
+		self.start(reorder = 0.2, reorder_delay = 0.05, timeout = 0.02)
+		num_chunks = self.check_round_trip()
+		self.assertGreater(self.server.num_requests, num_chunks)
+	
+	
+	def test_version(self):
+		self.start(loss = 0.3)
+		self.assertIn("FakeSCP", self.transport.version((1, 2, 0)))
+	
+	
+	def test_retries_exhausted_by_loss(self):
+		# A request which is never answered is sent retries + 1 times
+		self.start(loss = 1.0, timeout = 0.01, retries = 2)
+		with self.assertRaises(scp_transport.SCPError) as context:
+			self.transport.read_mem((0, 0, 0), 0x70000000, 4)
+		self.assertIsNone(context.exception.rc)
+		time.sleep(0.05)
+		self.assertEqual(self.server.num_requests, 3)
+	
+	
+	def test_retries_exhausted_by_busy(self):
+		self.start(busy = 1.0, timeout = 0.01, retries = 2)
+		with self.assertRaises(scp_transport.SCPError) as context:
+			self.transport.write_mem((0, 0, 0), 0x70000000, "data")
+		self.assertIsNone(context.exception.rc)
+		self.assertEqual(self.server.num_requests, 3)
+	
+	
+	def test_non_transient_error(self):
+		# Errors other than those in TRANSIENT_RCS are raised at once
+		self.start()
+		with self.assertRaises(scp_transport.SCPError) as context:
+			self.transport.map( lambda coord: self.transport._channel().transact(
+			                      [(coord, 99, 0, 0, 0, "")])
+			                  , [(0, 0, 0)]
+			                  )
+		self.assertEqual(context.exception.rc, scp_transport.RC_CMD)
+		self.assertEqual(self.server.num_requests, 1)
+
+
+if __name__ == "__main__":
+	unittest.main()